@@ -0,0 +1,300 @@
+/* lecroy_align.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Averaging of segmented data with the trigger jitter taken out.
+ * lecroy_average_segmented_data() assumes each segment starts at exactly the
+ * same point in the signal; in reality the trigger jitters by a fraction of a
+ * sample or more, which smears out the average (it acts as a low pass
+ * filter). Here we find each segment's shift relative to a reference by
+ * cross-correlating the two over a window, +/- max_shift points, and fitting
+ * a parabola to the peak to get the fraction of a point. Each segment is
+ * then resampled (cubic interpolation) by its shift before being added in.
+ *
+ * The reference starts off as the first segment, which is noisy; so we do it
+ * twice, the second time against the aligned average from the first pass.
+ *
+ * The correlations (each segment against the reference) are spread across
+ * threads by segment; the resampling and adding up is spread across threads
+ * by point, in the same way as lecroy_average_segmented_data(), so the result
+ * doesn't depend on the number of threads.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "lecroy_vxi11.h"
+
+#define	LECROY_ALIGN_PASSES	2
+#define	LECROY_ALIGN_CHUNK	4096	/* points at a time when adding up */
+
+struct lecroy_align_args {
+	const char *in_buf;
+	long points_per_trace;
+	int no_of_segments;
+	int bytes_per_point;
+	long start;		/* the correlation window */
+	long end;
+	long max_shift;
+	const double *ref;	/* mean removed, over the window */
+	double *shifts;
+	double *sum;		/* points_per_trace long */
+};
+
+/* One segment's points [start, end) as doubles, mean removed */
+static void lecroy_align_load(const struct lecroy_align_args *args, long j,
+			      double *out)
+{
+	const char *seg;
+	long i, n = args->end - args->start;
+	double mean = 0;
+	signed char c;
+	short s;
+
+	seg = args->in_buf + j * args->points_per_trace * args->bytes_per_point;
+	if (args->bytes_per_point == 1) {
+		for (i = 0; i < n; i++) {
+			memcpy(&c, seg + args->start + i, 1);
+			out[i] = c;
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			memcpy(&s, seg + 2 * (args->start + i), 2);
+			out[i] = s;
+		}
+	}
+	for (i = 0; i < n; i++)
+		mean += out[i];
+	mean /= n;
+	for (i = 0; i < n; i++)
+		out[i] -= mean;
+}
+
+/* The dot product, with four separate sums so that the additions don't all
+ * have to wait for each other (and can go into SIMD registers) */
+static double lecroy_align_dot(const double *a, const double *b, long n)
+{
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	long i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		s0 += a[i] * b[i];
+		s1 += a[i + 1] * b[i + 1];
+		s2 += a[i + 2] * b[i + 2];
+		s3 += a[i + 3] * b[i + 3];
+	}
+	for (; i < n; i++)
+		s0 += a[i] * b[i];
+	return (s0 + s1) + (s2 + s3);
+}
+
+/* Works out the shifts of segments [start, end). The window of the segment
+ * is loaded max_shift points wider on each side than the reference, so every
+ * lag uses the same number of points. */
+static void lecroy_align_shift_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_align_args *args = (struct lecroy_align_args *)ptr;
+	struct lecroy_align_args wide = *args;
+	long n = args->end - args->start;
+	long m = args->max_shift;
+	long j, lag, best;
+	double *seg, *corr;
+	double cm, c0, cp, d;
+
+	seg = new double[n + 2 * m];
+	corr = new double[2 * m + 1];
+	wide.start -= m;
+	wide.end += m;
+	for (j = start; j < end; j++) {
+		lecroy_align_load(&wide, j, seg);
+		best = -m;
+		for (lag = -m; lag <= m; lag++) {
+			corr[lag + m] =
+			    lecroy_align_dot(args->ref, seg + m + lag, n);
+			if (corr[lag + m] > corr[best + m])
+				best = lag;
+		}
+		/* Parabola through the peak and its neighbours */
+		d = 0;
+		if (best > -m && best < m) {
+			cm = corr[best + m - 1];
+			c0 = corr[best + m];
+			cp = corr[best + m + 1];
+			if (cm - 2 * c0 + cp < 0)
+				d = 0.5 * (cm - cp) / (cm - 2 * c0 + cp);
+		}
+		args->shifts[j] = best + d;
+	}
+	delete[]seg;
+	delete[]corr;
+}
+
+static inline double lecroy_align_point(const char *seg, long i, long n,
+					int bytes_per_point)
+{
+	signed char c;
+	short s;
+
+	if (i < 0)
+		i = 0;
+	if (i >= n)
+		i = n - 1;
+	if (bytes_per_point == 1) {
+		memcpy(&c, seg + i, 1);
+		return c;
+	}
+	memcpy(&s, seg + 2 * i, 2);
+	return s;
+}
+
+/* Adds up points [start, end) of all the segments, each one resampled at
+ * point + shift (Catmull-Rom cubic; points off the ends repeat the end
+ * points) */
+static void lecroy_align_sum_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_align_args *args = (struct lecroy_align_args *)ptr;
+	long n = args->points_per_trace;
+	long i, j, k;
+	double f, p0, p1, p2, p3;
+	const char *seg;
+
+	for (i = start; i < end; i++)
+		args->sum[i] = 0;
+	for (j = 0; j < args->no_of_segments; j++) {
+		seg = args->in_buf + j * n * args->bytes_per_point;
+		k = (long)floor(args->shifts[j]);
+		f = args->shifts[j] - k;
+		for (i = start; i < end; i++) {
+			p0 = lecroy_align_point(seg, i + k - 1, n,
+						args->bytes_per_point);
+			p1 = lecroy_align_point(seg, i + k, n,
+						args->bytes_per_point);
+			p2 = lecroy_align_point(seg, i + k + 1, n,
+						args->bytes_per_point);
+			p3 = lecroy_align_point(seg, i + k + 2, n,
+						args->bytes_per_point);
+			args->sum[i] +=
+			    p1 + 0.5 * f * (p2 - p0 +
+					    f * (2 * p0 - 5 * p1 + 4 * p2 - p3 +
+						 f * (3 * (p1 - p2) + p3 - p0)));
+		}
+	}
+}
+
+long lecroy_align_segmented_data(char *in_buf, size_t in_buf_len,
+				 char *out_buf, size_t out_buf_len,
+				 int no_of_segments, int bytes_per_point,
+				 long window_start, long window_end,
+				 long max_shift, double *shifts)
+{
+	return lecroy_align_segmented_data(in_buf, in_buf_len, out_buf,
+					   out_buf_len, no_of_segments,
+					   bytes_per_point, window_start,
+					   window_end, max_shift, shifts, 1);
+}
+
+/* Averages no_of_segments segments, as lecroy_average_segmented_data(), but
+ * with each one shifted to line up with the others first. The shifts are
+ * worked out from points [window_start, window_end) of each segment
+ * (window_end <= 0 means the end of the segment), searching +/- max_shift
+ * points; the window is trimmed if need be so that it stays max_shift points
+ * away from each end. If shifts isn't NULL, it gets each segment's shift
+ * (in points; multiply by the horizontal interval for seconds), a positive
+ * shift meaning the segment was late. no_of_threads <= 0 means one per core.
+ * The averaged points are rounded to the nearest integer; out_buf can be
+ * in_buf, as nothing is written to it until the end. Returns the number
+ * of bytes written to out_buf, or -1 if there's no window left. */
+long lecroy_align_segmented_data(char *in_buf, size_t in_buf_len,
+				 char *out_buf, size_t out_buf_len,
+				 int no_of_segments, int bytes_per_point,
+				 long window_start, long window_end,
+				 long max_shift, double *shifts,
+				 int no_of_threads)
+{
+	struct lecroy_align_args args;
+	long i, out_points;
+	double *ref, *sum;
+	int pass, v;
+	signed char c;
+	short s;
+
+	if (no_of_segments < 1)
+		return -1;
+	args.in_buf = in_buf;
+	args.no_of_segments = no_of_segments;
+	args.bytes_per_point = bytes_per_point;
+	args.points_per_trace =
+	    (long)(in_buf_len / (bytes_per_point * no_of_segments));
+	args.max_shift = max_shift > 0 ? max_shift : 0;
+	if (window_end <= 0 || window_end > args.points_per_trace)
+		window_end = args.points_per_trace;
+	if (window_start < args.max_shift)
+		window_start = args.max_shift;
+	if (window_end > args.points_per_trace - args.max_shift)
+		window_end = args.points_per_trace - args.max_shift;
+	if (window_end - window_start < 2) {
+		printf
+		    ("lecroy_align_segmented_data: max_shift too big for the window\n");
+		return -1;
+	}
+	args.start = window_start;
+	args.end = window_end;
+	out_points = (long)(out_buf_len / bytes_per_point);
+	if (out_points > args.points_per_trace)
+		out_points = args.points_per_trace;
+
+	ref = new double[args.end - args.start];
+	sum = new double[args.points_per_trace];
+	args.ref = ref;
+	args.sum = sum;
+	args.shifts = new double[no_of_segments];
+	lecroy_align_load(&args, 0, ref);
+	for (pass = 0; pass < LECROY_ALIGN_PASSES; pass++) {
+		lecroy_parallel_for(no_of_segments, 1, no_of_threads,
+				    lecroy_align_shift_kernel, &args);
+		lecroy_parallel_for(args.points_per_trace, LECROY_ALIGN_CHUNK,
+				    no_of_threads, lecroy_align_sum_kernel,
+				    &args);
+		if (pass + 1 < LECROY_ALIGN_PASSES) {
+			/* The aligned average (mean removed) is the next
+			 * reference; the scaling doesn't matter */
+			double mean = 0;
+			for (i = args.start; i < args.end; i++)
+				mean += sum[i];
+			mean /= args.end - args.start;
+			for (i = args.start; i < args.end; i++)
+				ref[i - args.start] = sum[i] - mean;
+		}
+	}
+
+	for (i = 0; i < out_points; i++) {
+		v = (int)floor(sum[i] / no_of_segments + 0.5);
+		if (bytes_per_point == 1) {
+			c = (signed char)v;
+			memcpy(out_buf + i, &c, 1);
+		} else {
+			s = (short)v;
+			memcpy(out_buf + 2 * i, &s, 2);
+		}
+	}
+	if (shifts != NULL)
+		memcpy(shifts, args.shifts, no_of_segments * sizeof(double));
+	delete[]args.shifts;
+	delete[]ref;
+	delete[]sum;
+	return out_points * bytes_per_point;
+}
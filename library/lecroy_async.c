@@ -0,0 +1,328 @@
+/* lecroy_async.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Captures in the background, so that a scanning rig can move the stage to
+ * point N+1 while point N's data is still coming over the network. Each link
+ * gets its own I/O thread (lecroy_async_open()), which works through a queue
+ * of captures, each one a lecroy_get_data() call. lecroy_get_data_async()
+ * puts a capture on the queue and hands back straight away with a handle,
+ * which you can:
+ *
+ *   lecroy_capture_wait_acquired() : wait until the scope has acquired (the
+ *                                    stage can move from then on)
+ *   lecroy_capture_wait()          : wait until the data's in your buffer
+ *   lecroy_capture_wait_any()      : wait for the first of several
+ *   lecroy_capture_cancel()        : take it off the queue, if it's not
+ *                                    started yet
+ *   lecroy_capture_status()        : see how it's getting on
+ *
+ * or you can give a callback, which the I/O thread calls when the data is in.
+ * Either way, lecroy_capture_free() the handle when you're finished with it.
+ *
+ * The vxi11 link isn't safe to use from two threads at once, so don't talk to
+ * the scope yourself on the same link while it has captures outstanding;
+ * lecroy_capture_wait() for them first (or use a second link).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "lecroy_vxi11.h"
+
+struct lecroy_capture {
+	struct lecroy_async *async;
+	char chan;
+	int clear_sweeps;
+	char *buf;
+	size_t buf_len;
+	int arm_and_wait;
+	unsigned long timeout;
+	void (*callback) (struct lecroy_capture * capture, long result,
+			  void *arg);
+	void *arg;
+	int status;
+	long result;
+	struct lecroy_capture *next;
+};
+
+struct lecroy_async {
+	VXI11_CLINK *clink;
+	pthread_t thread;
+	pthread_cond_t work;	/* something's been queued, or we're closing */
+	struct lecroy_capture *head;
+	struct lecroy_capture *tail;
+	int closing;
+};
+
+/* One lock and one condition for every capture's status, whatever link it's
+ * on, so that lecroy_capture_wait_any() can wait on captures from several
+ * links at once */
+static pthread_mutex_t lecroy_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lecroy_async_changed = PTHREAD_COND_INITIALIZER;
+
+static void lecroy_async_set_status(struct lecroy_capture *c, int status)
+{
+	pthread_mutex_lock(&lecroy_async_mutex);
+	c->status = status;
+	pthread_cond_broadcast(&lecroy_async_changed);
+	pthread_mutex_unlock(&lecroy_async_mutex);
+}
+
+static void lecroy_async_acquired(void *arg)
+{
+	lecroy_async_set_status((struct lecroy_capture *)arg,
+				LECROY_CAPTURE_ACQUIRED);
+}
+
+static void *lecroy_async_thread(void *arg)
+{
+	struct lecroy_async *async = (struct lecroy_async *)arg;
+	struct lecroy_capture *c;
+	long result;
+
+	for (;;) {
+		pthread_mutex_lock(&lecroy_async_mutex);
+		while (async->head == NULL && async->closing == 0)
+			pthread_cond_wait(&async->work, &lecroy_async_mutex);
+		c = async->head;
+		if (c == NULL) {
+			pthread_mutex_unlock(&lecroy_async_mutex);
+			break;
+		}
+		async->head = c->next;
+		if (async->head == NULL)
+			async->tail = NULL;
+		c->status = LECROY_CAPTURE_RUNNING;
+		pthread_cond_broadcast(&lecroy_async_changed);
+		pthread_mutex_unlock(&lecroy_async_mutex);
+
+		result = lecroy_get_data(async->clink, c->chan,
+					 c->clear_sweeps, c->buf, c->buf_len,
+					 c->arm_and_wait, c->timeout,
+					 lecroy_async_acquired, c);
+		c->result = result;
+		if (c->callback != NULL)
+			c->callback(c, result, c->arg);
+		lecroy_async_set_status(c, LECROY_CAPTURE_DONE);
+	}
+	return NULL;
+}
+
+/* Starts the I/O thread for a link. Returns NULL if it can't. */
+struct lecroy_async *lecroy_async_open(VXI11_CLINK * clink)
+{
+	struct lecroy_async *async = new struct lecroy_async;
+
+	memset(async, 0, sizeof(struct lecroy_async));
+	async->clink = clink;
+	pthread_cond_init(&async->work, NULL);
+	if (pthread_create(&async->thread, NULL, lecroy_async_thread, async)
+	    != 0) {
+		printf("lecroy_async_open: could not start the I/O thread\n");
+		pthread_cond_destroy(&async->work);
+		delete async;
+		return NULL;
+	}
+	return async;
+}
+
+/* Cancels anything still queued, waits for the capture in progress (if any)
+ * to finish, and stops the thread. The handles are still yours to free. */
+void lecroy_async_close(struct lecroy_async *async)
+{
+	struct lecroy_capture *c;
+
+	pthread_mutex_lock(&lecroy_async_mutex);
+	for (c = async->head; c != NULL; c = c->next)
+		c->status = LECROY_CAPTURE_CANCELLED;
+	async->head = async->tail = NULL;
+	async->closing = 1;
+	pthread_cond_signal(&async->work);
+	pthread_cond_broadcast(&lecroy_async_changed);
+	pthread_mutex_unlock(&lecroy_async_mutex);
+	pthread_join(async->thread, NULL);
+	pthread_cond_destroy(&async->work);
+	delete async;
+}
+
+struct lecroy_capture *lecroy_get_data_async(struct lecroy_async *async,
+					     char chan, int clear_sweeps,
+					     char *buf, size_t buf_len,
+					     int arm_and_wait,
+					     unsigned long timeout)
+{
+	return lecroy_get_data_async(async, chan, clear_sweeps, buf, buf_len,
+				     arm_and_wait, timeout, NULL, NULL);
+}
+
+/* Queues a lecroy_get_data() (the arguments are the same) and returns its
+ * handle. buf mustn't be touched until the capture's done. If callback isn't
+ * NULL, the I/O thread calls it with what lecroy_get_data() returned, just
+ * before the capture counts as done; it mustn't free the handle. */
+struct lecroy_capture *lecroy_get_data_async(struct lecroy_async *async,
+					     char chan, int clear_sweeps,
+					     char *buf, size_t buf_len,
+					     int arm_and_wait,
+					     unsigned long timeout,
+					     void (*callback) (struct
+							       lecroy_capture *
+							       capture,
+							       long result,
+							       void *arg),
+					     void *arg)
+{
+	struct lecroy_capture *c = new struct lecroy_capture;
+
+	memset(c, 0, sizeof(struct lecroy_capture));
+	c->async = async;
+	c->chan = chan;
+	c->clear_sweeps = clear_sweeps;
+	c->buf = buf;
+	c->buf_len = buf_len;
+	c->arm_and_wait = arm_and_wait;
+	c->timeout = timeout;
+	c->callback = callback;
+	c->arg = arg;
+	c->status = LECROY_CAPTURE_QUEUED;
+
+	pthread_mutex_lock(&lecroy_async_mutex);
+	if (async->tail != NULL)
+		async->tail->next = c;
+	else
+		async->head = c;
+	async->tail = c;
+	pthread_cond_signal(&async->work);
+	pthread_mutex_unlock(&lecroy_async_mutex);
+	return c;
+}
+
+int lecroy_capture_status(struct lecroy_capture *capture)
+{
+	int status;
+	pthread_mutex_lock(&lecroy_async_mutex);
+	status = capture->status;
+	pthread_mutex_unlock(&lecroy_async_mutex);
+	return status;
+}
+
+/* Takes a capture off the queue. Once it's started it has to run its course
+ * (stopping a vxi11 transfer half way leaves the link in a mess), so this
+ * returns 0 if it was cancelled, -1 if it's too late. */
+int lecroy_capture_cancel(struct lecroy_capture *capture)
+{
+	struct lecroy_async *async = capture->async;
+	struct lecroy_capture *c, *prev = NULL;
+	int ret = -1;
+
+	pthread_mutex_lock(&lecroy_async_mutex);
+	if (capture->status == LECROY_CAPTURE_CANCELLED)
+		ret = 0;
+	for (c = async->head; c != NULL && ret != 0; prev = c, c = c->next) {
+		if (c != capture)
+			continue;
+		if (prev != NULL)
+			prev->next = c->next;
+		else
+			async->head = c->next;
+		if (async->tail == c)
+			async->tail = prev;
+		c->status = LECROY_CAPTURE_CANCELLED;
+		pthread_cond_broadcast(&lecroy_async_changed);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lecroy_async_mutex);
+	return ret;
+}
+
+/* Waits until the scope has finished acquiring (or the capture has finished,
+ * or been cancelled) */
+void lecroy_capture_wait_acquired(struct lecroy_capture *capture)
+{
+	pthread_mutex_lock(&lecroy_async_mutex);
+	while (capture->status < LECROY_CAPTURE_ACQUIRED)
+		pthread_cond_wait(&lecroy_async_changed, &lecroy_async_mutex);
+	pthread_mutex_unlock(&lecroy_async_mutex);
+}
+
+/* Waits for the capture to finish. Returns what lecroy_get_data() returned,
+ * or -1 if it was cancelled. */
+long lecroy_capture_wait(struct lecroy_capture *capture)
+{
+	long result;
+
+	pthread_mutex_lock(&lecroy_async_mutex);
+	while (capture->status < LECROY_CAPTURE_DONE)
+		pthread_cond_wait(&lecroy_async_changed, &lecroy_async_mutex);
+	if (capture->status == LECROY_CAPTURE_CANCELLED)
+		result = -1;
+	else
+		result = capture->result;
+	pthread_mutex_unlock(&lecroy_async_mutex);
+	return result;
+}
+
+/* Waits for the first of n captures to finish (or be cancelled), and returns
+ * its index. NULLs in the array are skipped, so you can NULL out each one as
+ * you deal with it. Gives up after timeout_ms milliseconds (never, if it's
+ * negative) and returns -1, as it does if they're all NULL. */
+int lecroy_capture_wait_any(struct lecroy_capture **captures, int n,
+			    long timeout_ms)
+{
+	struct timespec deadline;
+	int i, any, ret = -1;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	if (timeout_ms > 0) {
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+	pthread_mutex_lock(&lecroy_async_mutex);
+	for (;;) {
+		any = 0;
+		for (i = 0; i < n && ret < 0; i++) {
+			if (captures[i] == NULL)
+				continue;
+			any = 1;
+			if (captures[i]->status >= LECROY_CAPTURE_DONE)
+				ret = i;
+		}
+		if (ret >= 0 || any == 0 || timeout_ms == 0)
+			break;
+		if (timeout_ms < 0)
+			pthread_cond_wait(&lecroy_async_changed,
+					  &lecroy_async_mutex);
+		else if (pthread_cond_timedwait(&lecroy_async_changed,
+						&lecroy_async_mutex,
+						&deadline) == ETIMEDOUT)
+			timeout_ms = 0;	/* one last look */
+	}
+	pthread_mutex_unlock(&lecroy_async_mutex);
+	return ret;
+}
+
+/* Frees a handle. Only once it's done or cancelled, please. */
+void lecroy_capture_free(struct lecroy_capture *capture)
+{
+	delete capture;
+}
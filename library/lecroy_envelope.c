@@ -0,0 +1,372 @@
+/* lecroy_envelope.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Min/max envelope "pyramid" of a (big) record, for plotting. Drawing a
+ * 100M point trace on a 2000 pixel wide screen means finding the min and max
+ * of 50000 points for every pixel, every time you zoom or pan. Instead we
+ * work out, once, the min and max of every block of 16 points (level 0),
+ * then of every 32 (level 1), 64, and so on up to the whole record. Any
+ * window of the record can then be drawn at any width by looking at no more
+ * than a few blocks per pixel (the biggest ones that fit in it), plus a few
+ * points at its edges.
+ *
+ * The envelope can be saved next to the trace (filename.wfe, see
+ * lecroy_envelope_write() for the layout) so a viewer needn't read the .wf
+ * file at all until you zoom right in.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lecroy_vxi11.h"
+
+#define	LECROY_ENVELOPE_MAGIC	"WFENV001"
+/* Biggest base shift we'll read from a file (we only ever write
+ * LECROY_ENVELOPE_BASE_SHIFT) */
+#define	LECROY_ENVELOPE_MAX_BASE_SHIFT	20
+
+struct lecroy_envelope_args {
+	struct lecroy_envelope *env;
+	const char *buf;
+};
+
+/* Level 0 for blocks [start, end): a separate loop for 8 and 16 bit data,
+ * and a simple inner loop over each block, which the compiler vectorises */
+template <typename T>
+static void lecroy_envelope_level0(struct lecroy_envelope *env,
+				   const char *buf, long start, long end)
+{
+	long block = 1L << env->base_shift;
+	long b, i, i0, i1;
+	T v, lo, hi;
+
+	for (b = start; b < end; b++) {
+		i0 = b * block;
+		i1 = i0 + block;
+		if (i1 > env->no_of_points)
+			i1 = env->no_of_points;
+		memcpy(&lo, buf + i0 * sizeof(T), sizeof(T));
+		hi = lo;
+		for (i = i0 + 1; i < i1; i++) {
+			memcpy(&v, buf + i * sizeof(T), sizeof(T));
+			lo = v < lo ? v : lo;
+			hi = v > hi ? v : hi;
+		}
+		env->min[0][b] = lo;
+		env->max[0][b] = hi;
+	}
+}
+
+static void lecroy_envelope_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_envelope_args *args =
+	    (struct lecroy_envelope_args *)ptr;
+	if (args->env->bytes_per_point == 1)
+		lecroy_envelope_level0<signed char>(args->env, args->buf,
+						    start, end);
+	else
+		lecroy_envelope_level0<short>(args->env, args->buf, start,
+					      end);
+}
+
+static void lecroy_envelope_alloc(struct lecroy_envelope *env)
+{
+	long len;
+	int k;
+
+	len = (env->no_of_points + (1L << env->base_shift) - 1)
+	    >> env->base_shift;
+	for (k = 0; k < LECROY_ENVELOPE_MAX_LEVELS; k++) {
+		env->level_len[k] = len;
+		env->min[k] = new short[len];
+		env->max[k] = new short[len];
+		env->no_of_levels = k + 1;
+		if (len <= 1)
+			break;
+		len = (len + 1) / 2;
+	}
+}
+
+/* Builds the envelope of the data in buf (as returned by lecroy_get_data();
+ * segments are just treated as one long record, segment j being points
+ * j * points_per_segment onwards). desc supplies the bytes per point and the
+ * scaling. Returns 0, or -1 if there's no data. */
+int lecroy_envelope_build(struct lecroy_envelope *env, const char *buf,
+			  size_t buf_len, const struct lecroy_wavedesc *desc)
+{
+	return lecroy_envelope_build(env, buf, buf_len, desc, 1);
+}
+
+/* As above, with level 0 (which is nearly all the work) split amongst
+ * no_of_threads threads (<=0 means one per core). */
+int lecroy_envelope_build(struct lecroy_envelope *env, const char *buf,
+			  size_t buf_len, const struct lecroy_wavedesc *desc,
+			  int no_of_threads)
+{
+	struct lecroy_envelope_args args;
+	long b;
+	int k;
+
+	memset(env, 0, sizeof(struct lecroy_envelope));
+	env->bytes_per_point = desc->comm_type == 1 ? 2 : 1;
+	env->no_of_points = (long)(buf_len / env->bytes_per_point);
+	if (env->no_of_points < 1)
+		return -1;
+	env->base_shift = LECROY_ENVELOPE_BASE_SHIFT;
+	env->vgain = desc->vertical_gain;
+	env->voffset = desc->vertical_offset;
+	env->horiz_interval = desc->horiz_interval;
+	env->horiz_offset = desc->horiz_offset;
+	lecroy_envelope_alloc(env);
+
+	args.env = env;
+	args.buf = buf;
+	lecroy_parallel_for(env->level_len[0], 4096, no_of_threads,
+			    lecroy_envelope_kernel, &args);
+	/* Each level up is pairs of the one below (the last may be a single) */
+	for (k = 1; k < env->no_of_levels; k++) {
+		for (b = 0; b < env->level_len[k]; b++) {
+			env->min[k][b] = env->min[k - 1][2 * b];
+			env->max[k][b] = env->max[k - 1][2 * b];
+			if (2 * b + 1 < env->level_len[k - 1]) {
+				if (env->min[k - 1][2 * b + 1] < env->min[k][b])
+					env->min[k][b] =
+					    env->min[k - 1][2 * b + 1];
+				if (env->max[k - 1][2 * b + 1] > env->max[k][b])
+					env->max[k][b] =
+					    env->max[k - 1][2 * b + 1];
+			}
+		}
+	}
+	return 0;
+}
+
+void lecroy_envelope_free(struct lecroy_envelope *env)
+{
+	int k;
+	for (k = 0; k < env->no_of_levels; k++) {
+		delete[]env->min[k];
+		delete[]env->max[k];
+		env->min[k] = env->max[k] = NULL;
+	}
+	env->no_of_levels = 0;
+}
+
+/* Fills min and max (no_of_pixels values each, in volts) with the envelope
+ * of points [start, end) of the record, as they'd be drawn no_of_pixels
+ * wide. Each pixel's range of points is covered exactly by the biggest
+ * blocks that fit inside it, so the work done depends only on the number of
+ * pixels, not on how many points are in the window. What's left over at
+ * the edges of a pixel (less than a level 0 block) is read from the raw
+ * data in buf, if you pass it, and then the envelope is exact; buf can
+ * otherwise be NULL, and those points are given the range of the whole
+ * level 0 block they're in (so a pixel can come out a bit taller than it
+ * should). Point i is at time i * horiz_interval + horiz_offset (within its
+ * segment). Returns the number of pixels filled in. */
+long lecroy_envelope_query(const struct lecroy_envelope *env,
+			   const char *buf, long start, long end,
+			   long no_of_pixels, double *min, double *max)
+{
+	long span, p, a, b, i, n, block, size;
+	int k;
+	short lo, hi, v;
+	signed char c;
+
+	if (start < 0)
+		start = 0;
+	if (end > env->no_of_points)
+		end = env->no_of_points;
+	span = end - start;
+	if (span <= 0 || no_of_pixels <= 0 || env->no_of_levels == 0)
+		return 0;
+	block = 1L << env->base_shift;
+
+	for (p = 0; p < no_of_pixels; p++) {
+		a = start + (span * p) / no_of_pixels;
+		b = start + (span * (p + 1)) / no_of_pixels;
+		if (b <= a)
+			b = a + 1;
+		lo = 32767;
+		hi = -32768;
+		i = a;
+		while (i < b) {
+			/* A level 0 block that starts here and fits (the last
+			 * one in the record may be short) */
+			if ((i & (block - 1)) == 0
+			    && (i + block <= b || b == env->no_of_points)) {
+				/* ...and the biggest one that does */
+				k = 0;
+				size = block;
+				while (k + 1 < env->no_of_levels
+				       && (i & (2 * size - 1)) == 0
+				       && (i + 2 * size <= b
+					   || b == env->no_of_points)) {
+					k++;
+					size *= 2;
+				}
+				n = i >> (env->base_shift + k);
+				lo = env->min[k][n] < lo ? env->min[k][n] : lo;
+				hi = env->max[k][n] > hi ? env->max[k][n] : hi;
+				i += size;
+			} else if (buf != NULL) {
+				/* An edge: straight from the data */
+				if (env->bytes_per_point == 1) {
+					memcpy(&c, buf + i, 1);
+					v = c;
+				} else {
+					memcpy(&v, buf + 2 * i, 2);
+				}
+				lo = v < lo ? v : lo;
+				hi = v > hi ? v : hi;
+				i++;
+			} else {
+				/* An edge, and no data: the whole block */
+				n = i >> env->base_shift;
+				lo = env->min[0][n] < lo ? env->min[0][n] : lo;
+				hi = env->max[0][n] > hi ? env->max[0][n] : hi;
+				i = (n + 1) << env->base_shift;
+			}
+		}
+		min[p] = env->vgain * lo - env->voffset;
+		max[p] = env->vgain * hi - env->voffset;
+	}
+	return no_of_pixels;
+}
+
+/* The .wfe file is native-endian binary (like the .wf file):
+ *	char[8]   "WFENV001"
+ *	int32     bytes per point (of the original data)
+ *	int32     base shift (level 0 blocks are 2^base_shift points)
+ *	int32     number of levels
+ *	int32     0 (padding)
+ *	int64     number of points
+ *	double    vertical gain, vertical offset, horiz interval, horiz offset
+ * then for each level, from 0:
+ *	int64     number of blocks
+ *	int16[]   min of each block (raw units)
+ *	int16[]   max of each block (raw units)
+ * Returns 0, or -1 if the file couldn't be written. */
+int lecroy_envelope_write(const char *filename,
+			  const struct lecroy_envelope *env)
+{
+	FILE *f;
+	int header[4];
+	long long len;
+	double scaling[4];
+	int k, ok = 1;
+
+	f = fopen(filename, "wb");
+	if (f == NULL) {
+		printf
+		    ("error: lecroy_envelope_write: could not open %s for writing\n",
+		     filename);
+		return -1;
+	}
+	header[0] = env->bytes_per_point;
+	header[1] = env->base_shift;
+	header[2] = env->no_of_levels;
+	header[3] = 0;
+	len = env->no_of_points;
+	scaling[0] = env->vgain;
+	scaling[1] = env->voffset;
+	scaling[2] = env->horiz_interval;
+	scaling[3] = env->horiz_offset;
+	ok &= fwrite(LECROY_ENVELOPE_MAGIC, 1, 8, f) == 8;
+	ok &= fwrite(header, sizeof(int), 4, f) == 4;
+	ok &= fwrite(&len, sizeof(long long), 1, f) == 1;
+	ok &= fwrite(scaling, sizeof(double), 4, f) == 4;
+	for (k = 0; k < env->no_of_levels; k++) {
+		len = env->level_len[k];
+		ok &= fwrite(&len, sizeof(long long), 1, f) == 1;
+		ok &= fwrite(env->min[k], sizeof(short), len, f) == (size_t)len;
+		ok &= fwrite(env->max[k], sizeof(short), len, f) == (size_t)len;
+	}
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok) {
+		printf("error: lecroy_envelope_write: could not write %s\n",
+		       filename);
+		return -1;
+	}
+	return 0;
+}
+
+/* Reads a .wfe file written by lecroy_envelope_write(). Returns 0, or -1 if
+ * it isn't one. */
+int lecroy_envelope_read(const char *filename, struct lecroy_envelope *env)
+{
+	FILE *f;
+	char magic[8];
+	int header[4];
+	long long len, file_len = 0;
+	double scaling[4];
+	int k, ok = 1;
+
+	memset(env, 0, sizeof(struct lecroy_envelope));
+	f = fopen(filename, "rb");
+	if (f == NULL) {
+		printf("error: lecroy_envelope_read: could not open %s\n",
+		       filename);
+		return -1;
+	}
+	if (fseek(f, 0, SEEK_END) == 0)
+		file_len = ftell(f);
+	rewind(f);
+	/* The header's checked before we believe it: the bytes per point
+	 * picks how the raw data's read, the base shift is used to shift by,
+	 * and the number of points says how much to allocate, so a corrupt
+	 * one mustn't get as far as lecroy_envelope_alloc() */
+	if (fread(magic, 1, 8, f) != 8
+	    || memcmp(magic, LECROY_ENVELOPE_MAGIC, 8) != 0
+	    || fread(header, sizeof(int), 4, f) != 4
+	    || fread(&len, sizeof(long long), 1, f) != 1
+	    || fread(scaling, sizeof(double), 4, f) != 4
+	    || (header[0] != 1 && header[0] != 2)
+	    || header[1] < 0 || header[1] > LECROY_ENVELOPE_MAX_BASE_SHIFT
+	    || header[2] < 1 || header[2] > LECROY_ENVELOPE_MAX_LEVELS
+	    || len < 1
+	    || ((len + (1LL << header[1]) - 1) >> header[1]) * 2 *
+	    (long long)sizeof(short) > file_len) {
+		printf("error: lecroy_envelope_read: %s is not an envelope file\n",
+		       filename);
+		fclose(f);
+		return -1;
+	}
+	env->bytes_per_point = header[0];
+	env->base_shift = header[1];
+	env->no_of_points = (long)len;
+	env->vgain = scaling[0];
+	env->voffset = scaling[1];
+	env->horiz_interval = scaling[2];
+	env->horiz_offset = scaling[3];
+	lecroy_envelope_alloc(env);
+	for (k = 0; k < env->no_of_levels && ok; k++) {
+		ok &= fread(&len, sizeof(long long), 1, f) == 1
+		    && len == env->level_len[k];
+		ok = ok
+		    && fread(env->min[k], sizeof(short), len, f) == (size_t)len
+		    && fread(env->max[k], sizeof(short), len, f) == (size_t)len;
+	}
+	fclose(f);
+	if (!ok || env->no_of_levels != header[2]) {
+		printf("error: lecroy_envelope_read: %s is truncated\n",
+		       filename);
+		lecroy_envelope_free(env);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,664 @@
+/* lecroy_fft.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Host-side spectra of traces grabbed with lecroy_get_data(). The scope's
+ * own FFT maths channel is slow, and won't do long records; this does
+ * averaged power spectra straight from the raw 8 or 16 bit data, over all the
+ * segments of a segmented acquisition, using all the cores of the PC. It's
+ * quick enough to keep up with the scope in most cases.
+ *
+ * The FFT itself is a mixed-radix (4, 2, 3, 5, and anything else up to 32)
+ * Stockham FFT, which needs no bit reversal. Lengths with a bigger prime
+ * factor than that (LeCroy records are often something like 10002 points,
+ * which is 2 x 3 x 1667) go through Bluestein's algorithm, using a power of
+ * two FFT of at least twice the length; slower, but still n log n. Real data
+ * of even length n is done as a complex FFT of length n/2. The complex data
+ * is kept as separate real and imaginary arrays, so the inner loops are
+ * simple unit-stride loops that the compiler turns into SIMD instructions.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "lecroy_vxi11.h"
+
+#define	LECROY_FFT_MAX_RADIX	32	/* bigger prime factors use Bluestein */
+#define	LECROY_FFT_MAX_FACTORS	64
+
+/* A complex FFT of one length */
+struct lecroy_cfft {
+	long n;
+	int no_of_factors;
+	long factors[LECROY_FFT_MAX_FACTORS];
+	double *tw_re;		/* W_n^t = exp(-2 pi i t / n), t = 0..n-1 */
+	double *tw_im;
+	long work_len;		/* doubles needed in each work array */
+	/* Bluestein only */
+	long m;			/* length of the power of two FFT */
+	struct lecroy_cfft *sub;
+	double *chirp_re;	/* exp(-i pi k^2 / n), k = 0..n-1 */
+	double *chirp_im;
+	double *b_re;		/* FFT of the conjugate chirp, length m */
+	double *b_im;
+};
+
+struct lecroy_fft_plan {
+	long n;
+	int window;
+	double *win;
+	double win_sum;
+	double win_sum_sq;
+	struct lecroy_cfft *cfft;	/* length n/2 if n is even, else n */
+	double *rtw_re;		/* W_n^k, k = 0..n/2, for unpacking the real FFT */
+	double *rtw_im;
+	long work_len;		/* doubles in each of the 4 work arrays */
+};
+
+static void lecroy_cfft_exec(const struct lecroy_cfft *f, double *re,
+			     double *im, double *work_re, double *work_im);
+
+/* Factors n into radices, 4s first (fewest passes), then 2, 3, 5 and any
+ * others. Returns the number of factors. */
+static int lecroy_cfft_factorise(long n, long *factors)
+{
+	int nf = 0;
+	long p;
+
+	while (n % 4 == 0 && nf < LECROY_FFT_MAX_FACTORS) {
+		factors[nf++] = 4;
+		n /= 4;
+	}
+	while (n % 2 == 0 && nf < LECROY_FFT_MAX_FACTORS) {
+		factors[nf++] = 2;
+		n /= 2;
+	}
+	for (p = 3; p * p <= n && nf < LECROY_FFT_MAX_FACTORS; p += 2) {
+		while (n % p == 0 && nf < LECROY_FFT_MAX_FACTORS) {
+			factors[nf++] = p;
+			n /= p;
+		}
+	}
+	if (n > 1 && nf < LECROY_FFT_MAX_FACTORS)
+		factors[nf++] = n;
+	return nf;
+}
+
+static void lecroy_cfft_destroy(struct lecroy_cfft *f)
+{
+	if (f == NULL)
+		return;
+	delete[]f->tw_re;
+	delete[]f->tw_im;
+	delete[]f->chirp_re;
+	delete[]f->chirp_im;
+	delete[]f->b_re;
+	delete[]f->b_im;
+	lecroy_cfft_destroy(f->sub);
+	delete f;
+}
+
+static struct lecroy_cfft *lecroy_cfft_create(long n)
+{
+	struct lecroy_cfft *f;
+	double *work_re, *work_im;
+	double angle;
+	long t, k, k2;
+	int l;
+
+	f = new struct lecroy_cfft;
+	memset(f, 0, sizeof(struct lecroy_cfft));
+	f->n = n;
+	f->no_of_factors = lecroy_cfft_factorise(n, f->factors);
+	f->work_len = n;
+	for (l = 0; l < f->no_of_factors; l++) {
+		if (f->factors[l] > LECROY_FFT_MAX_RADIX)
+			break;
+	}
+	if (l < f->no_of_factors) {
+		/* Bluestein: an FFT of length n as a convolution, done with
+		 * FFTs of a power of two length m >= 2n - 1 */
+		f->m = 1;
+		while (f->m < 2 * n - 1)
+			f->m *= 2;
+		f->sub = lecroy_cfft_create(f->m);
+		f->work_len = 2 * f->m;
+		f->chirp_re = new double[n];
+		f->chirp_im = new double[n];
+		f->b_re = new double[f->m];
+		f->b_im = new double[f->m];
+		memset(f->b_re, 0, f->m * sizeof(double));
+		memset(f->b_im, 0, f->m * sizeof(double));
+		for (k = 0; k < n; k++) {
+			/* k^2 mod 2n, so the angle doesn't lose precision */
+			k2 = (long)(((long long)k * k) % (2 * (long long)n));
+			angle = M_PI * (double)k2 / (double)n;
+			f->chirp_re[k] = cos(angle);
+			f->chirp_im[k] = -sin(angle);
+			f->b_re[k] = f->chirp_re[k];
+			f->b_im[k] = -f->chirp_im[k];
+			if (k > 0) {
+				f->b_re[f->m - k] = f->b_re[k];
+				f->b_im[f->m - k] = f->b_im[k];
+			}
+		}
+		work_re = new double[f->sub->work_len];
+		work_im = new double[f->sub->work_len];
+		lecroy_cfft_exec(f->sub, f->b_re, f->b_im, work_re, work_im);
+		delete[]work_re;
+		delete[]work_im;
+		return f;
+	}
+	f->tw_re = new double[n];
+	f->tw_im = new double[n];
+	for (t = 0; t < n; t++) {
+		angle = 2.0 * M_PI * (double)t / (double)n;
+		f->tw_re[t] = cos(angle);
+		f->tw_im[t] = -sin(angle);
+	}
+	return f;
+}
+
+/* One Stockham pass of radix r over sub-transforms of length n_cur, each
+ * interleaved with stride s (n_cur * s = n). Reads x, writes y. Output k of
+ * butterfly p goes to y[s * (r * p + k)], multiplied by W_n^(p k s). The
+ * innermost loops run over q, the s interleaved transforms, which are next
+ * to each other in memory. */
+static void lecroy_cfft_pass(const struct lecroy_cfft *f, long r, long n_cur,
+			     long s, const double *xr, const double *xi,
+			     double *yr, double *yi)
+{
+	const double *tr = f->tw_re;
+	const double *ti = f->tw_im;
+	long m = n_cur / r;
+	long p, q, j, k;
+	double wr, wi, dr, di;
+
+	if (r == 2) {
+		for (p = 0; p < m; p++) {
+			const double *a0r = xr + s * p, *a0i = xi + s * p;
+			const double *a1r = xr + s * (p + m), *a1i =
+			    xi + s * (p + m);
+			double *y0r = yr + s * 2 * p, *y0i = yi + s * 2 * p;
+			double *y1r = y0r + s, *y1i = y0i + s;
+			wr = tr[p * s];
+			wi = ti[p * s];
+			for (q = 0; q < s; q++) {
+				y0r[q] = a0r[q] + a1r[q];
+				y0i[q] = a0i[q] + a1i[q];
+				dr = a0r[q] - a1r[q];
+				di = a0i[q] - a1i[q];
+				y1r[q] = dr * wr - di * wi;
+				y1i[q] = dr * wi + di * wr;
+			}
+		}
+	} else if (r == 4) {
+		for (p = 0; p < m; p++) {
+			const double *a0r = xr + s * p, *a0i = xi + s * p;
+			const double *a1r = a0r + s * m, *a1i = a0i + s * m;
+			const double *a2r = a1r + s * m, *a2i = a1i + s * m;
+			const double *a3r = a2r + s * m, *a3i = a2i + s * m;
+			double *y0r = yr + s * 4 * p, *y0i = yi + s * 4 * p;
+			double *y1r = y0r + s, *y1i = y0i + s;
+			double *y2r = y1r + s, *y2i = y1i + s;
+			double *y3r = y2r + s, *y3i = y2i + s;
+			double w1r = tr[p * s], w1i = ti[p * s];
+			double w2r = tr[2 * p * s], w2i = ti[2 * p * s];
+			double w3r = tr[3 * p * s], w3i = ti[3 * p * s];
+			for (q = 0; q < s; q++) {
+				double t0r = a0r[q] + a2r[q], t0i = a0i[q] + a2i[q];
+				double t1r = a0r[q] - a2r[q], t1i = a0i[q] - a2i[q];
+				double t2r = a1r[q] + a3r[q], t2i = a1i[q] + a3i[q];
+				/* (a1 - a3) * -i */
+				double t3r = a1i[q] - a3i[q], t3i = a3r[q] - a1r[q];
+				double b1r = t1r + t3r, b1i = t1i + t3i;
+				double b2r = t0r - t2r, b2i = t0i - t2i;
+				double b3r = t1r - t3r, b3i = t1i - t3i;
+				y0r[q] = t0r + t2r;
+				y0i[q] = t0i + t2i;
+				y1r[q] = b1r * w1r - b1i * w1i;
+				y1i[q] = b1r * w1i + b1i * w1r;
+				y2r[q] = b2r * w2r - b2i * w2i;
+				y2i[q] = b2r * w2i + b2i * w2r;
+				y3r[q] = b3r * w3r - b3i * w3i;
+				y3i[q] = b3r * w3i + b3i * w3r;
+			}
+		}
+	} else if (r == 3) {
+		const double c = 0.86602540378443864676;	/* sqrt(3)/2 */
+		for (p = 0; p < m; p++) {
+			const double *a0r = xr + s * p, *a0i = xi + s * p;
+			const double *a1r = a0r + s * m, *a1i = a0i + s * m;
+			const double *a2r = a1r + s * m, *a2i = a1i + s * m;
+			double *y0r = yr + s * 3 * p, *y0i = yi + s * 3 * p;
+			double *y1r = y0r + s, *y1i = y0i + s;
+			double *y2r = y1r + s, *y2i = y1i + s;
+			double w1r = tr[p * s], w1i = ti[p * s];
+			double w2r = tr[2 * p * s], w2i = ti[2 * p * s];
+			for (q = 0; q < s; q++) {
+				double sr = a1r[q] + a2r[q], si = a1i[q] + a2i[q];
+				double hr = a0r[q] - 0.5 * sr, hi = a0i[q] - 0.5 * si;
+				dr = c * (a1r[q] - a2r[q]);
+				di = c * (a1i[q] - a2i[q]);
+				double b1r = hr + di, b1i = hi - dr;
+				double b2r = hr - di, b2i = hi + dr;
+				y0r[q] = a0r[q] + sr;
+				y0i[q] = a0i[q] + si;
+				y1r[q] = b1r * w1r - b1i * w1i;
+				y1i[q] = b1r * w1i + b1i * w1r;
+				y2r[q] = b2r * w2r - b2i * w2i;
+				y2i[q] = b2r * w2i + b2i * w2r;
+			}
+		}
+	} else {
+		/* Any other radix (5, 7, ... 31): a straight DFT of the r
+		 * points of each butterfly */
+		double ar[LECROY_FFT_MAX_RADIX], ai[LECROY_FFT_MAX_RADIX];
+		long step = f->n / r;	/* W_r^1 = W_n^step */
+		long idx;
+		double sr, si;
+		for (p = 0; p < m; p++) {
+			for (q = 0; q < s; q++) {
+				for (j = 0; j < r; j++) {
+					ar[j] = xr[q + s * (p + j * m)];
+					ai[j] = xi[q + s * (p + j * m)];
+				}
+				for (k = 0; k < r; k++) {
+					sr = 0;
+					si = 0;
+					idx = 0;
+					for (j = 0; j < r; j++) {
+						wr = tr[idx * step];
+						wi = ti[idx * step];
+						sr += ar[j] * wr - ai[j] * wi;
+						si += ar[j] * wi + ai[j] * wr;
+						idx += k;
+						if (idx >= r)
+							idx -= r;
+					}
+					wr = tr[p * k * s];
+					wi = ti[p * k * s];
+					yr[q + s * (r * p + k)] = sr * wr - si * wi;
+					yi[q + s * (r * p + k)] = sr * wi + si * wr;
+				}
+			}
+		}
+	}
+}
+
+/* Forward FFT of (re, im), in place. work_re and work_im must each have
+ * f->work_len doubles. */
+static void lecroy_cfft_exec(const struct lecroy_cfft *f, double *re,
+			     double *im, double *work_re, double *work_im)
+{
+	double *xr = re, *xi = im, *yr = work_re, *yi = work_im, *tmp;
+	long n_cur = f->n, s = 1, k, m;
+	double ar, ai;
+	int l;
+
+	if (f->sub != NULL) {
+		/* Bluestein: chirp, convolve with the conjugate chirp (by
+		 * multiplying FFTs; the inverse is done as conj(FFT(conj))),
+		 * chirp again */
+		m = f->m;
+		xr = work_re;
+		xi = work_im;
+		for (k = 0; k < f->n; k++) {
+			xr[k] = re[k] * f->chirp_re[k] - im[k] * f->chirp_im[k];
+			xi[k] = re[k] * f->chirp_im[k] + im[k] * f->chirp_re[k];
+		}
+		memset(xr + f->n, 0, (m - f->n) * sizeof(double));
+		memset(xi + f->n, 0, (m - f->n) * sizeof(double));
+		lecroy_cfft_exec(f->sub, xr, xi, work_re + m, work_im + m);
+		for (k = 0; k < m; k++) {
+			ar = xr[k] * f->b_re[k] - xi[k] * f->b_im[k];
+			ai = xr[k] * f->b_im[k] + xi[k] * f->b_re[k];
+			xr[k] = ar;
+			xi[k] = -ai;
+		}
+		lecroy_cfft_exec(f->sub, xr, xi, work_re + m, work_im + m);
+		for (k = 0; k < f->n; k++) {
+			ar = xr[k] / (double)m;
+			ai = -xi[k] / (double)m;
+			re[k] = ar * f->chirp_re[k] - ai * f->chirp_im[k];
+			im[k] = ar * f->chirp_im[k] + ai * f->chirp_re[k];
+		}
+		return;
+	}
+
+	for (l = 0; l < f->no_of_factors; l++) {
+		lecroy_cfft_pass(f, f->factors[l], n_cur, s, xr, xi, yr, yi);
+		tmp = xr;
+		xr = yr;
+		yr = tmp;
+		tmp = xi;
+		xi = yi;
+		yi = tmp;
+		n_cur /= f->factors[l];
+		s *= f->factors[l];
+	}
+	if (xr != re) {
+		memcpy(re, xr, f->n * sizeof(double));
+		memcpy(im, xi, f->n * sizeof(double));
+	}
+}
+
+/* Creates a plan for real FFTs of length n, with one of the LECROY_WINDOW_*
+ * windows. The windows are the "periodic" kind, as is usual for spectral
+ * analysis. A plan can be shared between threads. Returns NULL if n < 2. */
+struct lecroy_fft_plan *lecroy_fft_plan_create(long n, int window)
+{
+	struct lecroy_fft_plan *plan;
+	double x, angle;
+	long i, k;
+
+	if (n < 2)
+		return NULL;
+	plan = new struct lecroy_fft_plan;
+	memset(plan, 0, sizeof(struct lecroy_fft_plan));
+	plan->n = n;
+	plan->window = window;
+	plan->win = new double[n];
+	for (i = 0; i < n; i++) {
+		x = 2.0 * M_PI * (double)i / (double)n;
+		switch (window) {
+		case LECROY_WINDOW_HANN:
+			plan->win[i] = 0.5 - 0.5 * cos(x);
+			break;
+		case LECROY_WINDOW_HAMMING:
+			plan->win[i] = 0.54 - 0.46 * cos(x);
+			break;
+		case LECROY_WINDOW_BLACKMAN_HARRIS:
+			plan->win[i] = 0.35875 - 0.48829 * cos(x)
+			    + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+			break;
+		case LECROY_WINDOW_FLATTOP:
+			plan->win[i] = 0.21557895 - 0.41663158 * cos(x)
+			    + 0.277263158 * cos(2 * x)
+			    - 0.083578947 * cos(3 * x)
+			    + 0.006947368 * cos(4 * x);
+			break;
+		default:
+			plan->window = LECROY_WINDOW_RECT;
+			plan->win[i] = 1.0;
+			break;
+		}
+		plan->win_sum += plan->win[i];
+		plan->win_sum_sq += plan->win[i] * plan->win[i];
+	}
+
+	if (n % 2 == 0) {
+		plan->cfft = lecroy_cfft_create(n / 2);
+		plan->rtw_re = new double[n / 2 + 1];
+		plan->rtw_im = new double[n / 2 + 1];
+		for (k = 0; k <= n / 2; k++) {
+			angle = 2.0 * M_PI * (double)k / (double)n;
+			plan->rtw_re[k] = cos(angle);
+			plan->rtw_im[k] = -sin(angle);
+		}
+	} else {
+		plan->cfft = lecroy_cfft_create(n);
+	}
+	plan->work_len =
+	    plan->cfft->n > plan->cfft->work_len ? plan->cfft->n :
+	    plan->cfft->work_len;
+	return plan;
+}
+
+void lecroy_fft_plan_destroy(struct lecroy_fft_plan *plan)
+{
+	if (plan == NULL)
+		return;
+	delete[]plan->win;
+	delete[]plan->rtw_re;
+	delete[]plan->rtw_im;
+	lecroy_cfft_destroy(plan->cfft);
+	delete plan;
+}
+
+/* Number of frequency bins out of a real FFT: n/2 + 1. Bin k is at
+ * frequency k / (n * horiz_interval). */
+long lecroy_fft_no_of_bins(const struct lecroy_fft_plan *plan)
+{
+	return plan->n / 2 + 1;
+}
+
+/* Equivalent noise bandwidth of the window, in bins. Divide a power
+ * spectrum by this and by the bin width (in Hz) to get a power spectral
+ * density in V^2/Hz. */
+double lecroy_fft_enbw(const struct lecroy_fft_plan *plan)
+{
+	return (double)plan->n * plan->win_sum_sq /
+	    (plan->win_sum * plan->win_sum);
+}
+
+/* Transforms the (already windowed) data the caller has loaded into z_re and
+ * z_im: packed in pairs (z = x[2k] + i x[2k+1]) for even n, or just x for odd
+ * n. Calls out(k, re, im) with each of the n/2 + 1 bins. Work arrays are
+ * plan->work_len long. */
+struct lecroy_fft_sink {
+	double *re;		/* either the spectrum... */
+	double *im;
+	double *power;		/* ...or a power spectrum to add to */
+	double scale;
+};
+
+static void lecroy_fft_real_exec(const struct lecroy_fft_plan *plan,
+				 double *z_re, double *z_im, double *work_re,
+				 double *work_im, struct lecroy_fft_sink *sink)
+{
+	long n = plan->n, half = n / 2, k, kc;
+	double er, ei, dr, di, or_, oi, xr, xi, p;
+
+	lecroy_cfft_exec(plan->cfft, z_re, z_im, work_re, work_im);
+	for (k = 0; k <= half; k++) {
+		if (n % 2 == 0) {
+			/* X_k = E_k + W_n^k O_k, where E and O (the FFTs of
+			 * the even and odd samples) come out of Z_k and
+			 * conj(Z_(n/2 - k)) */
+			kc = (half - k) % half;
+			er = 0.5 * (z_re[k % half] + z_re[kc]);
+			ei = 0.5 * (z_im[k % half] - z_im[kc]);
+			dr = z_re[k % half] - z_re[kc];
+			di = z_im[k % half] + z_im[kc];
+			or_ = 0.5 * di;
+			oi = -0.5 * dr;
+			xr = er + or_ * plan->rtw_re[k] - oi * plan->rtw_im[k];
+			xi = ei + or_ * plan->rtw_im[k] + oi * plan->rtw_re[k];
+		} else {
+			xr = z_re[k];
+			xi = z_im[k];
+		}
+		if (sink->power != NULL) {
+			p = (xr * xr + xi * xi) * sink->scale;
+			/* Single sided: everything except DC and Nyquist
+			 * gets the power from the negative frequencies too */
+			if (k != 0 && !(n % 2 == 0 && k == half))
+				p *= 2.0;
+			sink->power[k] += p;
+		} else {
+			sink->re[k] = xr;
+			sink->im[k] = xi;
+		}
+	}
+}
+
+/* Loads n points (windowed, real) into the packed form that
+ * lecroy_fft_real_exec() wants */
+static inline void lecroy_fft_load(const struct lecroy_fft_plan *plan,
+				   long i, double x, double *z_re,
+				   double *z_im)
+{
+	x *= plan->win[i];
+	if (plan->n % 2 == 0) {
+		if ((i & 1) == 0)
+			z_re[i >> 1] = x;
+		else
+			z_im[i >> 1] = x;
+	} else {
+		z_re[i] = x;
+		z_im[i] = 0;
+	}
+}
+
+/* The discrete Fourier transform of n real values, with the plan's window
+ * applied. out_re and out_im get the n/2 + 1 non-negative frequency bins.
+ * Not the quickest way of doing lots of them (it allocates its own work
+ * space every time); see lecroy_fft_power_spectrum(). */
+int lecroy_fft_real(const struct lecroy_fft_plan *plan, const double *in,
+		    double *out_re, double *out_im)
+{
+	double *z_re, *z_im, *work_re, *work_im;
+	struct lecroy_fft_sink sink;
+	long i;
+
+	z_re = new double[plan->work_len];
+	z_im = new double[plan->work_len];
+	work_re = new double[plan->work_len];
+	work_im = new double[plan->work_len];
+	for (i = 0; i < plan->n; i++)
+		lecroy_fft_load(plan, i, in[i], z_re, z_im);
+	sink.re = out_re;
+	sink.im = out_im;
+	sink.power = NULL;
+	sink.scale = 1.0;
+	lecroy_fft_real_exec(plan, z_re, z_im, work_re, work_im, &sink);
+	delete[]z_re;
+	delete[]z_im;
+	delete[]work_re;
+	delete[]work_im;
+	return 0;
+}
+
+struct lecroy_fft_power_args {
+	const struct lecroy_fft_plan *plan;
+	const char *buf;
+	int bytes_per_point;
+	double vgain;
+	double voffset;
+	long no_of_segments;
+	long no_of_blocks;
+	double *partial;	/* no_of_blocks power spectra */
+};
+
+/* Does the segments of one block, each block into its own partial sum, so
+ * the threads never write to the same memory */
+static void lecroy_fft_power_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_fft_power_args *args =
+	    (struct lecroy_fft_power_args *)ptr;
+	const struct lecroy_fft_plan *plan = args->plan;
+	long bins = plan->n / 2 + 1;
+	double *z_re, *z_im, *work_re, *work_im;
+	struct lecroy_fft_sink sink;
+	const char *seg;
+	long b, j, i, j0, j1;
+	signed char c;
+	short v;
+
+	z_re = new double[plan->work_len];
+	z_im = new double[plan->work_len];
+	work_re = new double[plan->work_len];
+	work_im = new double[plan->work_len];
+	sink.re = sink.im = NULL;
+	sink.scale = 1.0 / (plan->win_sum * plan->win_sum);
+	for (b = start; b < end; b++) {
+		sink.power = args->partial + b * bins;
+		memset(sink.power, 0, bins * sizeof(double));
+		j0 = (args->no_of_segments * b) / args->no_of_blocks;
+		j1 = (args->no_of_segments * (b + 1)) / args->no_of_blocks;
+		for (j = j0; j < j1; j++) {
+			seg = args->buf + j * plan->n * args->bytes_per_point;
+			if (args->bytes_per_point == 1) {
+				for (i = 0; i < plan->n; i++) {
+					memcpy(&c, seg + i, 1);
+					lecroy_fft_load(plan, i,
+							args->vgain * c -
+							args->voffset, z_re,
+							z_im);
+				}
+			} else {
+				for (i = 0; i < plan->n; i++) {
+					memcpy(&v, seg + 2 * i, 2);
+					lecroy_fft_load(plan, i,
+							args->vgain * v -
+							args->voffset, z_re,
+							z_im);
+				}
+			}
+			lecroy_fft_real_exec(plan, z_re, z_im, work_re,
+					     work_im, &sink);
+		}
+	}
+	delete[]z_re;
+	delete[]z_im;
+	delete[]work_re;
+	delete[]work_im;
+}
+
+/* Adds the power spectrum of every segment in buf (each plan->n points long;
+ * any incomplete segment at the end is ignored) to psd_sum, which has
+ * lecroy_fft_no_of_bins() values. The data is scaled to volts with the
+ * vertical gain and offset (from the waveform descriptor) first. The power
+ * spectrum is single sided, in V^2, normalised for the window's coherent
+ * gain: a sine wave of amplitude A on a bin shows up as A^2/2. Divide by the
+ * total number of segments added for the average (so you can keep adding
+ * acquisitions as they arrive). Returns the number of segments added. */
+long lecroy_fft_power_spectrum(const struct lecroy_fft_plan *plan,
+			       const char *buf, size_t buf_len,
+			       int bytes_per_point, double vgain,
+			       double voffset, double *psd_sum)
+{
+	return lecroy_fft_power_spectrum(plan, buf, buf_len, bytes_per_point,
+					 vgain, voffset, psd_sum, 1);
+}
+
+/* As above, with the segments split amongst no_of_threads threads (<=0 means
+ * one per core). The result can differ from the single threaded one in the
+ * last few bits, as the sums are done in a different order. */
+long lecroy_fft_power_spectrum(const struct lecroy_fft_plan *plan,
+			       const char *buf, size_t buf_len,
+			       int bytes_per_point, double vgain,
+			       double voffset, double *psd_sum,
+			       int no_of_threads)
+{
+	struct lecroy_fft_power_args args;
+	long bins = plan->n / 2 + 1;
+	long b, k;
+
+	args.plan = plan;
+	args.buf = buf;
+	args.bytes_per_point = bytes_per_point;
+	args.vgain = vgain;
+	args.voffset = voffset;
+	args.no_of_segments =
+	    (long)(buf_len / (plan->n * (size_t)bytes_per_point));
+	if (args.no_of_segments == 0)
+		return 0;
+	args.no_of_blocks = lecroy_get_no_of_threads(no_of_threads);
+	if (args.no_of_blocks > args.no_of_segments)
+		args.no_of_blocks = args.no_of_segments;
+	args.partial = new double[args.no_of_blocks * bins];
+	lecroy_parallel_for(args.no_of_blocks, 1, (int)args.no_of_blocks,
+			    lecroy_fft_power_kernel, &args);
+	for (b = 0; b < args.no_of_blocks; b++) {
+		for (k = 0; k < bins; k++)
+			psd_sum[k] += args.partial[b * bins + k];
+	}
+	delete[]args.partial;
+	return args.no_of_segments;
+}
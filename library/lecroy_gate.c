@@ -0,0 +1,407 @@
+/* lecroy_gate.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Event gating of segmented acquisitions. With a few thousand segments per
+ * acquisition, most of them usually have nothing in them; this looks at each
+ * segment as it arrives, and keeps only the ones that meet some criteria:
+ *
+ *   LECROY_GATE_THRESHOLD : the signal crosses a level (volts)
+ *   LECROY_GATE_PEAK      : the biggest |signal| reaches a level (volts)
+ *   LECROY_GATE_ENERGY    : the mean square signal reaches a level (V^2)
+ *   LECROY_GATE_TEMPLATE  : the correlation coefficient with a template
+ *                           shape, at the best lag, reaches a level (0-1)
+ *
+ * each looking at a "gate" (a range of points) within the segment. The kept
+ * segments are moved up to the front of the buffer, ready to be written out,
+ * and every segment (kept or not) gets a small record of what was measured,
+ * so nothing is completely lost.
+ *
+ * The measurements are done on the raw integer data, with the levels
+ * converted to raw units once, so the inner loops are plain integer loops
+ * that the compiler vectorises; segments are spread across threads.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "lecroy_vxi11.h"
+
+/* Sets up a gate for data described by desc (bytes per point, points per
+ * segment and scaling all come from the waveform descriptor). The criteria
+ * are copied, as are any templates (which are in volts). combine is
+ * LECROY_GATE_ANY (keep a segment if any criterion is met) or
+ * LECROY_GATE_ALL. Returns 0, or -1 if the criteria don't make sense. */
+int lecroy_gate_init(struct lecroy_gate *gate,
+		     const struct lecroy_gate_criterion *criteria,
+		     int no_of_criteria, int combine,
+		     const struct lecroy_wavedesc *desc)
+{
+	struct lecroy_gate_criterion *c;
+	double mean;
+	long i;
+	int l;
+
+	memset(gate, 0, sizeof(struct lecroy_gate));
+	if (no_of_criteria < 1 || no_of_criteria > LECROY_GATE_MAX_CRITERIA) {
+		printf("lecroy_gate_init: need 1 to %d criteria\n",
+		       LECROY_GATE_MAX_CRITERIA);
+		return -1;
+	}
+	gate->no_of_criteria = no_of_criteria;
+	gate->combine = combine;
+	gate->bytes_per_point = desc->comm_type == 1 ? 2 : 1;
+	gate->vgain = desc->vertical_gain;
+	gate->voffset = desc->vertical_offset;
+	if (desc->subarray_count > 1)
+		gate->points_per_segment =
+		    desc->wave_array_count / desc->subarray_count;
+	else
+		gate->points_per_segment = desc->wave_array_count;
+	if (gate->points_per_segment < 1 || gate->vgain <= 0) {
+		printf("lecroy_gate_init: descriptor has no data\n");
+		return -1;
+	}
+
+	for (l = 0; l < no_of_criteria; l++) {
+		c = &gate->criteria[l];
+		*c = criteria[l];
+		if (c->end <= 0 || c->end > gate->points_per_segment)
+			c->end = gate->points_per_segment;
+		if (c->start < 0)
+			c->start = 0;
+		if (c->start >= c->end) {
+			printf("lecroy_gate_init: empty gate\n");
+			lecroy_gate_free(gate);
+			return -1;
+		}
+		/* Levels in raw data units; volts = vgain * raw - voffset */
+		gate->raw_level[l] = (c->level + gate->voffset) / gate->vgain;
+		if (c->type == LECROY_GATE_TEMPLATE) {
+			if (c->templ == NULL || c->templ_len < 2
+			    || c->templ_len > c->end - c->start) {
+				printf
+				    ("lecroy_gate_init: template missing, or longer than its gate\n");
+				lecroy_gate_free(gate);
+				return -1;
+			}
+			/* Keep the template with its mean taken off, and its
+			 * norm; then the correlation with any stretch of raw
+			 * data is a dot product and a couple of sums */
+			gate->templ[l] = new double[c->templ_len];
+			mean = 0;
+			for (i = 0; i < c->templ_len; i++)
+				mean += c->templ[i];
+			mean /= c->templ_len;
+			for (i = 0; i < c->templ_len; i++) {
+				gate->templ[l][i] = c->templ[i] - mean;
+				gate->templ_norm[l] +=
+				    gate->templ[l][i] * gate->templ[l][i];
+			}
+			c->templ = gate->templ[l];
+		}
+	}
+	return 0;
+}
+
+void lecroy_gate_free(struct lecroy_gate *gate)
+{
+	int l;
+	for (l = 0; l < LECROY_GATE_MAX_CRITERIA; l++) {
+		delete[]gate->templ[l];
+		gate->templ[l] = NULL;
+	}
+}
+
+/* The measurements, for 8 (T = signed char) or 16 (T = short) bit data. The
+ * samples are loaded with memcpy() as the data needn't be aligned. */
+template <typename T> static inline T lecroy_gate_load(const char *p)
+{
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+/* Number of times the data crosses the level */
+template <typename T>
+static double lecroy_gate_threshold(const char *seg, long start, long end,
+				    double raw_level)
+{
+	long i, count = 0;
+	int above, was_above;
+
+	was_above = lecroy_gate_load<T>(seg + start * sizeof(T)) >= raw_level;
+	for (i = start + 1; i < end; i++) {
+		above = lecroy_gate_load<T>(seg + i * sizeof(T)) >= raw_level;
+		count += above ^ was_above;
+		was_above = above;
+	}
+	return (double)count;
+}
+
+/* Biggest |volts| */
+template <typename T>
+static double lecroy_gate_peak(const struct lecroy_gate *gate,
+			       const char *seg, long start, long end)
+{
+	long i;
+	T v, lo, hi;
+	double a, b;
+
+	lo = hi = lecroy_gate_load<T>(seg + start * sizeof(T));
+	for (i = start + 1; i < end; i++) {
+		v = lecroy_gate_load<T>(seg + i * sizeof(T));
+		lo = v < lo ? v : lo;
+		hi = v > hi ? v : hi;
+	}
+	a = fabs(gate->vgain * hi - gate->voffset);
+	b = fabs(gate->vgain * lo - gate->voffset);
+	return a > b ? a : b;
+}
+
+/* Mean of volts^2, from exact integer sums of raw and raw^2 */
+template <typename T>
+static double lecroy_gate_energy(const struct lecroy_gate *gate,
+				 const char *seg, long start, long end)
+{
+	long i;
+	long long s1 = 0, s2 = 0;
+	int v;
+	double n = (double)(end - start);
+	double a = gate->vgain, b = gate->voffset;
+
+	for (i = start; i < end; i++) {
+		v = lecroy_gate_load<T>(seg + i * sizeof(T));
+		s1 += v;
+		s2 += v * v;
+	}
+	return (a * a * (double)s2 - 2 * a * b * (double)s1 + n * b * b) / n;
+}
+
+/* Best (Pearson) correlation coefficient between the template and the data,
+ * over all the lags at which the template fits inside the gate. The scaling
+ * to volts doesn't change the correlation coefficient, so this works on the
+ * raw data throughout. */
+template <typename T>
+static double lecroy_gate_template(const struct lecroy_gate *gate, int c,
+				   const char *seg, long start, long end)
+{
+	const double *t = gate->templ[c];
+	long len = gate->criteria[c].templ_len;
+	long lag, j;
+	double dot, s1 = 0, s2 = 0, var, rho, best = -1.0, x, x_old;
+
+	for (j = 0; j < len; j++) {
+		x = lecroy_gate_load<T>(seg + (start + j) * sizeof(T));
+		s1 += x;
+		s2 += x * x;
+	}
+	for (lag = 0; start + lag + len <= end; lag++) {
+		if (lag > 0) {
+			/* slide the window sums along one point */
+			x_old = lecroy_gate_load<T>(seg +
+						    (start + lag - 1) *
+						    sizeof(T));
+			x = lecroy_gate_load<T>(seg +
+						(start + lag + len - 1) *
+						sizeof(T));
+			s1 += x - x_old;
+			s2 += x * x - x_old * x_old;
+		}
+		dot = 0;
+		for (j = 0; j < len; j++)
+			dot +=
+			    t[j] * lecroy_gate_load<T>(seg +
+						       (start + lag + j) *
+						       sizeof(T));
+		var = s2 - s1 * s1 / len;
+		if (var <= 0 || gate->templ_norm[c] <= 0)
+			continue;
+		rho = dot / sqrt(var * gate->templ_norm[c]);
+		if (rho > best)
+			best = rho;
+	}
+	return best;
+}
+
+template <typename T>
+static int lecroy_gate_segment(const struct lecroy_gate *gate,
+			       const char *seg, struct lecroy_gate_record *rec)
+{
+	const struct lecroy_gate_criterion *c;
+	double value;
+	int l, met, no_met = 0;
+
+	for (l = 0; l < gate->no_of_criteria; l++) {
+		c = &gate->criteria[l];
+		switch (c->type) {
+		case LECROY_GATE_THRESHOLD:
+			value = lecroy_gate_threshold<T>(seg, c->start, c->end,
+							 gate->raw_level[l]);
+			met = value >= 1;
+			break;
+		case LECROY_GATE_PEAK:
+			value = lecroy_gate_peak<T>(gate, seg, c->start, c->end);
+			met = value >= c->level;
+			break;
+		case LECROY_GATE_ENERGY:
+			value =
+			    lecroy_gate_energy<T>(gate, seg, c->start, c->end);
+			met = value >= c->level;
+			break;
+		case LECROY_GATE_TEMPLATE:
+			value = lecroy_gate_template<T>(gate, l, seg, c->start,
+							c->end);
+			met = value >= c->level;
+			break;
+		default:
+			value = 0;
+			met = 0;
+			break;
+		}
+		rec->value[l] = (float)value;
+		no_met += met;
+	}
+	if (gate->combine == LECROY_GATE_ALL)
+		return no_met == gate->no_of_criteria;
+	return no_met > 0;
+}
+
+struct lecroy_gate_args {
+	struct lecroy_gate *gate;
+	const char *buf;
+	struct lecroy_gate_record *records;
+	long first_segment;
+};
+
+static void lecroy_gate_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_gate_args *args = (struct lecroy_gate_args *)ptr;
+	struct lecroy_gate *gate = args->gate;
+	size_t seg_bytes = gate->points_per_segment * gate->bytes_per_point;
+	struct lecroy_gate_record *rec;
+	const char *seg;
+	long j;
+
+	for (j = start; j < end; j++) {
+		seg = args->buf + j * seg_bytes;
+		rec = &args->records[j];
+		memset(rec, 0, sizeof(struct lecroy_gate_record));
+		rec->segment = args->first_segment + j;
+		if (gate->bytes_per_point == 1)
+			rec->kept =
+			    lecroy_gate_segment<signed char>(gate, seg, rec);
+		else
+			rec->kept = lecroy_gate_segment<short>(gate, seg, rec);
+	}
+}
+
+/* Looks at every whole segment in buf (as returned by lecroy_get_data()).
+ * The segments that are kept are moved, in order, to the front of buf; the
+ * rest of buf is left as it is. records (buf_len / bytes per segment of
+ * them) gets a record of every segment. Segment numbers carry on from one
+ * call to the next, so you can feed acquisitions in as they arrive. Returns
+ * the number of bytes of kept segments at the front of buf. */
+long lecroy_gate_process(struct lecroy_gate *gate, char *buf, size_t buf_len,
+			 struct lecroy_gate_record *records)
+{
+	return lecroy_gate_process(gate, buf, buf_len, records, 1);
+}
+
+/* As above, with the segments split amongst no_of_threads threads (<=0 means
+ * one per core). */
+long lecroy_gate_process(struct lecroy_gate *gate, char *buf, size_t buf_len,
+			 struct lecroy_gate_record *records,
+			 int no_of_threads)
+{
+	struct lecroy_gate_args args;
+	size_t seg_bytes = gate->points_per_segment * gate->bytes_per_point;
+	long no_of_segments, j, kept = 0;
+
+	no_of_segments = (long)(buf_len / seg_bytes);
+	if (no_of_segments == 0)
+		return 0;
+	args.gate = gate;
+	args.buf = buf;
+	args.records = records;
+	args.first_segment = gate->segments_seen;
+	lecroy_parallel_for(no_of_segments, 4, no_of_threads,
+			    lecroy_gate_kernel, &args);
+
+	/* Kept segments only ever move towards the front, so this is safe in
+	 * place (and usually no copying at all happens until the first
+	 * segment that's thrown away) */
+	for (j = 0; j < no_of_segments; j++) {
+		if (records[j].kept == 0)
+			continue;
+		if (kept != j)
+			memmove(buf + kept * seg_bytes, buf + j * seg_bytes,
+				seg_bytes);
+		kept++;
+	}
+	gate->segments_seen += no_of_segments;
+	gate->segments_kept += kept;
+	return kept * (long)seg_bytes;
+}
+
+/* Writes the records as a text file (a .wfg file, say): a line for every
+ * segment, with whether it was kept and what each criterion measured. Set
+ * append to add to an existing file. Returns 0, or -1 if the file couldn't
+ * be written. */
+int lecroy_gate_write_summary(const char *filename,
+			      const struct lecroy_gate *gate,
+			      const struct lecroy_gate_record *records,
+			      long no_of_records, const char *captured_by,
+			      int append)
+{
+	static const char *names[] = { "threshold_crossings", "peak_volts",
+		"mean_square_volts", "template_correlation"
+	};
+	FILE *f;
+	long j;
+	int l;
+
+	f = fopen(filename, append == 0 ? "w" : "a");
+	if (f == NULL) {
+		printf
+		    ("error: lecroy_gate_write_summary: could not open %s for writing\n",
+		     filename);
+		return -1;
+	}
+	if (append == 0 || ftell(f) == 0) {
+		fprintf(f, "%% %s\n", filename);
+		fprintf(f, "%% Segments gated using %s\n", captured_by);
+		fprintf(f, "%% segment kept");
+		for (l = 0; l < gate->no_of_criteria; l++) {
+			if (gate->criteria[l].type >= 0
+			    && gate->criteria[l].type <= LECROY_GATE_TEMPLATE)
+				fprintf(f, " %s[%ld:%ld]",
+					names[gate->criteria[l].type],
+					gate->criteria[l].start,
+					gate->criteria[l].end);
+		}
+		fprintf(f, "\n");
+	}
+	for (j = 0; j < no_of_records; j++) {
+		fprintf(f, "%ld %d", records[j].segment, records[j].kept);
+		for (l = 0; l < gate->no_of_criteria; l++)
+			fprintf(f, " %g", records[j].value[l]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	return 0;
+}
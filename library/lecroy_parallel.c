@@ -0,0 +1,158 @@
+/* lecroy_parallel.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * A very small work-sharing engine, used to spread the post-processing of
+ * large (segmented) acquisitions over all the cores of the PC. None of this
+ * talks to the scope.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "lecroy_vxi11.h"
+
+/* Each thread starts off with its own contiguous slice of the range [0, n),
+ * and works through it chunk by chunk, so that it streams through one part
+ * of the buffers rather than hopping about. When it runs out, it steals
+ * chunks from the other threads' slices. */
+struct lecroy_parallel_slice {
+	long next;		/* next unclaimed index, claimed atomically */
+	long end;
+	char pad[64 - 2 * sizeof(long)];	/* keep slices on separate cache lines */
+};
+
+struct lecroy_parallel_job {
+	struct lecroy_parallel_slice *slices;
+	int no_of_threads;
+	long chunk;
+	void (*fn) (void *arg, long start, long end);
+	void *arg;
+};
+
+struct lecroy_parallel_worker {
+	struct lecroy_parallel_job *job;
+	int id;
+};
+
+static void *lecroy_parallel_worker_fn(void *ptr)
+{
+	struct lecroy_parallel_worker *worker =
+	    (struct lecroy_parallel_worker *)ptr;
+	struct lecroy_parallel_job *job = worker->job;
+	struct lecroy_parallel_slice *slice;
+	long start, end;
+	int l, victim;
+
+	/* Own slice first, then everyone else's, round robin */
+	for (l = 0; l < job->no_of_threads; l++) {
+		victim = (worker->id + l) % job->no_of_threads;
+		slice = &job->slices[victim];
+		while (1) {
+			start = __sync_fetch_and_add(&slice->next, job->chunk);
+			if (start >= slice->end)
+				break;
+			end = start + job->chunk;
+			if (end > slice->end)
+				end = slice->end;
+			job->fn(job->arg, start, end);
+		}
+	}
+	return NULL;
+}
+
+/* Returns the number of threads to actually use: no_of_threads if it's
+ * positive, otherwise the number of cores that are online. */
+int lecroy_get_no_of_threads(int no_of_threads)
+{
+	long ncpu;
+	if (no_of_threads > 0)
+		return no_of_threads;
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		return 1;
+	return (int)ncpu;
+}
+
+/* Calls fn(arg, start, end) for consecutive chunks of the range [0, n),
+ * spread over no_of_threads threads (<=0 means one per core). fn must be
+ * happy to be called concurrently for different, non-overlapping ranges.
+ * With one thread (or one chunk) everything happens in the calling thread,
+ * in order, so the serial and parallel paths run exactly the same code. */
+void lecroy_parallel_for(long n, long chunk, int no_of_threads,
+			 void (*fn) (void *arg, long start, long end),
+			 void *arg)
+{
+	struct lecroy_parallel_job job;
+	struct lecroy_parallel_worker *workers;
+	pthread_t *threads;
+	long per_thread;
+	int l, started;
+
+	if (n <= 0)
+		return;
+	if (chunk < 1)
+		chunk = 1;
+	no_of_threads = lecroy_get_no_of_threads(no_of_threads);
+	if (no_of_threads > (n + chunk - 1) / chunk)
+		no_of_threads = (int)((n + chunk - 1) / chunk);
+	if (no_of_threads <= 1) {
+		fn(arg, 0, n);
+		return;
+	}
+
+	job.slices = new struct lecroy_parallel_slice[no_of_threads];
+	job.no_of_threads = no_of_threads;
+	job.chunk = chunk;
+	job.fn = fn;
+	job.arg = arg;
+	/* Slices are whole numbers of chunks, so that the chunk boundaries
+	 * are the same as they would be with a single thread */
+	per_thread = (((n + chunk - 1) / chunk + no_of_threads - 1)
+		      / no_of_threads) * chunk;
+	for (l = 0; l < no_of_threads; l++) {
+		job.slices[l].next = l * per_thread;
+		job.slices[l].end = (l + 1) * per_thread;
+		if (job.slices[l].next > n)
+			job.slices[l].next = n;
+		if (job.slices[l].end > n || l == no_of_threads - 1)
+			job.slices[l].end = n;
+	}
+
+	workers = new struct lecroy_parallel_worker[no_of_threads];
+	threads = new pthread_t[no_of_threads];
+	started = 1;
+	for (l = 0; l < no_of_threads; l++) {
+		workers[l].job = &job;
+		workers[l].id = l;
+	}
+	/* The calling thread is worker 0. If we can't start a thread, that's
+	 * OK, its slice will get stolen by the others. */
+	for (l = 1; l < no_of_threads; l++) {
+		if (pthread_create(&threads[l], NULL, lecroy_parallel_worker_fn,
+				   &workers[l]) != 0)
+			break;
+		started++;
+	}
+	lecroy_parallel_worker_fn(&workers[0]);
+	for (l = 1; l < started; l++)
+		pthread_join(threads[l], NULL);
+
+	delete[]threads;
+	delete[]workers;
+	delete[]job.slices;
+}
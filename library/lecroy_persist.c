@@ -0,0 +1,326 @@
+/* lecroy_persist.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Host-side persistence: a 2D histogram (time across, amplitude up) of how
+ * many times each trace has passed through each spot, like the scope's
+ * persistence display, but at whatever resolution you like, without
+ * slowing the scope down, and with the counts to hand afterwards. Feed it
+ * everything lecroy_get_data() gets (a single trace, or a whole segmented
+ * acquisition, each segment counting as a trace) with lecroy_persist_add().
+ *
+ * By default every hit counts for ever (infinite persistence). With
+ * lecroy_persist_set_decay() the old hits fade away instead, the counts
+ * dropping by a factor of e every so many traces (variable persistence);
+ * the decay is applied once per lecroy_persist_add(), for all the traces
+ * in it.
+ *
+ * Working out which spot each point falls in is a loop on its own, with
+ * no branches, which the compiler can turn into SIMD instructions; the
+ * counting is a second loop. The threads split the histogram up by time
+ * (each takes a range of columns, and the points that fall in them), so
+ * no two threads ever touch the same count: no locks, no atomics, and no
+ * partial histograms to merge at the end.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "lecroy_vxi11.h"
+
+#define	LECROY_PERSIST_BLOCK	1024	/* points binned at a time */
+#define	LECROY_PERSIST_CHUNK	16	/* columns per thread, at least */
+#define	LECROY_PERSIST_DECAY_WEIGHT	256	/* a hit, with decay on */
+
+/* Sets up a histogram of columns x rows for traces of no_of_points points
+ * (columns <= 0 means one per point). The rows cover raw data values
+ * [raw_lo, raw_hi); if raw_lo >= raw_hi, the whole range of bytes_per_point
+ * data. There's no point having more rows than raw values, so there won't
+ * be. Returns 0, or -1 if the sizes make no sense. */
+int lecroy_persist_init(struct lecroy_persist *persist, long no_of_points,
+			int bytes_per_point, int columns, int rows, int raw_lo,
+			int raw_hi)
+{
+	long i;
+	int c;
+
+	memset(persist, 0, sizeof(struct lecroy_persist));
+	if (no_of_points < 1 || rows < 1
+	    || (bytes_per_point != 1 && bytes_per_point != 2)) {
+		printf("lecroy_persist_init: no points, or no rows\n");
+		return -1;
+	}
+	if (raw_lo >= raw_hi) {
+		raw_lo = bytes_per_point == 1 ? -128 : -32768;
+		raw_hi = -raw_lo;
+	}
+	if (columns <= 0 || columns > no_of_points)
+		columns = (int)no_of_points;
+	if (rows > raw_hi - raw_lo)
+		rows = raw_hi - raw_lo;
+	persist->no_of_points = no_of_points;
+	persist->bytes_per_point = bytes_per_point;
+	persist->columns = columns;
+	persist->rows = rows;
+	persist->raw_lo = raw_lo;
+	persist->raw_hi = raw_hi;
+	persist->counts = new unsigned int[(long)columns * (rows + 1)];
+	persist->column_of = new int[no_of_points];
+	persist->first_point = new long[columns + 1];
+	for (i = 0; i < no_of_points; i++)
+		persist->column_of[i] =
+		    (int)((long long)i * columns / no_of_points);
+	c = 0;
+	for (i = 0; i < no_of_points; i++)
+		while (c <= persist->column_of[i])
+			persist->first_point[c++] = i;
+	persist->first_point[columns] = no_of_points;
+	persist->weight = 1;
+	persist->decay = 1;
+	lecroy_persist_reset(persist);
+	return 0;
+}
+
+void lecroy_persist_reset(struct lecroy_persist *persist)
+{
+	memset(persist->counts, 0, (long)persist->columns *
+	       (persist->rows + 1) * sizeof(unsigned int));
+	persist->traces = 0;
+}
+
+void lecroy_persist_free(struct lecroy_persist *persist)
+{
+	delete[]persist->counts;
+	delete[]persist->column_of;
+	delete[]persist->first_point;
+	persist->counts = NULL;
+	persist->column_of = NULL;
+	persist->first_point = NULL;
+	persist->columns = 0;
+}
+
+/* Hits fade by a factor of e every `traces' traces; 0 (or less) means they
+ * never fade. With decay on, each hit counts for LECROY_PERSIST_DECAY_WEIGHT
+ * in the counts, so that they can fade smoothly; anything already counted
+ * is scaled to match. */
+void lecroy_persist_set_decay(struct lecroy_persist *persist, double traces)
+{
+	unsigned int weight;
+	long i, n;
+
+	weight = traces > 0 ? LECROY_PERSIST_DECAY_WEIGHT : 1;
+	persist->decay = traces > 0 ? exp(-1.0 / traces) : 1;
+	n = (long)persist->columns * (persist->rows + 1);
+	if (weight > persist->weight) {
+		for (i = 0; i < n; i++)
+			persist->counts[i] =
+			    persist->counts[i] > 0xffffffffu / weight ?
+			    0xffffffffu : persist->counts[i] * weight;
+	} else if (weight < persist->weight) {
+		for (i = 0; i < n; i++)
+			persist->counts[i] /= persist->weight;
+	}
+	persist->weight = weight;
+}
+
+struct lecroy_persist_args {
+	struct lecroy_persist *persist;
+	const char *buf;
+	long no_of_traces;
+	unsigned int fade;	/* decay multiplier, out of 65536 */
+};
+
+/* Columns [start, end): fades them, then bins and counts every trace's
+ * points that fall in them */
+static void lecroy_persist_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_persist_args *args = (struct lecroy_persist_args *)ptr;
+	struct lecroy_persist *p = args->persist;
+	unsigned int *counts = p->counts;
+	const int *column_of = p->column_of;
+	unsigned int cell[LECROY_PERSIST_BLOCK];
+	unsigned int range = (unsigned int)(p->raw_hi - p->raw_lo);
+	/* rows / range in 32.32 fixed point, rounded up, which gives exactly
+	 * u * rows / range (rounded down) for every u < range */
+	unsigned long long mul = (((unsigned long long)p->rows << 32) /
+				  range) + 1;
+	unsigned int stride = (unsigned int)(p->rows + 1);
+	unsigned int weight = p->weight;
+	unsigned int u, r;
+	long i, j, k, n, p0, p1;
+	const char *trace;
+	signed char c;
+	short s;
+
+	if (args->fade < 65536) {
+		for (i = start * stride; i < end * stride; i++)
+			counts[i] = (unsigned int)
+			    (((unsigned long long)counts[i] * args->fade) >> 16);
+	}
+	p0 = p->first_point[start];
+	p1 = p->first_point[end];
+	for (j = 0; j < args->no_of_traces; j++) {
+		trace = args->buf + j * p->no_of_points * p->bytes_per_point;
+		for (i = p0; i < p1; i += LECROY_PERSIST_BLOCK) {
+			n = p1 - i < LECROY_PERSIST_BLOCK ?
+			    p1 - i : LECROY_PERSIST_BLOCK;
+			/* Which cell each point falls in; off the top or
+			 * bottom goes in the column's extra cell (row = rows) */
+			if (p->bytes_per_point == 1) {
+				for (k = 0; k < n; k++) {
+					memcpy(&c, trace + i + k, 1);
+					u = (unsigned int)(c - p->raw_lo);
+					r = (unsigned int)((u * mul) >> 32);
+					r = u < range ? r : (unsigned int)p->rows;
+					cell[k] = column_of[i + k] * stride + r;
+				}
+			} else {
+				for (k = 0; k < n; k++) {
+					memcpy(&s, trace + 2 * (i + k), 2);
+					u = (unsigned int)(s - p->raw_lo);
+					r = (unsigned int)((u * mul) >> 32);
+					r = u < range ? r : (unsigned int)p->rows;
+					cell[k] = column_of[i + k] * stride + r;
+				}
+			}
+			for (k = 0; k < n; k++)
+				counts[cell[k]] += weight;
+		}
+	}
+}
+
+long lecroy_persist_add(struct lecroy_persist *persist, const char *buf,
+			size_t buf_len)
+{
+	return lecroy_persist_add(persist, buf, buf_len, 1);
+}
+
+/* Adds every trace in buf (a single trace, or a whole segmented
+ * acquisition; any incomplete trace at the end is ignored), with the
+ * columns split amongst no_of_threads threads (<=0 means one per core).
+ * Returns the number of traces added. */
+long lecroy_persist_add(struct lecroy_persist *persist, const char *buf,
+			size_t buf_len, int no_of_threads)
+{
+	struct lecroy_persist_args args;
+
+	if (persist->columns <= 0)
+		return 0;
+	args.persist = persist;
+	args.buf = buf;
+	args.no_of_traces = (long)(buf_len / (persist->no_of_points *
+					      persist->bytes_per_point));
+	if (args.no_of_traces == 0)
+		return 0;
+	args.fade = 65536;
+	if (persist->decay < 1)
+		args.fade = (unsigned int)(65536.0 *
+					   pow(persist->decay,
+					       (double)args.no_of_traces));
+	lecroy_parallel_for(persist->columns, LECROY_PERSIST_CHUNK,
+			    no_of_threads, lecroy_persist_kernel, &args);
+	persist->traces += args.no_of_traces;
+	return args.no_of_traces;
+}
+
+/* Copies the histogram out as hits (fractions of a hit, with decay on),
+ * rows * columns of them: hits[row * columns + column], row 0 being the
+ * bottom (raw_lo). If outside isn't NULL, it gets (columns long) the hits
+ * that were off the top or bottom of each column. Returns the number of
+ * traces added so far. */
+long lecroy_persist_snapshot(const struct lecroy_persist *persist,
+			     double *hits, double *outside)
+{
+	const unsigned int *col;
+	long stride = persist->rows + 1;
+	double scale = 1.0 / persist->weight;
+	int c, r;
+
+	for (c = 0; c < persist->columns; c++) {
+		col = persist->counts + c * stride;
+		if (hits != NULL)
+			for (r = 0; r < persist->rows; r++)
+				hits[(long)r * persist->columns + c] =
+				    col[r] * scale;
+		if (outside != NULL)
+			outside[c] = col[persist->rows] * scale;
+	}
+	return persist->traces;
+}
+
+/* Writes the histogram as a 16-bit greyscale PGM image (any image viewer
+ * will show it; the top row is the highest amplitude), scaled so that the
+ * busiest spot is white: linearly, or with log_scale, logarithmically
+ * (which shows the rare excursions up better). If desc isn't NULL, the
+ * volts and seconds of the rows and columns go in the comments. Returns 0,
+ * or -1 if the file couldn't be written. */
+int lecroy_persist_write(const char *filename,
+			 const struct lecroy_persist *persist,
+			 const struct lecroy_wavedesc *desc, int log_scale)
+{
+	FILE *f;
+	const unsigned int *counts = persist->counts;
+	long stride = persist->rows + 1;
+	unsigned int max = 0;
+	unsigned char *line;
+	double v, scale, raw_per_row;
+	int c, r, pix;
+
+	f = fopen(filename, "wb");
+	if (f == NULL) {
+		printf("lecroy_persist_write: could not open %s\n", filename);
+		return -1;
+	}
+	for (c = 0; c < persist->columns; c++)
+		for (r = 0; r < persist->rows; r++)
+			if (counts[c * stride + r] > max)
+				max = counts[c * stride + r];
+	scale = max == 0 ? 0 :
+	    (log_scale ? 65535.0 / log1p((double)max) : 65535.0 / max);
+	raw_per_row = (double)(persist->raw_hi - persist->raw_lo) /
+	    persist->rows;
+
+	fprintf(f, "P5\n# lecroy_persist: %ld traces, %s scale\n",
+		persist->traces, log_scale ? "log" : "linear");
+	if (desc != NULL) {
+		fprintf(f, "# bottom row (centre): %g V, volts per row: %g\n",
+			(persist->raw_lo + 0.5 * raw_per_row) *
+			desc->vertical_gain - desc->vertical_offset,
+			raw_per_row * desc->vertical_gain);
+		fprintf(f, "# first column: %g s, seconds per column: %g\n",
+			desc->horiz_offset,
+			(double)persist->no_of_points / persist->columns *
+			desc->horiz_interval);
+	}
+	fprintf(f, "%d %d\n65535\n", persist->columns, persist->rows);
+	line = new unsigned char[2 * persist->columns];
+	for (r = persist->rows - 1; r >= 0; r--) {
+		for (c = 0; c < persist->columns; c++) {
+			v = counts[c * stride + r];
+			pix = (int)((log_scale ? log1p(v) : v) * scale + 0.5);
+			line[2 * c] = (unsigned char)(pix >> 8);	/* MSB first */
+			line[2 * c + 1] = (unsigned char)(pix & 255);
+		}
+		fwrite(line, 1, 2 * persist->columns, f);
+	}
+	delete[]line;
+	if (fclose(f) != 0) {
+		printf("lecroy_persist_write: could not write %s\n", filename);
+		return -1;
+	}
+	return 0;
+}
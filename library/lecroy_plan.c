@@ -0,0 +1,417 @@
+/* lecroy_plan.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Which is the quickest way to get an average of N traces? There are three:
+ *
+ *   LECROY_PLAN_SCOPE_AVG : the scope averages (AVG maths), and we grab the
+ *                           result. Only one trace comes over the network,
+ *                           but the scope can be slow to add each sweep in.
+ *   LECROY_PLAN_SEGMENTED : the scope captures the traces as segments, as
+ *                           fast as it's triggered, and the PC averages them.
+ *                           Every segment comes over the network.
+ *   LECROY_PLAN_STREAM    : one trace at a time, averaged on the PC. Every
+ *                           trace comes over the network, plus an ARM and
+ *                           round trips for each one, but it works whatever
+ *                           the record length (there's only so much segment
+ *                           memory).
+ *
+ * Which one wins depends on the record length, how often the scope
+ * triggers, how fast the network is, and how quick the PC is, so rather
+ * than guess, lecroy_plan_measure() finds out: it times a few queries (the
+ * round trip time), a few single captures (how long from ARM to done, and
+ * the transfer rate), a short segmented capture (the time between
+ * triggers), a short scope average (the time per sweep), and adding up
+ * traces on the PC. That takes a few seconds (longer if the scope isn't
+ * triggering often), so do it once, at the start, and keep the plan.
+ * lecroy_plan_choose() then predicts how long each way would take for a
+ * given number of averages, and picks the quickest; lecroy_plan_average()
+ * does it, and gives you the average in volts whichever way it was done.
+ *
+ * The measurements are made with the scope set up as it is (record length,
+ * sample rate, trigger), so set it up first. The probes leave the scope in
+ * normal trigger mode, out of sequence mode, with the maths channel off.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lecroy_vxi11.h"
+
+#define	LECROY_PLAN_PROBE_QUERIES	8
+#define	LECROY_PLAN_PROBE_CAPTURES	3
+#define	LECROY_PLAN_PROBE_SEGMENTS	16
+#define	LECROY_PLAN_PROBE_SWEEPS	16
+#define	LECROY_PLAN_PROBE_HOST_POINTS	4000000	/* roughly, per go */
+/* Round trips lecroy_get_data() makes waiting for the scope to average
+ * (INR?, CLSW, then asking about each of the four maths channels) */
+#define	LECROY_PLAN_AVG_ROUND_TRIPS	10
+
+static double lecroy_plan_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int lecroy_plan_compare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* lecroy_get_data() calls this when the acquisition's over and the transfer
+ * is about to start, so we can time the two separately */
+static void lecroy_plan_acquired(void *arg)
+{
+	*(double *)arg = lecroy_plan_now();
+}
+
+/* Times one lecroy_get_data(): *acquire is how long until the scope had
+ * finished acquiring, *transfer the rest. Returns the number of bytes. */
+static long lecroy_plan_timed_capture(VXI11_CLINK * clink, char chan,
+				      int clear_sweeps, char *buf,
+				      size_t buf_len, int arm_and_wait,
+				      unsigned long timeout, double *acquire,
+				      double *transfer)
+{
+	double start, acquired, end;
+	long ret;
+
+	start = lecroy_plan_now();
+	acquired = start;
+	ret = lecroy_get_data(clink, chan, clear_sweeps, buf, buf_len,
+			      arm_and_wait, timeout, lecroy_plan_acquired,
+			      &acquired);
+	end = lecroy_plan_now();
+	*acquire = acquired - start;
+	*transfer = end - acquired;
+	return ret;
+}
+
+/* Points per trace, and bytes per point, that chan is set up for. These
+ * come from the VBS settings, not WF? DESC: the descriptor describes the
+ * last acquisition, so it's out of date straight after SEQ ON/OFF and the
+ * like (see lecroy_calculate_no_of_bytes_from_vbs()). */
+static int lecroy_plan_record(VXI11_CLINK * clink, char chan,
+			      long *no_of_points, int *bytes_per_point,
+			      unsigned long timeout)
+{
+	long points;
+
+	points = vxi11_obtain_long_value_timeout(clink,
+						 "VBS? 'Return=app.Acquisition.Horizontal.NumPoints'",
+						 timeout);
+	if (points <= 0)
+		return -1;
+	/* Maths channels send one extra point, acquisition channels two */
+	*no_of_points = points + (lecroy_is_maths_chan(chan) == 1 ? 1 : 2);
+	*bytes_per_point = lecroy_get_bytes_per_point(clink);
+	return 0;
+}
+
+/* Measures everything the cost model needs (see the top of the file), for
+ * acquisition channel chan (1-4) as the scope is set up now. The PC side is
+ * timed with no_of_threads threads (<=0 means one per core), which is what
+ * lecroy_plan_average() will use. Returns 0, or -1 if the scope didn't
+ * cooperate. */
+int lecroy_plan_measure(VXI11_CLINK * clink, char chan,
+			struct lecroy_plan *plan, int no_of_threads,
+			unsigned long timeout)
+{
+	struct lecroy_stats stats;
+	double t[LECROY_PLAN_PROBE_QUERIES];
+	double acquire, transfer, start, min_acquire, total_transfer = 0;
+	long l, ret, bytes = 0, reps, trace_bytes;
+	char *buf;
+	char maths_chan;
+	int segments, bytes_per_point;
+
+	memset(plan, 0, sizeof(struct lecroy_plan));
+	plan->strategy = LECROY_PLAN_AUTO;
+	plan->no_of_threads = no_of_threads;
+	if (lecroy_is_maths_chan(chan) == 1)
+		chan = lecroy_relate_function_to_source(chan);
+
+	/* Plain captures of the channel on its own */
+	lecroy_set_averages(clink, chan, 0);
+	vxi11_send_printf(clink, "SEQ OFF");
+
+	/* Round trip time: the median of a few *OPC?s */
+	for (l = 0; l < LECROY_PLAN_PROBE_QUERIES; l++) {
+		start = lecroy_plan_now();
+		vxi11_obtain_long_value_timeout(clink, "*OPC?", timeout);
+		t[l] = lecroy_plan_now() - start;
+	}
+	qsort(t, LECROY_PLAN_PROBE_QUERIES, sizeof(double),
+	      lecroy_plan_compare);
+	plan->latency = t[LECROY_PLAN_PROBE_QUERIES / 2];
+
+	if (lecroy_plan_record(clink, chan, &plan->no_of_points,
+			       &plan->bytes_per_point, timeout) != 0) {
+		printf("lecroy_plan_measure: could not get the record length\n");
+		return -1;
+	}
+	trace_bytes = plan->no_of_points * plan->bytes_per_point;
+
+	/* Single captures: ARM to done (the best of a few, the others will
+	 * have waited longer for a trigger), and the transfer rate */
+	buf = new char[trace_bytes + LECROY_DATA_BLOCK_HEADER_LEN];
+	min_acquire = -1;
+	for (l = 0; l < LECROY_PLAN_PROBE_CAPTURES; l++) {
+		ret = lecroy_plan_timed_capture(clink, chan, 0, buf,
+						trace_bytes, 1, timeout,
+						&acquire, &transfer);
+		if (ret <= 0) {
+			printf("lecroy_plan_measure: no data (no trigger?)\n");
+			delete[]buf;
+			return -1;
+		}
+		if (min_acquire < 0 || acquire < min_acquire)
+			min_acquire = acquire;
+		bytes += ret;
+		total_transfer += transfer;
+	}
+	plan->acquire_time = min_acquire;
+	total_transfer -= LECROY_PLAN_PROBE_CAPTURES * plan->latency;
+	if (total_transfer < 1e-6 * LECROY_PLAN_PROBE_CAPTURES)
+		total_transfer = 1e-6 * LECROY_PLAN_PROBE_CAPTURES;
+	plan->transfer_rate = bytes / total_transfer;
+	delete[]buf;
+
+	/* The time between triggers: a short segmented capture takes
+	 * (segments - 1) of them longer to acquire than a single one */
+	segments = lecroy_set_segmented(clink, LECROY_PLAN_PROBE_SEGMENTS);
+	if (segments > 1) {
+		buf = new char[segments * trace_bytes +
+			       LECROY_DATA_BLOCK_HEADER_LEN];
+		ret = lecroy_plan_timed_capture(clink, chan, 0, buf,
+						segments * trace_bytes, 1,
+						timeout, &acquire, &transfer);
+		delete[]buf;
+		if (ret > 0 && acquire > plan->acquire_time)
+			plan->trigger_period = (acquire - plan->acquire_time) /
+			    (segments - 1);
+	}
+	vxi11_send_printf(clink, "SEQ OFF");
+
+	/* The time per sweep when the scope does the averaging */
+	lecroy_set_for_norm(clink);
+	maths_chan = lecroy_set_averages(clink, chan, LECROY_PLAN_PROBE_SWEEPS);
+	l = 0;
+	if (lecroy_plan_record(clink, maths_chan, &l, &bytes_per_point,
+			       timeout) == 0)
+		l *= bytes_per_point;
+	if (l > 0) {
+		buf = new char[l + LECROY_DATA_BLOCK_HEADER_LEN];
+		ret = lecroy_plan_timed_capture(clink, maths_chan, 1, buf, l, 0,
+						timeout, &acquire, &transfer);
+		delete[]buf;
+		acquire -= LECROY_PLAN_AVG_ROUND_TRIPS * plan->latency;
+		if (ret > 0 && acquire > 0)
+			plan->sweep_period = acquire / LECROY_PLAN_PROBE_SWEEPS;
+	}
+	lecroy_set_averages(clink, chan, 0);
+
+	/* Adding up on the PC, a few million points' worth */
+	reps = LECROY_PLAN_PROBE_HOST_POINTS / plan->no_of_points + 1;
+	bytes = reps * plan->no_of_points * plan->bytes_per_point;
+	buf = new char[bytes];
+	memset(buf, 0, bytes);
+	lecroy_stats_init(&stats, plan->no_of_points);
+	start = lecroy_plan_now();
+	lecroy_stats_add(&stats, buf, bytes, plan->bytes_per_point,
+			 no_of_threads);
+	transfer = lecroy_plan_now() - start;
+	if (transfer < 1e-6)
+		transfer = 1e-6;
+	plan->host_rate = reps * plan->no_of_points / transfer;
+	lecroy_stats_free(&stats);
+	delete[]buf;
+	return 0;
+}
+
+/* How long one capture of no_of_segments segments takes, start to finish */
+static double lecroy_plan_capture_cost(const struct lecroy_plan *plan,
+				       long no_of_segments)
+{
+	return plan->acquire_time + (no_of_segments - 1) * plan->trigger_period
+	    + plan->latency + (double)no_of_segments * plan->no_of_points *
+	    plan->bytes_per_point / plan->transfer_rate;
+}
+
+/* Predicts how long (in seconds) strategy would take to average
+ * no_of_averages traces. For LECROY_PLAN_SEGMENTED, *segments (if it isn't
+ * NULL) gets the number of segments per capture. */
+double lecroy_plan_cost(const struct lecroy_plan *plan, int strategy,
+			long no_of_averages, long *segments)
+{
+	double host;
+	long s, batches;
+
+	if (no_of_averages < 1)
+		no_of_averages = 1;
+	host = (double)no_of_averages * plan->no_of_points / plan->host_rate;
+	switch (strategy) {
+	case LECROY_PLAN_SCOPE_AVG:
+		return LECROY_PLAN_AVG_ROUND_TRIPS * plan->latency +
+		    no_of_averages * plan->sweep_period + plan->latency +
+		    2.0 * plan->no_of_points / plan->transfer_rate;
+	case LECROY_PLAN_SEGMENTED:
+		s = no_of_averages;
+		if (plan->max_segments > 1 && s > plan->max_segments)
+			s = plan->max_segments;
+		if (s < 2)
+			s = 2;
+		batches = (no_of_averages + s - 1) / s;
+		if (segments != NULL)
+			*segments = s;
+		return batches * lecroy_plan_capture_cost(plan, s) + host;
+	case LECROY_PLAN_STREAM:
+		return no_of_averages * lecroy_plan_capture_cost(plan, 1) + host;
+	}
+	return -1;
+}
+
+/* Works out the cost of each strategy for no_of_averages averages, and
+ * picks the quickest (the scope's averaging only if it was measured).
+ * Returns the strategy, which is also left in plan->strategy. */
+int lecroy_plan_choose(struct lecroy_plan *plan, long no_of_averages)
+{
+	int s;
+
+	for (s = 0; s < LECROY_PLAN_STRATEGIES; s++)
+		plan->cost[s] =
+		    lecroy_plan_cost(plan, s, no_of_averages,
+				     s == LECROY_PLAN_SEGMENTED ?
+				     &plan->segments : NULL);
+	plan->strategy = LECROY_PLAN_STREAM;
+	for (s = 0; s < LECROY_PLAN_STRATEGIES; s++) {
+		if (s == LECROY_PLAN_SCOPE_AVG && plan->sweep_period <= 0)
+			continue;
+		if (plan->cost[s] < plan->cost[plan->strategy])
+			plan->strategy = s;
+	}
+	return plan->strategy;
+}
+
+/* Raw data to volts, the PC-averaged way */
+static long lecroy_plan_to_volts(const double *mean, long n,
+				 const struct lecroy_wavedesc *desc,
+				 double *volts, long max_points)
+{
+	long i;
+
+	if (n > max_points)
+		n = max_points;
+	for (i = 0; i < n; i++)
+		volts[i] = mean[i] * desc->vertical_gain - desc->vertical_offset;
+	return n;
+}
+
+/* Averages no_of_averages traces from acquisition channel chan, using the
+ * strategy in plan->strategy (if it's LECROY_PLAN_AUTO, lecroy_plan_choose()
+ * picks one first). volts gets the average, up to max_points of it. Returns
+ * the number of points, or -1. */
+long lecroy_plan_average(VXI11_CLINK * clink, char chan,
+			 struct lecroy_plan *plan, long no_of_averages,
+			 double *volts, long max_points, unsigned long timeout)
+{
+	struct lecroy_wavedesc desc;
+	struct lecroy_stats stats;
+	long no_of_points, len, ret, segments = 1, traces;
+	int bytes_per_point;
+	char maths_chan, fetch_chan = chan;
+	char *buf;
+	double *mean;
+
+	if (no_of_averages < 1)
+		no_of_averages = 1;
+	if (lecroy_is_maths_chan(chan) == 1)
+		chan = lecroy_relate_function_to_source(chan);
+	if (plan->strategy < 0)
+		lecroy_plan_choose(plan, no_of_averages);
+
+	if (plan->strategy == LECROY_PLAN_SCOPE_AVG) {
+		vxi11_send_printf(clink, "SEQ OFF");
+		lecroy_set_for_norm(clink);
+		maths_chan = lecroy_set_averages(clink, chan, no_of_averages);
+		fetch_chan = maths_chan;
+		if (lecroy_plan_record(clink, maths_chan, &no_of_points,
+				       &bytes_per_point, timeout) != 0)
+			return -1;
+		len = no_of_points * bytes_per_point;
+		buf = new char[len + LECROY_DATA_BLOCK_HEADER_LEN];
+		ret = lecroy_get_data(clink, maths_chan, 1, buf, len, 0,
+				      timeout);
+		if (ret <= 0) {
+			delete[]buf;
+			return -1;
+		}
+		lecroy_stats_init(&stats, ret / bytes_per_point);
+		lecroy_stats_add(&stats, buf, ret, bytes_per_point);
+	} else {
+		lecroy_set_averages(clink, chan, 0);
+		if (plan->strategy == LECROY_PLAN_SEGMENTED) {
+			lecroy_plan_cost(plan, LECROY_PLAN_SEGMENTED,
+					 no_of_averages, &segments);
+			segments = lecroy_set_segmented(clink, segments);
+		} else {
+			vxi11_send_printf(clink, "SEQ OFF");
+		}
+		if (lecroy_plan_record(clink, chan, &no_of_points,
+				       &bytes_per_point, timeout) != 0)
+			return -1;
+		len = segments * no_of_points * bytes_per_point;
+		buf = new char[len + LECROY_DATA_BLOCK_HEADER_LEN];
+		lecroy_stats_init(&stats, no_of_points);
+		while (stats.count < no_of_averages) {
+			ret = lecroy_get_data(clink, chan, 0, buf, len, 1,
+					      timeout);
+			if (ret <= 0) {
+				printf
+				    ("lecroy_plan_average: no data after %ld traces\n",
+				     stats.count);
+				break;
+			}
+			/* Only as many as we still need */
+			traces = ret / (no_of_points * bytes_per_point);
+			if (traces > no_of_averages - stats.count)
+				traces = no_of_averages - stats.count;
+			lecroy_stats_add(&stats, buf,
+					 traces * no_of_points * bytes_per_point,
+					 bytes_per_point, plan->no_of_threads);
+			if (traces == 0)
+				break;
+		}
+	}
+	delete[]buf;
+	/* The scaling, from the descriptor of what we've just captured */
+	if (stats.count == 0
+	    || lecroy_get_wavedesc(clink, fetch_chan, &desc, timeout) != 0) {
+		lecroy_stats_free(&stats);
+		return -1;
+	}
+	mean = new double[stats.no_of_points];
+	lecroy_stats_snapshot(&stats, mean, NULL, NULL, NULL);
+	ret = lecroy_plan_to_volts(mean, stats.no_of_points, &desc, volts,
+				   max_points);
+	delete[]mean;
+	lecroy_stats_free(&stats);
+	return ret;
+}
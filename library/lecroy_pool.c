@@ -0,0 +1,214 @@
+/* lecroy_pool.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * A pool of acquisition buffers. Grabbing a few hundred MB of waveform into a
+ * freshly new[]-ed buffer means the kernel has to find a page for every 4kB
+ * of it, as it arrives, which shows up as jitter in the transfer time. The
+ * pool maps all its memory up front (using huge pages if asked), touches
+ * every page so it's really there, and optionally locks it into RAM. Handing
+ * a buffer out and taking it back are then just a push and a pop.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "lecroy_vxi11.h"
+
+#ifndef MAP_HUGETLB
+#define	MAP_HUGETLB	0x40000
+#endif
+
+/* Used if /proc/meminfo doesn't tell us */
+#define	LECROY_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+/* The size of a huge page, which isn't 2MB everywhere. Explicit huge page
+ * mappings have to be a whole number of the system's default huge page size
+ * (often 1GB, or 512MB on some ARM machines); transparent huge pages are
+ * always the size the page tables map in one go. */
+static size_t lecroy_huge_page_size(int flags)
+{
+	FILE *f;
+	char line[256];
+	unsigned long value;
+	size_t size = LECROY_HUGE_PAGE_SIZE;
+
+	if ((flags & LECROY_POOL_HUGETLB) != 0) {
+		f = fopen("/proc/meminfo", "r");
+		if (f == NULL)
+			return size;
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (sscanf(line, "Hugepagesize: %lu kB", &value) == 1) {
+				if (value > 0)
+					size = (size_t)value * 1024;
+				break;
+			}
+		}
+	} else {
+		f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size",
+			  "r");
+		if (f == NULL)
+			return size;
+		if (fscanf(f, "%lu", &value) == 1 && value > 0)
+			size = (size_t)value;
+	}
+	fclose(f);
+	return size;
+}
+
+/* Creates a pool of no_of_buffers buffers, each at least buffer_size bytes.
+ * flags is any combination of:
+ *   LECROY_POOL_HUGEPAGES : ask for transparent huge pages (madvise)
+ *   LECROY_POOL_HUGETLB   : use explicit huge pages (needs
+ *                           /proc/sys/vm/nr_hugepages to be set up); if
+ *                           there aren't enough, we fall back to normal pages
+ *   LECROY_POOL_MLOCK     : lock the pool into RAM (needs a big enough
+ *                           "ulimit -l", or CAP_IPC_LOCK); a failure here is
+ *                           reported but not fatal
+ * Returns 0 on success, -1 if the memory couldn't be mapped. */
+int lecroy_pool_create(struct lecroy_pool *pool, int no_of_buffers,
+		       size_t buffer_size, int flags)
+{
+	size_t page_size, align, l;
+	void *mem = MAP_FAILED;
+	int i;
+
+	memset(pool, 0, sizeof(struct lecroy_pool));
+	if (no_of_buffers < 1)
+		no_of_buffers = 1;
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+	if ((flags & (LECROY_POOL_HUGEPAGES | LECROY_POOL_HUGETLB)) != 0)
+		align = lecroy_huge_page_size(flags);
+	else
+		align = page_size;
+	/* Every buffer starts on a (huge) page boundary */
+	pool->buffer_size = ((buffer_size + align - 1) / align) * align;
+	pool->map_len = pool->buffer_size * no_of_buffers;
+
+	if ((flags & LECROY_POOL_HUGETLB) != 0) {
+		mem = mmap(NULL, pool->map_len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mem == MAP_FAILED) {
+			printf
+			    ("lecroy_pool_create: no explicit huge pages available, using normal pages\n");
+			flags &= ~LECROY_POOL_HUGETLB;
+			flags |= LECROY_POOL_HUGEPAGES;
+		}
+	}
+	if (mem == MAP_FAILED) {
+		mem = mmap(NULL, pool->map_len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) {
+			printf
+			    ("lecroy_pool_create: error, could not map %lu bytes\n",
+			     (unsigned long)pool->map_len);
+			return -1;
+		}
+#ifdef MADV_HUGEPAGE
+		if ((flags & LECROY_POOL_HUGEPAGES) != 0)
+			madvise(mem, pool->map_len, MADV_HUGEPAGE);
+#endif
+	}
+	pool->base = (char *)mem;
+	pool->flags = flags;
+
+	/* Pre-fault: write to every page now, rather than during a transfer */
+	for (l = 0; l < pool->map_len; l += page_size)
+		pool->base[l] = 0;
+
+	if ((flags & LECROY_POOL_MLOCK) != 0) {
+		if (mlock(pool->base, pool->map_len) == 0)
+			pool->locked = 1;
+		else
+			printf
+			    ("lecroy_pool_create: could not lock %lu bytes into memory (check ulimit -l)\n",
+			     (unsigned long)pool->map_len);
+	}
+
+	pool->no_of_buffers = no_of_buffers;
+	pool->free_list = new int[no_of_buffers];
+	pool->in_use = new char[no_of_buffers];
+	for (i = 0; i < no_of_buffers; i++) {
+		pool->free_list[i] = no_of_buffers - 1 - i;
+		pool->in_use[i] = 0;
+	}
+	pool->no_free = no_of_buffers;
+	pthread_mutex_init(&pool->mutex, NULL);
+	return 0;
+}
+
+void lecroy_pool_destroy(struct lecroy_pool *pool)
+{
+	if (pool->base == NULL)
+		return;
+	if (pool->locked == 1)
+		munlock(pool->base, pool->map_len);
+	munmap(pool->base, pool->map_len);
+	delete[]pool->free_list;
+	delete[]pool->in_use;
+	pthread_mutex_destroy(&pool->mutex);
+	pool->base = NULL;
+	pool->free_list = NULL;
+	pool->in_use = NULL;
+	pool->no_free = 0;
+}
+
+/* Returns a buffer (pool->buffer_size bytes long), or NULL if they're all in
+ * use. */
+char *lecroy_pool_get(struct lecroy_pool *pool)
+{
+	char *buf = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->no_free > 0) {
+		pool->no_free--;
+		pool->in_use[pool->free_list[pool->no_free]] = 1;
+		buf =
+		    pool->base +
+		    (pool->free_list[pool->no_free] * pool->buffer_size);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return buf;
+}
+
+/* Gives a buffer back. Returns 0, -1 if it didn't come from this pool, or
+ * -2 if it's already been given back (which would otherwise put it on the
+ * free list twice, and hand it out to two people at once). */
+int lecroy_pool_put(struct lecroy_pool *pool, char *buf)
+{
+	size_t offset;
+	int index;
+
+	if (buf < pool->base || buf >= pool->base + pool->map_len)
+		return -1;
+	offset = buf - pool->base;
+	if (offset % pool->buffer_size != 0)
+		return -1;
+	index = (int)(offset / pool->buffer_size);
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->in_use[index] == 0) {
+		pthread_mutex_unlock(&pool->mutex);
+		printf("lecroy_pool_put: error, buffer %d was already free\n",
+		       index);
+		return -2;
+	}
+	pool->in_use[index] = 0;
+	pool->free_list[pool->no_free++] = index;
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
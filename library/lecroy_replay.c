@@ -0,0 +1,658 @@
+/* lecroy_replay.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Record and replay of vxi11 sessions, so that lgetwf (or anything else using
+ * the library) can be timed and tested on a PC with no scope attached. This
+ * builds into its own small library, liblecroy_replay.so, which goes in
+ * front of the vxi11 library with LD_PRELOAD:
+ *
+ *   LECROY_VXI11_RECORD=session.vxr LD_PRELOAD=liblecroy_replay.so \
+ *     lgetwf -ip 128.243.74.78 -f test -c 2
+ *
+ * passes every vxi11 call through to the scope as usual, and logs what was
+ * sent, what came back and how long it took to session.vxr. Then, anywhere,
+ *
+ *   LECROY_VXI11_REPLAY=session.vxr LD_PRELOAD=liblecroy_replay.so \
+ *     lgetwf -ip 128.243.74.78 -f test -c 2
+ *
+ * never touches the network: each call is answered from the log. By default
+ * the answers come back straight away; LECROY_VXI11_REPLAY_TIMING=1 makes
+ * each call take as long as it did originally, and any other number scales
+ * that (0.5 = twice as fast as the real thing).
+ *
+ * The calls covered are the ones the library makes: vxi11_open_device(),
+ * vxi11_close_device(), vxi11_clear() (lecroy_abort()), vxi11_send(),
+ * vxi11_send_printf(), vxi11_receive(), vxi11_receive_timeout(),
+ * vxi11_receive_data_block(), vxi11_send_and_receive() and the
+ * vxi11_obtain_*() functions. Calls that the
+ * vxi11 library makes to itself (vxi11_send_and_receive() is a vxi11_send()
+ * and a vxi11_receive()) are only logged once, at the outermost level.
+ *
+ * Each link has its own place in the log, so sessions with more than one
+ * link (or more than one thread) replay properly as long as each link makes
+ * the same calls in the same order as before. If a call doesn't match the
+ * log (a different command was sent), a warning is printed and the logged
+ * answer is used anyway; if it's a different sort of call altogether, the
+ * call fails.
+ *
+ * The log is a sequence of records, after an 8 byte "VXREC001" header, each
+ * one being a struct lecroy_replay_record (40 bytes, native endian), then
+ * req_len bytes of what was sent, then resp_len bytes of what came back
+ * (for vxi11_obtain_double_value(), the double itself).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef	_GNU_SOURCE
+#define	_GNU_SOURCE		/* RTLD_NEXT, dladdr() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "vxi11_user.h"
+
+#define	LECROY_REPLAY_MAGIC	"VXREC001"
+#define	LECROY_REPLAY_MAX_LINKS	16
+#define	LECROY_REPLAY_MAX_CMD	4096
+
+#define	LECROY_REPLAY_OPEN		1
+#define	LECROY_REPLAY_CLOSE		2
+#define	LECROY_REPLAY_SEND		3
+#define	LECROY_REPLAY_RECEIVE		4
+#define	LECROY_REPLAY_RECEIVE_BLOCK	5
+#define	LECROY_REPLAY_SEND_AND_RECEIVE	6
+#define	LECROY_REPLAY_OBTAIN_LONG	7
+#define	LECROY_REPLAY_OBTAIN_DOUBLE	8
+#define	LECROY_REPLAY_CLEAR		9
+
+struct lecroy_replay_record {
+	unsigned char op;
+	unsigned char link;
+	unsigned short reserved;
+	unsigned int req_len;
+	unsigned int resp_len;
+	unsigned int reserved2;
+	long long start_ns;	/* since the start of the session */
+	long long duration_ns;
+	long long ret;		/* what the call returned */
+};
+
+#define	LECROY_REPLAY_PASS	0
+#define	LECROY_REPLAY_RECORDING	1
+#define	LECROY_REPLAY_REPLAYING	2
+
+static pthread_once_t lecroy_replay_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t lecroy_replay_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int lecroy_replay_mode = LECROY_REPLAY_PASS;
+static FILE *lecroy_replay_file = NULL;
+static long long lecroy_replay_t0;
+static double lecroy_replay_timing = 0;
+/* Recording: which link is which */
+static VXI11_CLINK *lecroy_replay_links[LECROY_REPLAY_MAX_LINKS];
+/* Replaying: the whole log, and where each link has got to in it. The
+ * links we hand out are just pointers into lecroy_replay_fake[], which are
+ * never dereferenced. */
+static char *lecroy_replay_log = NULL;
+static size_t lecroy_replay_log_len = 0;
+static size_t lecroy_replay_open_pos = 0;
+static size_t lecroy_replay_pos[LECROY_REPLAY_MAX_LINKS];
+static char lecroy_replay_fake[LECROY_REPLAY_MAX_LINKS];
+/* How deep inside the vxi11 library this thread is */
+static __thread int lecroy_replay_depth = 0;
+
+static long long lecroy_replay_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void lecroy_replay_atexit(void)
+{
+	pthread_mutex_lock(&lecroy_replay_mutex);
+	if (lecroy_replay_file != NULL)
+		fclose(lecroy_replay_file);
+	lecroy_replay_file = NULL;
+	pthread_mutex_unlock(&lecroy_replay_mutex);
+}
+
+static void lecroy_replay_setup(void)
+{
+	const char *rec = getenv("LECROY_VXI11_RECORD");
+	const char *rep = getenv("LECROY_VXI11_REPLAY");
+	const char *timing = getenv("LECROY_VXI11_REPLAY_TIMING");
+	FILE *f;
+	long len;
+
+	lecroy_replay_t0 = lecroy_replay_now();
+	if (rep != NULL && *rep != 0) {
+		f = fopen(rep, "rb");
+		if (f == NULL || fseek(f, 0, SEEK_END) != 0
+		    || (len = ftell(f)) < 8) {
+			printf("error: lecroy_replay: could not read %s\n", rep);
+			exit(3);
+		}
+		rewind(f);
+		lecroy_replay_log = new char[len];
+		if (fread(lecroy_replay_log, 1, len, f) != (size_t)len
+		    || memcmp(lecroy_replay_log, LECROY_REPLAY_MAGIC, 8) != 0) {
+			printf("error: lecroy_replay: %s is not a vxi11 log\n",
+			       rep);
+			exit(3);
+		}
+		fclose(f);
+		lecroy_replay_log_len = len;
+		lecroy_replay_open_pos = 8;
+		if (timing != NULL)
+			lecroy_replay_timing = atof(timing);
+		lecroy_replay_mode = LECROY_REPLAY_REPLAYING;
+	} else if (rec != NULL && *rec != 0) {
+		lecroy_replay_file = fopen(rec, "wb");
+		if (lecroy_replay_file == NULL) {
+			printf("error: lecroy_replay: could not open %s\n", rec);
+			exit(3);
+		}
+		fwrite(LECROY_REPLAY_MAGIC, 1, 8, lecroy_replay_file);
+		atexit(lecroy_replay_atexit);
+		lecroy_replay_mode = LECROY_REPLAY_RECORDING;
+	}
+}
+
+static int lecroy_replay_get_mode(void)
+{
+	pthread_once(&lecroy_replay_once, lecroy_replay_setup);
+	return lecroy_replay_mode;
+}
+
+/* The real vxi11 function, found by looking up our own symbol name (so it
+ * doesn't matter whether the vxi11 library was built as C or C++) */
+static void *lecroy_replay_real(void *ours)
+{
+	Dl_info info;
+	void *real = NULL;
+	if (dladdr(ours, &info) != 0 && info.dli_sname != NULL)
+		real = dlsym(RTLD_NEXT, info.dli_sname);
+	if (real == NULL) {
+		printf("error: lecroy_replay: can't find the real vxi11 library\n");
+		exit(3);
+	}
+	return real;
+}
+
+/* Recording: whether this call should be logged, i.e. we're recording and
+ * it's not the vxi11 library calling itself (if so, we're now inside it
+ * until lecroy_replay_log_call()) */
+static int lecroy_replay_enter(void)
+{
+	if (lecroy_replay_get_mode() != LECROY_REPLAY_RECORDING
+	    || lecroy_replay_depth > 0)
+		return 0;
+	lecroy_replay_depth++;
+	return 1;
+}
+
+static int lecroy_replay_link_index(VXI11_CLINK * clink)
+{
+	int i;
+	for (i = 0; i < LECROY_REPLAY_MAX_LINKS; i++)
+		if (lecroy_replay_links[i] == clink)
+			return i;
+	return 0;
+}
+
+static void lecroy_replay_log_call(int op, int link, long long start,
+				   long long ret, const void *req,
+				   size_t req_len, const void *resp,
+				   size_t resp_len)
+{
+	struct lecroy_replay_record r;
+
+	lecroy_replay_depth--;
+	memset(&r, 0, sizeof(r));
+	r.op = op;
+	r.link = link;
+	r.req_len = req_len;
+	r.resp_len = resp_len;
+	r.start_ns = start - lecroy_replay_t0;
+	r.duration_ns = lecroy_replay_now() - start;
+	r.ret = ret;
+	pthread_mutex_lock(&lecroy_replay_mutex);
+	if (lecroy_replay_file != NULL) {
+		fwrite(&r, sizeof(r), 1, lecroy_replay_file);
+		if (req_len > 0)
+			fwrite(req, 1, req_len, lecroy_replay_file);
+		if (resp_len > 0)
+			fwrite(resp, 1, resp_len, lecroy_replay_file);
+	}
+	pthread_mutex_unlock(&lecroy_replay_mutex);
+}
+
+static int lecroy_replay_valid(size_t pos)
+{
+	struct lecroy_replay_record r;
+	if (pos + sizeof(r) > lecroy_replay_log_len)
+		return 0;
+	memcpy(&r, lecroy_replay_log + pos, sizeof(r));
+	return pos + sizeof(r) + r.req_len + r.resp_len <=
+	    lecroy_replay_log_len;
+}
+
+static size_t lecroy_replay_skip(size_t pos)
+{
+	struct lecroy_replay_record r;
+	memcpy(&r, lecroy_replay_log + pos, sizeof(r));
+	return pos + sizeof(r) + r.req_len + r.resp_len;
+}
+
+/* Replaying: finds this link's next record, checks it's the call we're
+ * making, and waits for as long as the original took (scaled). Returns a
+ * pointer to the record (req and resp follow it), or NULL. */
+static const char *lecroy_replay_next(int op, VXI11_CLINK * clink,
+				      const void *req, size_t req_len)
+{
+	struct lecroy_replay_record r;
+	struct timespec ts;
+	long long wait;
+	const char *p;
+	int link = (char *)clink - lecroy_replay_fake;
+	size_t pos;
+
+	if (link < 0 || link >= LECROY_REPLAY_MAX_LINKS)
+		return NULL;
+	pthread_mutex_lock(&lecroy_replay_mutex);
+	pos = lecroy_replay_pos[link];
+	while (lecroy_replay_valid(pos)) {
+		memcpy(&r, lecroy_replay_log + pos, sizeof(r));
+		if (r.link == link && r.op != LECROY_REPLAY_OPEN)
+			break;
+		pos = lecroy_replay_skip(pos);
+	}
+	if (!lecroy_replay_valid(pos)) {
+		pthread_mutex_unlock(&lecroy_replay_mutex);
+		printf("error: lecroy_replay: ran off the end of the log\n");
+		return NULL;
+	}
+	lecroy_replay_pos[link] = lecroy_replay_skip(pos);
+	pthread_mutex_unlock(&lecroy_replay_mutex);
+
+	p = lecroy_replay_log + pos;
+	if (r.op != op) {
+		printf
+		    ("error: lecroy_replay: call %d doesn't match the log (%d) at byte %lu\n",
+		     op, r.op, (unsigned long)pos);
+		return NULL;
+	}
+	if (r.req_len != req_len
+	    || memcmp(p + sizeof(r), req, req_len) != 0)
+		printf
+		    ("warning: lecroy_replay: sent \"%.*s\", log has \"%.*s\"\n",
+		     (int)req_len, (const char *)req, (int)r.req_len,
+		     p + sizeof(r));
+	if (lecroy_replay_timing > 0) {
+		wait = (long long)(r.duration_ns * lecroy_replay_timing);
+		ts.tv_sec = wait / 1000000000LL;
+		ts.tv_nsec = wait % 1000000000LL;
+		nanosleep(&ts, NULL);
+	}
+	return p;
+}
+
+static long long lecroy_replay_ret(const char *p)
+{
+	struct lecroy_replay_record r;
+	memcpy(&r, p, sizeof(r));
+	return r.ret;
+}
+
+/* Copies the logged response into buffer (len long). If the buffer's
+ * smaller than it was, we give back what fits and -100, as vxi11 would. */
+static long lecroy_replay_response(const char *p, char *buffer, size_t len)
+{
+	struct lecroy_replay_record r;
+	memcpy(&r, p, sizeof(r));
+	if (r.resp_len > len) {
+		memcpy(buffer, p + sizeof(r) + r.req_len, len);
+		return -100;
+	}
+	memcpy(buffer, p + sizeof(r) + r.req_len, r.resp_len);
+	return (long)r.ret;
+}
+
+int vxi11_open_device(VXI11_CLINK ** clink, const char *address, char *device)
+{
+	typedef int (*fn_t) (VXI11_CLINK **, const char *, char *);
+	struct lecroy_replay_record r;
+	long long start = lecroy_replay_now();
+	char req[512];
+	int ret, i, req_len;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		/* Opens are taken in the order they were logged */
+		pthread_mutex_lock(&lecroy_replay_mutex);
+		while (lecroy_replay_valid(lecroy_replay_open_pos)) {
+			memcpy(&r, lecroy_replay_log + lecroy_replay_open_pos,
+			       sizeof(r));
+			lecroy_replay_open_pos =
+			    lecroy_replay_skip(lecroy_replay_open_pos);
+			if (r.op == LECROY_REPLAY_OPEN
+			    && r.link < LECROY_REPLAY_MAX_LINKS) {
+				lecroy_replay_pos[r.link] =
+				    lecroy_replay_open_pos;
+				*clink =
+				    (VXI11_CLINK *) (lecroy_replay_fake +
+						     r.link);
+				pthread_mutex_unlock(&lecroy_replay_mutex);
+				return (int)r.ret;
+			}
+		}
+		pthread_mutex_unlock(&lecroy_replay_mutex);
+		printf("error: lecroy_replay: no more opens in the log\n");
+		return -1;
+	}
+	if (!lecroy_replay_enter())
+		return ((fn_t) lecroy_replay_real((void *)vxi11_open_device))
+		    (clink, address, device);
+	ret = ((fn_t) lecroy_replay_real((void *)vxi11_open_device))
+	    (clink, address, device);
+	pthread_mutex_lock(&lecroy_replay_mutex);
+	for (i = 0; i < LECROY_REPLAY_MAX_LINKS - 1; i++)
+		if (lecroy_replay_links[i] == NULL)
+			break;
+	lecroy_replay_links[i] = *clink;
+	pthread_mutex_unlock(&lecroy_replay_mutex);
+	req_len = snprintf(req, sizeof(req), "%s %s", address,
+			   device != NULL ? device : "");
+	if (req_len >= (int)sizeof(req))
+		req_len = sizeof(req) - 1;
+	lecroy_replay_log_call(LECROY_REPLAY_OPEN, i, start, ret, req, req_len,
+			       NULL, 0);
+	return ret;
+}
+
+int vxi11_close_device(VXI11_CLINK * clink, const char *address)
+{
+	typedef int (*fn_t) (VXI11_CLINK *, const char *);
+	long long start = lecroy_replay_now();
+	const char *p;
+	int ret, link;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		p = lecroy_replay_next(LECROY_REPLAY_CLOSE, clink, NULL, 0);
+		return p != NULL ? (int)lecroy_replay_ret(p) : -1;
+	}
+	if (!lecroy_replay_enter())
+		return ((fn_t) lecroy_replay_real((void *)vxi11_close_device))
+		    (clink, address);
+	ret = ((fn_t) lecroy_replay_real((void *)vxi11_close_device))
+	    (clink, address);
+	link = lecroy_replay_link_index(clink);
+	lecroy_replay_log_call(LECROY_REPLAY_CLOSE, link, start, ret, NULL, 0,
+			       NULL, 0);
+	pthread_mutex_lock(&lecroy_replay_mutex);
+	lecroy_replay_links[link] = NULL;
+	if (lecroy_replay_file != NULL)
+		fflush(lecroy_replay_file);
+	pthread_mutex_unlock(&lecroy_replay_mutex);
+	return ret;
+}
+
+/* A device clear; lecroy_abort() sends one on the control link */
+int vxi11_clear(VXI11_CLINK * clink)
+{
+	typedef int (*fn_t) (VXI11_CLINK *);
+	long long start = lecroy_replay_now();
+	const char *p;
+	int ret;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		p = lecroy_replay_next(LECROY_REPLAY_CLEAR, clink, NULL, 0);
+		return p != NULL ? (int)lecroy_replay_ret(p) : -1;
+	}
+	if (!lecroy_replay_enter())
+		return ((fn_t) lecroy_replay_real((void *)vxi11_clear)) (clink);
+	ret = ((fn_t) lecroy_replay_real((void *)vxi11_clear)) (clink);
+	lecroy_replay_log_call(LECROY_REPLAY_CLEAR,
+			       lecroy_replay_link_index(clink), start, ret, NULL,
+			       0, NULL, 0);
+	return ret;
+}
+
+int vxi11_send(VXI11_CLINK * clink, const char *cmd, size_t len)
+{
+	typedef int (*fn_t) (VXI11_CLINK *, const char *, size_t);
+	long long start = lecroy_replay_now();
+	const char *p;
+	int ret;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		p = lecroy_replay_next(LECROY_REPLAY_SEND, clink, cmd, len);
+		return p != NULL ? (int)lecroy_replay_ret(p) : -1;
+	}
+	if (!lecroy_replay_enter())
+		return ((fn_t) lecroy_replay_real((void *)vxi11_send))
+		    (clink, cmd, len);
+	ret = ((fn_t) lecroy_replay_real((void *)vxi11_send)) (clink, cmd, len);
+	lecroy_replay_log_call(LECROY_REPLAY_SEND,
+			       lecroy_replay_link_index(clink), start, ret, cmd,
+			       len, NULL, 0);
+	return ret;
+}
+
+/* The vxi11 library does this as a vsnprintf() and a vxi11_send(), which is
+ * what we do too (there's no passing the arguments on to the real one) */
+int vxi11_send_printf(VXI11_CLINK * clink, const char *format, ...)
+{
+	char cmd[LECROY_REPLAY_MAX_CMD];
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(cmd, sizeof(cmd), format, ap);
+	va_end(ap);
+	if (len < 0 || len >= (int)sizeof(cmd))
+		return -1;
+	return vxi11_send(clink, cmd, len);
+}
+
+static ssize_t lecroy_replay_receive(int op, void *ours, VXI11_CLINK * clink,
+				     char *buffer, size_t len,
+				     unsigned long timeout, int with_timeout)
+{
+	typedef ssize_t(*fn_t) (VXI11_CLINK *, char *, size_t);
+	typedef ssize_t(*fn_timeout_t) (VXI11_CLINK *, char *, size_t,
+					unsigned long);
+	long long start = lecroy_replay_now();
+	const char *p;
+	ssize_t ret;
+	int logging;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		p = lecroy_replay_next(op, clink, NULL, 0);
+		return p != NULL ? lecroy_replay_response(p, buffer, len) : -1;
+	}
+	logging = lecroy_replay_enter();
+	if (with_timeout)
+		ret = ((fn_timeout_t) lecroy_replay_real(ours))
+		    (clink, buffer, len, timeout);
+	else
+		ret = ((fn_t) lecroy_replay_real(ours)) (clink, buffer, len);
+	if (logging)
+		lecroy_replay_log_call(op, lecroy_replay_link_index(clink),
+				       start, ret, NULL, 0, buffer,
+				       ret > 0 ? ret : (ret == -100 ? len : 0));
+	return ret;
+}
+
+ssize_t vxi11_receive(VXI11_CLINK * clink, char *buffer, size_t len)
+{
+	return lecroy_replay_receive(LECROY_REPLAY_RECEIVE,
+				     (void *)vxi11_receive, clink, buffer, len,
+				     0, 0);
+}
+
+ssize_t vxi11_receive_timeout(VXI11_CLINK * clink, char *buffer, size_t len,
+			      unsigned long timeout)
+{
+	return lecroy_replay_receive(LECROY_REPLAY_RECEIVE,
+				     (void *)vxi11_receive_timeout, clink,
+				     buffer, len, timeout, 1);
+}
+
+ssize_t vxi11_receive_data_block(VXI11_CLINK * clink, char *buffer,
+				 size_t len, unsigned long timeout)
+{
+	return lecroy_replay_receive(LECROY_REPLAY_RECEIVE_BLOCK,
+				     (void *)vxi11_receive_data_block, clink,
+				     buffer, len, timeout, 1);
+}
+
+long vxi11_send_and_receive(VXI11_CLINK * clink, const char *cmd, char *buf,
+			    size_t len, unsigned long timeout)
+{
+	typedef long (*fn_t) (VXI11_CLINK *, const char *, char *, size_t,
+			      unsigned long);
+	long long start = lecroy_replay_now();
+	const char *p;
+	size_t resp_len = 0;
+	long ret;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		p = lecroy_replay_next(LECROY_REPLAY_SEND_AND_RECEIVE, clink,
+				       cmd, strlen(cmd));
+		if (p == NULL)
+			return -1;
+		lecroy_replay_response(p, buf, len);
+		return (long)lecroy_replay_ret(p);
+	}
+	if (!lecroy_replay_enter())
+		return ((fn_t) lecroy_replay_real((void *)vxi11_send_and_receive))
+		    (clink, cmd, buf, len, timeout);
+	ret = ((fn_t) lecroy_replay_real((void *)vxi11_send_and_receive))
+	    (clink, cmd, buf, len, timeout);
+	/* It returns 0 rather than the length, so we log the buffer up to
+	 * and including the terminating zero */
+	if (ret == 0) {
+		resp_len = strnlen(buf, len);
+		if (resp_len < len)
+			resp_len++;
+	}
+	lecroy_replay_log_call(LECROY_REPLAY_SEND_AND_RECEIVE,
+			       lecroy_replay_link_index(clink), start, ret, cmd,
+			       strlen(cmd), buf, resp_len);
+	return ret;
+}
+
+static long lecroy_replay_obtain_long(void *ours, VXI11_CLINK * clink,
+				      const char *cmd, unsigned long timeout,
+				      int with_timeout)
+{
+	typedef long (*fn_t) (VXI11_CLINK *, const char *);
+	typedef long (*fn_timeout_t) (VXI11_CLINK *, const char *,
+				      unsigned long);
+	long long start = lecroy_replay_now();
+	const char *p;
+	long ret;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		p = lecroy_replay_next(LECROY_REPLAY_OBTAIN_LONG, clink, cmd,
+				       strlen(cmd));
+		return p != NULL ? (long)lecroy_replay_ret(p) : 0;
+	}
+	if (!lecroy_replay_enter()) {
+		if (with_timeout)
+			return ((fn_timeout_t) lecroy_replay_real(ours))
+			    (clink, cmd, timeout);
+		return ((fn_t) lecroy_replay_real(ours)) (clink, cmd);
+	}
+	if (with_timeout)
+		ret = ((fn_timeout_t) lecroy_replay_real(ours))
+		    (clink, cmd, timeout);
+	else
+		ret = ((fn_t) lecroy_replay_real(ours)) (clink, cmd);
+	lecroy_replay_log_call(LECROY_REPLAY_OBTAIN_LONG,
+			       lecroy_replay_link_index(clink), start, ret, cmd,
+			       strlen(cmd), NULL, 0);
+	return ret;
+}
+
+long vxi11_obtain_long_value(VXI11_CLINK * clink, const char *cmd)
+{
+	return lecroy_replay_obtain_long((void *)vxi11_obtain_long_value,
+					 clink, cmd, 0, 0);
+}
+
+long vxi11_obtain_long_value_timeout(VXI11_CLINK * clink, const char *cmd,
+				     unsigned long timeout)
+{
+	return lecroy_replay_obtain_long((void *)
+					 vxi11_obtain_long_value_timeout, clink,
+					 cmd, timeout, 1);
+}
+
+static double lecroy_replay_obtain_double(void *ours, VXI11_CLINK * clink,
+					  const char *cmd,
+					  unsigned long timeout,
+					  int with_timeout)
+{
+	typedef double (*fn_t) (VXI11_CLINK *, const char *);
+	typedef double (*fn_timeout_t) (VXI11_CLINK *, const char *,
+					unsigned long);
+	long long start = lecroy_replay_now();
+	const char *p;
+	double ret = 0;
+
+	if (lecroy_replay_get_mode() == LECROY_REPLAY_REPLAYING) {
+		p = lecroy_replay_next(LECROY_REPLAY_OBTAIN_DOUBLE, clink, cmd,
+				       strlen(cmd));
+		if (p != NULL)
+			lecroy_replay_response(p, (char *)&ret, sizeof(ret));
+		return ret;
+	}
+	if (!lecroy_replay_enter()) {
+		if (with_timeout)
+			return ((fn_timeout_t) lecroy_replay_real(ours))
+			    (clink, cmd, timeout);
+		return ((fn_t) lecroy_replay_real(ours)) (clink, cmd);
+	}
+	if (with_timeout)
+		ret = ((fn_timeout_t) lecroy_replay_real(ours))
+		    (clink, cmd, timeout);
+	else
+		ret = ((fn_t) lecroy_replay_real(ours)) (clink, cmd);
+	lecroy_replay_log_call(LECROY_REPLAY_OBTAIN_DOUBLE,
+			       lecroy_replay_link_index(clink), start, 0, cmd,
+			       strlen(cmd), &ret, sizeof(ret));
+	return ret;
+}
+
+double vxi11_obtain_double_value(VXI11_CLINK * clink, const char *cmd)
+{
+	return lecroy_replay_obtain_double((void *)vxi11_obtain_double_value,
+					   clink, cmd, 0, 0);
+}
+
+double vxi11_obtain_double_value_timeout(VXI11_CLINK * clink, const char *cmd,
+					 unsigned long timeout)
+{
+	return lecroy_replay_obtain_double((void *)
+					   vxi11_obtain_double_value_timeout,
+					   clink, cmd, timeout, 1);
+}
@@ -0,0 +1,387 @@
+/* lecroy_sched.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Sharing one link between several threads. vxi11 talks to the scope one
+ * message at a time, and a query and its answer have to go together: if
+ * two threads each send a query and then read, they can get each other's
+ * answers. So every thread that wants the link takes a turn with it:
+ *
+ *	clink = lecroy_sched_acquire(sched, LECROY_SCHED_STATUS);
+ *	<talk to the scope using clink>
+ *	lecroy_sched_release(sched);
+ *
+ * or, for the common case of one query and its answer, just
+ *
+ *	lecroy_sched_obtain_long(sched, LECROY_SCHED_STATUS, "INR?", 50);
+ *
+ * Turns are handed out in priority order: anything waiting in the control
+ * class goes before anything in the status class, which goes before bulk
+ * data; within a class, first come first served. A turn that's already
+ * started has to finish (there's no stopping the scope half way through
+ * sending a waveform), but lecroy_sched_get_data() gives up the link
+ * between the acquisition and the transfer, so a quick status query
+ * queued behind it waits for one of those, not both. The priorities are
+ * strict, so something that polls the status class flat out will starve
+ * the bulk class; status polls are meant to be short and occasional.
+ *
+ * With lecroy_sched_set_control(), the control and status classes go over
+ * a second link (see lecroy_open_control()) and the bulk class has the
+ * first one to itself, so a status query doesn't have to wait for a
+ * transfer to finish at all, and lecroy_sched_abort() can stop one that's
+ * under way.
+ *
+ * lecroy_sched_get_stats() tells you, for each class, how many are waiting
+ * (and the most there have ever been), and how long they waited for their
+ * turns: if the status class's max_wait is creeping up, something is
+ * holding the link for too long.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "lecroy_vxi11.h"
+
+/* The data link, and the control link if there is one */
+#define	LECROY_SCHED_DATA_LINK		0
+#define	LECROY_SCHED_CONTROL_LINK	1
+
+struct lecroy_sched_link {
+	VXI11_CLINK *clink;
+	int busy;		/* someone has the link */
+	int holder_class;
+	pthread_t holder;
+	double held_since;
+	/* The holder has lent the link out (lecroy_sched_yield()): only
+	 * classes higher than yield_class may take it meanwhile */
+	int yielding;
+	int yield_class;
+};
+
+struct lecroy_sched {
+	struct lecroy_sched_link link[2];
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;	/* a link's been given up */
+	/* Tickets, one queue per class: a thread waiting in class c has its
+	 * turn when its link's free, no higher class on the same link has
+	 * anyone waiting, and serving[c] has got to its ticket */
+	unsigned long next_ticket[LECROY_SCHED_CLASSES];
+	unsigned long serving[LECROY_SCHED_CLASSES];
+	struct lecroy_sched_stats stats[LECROY_SCHED_CLASSES];
+};
+
+static double lecroy_sched_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The link that class cls goes over (call with the mutex held) */
+static int lecroy_sched_link_of(struct lecroy_sched *sched, int cls)
+{
+	if (cls != LECROY_SCHED_BULK
+	    && sched->link[LECROY_SCHED_CONTROL_LINK].clink != NULL)
+		return LECROY_SCHED_CONTROL_LINK;
+	return LECROY_SCHED_DATA_LINK;
+}
+
+static int lecroy_sched_class(int cls)
+{
+	if (cls < 0 || cls >= LECROY_SCHED_CLASSES) {
+		printf("lecroy_sched: no such class %d, using bulk\n", cls);
+		return LECROY_SCHED_BULK;
+	}
+	return cls;
+}
+
+struct lecroy_sched *lecroy_sched_open(VXI11_CLINK * clink)
+{
+	struct lecroy_sched *sched = new struct lecroy_sched;
+
+	memset(sched, 0, sizeof(struct lecroy_sched));
+	sched->link[LECROY_SCHED_DATA_LINK].clink = clink;
+	pthread_mutex_init(&sched->mutex, NULL);
+	pthread_cond_init(&sched->changed, NULL);
+	return sched;
+}
+
+/* Nobody should have, or be waiting for, the link by now. The links
+ * themselves are left open. */
+void lecroy_sched_close(struct lecroy_sched *sched)
+{
+	pthread_cond_destroy(&sched->changed);
+	pthread_mutex_destroy(&sched->mutex);
+	delete sched;
+}
+
+/* From now on the control and status classes use the control link (from
+ * lecroy_open_control()), leaving the data link to the bulk class. Call it
+ * before anyone starts using the scheduler. */
+void lecroy_sched_set_control(struct lecroy_sched *sched,
+			      VXI11_CLINK * control)
+{
+	pthread_mutex_lock(&sched->mutex);
+	sched->link[LECROY_SCHED_CONTROL_LINK].clink = control;
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+/* Waits for a turn with the link, in class cls (LECROY_SCHED_CONTROL,
+ * LECROY_SCHED_STATUS or LECROY_SCHED_BULK), and returns the link. Turns
+ * don't nest: lecroy_sched_release() before asking for another one. */
+VXI11_CLINK *lecroy_sched_acquire(struct lecroy_sched *sched, int cls)
+{
+	struct lecroy_sched_stats *st;
+	struct lecroy_sched_link *link;
+	unsigned long ticket;
+	double queued_at, now, wait;
+	int c, l, higher;
+
+	cls = lecroy_sched_class(cls);
+	st = &sched->stats[cls];
+	queued_at = lecroy_sched_now();
+	pthread_mutex_lock(&sched->mutex);
+	l = lecroy_sched_link_of(sched, cls);
+	link = &sched->link[l];
+	ticket = sched->next_ticket[cls]++;
+	st->queued++;
+	if (st->queued > st->max_queued)
+		st->max_queued = st->queued;
+	for (;;) {
+		higher = 0;
+		for (c = 0; c < cls; c++)
+			if (sched->stats[c].queued > 0
+			    && lecroy_sched_link_of(sched, c) == l)
+				higher = 1;
+		if (link->busy == 0 && higher == 0
+		    && (link->yielding == 0 || cls < link->yield_class)
+		    && sched->serving[cls] == ticket)
+			break;
+		pthread_cond_wait(&sched->changed, &sched->mutex);
+	}
+	now = lecroy_sched_now();
+	wait = now - queued_at;
+	sched->serving[cls]++;
+	link->busy = 1;
+	link->holder_class = cls;
+	link->holder = pthread_self();
+	link->held_since = now;
+	st->queued--;
+	st->turns++;
+	st->total_wait += wait;
+	if (wait > st->max_wait)
+		st->max_wait = wait;
+	pthread_mutex_unlock(&sched->mutex);
+	return link->clink;
+}
+
+/* The link this thread has a turn with (call with the mutex held) */
+static struct lecroy_sched_link *lecroy_sched_held(struct lecroy_sched *sched)
+{
+	struct lecroy_sched_link *link;
+	int l;
+
+	for (l = 0; l < 2; l++) {
+		link = &sched->link[l];
+		if (link->busy != 0
+		    && pthread_equal(link->holder, pthread_self()))
+			return link;
+	}
+	return NULL;
+}
+
+/* Gives up the turn, to whoever's next */
+void lecroy_sched_release(struct lecroy_sched *sched)
+{
+	struct lecroy_sched_link *link;
+
+	pthread_mutex_lock(&sched->mutex);
+	link = lecroy_sched_held(sched);
+	if (link == NULL) {
+		pthread_mutex_unlock(&sched->mutex);
+		printf("lecroy_sched_release: this thread doesn't have a turn\n");
+		return;
+	}
+	sched->stats[link->holder_class].total_held +=
+	    lecroy_sched_now() - link->held_since;
+	link->busy = 0;
+	pthread_cond_broadcast(&sched->changed);
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+/* Lets anyone in a higher class on the same link have the link, then
+ * carries on. Only call it between one query and the next, never while an
+ * answer is still to be read. Never to someone in our own class (or lower):
+ * another bulk transfer would ARM the scope and we'd read the wrong
+ * acquisition, so the link stays ours for everyone but the higher classes,
+ * rather than us going to the back of our queue. */
+void lecroy_sched_yield(struct lecroy_sched *sched)
+{
+	struct lecroy_sched_link *link;
+	int cls, c, l, higher;
+	double now;
+
+	pthread_mutex_lock(&sched->mutex);
+	link = lecroy_sched_held(sched);
+	if (link == NULL) {
+		pthread_mutex_unlock(&sched->mutex);
+		return;
+	}
+	cls = link->holder_class;
+	l = link - sched->link;
+	higher = 0;
+	for (c = 0; c < cls; c++)
+		if (sched->stats[c].queued > 0
+		    && lecroy_sched_link_of(sched, c) == l)
+			higher = 1;
+	if (higher == 0) {
+		pthread_mutex_unlock(&sched->mutex);
+		return;
+	}
+	sched->stats[cls].total_held += lecroy_sched_now() - link->held_since;
+	link->busy = 0;
+	link->yielding = 1;
+	link->yield_class = cls;
+	pthread_cond_broadcast(&sched->changed);
+	for (;;) {
+		higher = 0;
+		for (c = 0; c < cls; c++)
+			if (sched->stats[c].queued > 0
+			    && lecroy_sched_link_of(sched, c) == l)
+				higher = 1;
+		if (link->busy == 0 && higher == 0)
+			break;
+		pthread_cond_wait(&sched->changed, &sched->mutex);
+	}
+	now = lecroy_sched_now();
+	link->busy = 1;
+	link->yielding = 0;
+	link->holder_class = cls;
+	link->holder = pthread_self();
+	link->held_since = now;
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+/* Sends cmd and reads the answer into buf, as one turn. Returns the number
+ * of bytes read (as vxi11_send_and_receive()), or < 0 on error. */
+long lecroy_sched_query(struct lecroy_sched *sched, int cls, const char *cmd,
+			char *buf, size_t buf_len, unsigned long timeout)
+{
+	VXI11_CLINK *clink;
+	long ret;
+
+	clink = lecroy_sched_acquire(sched, cls);
+	ret = vxi11_send_and_receive(clink, cmd, buf, buf_len, timeout);
+	lecroy_sched_release(sched);
+	return ret;
+}
+
+long lecroy_sched_obtain_long(struct lecroy_sched *sched, int cls,
+			      const char *cmd, unsigned long timeout)
+{
+	VXI11_CLINK *clink;
+	long ret;
+
+	clink = lecroy_sched_acquire(sched, cls);
+	ret = vxi11_obtain_long_value_timeout(clink, cmd, timeout);
+	lecroy_sched_release(sched);
+	return ret;
+}
+
+/* A command with no answer */
+int lecroy_sched_send(struct lecroy_sched *sched, int cls, const char *cmd)
+{
+	VXI11_CLINK *clink;
+	int ret;
+
+	clink = lecroy_sched_acquire(sched, cls);
+	ret = vxi11_send(clink, cmd, strlen(cmd));
+	lecroy_sched_release(sched);
+	return ret;
+}
+
+/* lecroy_get_data() tells us when the acquisition's over and the WF? query
+ * is about to go, which is when it's safe to let the control and status
+ * classes in (they don't acquire anything) */
+static void lecroy_sched_acquired(void *arg)
+{
+	lecroy_sched_yield((struct lecroy_sched *)arg);
+}
+
+/* lecroy_get_data() (the arguments are the same) in the bulk class, giving
+ * up the link between the acquisition and the transfer */
+long lecroy_sched_get_data(struct lecroy_sched *sched, char chan,
+			   int clear_sweeps, char *buf, size_t buf_len,
+			   int arm_and_wait, unsigned long timeout)
+{
+	VXI11_CLINK *clink;
+	long ret;
+
+	clink = lecroy_sched_acquire(sched, LECROY_SCHED_BULK);
+	ret = lecroy_get_data(clink, chan, clear_sweeps, buf, buf_len,
+			      arm_and_wait, timeout, lecroy_sched_acquired,
+			      sched);
+	lecroy_sched_release(sched);
+	return ret;
+}
+
+/* Stops whatever's happening on the data link, without waiting for a turn
+ * (see lecroy_abort()). Only possible with a control link; returns -1 if
+ * there isn't one. */
+int lecroy_sched_abort(struct lecroy_sched *sched)
+{
+	VXI11_CLINK *control;
+
+	pthread_mutex_lock(&sched->mutex);
+	control = sched->link[LECROY_SCHED_CONTROL_LINK].clink;
+	pthread_mutex_unlock(&sched->mutex);
+	if (control == NULL) {
+		printf("lecroy_sched_abort: no control link to abort with\n");
+		return -1;
+	}
+	return lecroy_abort(control);
+}
+
+/* Copies out the numbers for class cls. Returns -1 if there's no such
+ * class. */
+int lecroy_sched_get_stats(struct lecroy_sched *sched, int cls,
+			   struct lecroy_sched_stats *stats)
+{
+	if (cls < 0 || cls >= LECROY_SCHED_CLASSES)
+		return -1;
+	pthread_mutex_lock(&sched->mutex);
+	*stats = sched->stats[cls];
+	pthread_mutex_unlock(&sched->mutex);
+	return 0;
+}
+
+/* Starts the counts and times again (the numbers waiting are left alone) */
+void lecroy_sched_reset_stats(struct lecroy_sched *sched)
+{
+	long queued;
+	int c;
+
+	pthread_mutex_lock(&sched->mutex);
+	for (c = 0; c < LECROY_SCHED_CLASSES; c++) {
+		queued = sched->stats[c].queued;
+		memset(&sched->stats[c], 0, sizeof(struct lecroy_sched_stats));
+		sched->stats[c].queued = queued;
+		sched->stats[c].max_queued = queued;
+	}
+	pthread_mutex_unlock(&sched->mutex);
+}
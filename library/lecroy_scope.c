@@ -0,0 +1,316 @@
+/* lecroy_scope.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * C++ layer over the lecroy_vxi11 library; see lecroy_scope.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lecroy_scope.h"
+
+namespace lecroy {
+
+BufferPool::~BufferPool()
+{
+	size_t l;
+	for (l = 0; l < free_.size(); l++)
+		delete[]free_[l].buf;
+}
+
+/* Hands out the smallest free buffer that's big enough. If there isn't one,
+ * a new one is allocated, and the biggest of the ones that were too small
+ * is thrown away, so that the pool doesn't fill up with buffers that are no
+ * use any more (eg after the number of points has been increased). */
+char *BufferPool::get(size_t len, size_t *capacity)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t l, best = free_.size(), too_small = free_.size();
+	char *buf;
+
+	for (l = 0; l < free_.size(); l++) {
+		if (free_[l].capacity >= len) {
+			if (best == free_.size()
+			    || free_[l].capacity < free_[best].capacity)
+				best = l;
+		} else if (too_small == free_.size()
+			   || free_[l].capacity > free_[too_small].capacity) {
+			too_small = l;
+		}
+	}
+	if (best == free_.size()) {
+		if (too_small != free_.size()) {
+			delete[]free_[too_small].buf;
+			free_[too_small] = free_.back();
+			free_.pop_back();
+		}
+		*capacity = len;
+		return new char[len];
+	}
+	buf = free_[best].buf;
+	*capacity = free_[best].capacity;
+	free_[best] = free_.back();
+	free_.pop_back();
+	return buf;
+}
+
+void BufferPool::put(char *buf, size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Buffer b;
+	b.buf = buf;
+	b.capacity = capacity;
+	free_.push_back(b);
+}
+
+size_t BufferPool::bytes_held() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t l, total = 0;
+	for (l = 0; l < free_.size(); l++)
+		total += free_[l].capacity;
+	return total;
+}
+
+size_t BufferPool::last_len() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return last_len_;
+}
+
+void BufferPool::set_last_len(size_t len)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	last_len_ = len;
+}
+
+Waveform::Waveform()
+:	buf_(NULL), capacity_(0), offset_(0), len_(0)
+{
+	memset(&desc_, 0, sizeof(desc_));
+}
+
+Waveform::~Waveform()
+{
+	release();
+}
+
+Waveform::Waveform(Waveform &&other)
+:	pool_(std::move(other.pool_)), buf_(other.buf_),
+	capacity_(other.capacity_), offset_(other.offset_), len_(other.len_),
+	desc_(other.desc_)
+{
+	other.buf_ = NULL;
+	other.capacity_ = 0;
+	other.offset_ = 0;
+	other.len_ = 0;
+}
+
+Waveform &Waveform::operator=(Waveform &&other)
+{
+	if (this != &other) {
+		release();
+		pool_ = std::move(other.pool_);
+		buf_ = other.buf_;
+		capacity_ = other.capacity_;
+		offset_ = other.offset_;
+		len_ = other.len_;
+		desc_ = other.desc_;
+		other.buf_ = NULL;
+		other.capacity_ = 0;
+		other.offset_ = 0;
+		other.len_ = 0;
+	}
+	return *this;
+}
+
+void Waveform::release()
+{
+	if (buf_ != NULL) {
+		if (pool_)
+			pool_->put(buf_, capacity_);
+		else
+			lecroy_free_receive_buffer(buf_);
+	}
+	buf_ = NULL;
+	capacity_ = 0;
+	offset_ = 0;
+	len_ = 0;
+	pool_.reset();
+}
+
+long Waveform::no_of_segments() const
+{
+	return desc_.subarray_count > 1 ? desc_.subarray_count : 1;
+}
+
+long Waveform::points_per_segment() const
+{
+	return no_of_points() / no_of_segments();
+}
+
+/* The data is always aligned for its type (see Scope::capture()), and has
+ * the PC's byte order as long as COMM_ORDER LO is set (lecroy_init() does) */
+span<const int16_t> Waveform::samples16() const
+{
+	if (bytes_per_point() != 2 || empty())
+		return span<const int16_t>();
+	return span<const int16_t>((const int16_t *)data(), no_of_points());
+}
+
+span<const int8_t> Waveform::samples8() const
+{
+	if (bytes_per_point() != 1 || empty())
+		return span<const int8_t>();
+	return span<const int8_t>((const int8_t *)data(), no_of_points());
+}
+
+int Waveform::sample(long i) const
+{
+	if (bytes_per_point() == 2)
+		return samples16()[i];
+	return samples8()[i];
+}
+
+double Waveform::volts(long i) const
+{
+	return desc_.vertical_gain * sample(i) - desc_.vertical_offset;
+}
+
+double Waveform::time(long i) const
+{
+	return desc_.horiz_offset + (i % points_per_segment()) *
+	    desc_.horiz_interval;
+}
+
+Scope::Scope()
+:	clink_(NULL), pool_(std::make_shared<BufferPool>())
+{
+}
+
+Scope::Scope(const char *ip)
+:	clink_(NULL), pool_(std::make_shared<BufferPool>())
+{
+	open(ip);
+}
+
+Scope::~Scope()
+{
+	close();
+}
+
+Scope::Scope(Scope &&other)
+:	clink_(other.clink_), ip_(std::move(other.ip_)),
+	pool_(std::move(other.pool_))
+{
+	other.clink_ = NULL;
+	other.pool_ = std::make_shared<BufferPool>();
+}
+
+Scope &Scope::operator=(Scope &&other)
+{
+	if (this != &other) {
+		close();
+		clink_ = other.clink_;
+		ip_ = std::move(other.ip_);
+		pool_.swap(other.pool_);
+		other.clink_ = NULL;
+	}
+	return *this;
+}
+
+int Scope::open(const char *ip)
+{
+	int ret;
+
+	close();
+	ret = lecroy_open(&clink_, ip);
+	if (ret != 0) {
+		clink_ = NULL;
+		return ret;
+	}
+	ip_ = ip;
+	ret = lecroy_init(clink_);
+	if (ret != 0) {
+		close();
+		return ret;
+	}
+	return 0;
+}
+
+int Scope::close()
+{
+	int ret = 0;
+	if (clink_ != NULL)
+		ret = lecroy_close(clink_, ip_.c_str());
+	clink_ = NULL;
+	return ret;
+}
+
+/* One WF? ALL: the descriptor comes back in the same block as the data (so
+ * it's the right one, even straight after the settings have changed), and
+ * the block is received straight into the Waveform's buffer, with no
+ * copying. If it doesn't fit, lecroy_get_all_growing() frees the buffer and
+ * allocates a bigger one (with new[], like the pool's own, as long as nobody
+ * has given this link a receive pool with lecroy_set_receive_pool()). The
+ * Waveform keeps that one, and it goes back to the pool with its real size
+ * when the Waveform is done with it. The pool remembers that size too, so
+ * a fresh Waveform asks for a buffer that's big enough straight away, and
+ * once the settings stop changing nothing is allocated at all. */
+long Scope::capture(Waveform &wf, char chan, int clear_sweeps,
+		    int arm_and_wait, unsigned long timeout)
+{
+	size_t len;
+	long ret, offset;
+	char *buf, *data;
+
+	if (clink_ == NULL)
+		return -1;
+	if (wf.buf_ == NULL) {
+		wf.buf_ = pool_->get(pool_->last_len(), &wf.capacity_);
+		wf.pool_ = pool_;
+	}
+	buf = wf.buf_;
+	len = wf.capacity_;
+	ret =
+	    lecroy_get_all_growing(clink_, chan, clear_sweeps, &buf, &len,
+				   &offset, &wf.desc_, arm_and_wait, timeout);
+	if (buf != wf.buf_) {
+		wf.buf_ = buf;
+		wf.capacity_ = len;
+		pool_->set_last_len(len);
+	}
+	if (ret <= 0) {
+		wf.offset_ = 0;
+		wf.len_ = 0;
+		return ret;
+	}
+	/* The descriptor etc in front of the data are an arbitrary number of
+	 * bytes long. If that leaves 16 bit data on an odd address, move it
+	 * back one (over the end of the trigger times, which we don't keep) so
+	 * the typed views are aligned. */
+	data = wf.buf_ + offset;
+	if (wf.desc_.comm_type == 1 && ((uintptr_t) data & 1) != 0) {
+		memmove(data - 1, data, ret);
+		offset--;
+	}
+	wf.offset_ = offset;
+	wf.len_ = ret;
+	return ret;
+}
+
+}				/* namespace lecroy */
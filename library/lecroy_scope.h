@@ -0,0 +1,165 @@
+/* lecroy_scope.h
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * A thin C++ layer over the lecroy_vxi11 library. A Scope owns a link to the
+ * scope (and closes it when it goes out of scope, if you'll pardon the pun),
+ * and a Waveform owns the descriptor and the samples of one capture. The
+ * sample buffers come from a pool belonging to the Scope, and go back to it
+ * when the Waveform is destroyed, so once the pool has warmed up repeated
+ * captures don't allocate any memory (the vxi11 and RPC layers underneath
+ * still do their own thing, of course).
+ *
+ *	lecroy::Scope scope("128.243.74.78");
+ *	lecroy::Waveform wf;
+ *	while (<some condition>) {
+ *		if (scope.capture(wf, '1') > 0)
+ *			<do something with wf.samples16(), wf.volts(i)>;
+ *	}
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef	_LECROY_SCOPE_H_
+#define	_LECROY_SCOPE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lecroy_vxi11.h"
+
+namespace lecroy {
+
+/* A read-only view of an array (like C++20's std::span, which we can't rely
+ * on having yet) */
+template <typename T> class span {
+public:
+	span() : data_(NULL), size_(0) { }
+	span(T *data, size_t size) : data_(data), size_(size) { }
+	T *data() const { return data_; }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	T &operator[](size_t i) const { return data_[i]; }
+	T *begin() const { return data_; }
+	T *end() const { return data_ + size_; }
+private:
+	T *data_;
+	size_t size_;
+};
+
+/* Buffers that have been handed out and given back, kept for next time.
+ * Shared between a Scope and its Waveforms, so it's fine for a Waveform to
+ * outlive the Scope it came from. */
+class BufferPool {
+public:
+	BufferPool() : last_len_(LECROY_GROWING_MIN_LEN) { }
+	~BufferPool();
+	BufferPool(const BufferPool &) = delete;
+	BufferPool &operator=(const BufferPool &) = delete;
+	char *get(size_t len, size_t *capacity);
+	void put(char *buf, size_t capacity);
+	size_t bytes_held() const;
+	/* The size of the last buffer a capture had to grow to, which is the
+	 * size worth asking for next time */
+	size_t last_len() const;
+	void set_last_len(size_t len);
+private:
+	struct Buffer {
+		char *buf;
+		size_t capacity;
+	};
+	mutable std::mutex mutex_;
+	std::vector<Buffer> free_;
+	size_t last_len_;
+};
+
+class Waveform {
+public:
+	Waveform();
+	~Waveform();
+	Waveform(Waveform &&other);
+	Waveform &operator=(Waveform &&other);
+	Waveform(const Waveform &) = delete;
+	Waveform &operator=(const Waveform &) = delete;
+
+	bool empty() const { return len_ <= 0; }
+	const struct lecroy_wavedesc &desc() const { return desc_; }
+	int bytes_per_point() const { return desc_.comm_type == 1 ? 2 : 1; }
+	long no_of_bytes() const { return len_ > 0 ? len_ : 0; }
+	long no_of_points() const { return no_of_bytes() / bytes_per_point(); }
+	long no_of_segments() const;
+	long points_per_segment() const;
+
+	/* The raw bytes, exactly as lecroy_get_data() would return them */
+	const char *data() const { return buf_ + offset_; }
+	/* Typed views of the samples; use the one that matches bytes_per_point() */
+	span<const int16_t> samples16() const;
+	span<const int8_t> samples8() const;
+	int sample(long i) const;
+	/* volts = vertical_gain * data - vertical_offset */
+	double volts(long i) const;
+	/* time of point i of its segment, relative to the trigger */
+	double time(long i) const;
+
+	/* Gives the buffer back to the pool */
+	void release();
+
+private:
+	friend class Scope;
+
+	std::shared_ptr<BufferPool> pool_;
+	char *buf_;
+	size_t capacity_;
+	long offset_;
+	long len_;
+	struct lecroy_wavedesc desc_;
+};
+
+class Scope {
+public:
+	Scope();
+	explicit Scope(const char *ip);	/* opens and initialises; check is_open() */
+	~Scope();
+	Scope(Scope &&other);
+	Scope &operator=(Scope &&other);
+	Scope(const Scope &) = delete;
+	Scope &operator=(const Scope &) = delete;
+
+	int open(const char *ip);	/* lecroy_open() then lecroy_init() */
+	int close();
+	bool is_open() const { return clink_ != NULL; }
+	/* For anything this layer doesn't wrap, use the C API directly */
+	VXI11_CLINK *clink() const { return clink_; }
+
+	/* Grabs a waveform (same arguments and return value as
+	 * lecroy_get_data()), along with its descriptor. Any buffer wf was
+	 * holding is recycled. */
+	long capture(Waveform &wf, char chan, int clear_sweeps = 1,
+		     int arm_and_wait = 1, unsigned long timeout = 10000);
+
+	const std::shared_ptr<BufferPool> &pool() const { return pool_; }
+
+private:
+	VXI11_CLINK *clink_;
+	std::string ip_;
+	std::shared_ptr<BufferPool> pool_;
+};
+
+}				/* namespace lecroy */
+
+#endif
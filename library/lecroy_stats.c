@@ -0,0 +1,183 @@
+/* lecroy_stats.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Host-side running statistics (mean, variance, min and max of every point)
+ * of traces grabbed with lecroy_get_data(). An alternative to averaging on
+ * the scope: you can grab raw traces as fast as the scope triggers, and you
+ * get error bars too.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lecroy_vxi11.h"
+
+/* The data is only ever 8 or 16 bit integers, so rather than keeping a
+ * running mean and variance in floating point (Welford's method), we keep the
+ * sum and the sum of the squares of each point in 64 bit integers. These are
+ * exact (no rounding error builds up, however many traces you add), good for
+ * 2^33 traces of 16 bit data, and the update is just integer adds, which the
+ * compiler turns into SIMD instructions. The mean and variance are only
+ * worked out (in long double) when you ask for a snapshot. */
+
+int lecroy_stats_init(struct lecroy_stats *stats, long no_of_points)
+{
+	stats->no_of_points = no_of_points;
+	stats->sum = new long long[no_of_points];
+	stats->sum_sq = new long long[no_of_points];
+	stats->min = new short[no_of_points];
+	stats->max = new short[no_of_points];
+	lecroy_stats_reset(stats);
+	return 0;
+}
+
+void lecroy_stats_reset(struct lecroy_stats *stats)
+{
+	long i;
+	stats->count = 0;
+	for (i = 0; i < stats->no_of_points; i++) {
+		stats->sum[i] = 0;
+		stats->sum_sq[i] = 0;
+		stats->min[i] = 32767;
+		stats->max[i] = -32768;
+	}
+}
+
+void lecroy_stats_free(struct lecroy_stats *stats)
+{
+	delete[]stats->sum;
+	delete[]stats->sum_sq;
+	delete[]stats->min;
+	delete[]stats->max;
+	stats->sum = stats->sum_sq = NULL;
+	stats->min = stats->max = NULL;
+	stats->no_of_points = 0;
+}
+
+struct lecroy_stats_args {
+	struct lecroy_stats *stats;
+	const char *buf;
+	long no_of_traces;
+	int bytes_per_point;
+};
+
+/* Updates points [start, end) with every trace in the buffer. The 8 and 16
+ * bit cases are separate loops so that each is a simple, vectorisable loop
+ * (memcpy() of a single value is how we tell the PC it's signed, see
+ * lecroy_average_segmented_data(), and compiles to a plain load). */
+static void lecroy_stats_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_stats_args *args = (struct lecroy_stats_args *)ptr;
+	struct lecroy_stats *stats = args->stats;
+	long long *sum = stats->sum;
+	long long *sum_sq = stats->sum_sq;
+	short *min = stats->min;
+	short *max = stats->max;
+	const char *trace;
+	long i, j;
+	signed char c;
+	short v;
+
+	for (j = 0; j < args->no_of_traces; j++) {
+		trace =
+		    args->buf +
+		    (j * stats->no_of_points * args->bytes_per_point);
+		if (args->bytes_per_point == 1) {
+			for (i = start; i < end; i++) {
+				memcpy(&c, trace + i, 1);
+				v = c;
+				sum[i] += v;
+				sum_sq[i] += (long long)(v * v);
+				min[i] = v < min[i] ? v : min[i];
+				max[i] = v > max[i] ? v : max[i];
+			}
+		} else {
+			for (i = start; i < end; i++) {
+				memcpy(&v, trace + (2 * i), 2);
+				sum[i] += v;
+				sum_sq[i] += (long long)((int)v * (int)v);
+				min[i] = v < min[i] ? v : min[i];
+				max[i] = v > max[i] ? v : max[i];
+			}
+		}
+	}
+}
+
+/* Adds every trace in buf to the statistics. buf can hold a single trace, or
+ * a whole segmented acquisition (each segment counts as one trace); any
+ * incomplete trace at the end is ignored. Don't mix 8 and 16 bit data in the
+ * same accumulator. Returns the number of traces added. */
+long lecroy_stats_add(struct lecroy_stats *stats, const char *buf,
+		      size_t buf_len, int bytes_per_point)
+{
+	return lecroy_stats_add(stats, buf, buf_len, bytes_per_point, 1);
+}
+
+/* As above, with the points split amongst no_of_threads threads (<=0 means
+ * one per core). */
+long lecroy_stats_add(struct lecroy_stats *stats, const char *buf,
+		      size_t buf_len, int bytes_per_point, int no_of_threads)
+{
+	struct lecroy_stats_args args;
+
+	if (stats->no_of_points <= 0)
+		return 0;
+	args.stats = stats;
+	args.buf = buf;
+	args.bytes_per_point = bytes_per_point;
+	args.no_of_traces =
+	    (long)(buf_len / (stats->no_of_points * bytes_per_point));
+	if (args.no_of_traces == 0)
+		return 0;
+	lecroy_parallel_for(stats->no_of_points, 16384, no_of_threads,
+			    lecroy_stats_kernel, &args);
+	stats->count += args.no_of_traces;
+	return args.no_of_traces;
+}
+
+/* Works out the statistics so far; can be called at any point, as often as
+ * you like. Any of the output arrays (each no_of_points long) can be NULL if
+ * you're not interested. The variance is the sample variance (divided by
+ * n - 1), in the same units as the raw data squared. Values are in raw data
+ * units; use the vertical gain and offset to get volts. Returns the number
+ * of traces the statistics are based on. */
+long lecroy_stats_snapshot(const struct lecroy_stats *stats, double *mean,
+			   double *variance, short *min, short *max)
+{
+	long i;
+	long double n, s, ss;
+
+	n = (long double)stats->count;
+	for (i = 0; i < stats->no_of_points; i++) {
+		s = (long double)stats->sum[i];
+		ss = (long double)stats->sum_sq[i];
+		if (mean != NULL)
+			mean[i] = stats->count > 0 ? (double)(s / n) : 0.0;
+		if (variance != NULL) {
+			if (stats->count > 1)
+				variance[i] =
+				    (double)((ss - (s * s / n)) / (n - 1));
+			else
+				variance[i] = 0.0;
+		}
+	}
+	if (min != NULL)
+		memcpy(min, stats->min, stats->no_of_points * sizeof(short));
+	if (max != NULL)
+		memcpy(max, stats->max, stats->no_of_points * sizeof(short));
+	return stats->count;
+}
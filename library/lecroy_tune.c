@@ -0,0 +1,355 @@
+/* lecroy_tune.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * How many segments should a sequence acquisition have? Every capture costs
+ * the same whatever its size (ARM, *OPC?, WF?, the block header, round
+ * trips), on top of the time between triggers and the transfer itself, so
+ * the more segments per capture, the less that fixed cost matters and the
+ * more triggers per second you get... until a capture takes longer than
+ * you're prepared to wait for it, takes more memory than you've got, or the
+ * scope runs out of segment memory (or slows down doing so much at once).
+ *
+ * lecroy_tune_run() finds out rather than guessing. At the scope's current
+ * settings (timebase, record length, bytes per point) it captures 1, 2, 4,
+ * 8... segments, timing the acquisition and the transfer of each
+ * separately, until a capture goes over the latency or memory budget, the
+ * scope won't take any more segments, or the triggers per second start
+ * going down. Straight lines fitted through those times give the fixed
+ * cost of a capture, the time between triggers, and the transfer rate.
+ * The number of segments chosen is the one that got the most triggers per
+ * second; if that was the biggest that stayed inside the budgets, the fit is
+ * used to go as far beyond it as the budgets allow. The scope is left in
+ * sequence mode with that many segments (or out of it, if 1 is best).
+ *
+ * The answer only holds for the settings it was tuned at, so call
+ * lecroy_tune_check() now and again (between runs, say); it re-tunes if the
+ * timebase, record length or bytes per point have changed since.
+ *
+ * The probes need triggers, and the biggest ones take as long as your
+ * latency budget (if you set one), so tuning takes a few seconds at best,
+ * and longer if the scope isn't triggering often.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lecroy_vxi11.h"
+
+#define	LECROY_TUNE_PROBE_CAPTURES	2	/* per probe; the quickest counts */
+
+static double lecroy_tune_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void lecroy_tune_acquired(void *arg)
+{
+	*(double *)arg = lecroy_tune_now();
+}
+
+/* Points per segment, bytes per point, and the sample interval, that chan
+ * is set up for, and how many bytes a whole capture will be. These come from
+ * the VBS settings rather than WF? DESC, as the descriptor describes the last
+ * acquisition, not the one we're about to make with the new no of segments. */
+static int lecroy_tune_record(VXI11_CLINK * clink, char chan,
+			      long *no_of_points, int *bytes_per_point,
+			      double *horiz_interval, long *capture_bytes,
+			      unsigned long timeout)
+{
+	long points;
+
+	points = vxi11_obtain_long_value_timeout(clink,
+						 "VBS? 'Return=app.Acquisition.Horizontal.NumPoints'",
+						 timeout);
+	if (points <= 0)
+		return -1;
+	*no_of_points = points + 2;	/* acquisition channels send 2 extra */
+	*bytes_per_point = lecroy_get_bytes_per_point(clink);
+	*horiz_interval =
+	    vxi11_obtain_double_value_timeout(clink,
+					      "VBS? 'Return=app.Acquisition.Horizontal.TimePerPoint'",
+					      timeout);
+	if (capture_bytes != NULL)
+		*capture_bytes = lecroy_calculate_no_of_bytes_from_vbs(clink,
+								       chan);
+	return 0;
+}
+
+/* 1 segment means out of sequence mode. Returns how many we actually got. */
+static long lecroy_tune_set_segments(VXI11_CLINK * clink, long segments)
+{
+	if (segments <= 1) {
+		vxi11_send_printf(clink, "SEQ OFF");
+		return 1;
+	}
+	return lecroy_set_segmented(clink, (int)segments, 0);
+}
+
+/* Captures probe->segments segments a few times, keeping the quickest
+ * acquisition and the quickest transfer. Returns 0, or -1 if no data. */
+static int lecroy_tune_probe(VXI11_CLINK * clink, char chan,
+			     struct lecroy_tune_probe *probe,
+			     unsigned long timeout)
+{
+	double start, acquired, end;
+	long ret;
+	char *buf;
+	int l;
+
+	buf = new char[probe->bytes + LECROY_DATA_BLOCK_HEADER_LEN];
+	probe->acquire = -1;
+	probe->transfer = -1;
+	for (l = 0; l < LECROY_TUNE_PROBE_CAPTURES; l++) {
+		start = lecroy_tune_now();
+		acquired = start;
+		ret = lecroy_get_data(clink, chan, 0, buf, probe->bytes, 1,
+				      timeout, lecroy_tune_acquired, &acquired);
+		end = lecroy_tune_now();
+		if (ret <= 0) {
+			delete[]buf;
+			return -1;
+		}
+		if (probe->acquire < 0 || acquired - start < probe->acquire)
+			probe->acquire = acquired - start;
+		if (probe->transfer < 0 || end - acquired < probe->transfer)
+			probe->transfer = end - acquired;
+		probe->bytes = ret;
+	}
+	delete[]buf;
+	probe->triggers_per_second = probe->segments /
+	    (probe->acquire + probe->transfer);
+	return 0;
+}
+
+/* Least squares straight line through the probes' acquisition (or, with
+ * transfer set, transfer) times: time = a + b * segments */
+static void lecroy_tune_fit(const struct lecroy_tune_probe *probe, int n,
+			    int transfer, double *a, double *b)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, x, y, d;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		x = (double)probe[i].segments;
+		y = transfer ? probe[i].transfer : probe[i].acquire;
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	d = n * sxx - sx * sx;
+	*b = d > 0 ? (n * sxy - sx * sy) / d : 0;
+	*a = (sy - *b * sx) / n;
+}
+
+/* Largest number of segments the memory budget (and max_segments, and the
+ * scope) allows; 0 means no limit */
+static long lecroy_tune_limit(const struct lecroy_tune *tune)
+{
+	long limit = tune->max_segments;
+	long bytes_per_segment = tune->no_of_points * tune->bytes_per_point;
+
+	if (tune->scope_max_segments > 0
+	    && (limit <= 0 || tune->scope_max_segments < limit))
+		limit = tune->scope_max_segments;
+	if (tune->max_bytes > 0 && (limit <= 0 ||
+				    tune->max_bytes / bytes_per_segment <
+				    limit))
+		limit = tune->max_bytes / bytes_per_segment;
+	if (tune->max_bytes > 0 && limit < 1)
+		limit = 1;	/* have to capture something */
+	return limit;
+}
+
+/* Predicted triggers per second with segments segments per capture, from
+ * the lines fitted by lecroy_tune_run(); *latency (if it isn't NULL) gets
+ * how long each capture would take, ARM to the last byte. */
+double lecroy_tune_predict(const struct lecroy_tune *tune, long segments,
+			   double *latency)
+{
+	double t;
+
+	if (segments < 1)
+		segments = 1;
+	t = tune->fixed_cost + segments * tune->trigger_period +
+	    (double)segments * tune->no_of_points * tune->bytes_per_point /
+	    tune->transfer_rate;
+	if (latency != NULL)
+		*latency = t;
+	return t > 0 ? segments / t : 0;
+}
+
+/* Probes, fits and chooses (see the top of the file) for acquisition
+ * channel chan (1-4), as the scope is set up now. Set max_latency,
+ * max_bytes and max_segments in tune first (0 means no limit); everything
+ * else is filled in. Returns the number of segments chosen, which the scope
+ * is left set to, or -1 if the scope didn't cooperate. */
+long lecroy_tune_run(VXI11_CLINK * clink, char chan, struct lecroy_tune *tune,
+		     unsigned long timeout)
+{
+	struct lecroy_tune_probe *probe;
+	double a, b, latency, per_segment;
+	long segments, limit, upper;
+	int l, best;
+
+	if (lecroy_is_maths_chan(chan) == 1)
+		chan = lecroy_relate_function_to_source(chan);
+	tune->chan = chan;
+	tune->no_of_probes = 0;
+	tune->scope_max_segments = 0;
+	tune->segments = 1;
+	lecroy_tune_set_segments(clink, 1);
+	if (lecroy_tune_record(clink, chan, &tune->no_of_points,
+			       &tune->bytes_per_point, &tune->horiz_interval,
+			       NULL, timeout) != 0) {
+		printf("lecroy_tune_run: could not get the record length\n");
+		return -1;
+	}
+
+	/* The probes: doubling up until something stops us */
+	best = 0;
+	segments = 1;
+	while (tune->no_of_probes < LECROY_TUNE_MAX_PROBES) {
+		limit = lecroy_tune_limit(tune);
+		if (limit > 0 && segments > limit)
+			break;
+		probe = &tune->probe[tune->no_of_probes];
+		probe->segments = lecroy_tune_set_segments(clink, segments);
+		if (probe->segments < segments) {
+			/* That's all the scope will do */
+			tune->scope_max_segments = probe->segments;
+			if (tune->no_of_probes > 0 && probe->segments <=
+			    tune->probe[tune->no_of_probes - 1].segments)
+				break;
+		}
+		if (lecroy_tune_record(clink, chan, &tune->no_of_points,
+				       &tune->bytes_per_point,
+				       &tune->horiz_interval, &probe->bytes,
+				       timeout) != 0
+		    || lecroy_tune_probe(clink, chan, probe, timeout) != 0) {
+			printf
+			    ("lecroy_tune_run: no data with %ld segments (no trigger?)\n",
+			     probe->segments);
+			break;
+		}
+		tune->no_of_probes++;
+		if (probe->triggers_per_second <
+		    tune->probe[best].triggers_per_second)
+			break;	/* past the best */
+		best = tune->no_of_probes - 1;
+		if (tune->max_latency > 0
+		    && probe->acquire + probe->transfer > tune->max_latency)
+			break;
+		if (tune->scope_max_segments > 0)
+			break;
+		segments = probe->segments * 2;
+	}
+	if (tune->no_of_probes == 0) {
+		lecroy_tune_set_segments(clink, 1);
+		return -1;
+	}
+
+	/* Straight lines through the acquisition and transfer times */
+	lecroy_tune_fit(tune->probe, tune->no_of_probes, 0, &a, &b);
+	tune->fixed_cost = a;
+	tune->trigger_period = b > 0 ? b : 0;
+	lecroy_tune_fit(tune->probe, tune->no_of_probes, 1, &a, &b);
+	tune->fixed_cost += a;
+	if (tune->fixed_cost < 0)
+		tune->fixed_cost = 0;
+	if (b <= 0)
+		b = 1e-12;
+	tune->transfer_rate = tune->no_of_points * tune->bytes_per_point / b;
+
+	/* The best probe that kept to the latency budget */
+	best = -1;
+	for (l = 0; l < tune->no_of_probes; l++) {
+		probe = &tune->probe[l];
+		if (tune->max_latency > 0
+		    && probe->acquire + probe->transfer > tune->max_latency)
+			continue;
+		if (best < 0 || probe->triggers_per_second >
+		    tune->probe[best].triggers_per_second)
+			best = l;
+	}
+	if (best < 0) {
+		printf
+		    ("lecroy_tune_run: even 1 segment takes longer than max_latency\n");
+		segments = 1;
+	} else {
+		segments = tune->probe[best].segments;
+		/* If the next probe up only lost because of the latency
+		 * budget, or there wasn't one because of the memory budget
+		 * or the scope, there's room between the two */
+		if (best + 1 < tune->no_of_probes) {
+			probe = &tune->probe[best + 1];
+			if (tune->max_latency > 0 && probe->acquire +
+			    probe->transfer > tune->max_latency)
+				upper = probe->segments - 1;
+			else
+				upper = segments;
+		} else {
+			upper = lecroy_tune_limit(tune);
+		}
+		if (upper > segments) {
+			per_segment = tune->trigger_period +
+			    tune->no_of_points * tune->bytes_per_point /
+			    tune->transfer_rate;
+			if (tune->max_latency > 0 && per_segment > 0
+			    && (tune->max_latency - tune->fixed_cost) /
+			    per_segment < upper)
+				upper = (long)((tune->max_latency -
+						tune->fixed_cost) /
+					       per_segment);
+			if (upper > segments)
+				segments = upper;
+		}
+	}
+	tune->segments = lecroy_tune_set_segments(clink, segments);
+	/* What lecroy_tune_check() compares against */
+	lecroy_tune_record(clink, chan, &tune->no_of_points,
+			   &tune->bytes_per_point, &tune->horiz_interval, NULL,
+			   timeout);
+	tune->triggers_per_second = lecroy_tune_predict(tune, tune->segments,
+							&latency);
+	tune->latency = latency;
+	return tune->segments;
+}
+
+/* Has the timebase, record length or bytes per point changed since tune
+ * was run? If so, runs it again. Returns 1 if it re-tuned, 0 if nothing
+ * had changed, or -1 if the scope didn't cooperate. */
+int lecroy_tune_check(VXI11_CLINK * clink, struct lecroy_tune *tune,
+		      unsigned long timeout)
+{
+	long no_of_points;
+	int bytes_per_point;
+	double horiz_interval;
+
+	if (lecroy_tune_record(clink, tune->chan, &no_of_points,
+			       &bytes_per_point, &horiz_interval, NULL,
+			       timeout) != 0)
+		return -1;
+	if (no_of_points == tune->no_of_points
+	    && bytes_per_point == tune->bytes_per_point
+	    && horiz_interval == tune->horiz_interval)
+		return 0;
+	return lecroy_tune_run(clink, tune->chan, tune, timeout) > 0 ? 1 : -1;
+}
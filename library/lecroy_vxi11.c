@@ -42,6 +42,46 @@ int lecroy_close(VXI11_CLINK * clink, const char *ip)
 	return vxi11_close_device(clink, ip);
 }
 
+/* A second link to the same scope, for status queries, device clear and
+ * lecroy_abort(), so that they don't have to queue up behind a waveform
+ * coming over the first one. Each link has its own buffers in the scope, so
+ * a query on one doesn't get muddled up with an answer waiting on the
+ * other. The vxi11 library shares one RPC connection between all the links
+ * it has open to a given address, though, and an RPC connection can't be
+ * used from two threads at once. So for the control link to be any use
+ * while the data link is busy, give it a different spelling of the
+ * scope's address (its hostname, if you opened the data link with its IP
+ * address, or vice versa): then it gets a connection of its own. */
+int lecroy_open_control(VXI11_CLINK ** control, const char *address)
+{
+	return vxi11_open_device(control, address, NULL);
+}
+
+/* Unlike lecroy_close(), leaves the message on the screen alone (the data
+ * link is still open, presumably) */
+int lecroy_close_control(VXI11_CLINK * control, const char *address)
+{
+	return vxi11_close_device(control, address);
+}
+
+/* Stops whatever the scope is doing on the other link(s): a device clear
+ * throws away any half-sent waveform and gets the scope out of a WAIT, and
+ * STOP stops it waiting for a trigger. Whatever was reading on the data
+ * link gets an error (or times out), and the capture returns 0, as if it
+ * had timed out. Use the control link (lecroy_open_control()) for this,
+ * from another thread. */
+int lecroy_abort(VXI11_CLINK * control)
+{
+	int ret;
+
+	ret = vxi11_clear(control);
+	if (ret != 0) {
+		printf("lecroy_abort: device clear failed\n");
+		return ret;
+	}
+	return vxi11_send_printf(control, "STOP");
+}
+
 /* Set up some fundamental settings for data transfer. It's possible
  * (although not certain) that some or all of these would be reset after
  * a system reset. It's a very tiny overhead right at the beginning of your
@@ -112,20 +152,154 @@ double lecroy_obtain_insp_double(VXI11_CLINK * clink, const char *cmd,
 	return strtod(buf + l + 2, (char **)NULL);
 }
 
-/* Why can't everything be this easy? */
-/* ...
- * Famous last words... turns out you have to ask twice, as if you've recently
- * changed the sample rate then the changes don't propagate through unless you've
- * asked a couple of times. Way to go, lecroy! */
-long lecroy_calculate_no_of_bytes(VXI11_CLINK * clink, char chan,
-				  unsigned long timeout)
+/* The WAVEDESC block is binary, in whatever byte order COMM_ORDER was set to
+ * when it was sent (the descriptor tells us which, in its COMM_ORDER field).
+ * These helpers pull the individual fields out without caring about the
+ * alignment of the buffer or the endian-ness of the PC. */
+static void lecroy_wavedesc_bytes(const char *p, void *out, int n,
+				  int lofirst)
+{
+	unsigned char tmp[8];
+	int l;
+	unsigned short one = 1;
+	int host_lofirst = (*(unsigned char *)&one == 1);
+
+	for (l = 0; l < n; l++) {
+		if (lofirst == host_lofirst)
+			tmp[l] = (unsigned char)p[l];
+		else
+			tmp[l] = (unsigned char)p[n - 1 - l];
+	}
+	memcpy(out, tmp, n);
+}
+
+static int lecroy_wavedesc_word(const char *p, int lofirst)
+{
+	short v;
+	lecroy_wavedesc_bytes(p, &v, 2, lofirst);
+	return (int)v;
+}
+
+static long lecroy_wavedesc_long(const char *p, int lofirst)
+{
+	int v;			/* "long" in LeCroy-speak is 32 bits */
+	lecroy_wavedesc_bytes(p, &v, 4, lofirst);
+	return (long)v;
+}
+
+static double lecroy_wavedesc_float(const char *p, int lofirst)
+{
+	float v;
+	lecroy_wavedesc_bytes(p, &v, 4, lofirst);
+	return (double)v;
+}
+
+static double lecroy_wavedesc_double(const char *p, int lofirst)
+{
+	double v;
+	lecroy_wavedesc_bytes(p, &v, 8, lofirst);
+	return v;
+}
+
+static void lecroy_wavedesc_string(const char *p, char *out)
+{
+	memcpy(out, p, 16);
+	out[16] = 0;
+}
+
+/* Decodes a binary WAVEDESC block (as returned in the data block of a
+ * "Cx:WF? DESC" or at the start of a "Cx:WF? ALL"). Returns 0 on success,
+ * -1 if the buffer doesn't look like a descriptor. */
+int lecroy_parse_wavedesc(const char *buf, size_t len,
+			  struct lecroy_wavedesc *desc)
+{
+	int lo;
+
+	if (len < LECROY_WAVEDESC_LEN || strncmp(buf, "WAVEDESC", 8) != 0) {
+		printf
+		    ("lecroy_parse_wavedesc: error, buffer does not contain a WAVEDESC block\n");
+		return -1;
+	}
+	memset(desc, 0, sizeof(struct lecroy_wavedesc));
+	/* COMM_ORDER is a 16 bit enum, 0 (HIFIRST) or 1 (LOFIRST). Whichever
+	 * order we read it in, one of the two bytes is non-zero for LOFIRST */
+	lo = (buf[34] != 0 || buf[35] != 0) ? 1 : 0;
+
+	lecroy_wavedesc_string(buf + 0, desc->descriptor_name);
+	lecroy_wavedesc_string(buf + 16, desc->template_name);
+	desc->comm_type = lecroy_wavedesc_word(buf + 32, lo);
+	desc->comm_order = lo;
+	desc->wave_descriptor = lecroy_wavedesc_long(buf + 36, lo);
+	desc->user_text = lecroy_wavedesc_long(buf + 40, lo);
+	desc->trigtime_array = lecroy_wavedesc_long(buf + 48, lo);
+	desc->ris_time_array = lecroy_wavedesc_long(buf + 52, lo);
+	desc->wave_array_1 = lecroy_wavedesc_long(buf + 60, lo);
+	desc->wave_array_2 = lecroy_wavedesc_long(buf + 64, lo);
+	lecroy_wavedesc_string(buf + 76, desc->instrument_name);
+	desc->wave_array_count = lecroy_wavedesc_long(buf + 116, lo);
+	desc->pnts_per_screen = lecroy_wavedesc_long(buf + 120, lo);
+	desc->first_valid_pnt = lecroy_wavedesc_long(buf + 124, lo);
+	desc->last_valid_pnt = lecroy_wavedesc_long(buf + 128, lo);
+	desc->subarray_count = lecroy_wavedesc_long(buf + 144, lo);
+	desc->sweeps_per_acq = lecroy_wavedesc_long(buf + 148, lo);
+	desc->vertical_gain = lecroy_wavedesc_float(buf + 156, lo);
+	desc->vertical_offset = lecroy_wavedesc_float(buf + 160, lo);
+	desc->nominal_bits = lecroy_wavedesc_word(buf + 172, lo);
+	desc->horiz_interval = lecroy_wavedesc_float(buf + 176, lo);
+	desc->horiz_offset = lecroy_wavedesc_double(buf + 180, lo);
+	desc->trigger_seconds = lecroy_wavedesc_double(buf + 296, lo);
+	desc->trigger_minutes = (unsigned char)buf[304];
+	desc->trigger_hours = (unsigned char)buf[305];
+	desc->trigger_days = (unsigned char)buf[306];
+	desc->trigger_months = (unsigned char)buf[307];
+	desc->trigger_year = lecroy_wavedesc_word(buf + 308, lo);
+	desc->acq_duration = lecroy_wavedesc_float(buf + 312, lo);
+	desc->record_type = lecroy_wavedesc_word(buf + 316, lo);
+	desc->processing_done = lecroy_wavedesc_word(buf + 318, lo);
+	desc->wave_source = lecroy_wavedesc_word(buf + 344, lo);
+	return 0;
+}
+
+/* Asks for the waveform descriptor of a channel, in a single round trip.
+ * Returns 0 on success, negative on failure. */
+int lecroy_get_wavedesc(VXI11_CLINK * clink, char chan,
+			struct lecroy_wavedesc *desc, unsigned long timeout)
 {
-	char cmd[256];
 	char source[20];
+	/* room for a few extra bytes, in case the scope sends a longer descriptor */
+	char buf[LECROY_WAVEDESC_LEN + LECROY_DATA_BLOCK_HEADER_LEN + 64];
+	long ret, offset;
+
 	lecroy_scope_channel_str(chan, source);
-	sprintf(cmd, "%s:INSP? WAVE_ARRAY_1", source);
-	lecroy_obtain_insp_long(clink, cmd, timeout);
-	return lecroy_obtain_insp_long(clink, cmd, timeout);
+	if (vxi11_send_printf(clink, "%s:WF? DESC", source) < 0)
+		return -1;
+	ret = lecroy_receive_data_block_in_place(clink, buf, sizeof(buf),
+						 &offset, timeout);
+	if (ret < LECROY_WAVEDESC_LEN) {
+		printf
+		    ("lecroy_get_wavedesc: error, WF? DESC returned %ld bytes\n",
+		     ret);
+		return -2;
+	}
+	return lecroy_parse_wavedesc(buf + offset, (size_t)ret, desc);
+}
+
+/* This used to be two "INSP? WAVE_ARRAY_1" queries (you had to ask twice, as
+ * if you'd recently changed the sample rate then the changes didn't propagate
+ * through unless you'd asked a couple of times. Way to go, lecroy!). The
+ * binary descriptor doesn't suffer from this, and it's a single round trip.
+ * It's the exact size of the waveform stored in the channel, ie the last
+ * acquisition: if you've changed the sample rate, no of points or segments
+ * since, either use lecroy_calculate_no_of_bytes_from_vbs() (an estimate),
+ * or better, don't ask at all, and let lecroy_get_all_growing() find out
+ * from the block itself. */
+long lecroy_calculate_no_of_bytes(VXI11_CLINK * clink, char chan,
+				  unsigned long timeout)
+{
+	struct lecroy_wavedesc desc;
+	if (lecroy_get_wavedesc(clink, chan, &desc, timeout) != 0)
+		return 0;
+	return desc.wave_array_1;
 }
 
 /* This version of the function, rather than using the "INSP? WAVE_ARRAY_1" query,
@@ -160,6 +334,86 @@ long lecroy_calculate_no_of_bytes_from_vbs(VXI11_CLINK * clink, char chan)
 	return no_of_bytes;
 }
 
+/* The functions that need a temporary buffer to receive a data block into
+ * can take it from a pool of pre-faulted buffers (see lecroy_pool.c) rather
+ * than new[]-ing one every time. Each link can have its own pool (or none),
+ * so two scopes being read at once don't fight over the same buffers. Pass
+ * a NULL pool to go back to new[] for that link; do that before destroying
+ * the pool, and only once every buffer the link got from it has been freed.
+ * If the pool is empty, or its buffers are too small, we quietly use new[]
+ * anyway. Returns 0, or -1 if there are already LECROY_MAX_RECEIVE_POOLS
+ * links with pools. */
+#define	LECROY_MAX_RECEIVE_POOLS	16
+
+struct lecroy_receive_pool_link {
+	VXI11_CLINK *clink;
+	struct lecroy_pool *pool;
+};
+
+static struct lecroy_receive_pool_link
+    lecroy_receive_pools[LECROY_MAX_RECEIVE_POOLS];
+static pthread_mutex_t lecroy_receive_pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int lecroy_set_receive_pool(VXI11_CLINK * clink, struct lecroy_pool *pool)
+{
+	int l, slot = -1;
+
+	pthread_mutex_lock(&lecroy_receive_pools_mutex);
+	for (l = 0; l < LECROY_MAX_RECEIVE_POOLS; l++) {
+		if (lecroy_receive_pools[l].clink == clink) {
+			slot = l;
+			break;
+		}
+		if (slot < 0 && lecroy_receive_pools[l].clink == NULL)
+			slot = l;
+	}
+	if (slot >= 0) {
+		lecroy_receive_pools[slot].clink = pool != NULL ? clink : NULL;
+		lecroy_receive_pools[slot].pool = pool;
+	} else if (pool != NULL) {
+		printf
+		    ("lecroy_set_receive_pool: error, already %d links with pools\n",
+		     LECROY_MAX_RECEIVE_POOLS);
+	}
+	pthread_mutex_unlock(&lecroy_receive_pools_mutex);
+	return (slot >= 0 || pool == NULL) ? 0 : -1;
+}
+
+static char *lecroy_get_receive_buffer(VXI11_CLINK * clink, size_t len)
+{
+	char *buf = NULL;
+	struct lecroy_pool *pool = NULL;
+	int l;
+
+	pthread_mutex_lock(&lecroy_receive_pools_mutex);
+	for (l = 0; l < LECROY_MAX_RECEIVE_POOLS; l++)
+		if (lecroy_receive_pools[l].clink == clink)
+			pool = lecroy_receive_pools[l].pool;
+	pthread_mutex_unlock(&lecroy_receive_pools_mutex);
+	if (pool != NULL && pool->buffer_size >= len)
+		buf = lecroy_pool_get(pool);
+	if (buf == NULL)
+		buf = new char[len];
+	return buf;
+}
+
+/* A buffer goes back to whichever pool it came from (which needn't be the
+ * pool of the link it was last used on), or is delete[]-ed if it didn't
+ * come from a pool */
+static void lecroy_put_receive_buffer(char *buf)
+{
+	int l, ret = -1;
+
+	pthread_mutex_lock(&lecroy_receive_pools_mutex);
+	for (l = 0; l < LECROY_MAX_RECEIVE_POOLS && ret == -1; l++)
+		if (lecroy_receive_pools[l].pool != NULL)
+			ret = lecroy_pool_put(lecroy_receive_pools[l].pool, buf);
+	pthread_mutex_unlock(&lecroy_receive_pools_mutex);
+	/* -2 is a buffer that's already back in its pool: not ours to free */
+	if (ret == -1)
+		delete[]buf;
+}
+
 /* This function reads a response in the form of a definite-length block, such
  * as when you ask for waveform data. The data is returned in the following
  * format:
@@ -174,47 +428,231 @@ long lecroy_calculate_no_of_bytes_from_vbs(VXI11_CLINK * clink, char chan)
 long lecroy_receive_data_block(VXI11_CLINK * clink, char *buffer,
 			       size_t len, unsigned long timeout)
 {
-/* I'm not sure what the maximum length of this header is, I'll assume it's
- * 24 (DATA_ARRAY_1,#9 + 9 digits) */
-	size_t necessary_buffer_size;
 	char *in_buffer;
-	int ret;
+	long ret, offset;
+
+	in_buffer =
+	    lecroy_get_receive_buffer(clink, len + LECROY_DATA_BLOCK_HEADER_LEN);
+	ret =
+	    lecroy_receive_data_block_in_place(clink, in_buffer,
+					       len + LECROY_DATA_BLOCK_HEADER_LEN,
+					       &offset, timeout);
+	if (ret > 0) {
+		if (ret > (long)len)
+			ret = (long)len;
+		memcpy(buffer, in_buffer + offset, ret);
+	}
+	lecroy_put_receive_buffer(in_buffer);
+	return ret;
+}
+
+/* Finds the "#9000001000" part of a data block header (see above) within the
+ * first few bytes of what we've received. Sets data_offset to where the data
+ * starts, and no_of_bytes to the length the header says it is. Returns 0 if
+ * all is well, -3 if there's no '#'. */
+static int lecroy_parse_data_block_header(const char *in_buffer, long received,
+					  long *data_offset, long *no_of_bytes)
+{
 	int ndigits;
-	size_t returned_bytes;
+	unsigned long returned_bytes;
 	int l = 0;
 	char scan_cmd[20];
-	necessary_buffer_size = len + 25;
-	in_buffer = new char[necessary_buffer_size];
-	ret =
-	    vxi11_receive_timeout(clink, in_buffer, necessary_buffer_size,
-				  timeout);
-	if (ret < 0)
-		return ret;
-	while ((in_buffer[l] != '#') && (l < 25))
+
+	while ((l < received) && (l < LECROY_DATA_BLOCK_HEADER_LEN)
+	       && (in_buffer[l] != '#'))
 		l++;
-	if (in_buffer[l] != '#') {
+	if ((l == received) || (l == LECROY_DATA_BLOCK_HEADER_LEN)) {
 		printf
 		    ("lecroy_user: data block error: data block does not begin with '#'\n");
-		printf("First 25 characters received were: '");
-		for (l = 0; l < 25; l++) {
-			printf("%c", in_buffer[l]);
+		printf("First %d characters received were: '", l);
+		for (ndigits = 0; ndigits < l; ndigits++) {
+			printf("%c", in_buffer[ndigits]);
 		}
 		printf("'\n");
 		return -3;
 	}
 
 	/* first find out how many digits */
+	ndigits = 0;
 	sscanf(in_buffer + l, "#%1d", &ndigits);
 	/* some instruments, if there is a problem acquiring the data, return only "#0" */
 	if (ndigits > 0) {
 		/* now that we know, we can convert the next <ndigits> bytes into an unsigned long */
 		sprintf(scan_cmd, "#%%1d%%%dlu", ndigits);
 		sscanf(in_buffer + l, scan_cmd, &ndigits, &returned_bytes);
-		memcpy(buffer, in_buffer + (ndigits + l + 2), returned_bytes);
-		delete[]in_buffer;
-		return (long)returned_bytes;
-	} else
+		*data_offset = ndigits + l + 2;
+		*no_of_bytes = (long)returned_bytes;
+	} else {
+		*data_offset = l + 2;
+		*no_of_bytes = 0;
+	}
+	return 0;
+}
+
+/* As lecroy_receive_data_block(), but doesn't copy the data anywhere: the
+ * whole response (header and all) is received straight into "buffer", which
+ * must be LECROY_DATA_BLOCK_HEADER_LEN bytes longer than the data you expect.
+ * The data starts at buffer + *data_offset. Avoids an extra allocation and
+ * copy of what can be hundreds of MB. Returns the number of bytes of data. */
+long lecroy_receive_data_block_in_place(VXI11_CLINK * clink, char *buffer,
+					size_t len, long *data_offset,
+					unsigned long timeout)
+{
+	long ret, no_of_bytes;
+
+	*data_offset = 0;
+	ret = vxi11_receive_timeout(clink, buffer, len, timeout);
+	if (ret < 0)
+		return ret;
+	if (lecroy_parse_data_block_header(buffer, ret, data_offset,
+					   &no_of_bytes) != 0)
+		return -3;
+	/* Never return more than we actually got */
+	if (no_of_bytes > ret - *data_offset)
+		no_of_bytes = ret - *data_offset;
+	if (no_of_bytes < 0)
+		no_of_bytes = 0;
+	return no_of_bytes;
+}
+
+/* Receives a data block into a buffer that grows to fit, so you don't need
+ * to know how big it'll be beforehand. *buffer (*len bytes) can start off
+ * NULL (and 0), or be whatever you used last time; it's replaced by a bigger
+ * one if need be, from the link's receive pool if it has one (see
+ * lecroy_set_receive_pool()), otherwise with new[]. Free it with
+ * lecroy_free_receive_buffer(). If the first read fills the buffer before
+ * the end of the block (vxi11 returns -100, and prints a complaint), we've
+ * at least got the header, which tells us exactly how long the block is; the
+ * rest is read straight into the new buffer. So once the buffer's the right
+ * size there's no extra cost at all. The data starts at *buffer +
+ * *data_offset. Returns the number of bytes of data. */
+long lecroy_receive_data_block_growing(VXI11_CLINK * clink, char **buffer,
+				       size_t *len, long *data_offset,
+				       unsigned long timeout)
+{
+	long ret, rest, no_of_bytes;
+	size_t new_len;
+	char *new_buffer;
+
+	if (*buffer == NULL || *len < LECROY_GROWING_MIN_LEN) {
+		if (*buffer != NULL)
+			lecroy_put_receive_buffer(*buffer);
+		*len = LECROY_GROWING_MIN_LEN;
+		*buffer = lecroy_get_receive_buffer(clink, *len);
+	}
+	*data_offset = 0;
+	ret = vxi11_receive_timeout(clink, *buffer, *len, timeout);
+	if (ret == -100) {
+		if (lecroy_parse_data_block_header(*buffer, (long)*len,
+						   data_offset,
+						   &no_of_bytes) != 0)
+			return -3;
+		/* Room for the terminator (and a bit) after the data */
+		new_len = *data_offset + no_of_bytes + LECROY_DATA_BLOCK_HEADER_LEN;
+		if (new_len <= *len) {
+			printf
+			    ("lecroy_receive_data_block_growing: block bigger than its header says\n");
+			return -3;
+		}
+		new_buffer = lecroy_get_receive_buffer(clink, new_len);
+		memcpy(new_buffer, *buffer, *len);
+		rest = vxi11_receive_timeout(clink, new_buffer + *len,
+					     new_len - *len, timeout);
+		ret = rest < 0 ? rest : (long)*len + rest;
+		lecroy_put_receive_buffer(*buffer);
+		*buffer = new_buffer;
+		*len = new_len;
+	}
+	if (ret < 0)
+		return ret;
+	if (lecroy_parse_data_block_header(*buffer, ret, data_offset,
+					   &no_of_bytes) != 0)
+		return -3;
+	if (no_of_bytes > ret - *data_offset)
+		no_of_bytes = ret - *data_offset;
+	if (no_of_bytes < 0)
+		no_of_bytes = 0;
+	return no_of_bytes;
+}
+
+/* Frees a buffer from lecroy_receive_data_block_growing() or
+ * lecroy_get_data_growing() */
+void lecroy_free_receive_buffer(char *buffer)
+{
+	if (buffer != NULL)
+		lecroy_put_receive_buffer(buffer);
+}
+
+/* Does the arming, waiting and clearing of sweeps described below (see
+ * lecroy_get_data()), ie everything up to the point where the data is ready
+ * to be asked for. Returns 0 if the data is ready, -1 if *OPC? didn't come
+ * back, or 1 if arm_and_wait is LECROY_ARM_FUSED and the arming and waiting
+ * have been left to go in front of the WF? query (see lecroy_send_wf_query()).
+ * Fusing isn't possible when we have to wait for the averaging registers
+ * after the acquisition (maths channel, clear_sweeps set), so then we do it
+ * the normal way. */
+static int lecroy_wait_for_data(VXI11_CLINK * clink, char chan,
+				int clear_sweeps, int arm_and_wait,
+				unsigned long timeout)
+{
+	long ret;
+	int is_maths_chan;
+
+	is_maths_chan = lecroy_is_maths_chan(chan);
+
+	if (arm_and_wait == LECROY_ARM_FUSED) {
+		if ((is_maths_chan == 0) || (clear_sweeps == 0))
+			return 1;
+		arm_and_wait = 1;
+	}
+	if ((is_maths_chan == 1) && (clear_sweeps == 1))
+		lecroy_clear_sweeps(clink);
+	if (arm_and_wait == 1)
+		vxi11_send_printf(clink, "ARM;WAIT");
+	if ((arm_and_wait == 1) || (is_maths_chan == 0)) {
+		ret = vxi11_obtain_long_value_timeout(clink, "*OPC?", timeout);
+		if (ret != 1) {
+			printf
+			    ("lecroy_get_data: error, *OPC? did not return 1\n");
+			return -1;
+		}
+	}
+	if ((is_maths_chan == 1) && (clear_sweeps == 1))
+		lecroy_wait_all_averages(clink, timeout);
+	return 0;
+}
+
+/* Sends the WF? query for an array ("DAT1", "ALL" etc). If fused is 1 the
+ * ARM;WAIT goes in the same message: the scope doesn't get round to the WF?
+ * until the acquisition is complete, so the arrival of the data block is our
+ * completion signal, instead of a separate *OPC? round trip. The read then
+ * has to cover the time we would have allowed *OPC? as well as the transfer,
+ * so we return the timeout to use for it. */
+static unsigned long lecroy_send_wf_query(VXI11_CLINK * clink, char chan,
+					  const char *array, int fused,
+					  unsigned long timeout)
+{
+	char source[20];
+
+	lecroy_scope_channel_str(chan, source);
+	if (fused == 1) {
+		vxi11_send_printf(clink, "ARM;WAIT;%s:WF? %s", source, array);
+		return 2 * timeout;
+	}
+	vxi11_send_printf(clink, "%s:WF? %s", source, array);
+	return timeout;
+}
+
+/* In the fused case a read that fails (most likely timed out waiting for the
+ * trigger) is the equivalent of *OPC? not returning 1, so behave the same. */
+static long lecroy_check_fused_read(long ret, int fused)
+{
+	if (fused == 1 && ret < 0) {
+		printf
+		    ("lecroy_get_data: error, no data after ARM;WAIT (timed out?)\n");
 		return 0;
+	}
+	return ret;
 }
 
 /* Wrapper. Most times we want to arm and wait... unless we've already set this up and returned
@@ -252,34 +690,279 @@ long lecroy_get_data(VXI11_CLINK * clink, char chan, int clear_sweeps,
  * Segmented averages		| Yes		| A-D		| 1		| 1
  *     "        "		| No		| A-D		| 0		| 0
  *
+ * Wherever arm_and_wait is 1 you can instead pass LECROY_ARM_FUSED, which
+ * sends "ARM;WAIT;Cx:WF? DAT1" as one message and skips the *OPC? round trip.
+ * For short records at high trigger rates this is noticeably quicker. (With
+ * clear_sweeps set on a maths channel we still have to poll the averaging
+ * registers, so that case quietly does the normal thing.)
  */
 long lecroy_get_data(VXI11_CLINK * clink, char chan, int clear_sweeps,
 		     char *buf, size_t buf_len, int arm_and_wait,
 		     unsigned long timeout)
 {
-	char source[20];
+	return lecroy_get_data(clink, chan, clear_sweeps, buf, buf_len,
+			       arm_and_wait, timeout, NULL, NULL);
+}
+
+/* As above, but calls acquired(arg) (if it isn't NULL) once the scope has
+ * finished acquiring, before the data comes over. Anything that doesn't need
+ * the scope (moving the stage to the next point, say) can start then, rather
+ * than after the transfer. With LECROY_ARM_FUSED we don't find out until the
+ * data arrives, so it's called after the read instead. */
+long lecroy_get_data(VXI11_CLINK * clink, char chan, int clear_sweeps,
+		     char *buf, size_t buf_len, int arm_and_wait,
+		     unsigned long timeout, void (*acquired) (void *arg),
+		     void *arg)
+{
+	int fused;
+	unsigned long read_timeout;
 	long ret;
-	int is_maths_chan;
 
-	is_maths_chan = lecroy_is_maths_chan(chan);
+	fused = lecroy_wait_for_data(clink, chan, clear_sweeps, arm_and_wait,
+				     timeout);
+	if (fused < 0)
+		return 0;
+	if (acquired != NULL && fused == 0)
+		acquired(arg);
+	read_timeout = lecroy_send_wf_query(clink, chan, "DAT1", fused, timeout);
+	ret = lecroy_check_fused_read(lecroy_receive_data_block
+				      (clink, buf, buf_len, read_timeout),
+				      fused);
+	if (acquired != NULL && fused == 1)
+		acquired(arg);
+	return ret;
+}
 
-	if ((is_maths_chan == 1) && (clear_sweeps == 1))
-		lecroy_clear_sweeps(clink);
-	if (arm_and_wait == 1)
-		vxi11_send_printf(clink, "ARM;WAIT");
-	if ((arm_and_wait == 1) || (is_maths_chan == 0)) {
-		ret = vxi11_obtain_long_value_timeout(clink, "*OPC?", timeout);
-		if (ret != 1) {
-			printf
-			    ("lecroy_get_data: error, *OPC? did not return 1\n");
-			return 0;
-		}
+/* As lecroy_get_data(), but with no need to know the size of the data
+ * first (so no lecroy_calculate_no_of_bytes() or similar beforehand): the
+ * block is received into a buffer that grows to fit, see
+ * lecroy_receive_data_block_growing() for what *buf and *buf_len can be.
+ * The data starts at *buf + *data_offset. Returns the number of bytes of
+ * data. */
+long lecroy_get_data_growing(VXI11_CLINK * clink, char chan, int clear_sweeps,
+			     char **buf, size_t *buf_len, long *data_offset,
+			     int arm_and_wait, unsigned long timeout)
+{
+	int fused;
+	unsigned long read_timeout;
+
+	*data_offset = 0;
+	fused = lecroy_wait_for_data(clink, chan, clear_sweeps, arm_and_wait,
+				     timeout);
+	if (fused < 0)
+		return 0;
+	read_timeout = lecroy_send_wf_query(clink, chan, "DAT1", fused, timeout);
+	return lecroy_check_fused_read(lecroy_receive_data_block_growing
+				       (clink, buf, buf_len, data_offset,
+					read_timeout), fused);
+}
+
+/* As lecroy_get_data_growing(), but asks for "WF? ALL" (see
+ * lecroy_get_data_with_trigtime() below) rather than DAT1, so the descriptor
+ * comes in the same block as the data, and is filled into desc. It describes
+ * exactly the data that came with it, which WF? DESC beforehand wouldn't if
+ * the settings had just changed. The sample data starts at *buf +
+ * *data_offset, with the rest of the block (descriptor, user text, trigger
+ * times) in front of it. Returns the number of bytes of sample data. */
+long lecroy_get_all_growing(VXI11_CLINK * clink, char chan, int clear_sweeps,
+			    char **buf, size_t *buf_len, long *data_offset,
+			    struct lecroy_wavedesc *desc, int arm_and_wait,
+			    unsigned long timeout)
+{
+	return lecroy_get_all_growing(clink, chan, clear_sweeps, buf, buf_len,
+				      data_offset, desc, arm_and_wait, timeout,
+				      NULL, NULL);
+}
+
+/* As above, with acquired(arg) called as for lecroy_get_data() */
+long lecroy_get_all_growing(VXI11_CLINK * clink, char chan, int clear_sweeps,
+			    char **buf, size_t *buf_len, long *data_offset,
+			    struct lecroy_wavedesc *desc, int arm_and_wait,
+			    unsigned long timeout, void (*acquired) (void *arg),
+			    void *arg)
+{
+	int fused;
+	unsigned long read_timeout;
+	long ret, offset, no_of_bytes;
+
+	*data_offset = 0;
+	fused = lecroy_wait_for_data(clink, chan, clear_sweeps, arm_and_wait,
+				     timeout);
+	if (fused < 0)
+		return 0;
+	if (acquired != NULL && fused == 0)
+		acquired(arg);
+	read_timeout = lecroy_send_wf_query(clink, chan, "ALL", fused, timeout);
+	ret =
+	    lecroy_check_fused_read(lecroy_receive_data_block_growing
+				    (clink, buf, buf_len, &offset,
+				     read_timeout), fused);
+	if (acquired != NULL && fused == 1)
+		acquired(arg);
+	if (ret <= 0 || lecroy_parse_wavedesc(*buf + offset, ret, desc) != 0)
+		return ret < 0 ? ret : 0;
+	*data_offset = desc->wave_descriptor + desc->user_text +
+	    desc->trigtime_array + desc->ris_time_array;
+	if (*data_offset < 0 || *data_offset > ret)
+		*data_offset = ret;
+	no_of_bytes = desc->wave_array_1;
+	if (no_of_bytes < 0 || *data_offset + no_of_bytes > ret)
+		no_of_bytes = ret - *data_offset;
+	*data_offset += offset;
+	return no_of_bytes;
+}
+
+/* As lecroy_get_data(), but receives the data block in place (see
+ * lecroy_receive_data_block_in_place()); buf must be buf_len +
+ * LECROY_DATA_BLOCK_HEADER_LEN bytes long, and the data starts at
+ * buf + *data_offset. */
+long lecroy_get_data_in_place(VXI11_CLINK * clink, char chan,
+			      int clear_sweeps, char *buf, size_t buf_len,
+			      long *data_offset, int arm_and_wait,
+			      unsigned long timeout)
+{
+	int fused;
+	unsigned long read_timeout;
+
+	*data_offset = 0;
+	fused = lecroy_wait_for_data(clink, chan, clear_sweeps, arm_and_wait,
+				     timeout);
+	if (fused < 0)
+		return 0;
+	read_timeout = lecroy_send_wf_query(clink, chan, "DAT1", fused, timeout);
+	return lecroy_check_fused_read(lecroy_receive_data_block_in_place
+				       (clink, buf,
+					buf_len + LECROY_DATA_BLOCK_HEADER_LEN,
+					data_offset, read_timeout), fused);
+}
+
+/* Wrapper, as for lecroy_get_data() */
+long lecroy_get_data_with_trigtime(VXI11_CLINK * clink, char chan,
+				   int clear_sweeps, char *buf, size_t buf_len,
+				   double *trig_time, double *trig_offset,
+				   int max_segments,
+				   struct lecroy_wavedesc *desc,
+				   unsigned long timeout)
+{
+	return lecroy_get_data_with_trigtime(clink, chan, clear_sweeps, buf,
+					     buf_len, trig_time, trig_offset,
+					     max_segments, desc, 1, timeout);
+}
+
+/* Same as lecroy_get_data(), but also gets the trigger time of every segment
+ * of a sequence (segmented) acquisition. Rather than asking for DAT1 and then
+ * TIME separately, we ask for "WF? ALL", which comes back as one data block:
+ *   <WAVEDESC><USERTEXT><TRIGTIME><RIS_TIME><DAT1><DAT2>
+ * with the length of each part given in the WAVEDESC. The sample data goes
+ * into "buf" as usual; the trigger times (relative to the first segment) and
+ * trigger offsets (time from the trigger to the first point of each segment)
+ * go into the trig_time and trig_offset arrays, which must have room for
+ * max_segments values each (if there are more segments than that, the rest
+ * are read and thrown away, and we say so). If desc is not NULL the waveform descriptor is
+ * copied into it too, which saves asking for it again when writing the wfi
+ * file. Returns the number of bytes of sample data, as lecroy_get_data(). */
+long lecroy_get_data_with_trigtime(VXI11_CLINK * clink, char chan,
+				   int clear_sweeps, char *buf, size_t buf_len,
+				   double *trig_time, double *trig_offset,
+				   int max_segments,
+				   struct lecroy_wavedesc *desc, int arm_and_wait,
+				   unsigned long timeout)
+{
+	struct lecroy_wavedesc tmp_desc;
+	char *all_buf;
+	size_t all_buf_len;
+	long ret, offset, trig, no_of_segments;
+
+	if (desc == NULL)
+		desc = &tmp_desc;
+
+	/* Room for the descriptor, user text (at most 160 bytes) and two
+	 * doubles of TRIGTIME per segment, on top of the data itself. If the
+	 * scope sends more than that (more segments than max_segments, say)
+	 * the buffer grows to fit, rather than the rest of the block being
+	 * left on the link. */
+	all_buf_len = buf_len + LECROY_WAVEDESC_LEN + 160 + (16 * max_segments) +
+	    LECROY_DATA_BLOCK_HEADER_LEN;
+	all_buf = lecroy_get_receive_buffer(clink, all_buf_len);
+	ret = lecroy_get_all_growing(clink, chan, clear_sweeps, &all_buf,
+				     &all_buf_len, &offset, desc,
+				     arm_and_wait, timeout);
+	if (ret <= 0) {
+		lecroy_put_receive_buffer(all_buf);
+		return ret;
 	}
-	if ((is_maths_chan == 1) && (clear_sweeps == 1))
-		lecroy_wait_all_averages(clink, timeout);
-	lecroy_scope_channel_str(chan, source);
-	vxi11_send_printf(clink, "%s:WF? DAT1", source);
-	return lecroy_receive_data_block(clink, buf, buf_len, timeout);
+
+	/* The trigger times are just in front of the RIS times, which are
+	 * just in front of the data */
+	trig = offset - desc->ris_time_array - desc->trigtime_array;
+	no_of_segments = desc->trigtime_array / 16;
+	if (no_of_segments > max_segments)
+		printf
+		    ("lecroy_get_data_with_trigtime: %ld segments, but only room for %d trigger times\n",
+		     no_of_segments, max_segments);
+	if (desc->trigtime_array > 0 && trig >= 0)
+		lecroy_parse_trigtime(all_buf + trig, desc->trigtime_array,
+				      desc->comm_order, trig_time, trig_offset,
+				      max_segments);
+
+	if (ret > (long)buf_len) {
+		printf
+		    ("lecroy_get_data_with_trigtime: %ld bytes of data, but only room for %ld\n",
+		     ret, (long)buf_len);
+		ret = buf_len;
+	}
+	memcpy(buf, all_buf + offset, ret);
+	lecroy_put_receive_buffer(all_buf);
+	return ret;
+}
+
+/* Decodes a TRIGTIME array (as returned by "WF? TIME" or found inside a
+ * "WF? ALL"). Each segment has two doubles: the trigger time, and the trigger
+ * offset. The byte order is that given in the descriptor (comm_order). Fills
+ * in at most max_segments values of each, and returns the number of segments
+ * decoded. */
+int lecroy_parse_trigtime(const char *buf, size_t len, int comm_order,
+			  double *trig_time, double *trig_offset,
+			  int max_segments)
+{
+	int l, no_of_segments;
+
+	no_of_segments = (int)(len / 16);
+	if (no_of_segments > max_segments)
+		no_of_segments = max_segments;
+	for (l = 0; l < no_of_segments; l++) {
+		trig_time[l] = lecroy_wavedesc_double(buf + (16 * l), comm_order);
+		trig_offset[l] =
+		    lecroy_wavedesc_double(buf + (16 * l) + 8, comm_order);
+	}
+	return no_of_segments;
+}
+
+/* Writes the trigger times of a segmented acquisition to a text file, in the
+ * same spirit as the wfi file. One line per segment: trigger time (relative
+ * to the first segment) then trigger offset, both in seconds. */
+int lecroy_write_trigtime_file(char *wftname, double *trig_time,
+			       double *trig_offset, int no_of_segments,
+			       char *captured_by)
+{
+	FILE *wft;
+	int l;
+
+	wft = fopen(wftname, "w");
+	if (wft == NULL) {
+		printf
+		    ("error: lecroy_write_trigtime_file: could not open %s for writing\n",
+		     wftname);
+		return -1;
+	}
+	fprintf(wft, "%% %s\n", wftname);
+	fprintf(wft, "%% Trigger times captured using %s\n\n", captured_by);
+	fprintf(wft, "%% Number of segments:\n%d\n\n", no_of_segments);
+	fprintf(wft, "%% Trigger time (s), trigger offset (s):\n");
+	for (l = 0; l < no_of_segments; l++)
+		fprintf(wft, "%.12g %.12g\n", trig_time[l], trig_offset[l]);
+	fclose(wft);
+	return 0;
 }
 
 void lecroy_set_for_auto(VXI11_CLINK * clink)
@@ -375,16 +1058,26 @@ int lecroy_wait_all_averages(VXI11_CLINK * clink, unsigned long timeout)
 	return 0;
 }
 
-/* This wrapper first calculates the number of bytes, then passes this information on to the main function */
+/* This wrapper fetches the waveform descriptor, then passes the number of
+ * bytes (and everything else) on to the main function. One query in total.
+ * Like lecroy_calculate_no_of_bytes(), it describes the waveform stored in
+ * the channel, so write the .wfi after the capture; or, with no query at
+ * all, use lecroy_write_wfi_file_from_wavedesc() with the descriptor that
+ * came with the data (lecroy_get_all_growing()). */
 long lecroy_write_wfi_file(VXI11_CLINK * clink, char *wfiname, char chan,
 			   char *captured_by, int no_of_traces,
 			   int bytes_per_point, unsigned long timeout)
 {
-	return lecroy_write_wfi_file(clink, wfiname, chan, captured_by,
-				     no_of_traces, bytes_per_point,
-				     lecroy_calculate_no_of_bytes(clink, chan,
-								  timeout),
-				     timeout);
+	struct lecroy_wavedesc desc;
+	if (lecroy_get_wavedesc(clink, chan, &desc, timeout) != 0) {
+		printf
+		    ("error: lecroy_write_wfi_file: could not obtain waveform descriptor\n");
+		return -1;
+	}
+	return lecroy_write_wfi_file_from_wavedesc(wfiname, &desc, chan,
+						   captured_by, no_of_traces,
+						   bytes_per_point,
+						   desc.wave_array_1, 0, 0);
 }
 
 /* This wrapper does not force the value of voffset (and is the usual behaviour). You might want to force voffset,
@@ -406,61 +1099,58 @@ long lecroy_write_wfi_file(VXI11_CLINK * clink, char *wfiname, char chan,
 			   unsigned long timeout, int force_voffset,
 			   double voffset)
 {
-	FILE *wfi;
-	double vgain, hinterval, hoffset;
-	int ret;
-	char cmd[256];
-	char source[20];
-	int no_of_segments;
-
-	lecroy_scope_channel_str(chan, source);
-
-	// VBS commands return quicker than INSP? commands, so where there is a
-	// direct equivalent they are used instead to speed things up
-
-//      sprintf(cmd, "%s:INSP? HORIZ_INTERVAL", source);
-//      hinterval = lecroy_obtain_insp_double(clink, cmd, timeout);
-	sprintf(cmd, "VBS? 'Return=app.Acquisition.Horizontal.TimePerPoint'");
-	hinterval = vxi11_obtain_double_value_timeout(clink, cmd, timeout);
-	sprintf(cmd, "%s:INSP? HORIZ_OFFSET", source);
-	hoffset = lecroy_obtain_insp_double(clink, cmd, timeout);
-	sprintf(cmd, "%s:INSP? VERTICAL_GAIN", source);
-	vgain = lecroy_obtain_insp_double(clink, cmd, timeout);
-	if (force_voffset == 0) {
-		sprintf(cmd, "%s:INSP? VERTICAL_OFFSET", source);
-		voffset = lecroy_obtain_insp_double(clink, cmd, timeout);
+	struct lecroy_wavedesc desc;
+	if (lecroy_get_wavedesc(clink, chan, &desc, timeout) != 0) {
+		printf
+		    ("error: lecroy_write_wfi_file: could not obtain waveform descriptor\n");
+		return -1;
 	}
-	//sprintf(cmd, "VBS? 'Return=app.Acquisition.%s.VerOffset'", source); // commented out as this doesn't work for maths channels
-	//voffset = vxi11_obtain_double_value_timeout(clink, cmd, timeout);
+	return lecroy_write_wfi_file_from_wavedesc(wfiname, &desc, chan,
+						   captured_by, no_of_traces,
+						   bytes_per_point, no_of_bytes,
+						   force_voffset, voffset);
+}
 
-	if (lecroy_is_maths_chan(chan) == 0) {
-		no_of_segments = lecroy_get_segmented(clink);	// returns 1 if not in segmented mode
+/* Writes the wfi file from a waveform descriptor you've already got, so
+ * doesn't talk to the scope at all. Previously this took one VBS? and three
+ * or four INSP? queries (plus two more to find out about segments). */
+long lecroy_write_wfi_file_from_wavedesc(char *wfiname,
+					 const struct lecroy_wavedesc *desc,
+					 char chan, char *captured_by,
+					 int no_of_traces, int bytes_per_point,
+					 long no_of_bytes, int force_voffset,
+					 double voffset)
+{
+	FILE *wfi;
+	double vgain, hinterval, hoffset;
+	long no_of_segments;
+
+	hinterval = desc->horiz_interval;
+	hoffset = desc->horiz_offset;
+	vgain = desc->vertical_gain;
+	if (force_voffset == 0)
+		voffset = desc->vertical_offset;
+
+	// SUBARRAY_COUNT is 1 if we're not in segmented mode. Maths channels
+	// return the average of all the segments, so count as one.
+	if (lecroy_is_maths_chan(chan) == 0 && desc->subarray_count > 1) {
+		no_of_segments = desc->subarray_count;
 	} else {
 		no_of_segments = 1;
 	}
 
 	wfi = fopen(wfiname, "w");
-	if (wfi > 0) {
+	if (wfi != NULL) {
 		fprintf(wfi, "%% %s\n", wfiname);
 		fprintf(wfi, "%% Waveform captured using %s\n\n", captured_by);
-		if (no_of_segments == 0) {
-			fprintf(wfi, "%% Number of bytes:\n%d\n\n",
-				no_of_bytes);
-		} else {
-			fprintf(wfi, "%% Number of bytes:\n%d\n\n",
-				(no_of_bytes / no_of_segments));
-		}
+		fprintf(wfi, "%% Number of bytes:\n%ld\n\n",
+			(no_of_bytes / no_of_segments));
 		fprintf(wfi, "%% Vertical gain:\n%g\n\n", vgain);
 		fprintf(wfi, "%% Vertical offset:\n%g\n\n", voffset);
 		fprintf(wfi, "%% Horizontal interval:\n%g\n\n", hinterval);
 		fprintf(wfi, "%% Horizontal offset:\n%g\n\n", hoffset);
-		if (no_of_segments == 0) {
-			fprintf(wfi, "%% Number of traces:\n%d\n\n",
-				no_of_traces);
-		} else {
-			fprintf(wfi, "%% Number of traces:\n%d\n\n",
-				(no_of_traces * no_of_segments));
-		}
+		fprintf(wfi, "%% Number of traces:\n%ld\n\n",
+			(no_of_traces * no_of_segments));
 		fprintf(wfi, "%% Number of bytes per data-point:\n%d\n\n",
 			bytes_per_point);
 		fprintf(wfi,
@@ -476,6 +1166,61 @@ long lecroy_write_wfi_file(VXI11_CLINK * clink, char *wfiname, char chan,
 	return no_of_bytes;
 }
 
+/* Reads a .wfi file back in (written by lecroy_write_wfi_file() or
+ * similar). Each value follows a "% <what it is>:" comment line; anything we
+ * don't recognise is skipped. Returns 0, or -1 if the file can't be read or
+ * hasn't got the number of bytes in it. */
+int lecroy_read_wfi_file(const char *wfiname, struct lecroy_wfi *wfi)
+{
+	FILE *f;
+	char line[256];
+	char label[256];
+
+	memset(wfi, 0, sizeof(struct lecroy_wfi));
+	wfi->no_of_traces = 1;
+	wfi->bytes_per_point = 2;
+	wfi->no_of_bytes = -1;
+	f = fopen(wfiname, "r");
+	if (f == NULL) {
+		printf("error: lecroy_read_wfi_file: could not open %s\n",
+		       wfiname);
+		return -1;
+	}
+	label[0] = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '%') {
+			strcpy(label, line);
+			continue;
+		}
+		if (line[0] == '\n' || label[0] == 0)
+			continue;
+		if (strstr(label, "Number of bytes per data-point") != NULL)
+			sscanf(line, "%d", &wfi->bytes_per_point);
+		else if (strstr(label, "Number of bytes") != NULL)
+			sscanf(line, "%ld", &wfi->no_of_bytes);
+		else if (strstr(label, "Vertical gain") != NULL)
+			sscanf(line, "%lg", &wfi->vgain);
+		else if (strstr(label, "Vertical offset") != NULL)
+			sscanf(line, "%lg", &wfi->voffset);
+		else if (strstr(label, "Horizontal interval") != NULL)
+			sscanf(line, "%lg", &wfi->horiz_interval);
+		else if (strstr(label, "Horizontal offset") != NULL)
+			sscanf(line, "%lg", &wfi->horiz_offset);
+		else if (strstr(label, "Number of traces") != NULL)
+			sscanf(line, "%ld", &wfi->no_of_traces);
+		else if (strstr(label, "Keep all datapoints") != NULL)
+			sscanf(line, "%d", &wfi->keep_all_points);
+		label[0] = 0;
+	}
+	fclose(f);
+	if (wfi->no_of_bytes < 0) {
+		printf("error: lecroy_read_wfi_file: %s has no number of bytes\n",
+		       wfiname);
+		return -1;
+	}
+	return 0;
+}
+
 /* Here, "chan" is either one of the acquisistion channels (1-4), or one of
  * the maths channels (A-D). In setting the number of averages, the 
  * nomenclature forces you to state not only the maths channel (quite
@@ -830,19 +1575,102 @@ long lecroy_average_segmented_data(char *in_buf, size_t in_buf_len,
 				   char *out_buf, size_t out_buf_len,
 				   int no_of_segments, int bytes_per_point)
 {
-	int i, j, points_per_trace;
-// need a temporary buffer to store the running total in, this needs to be >16 bits long, an int will do
-	int *int_buf;
-	short *short_in_buf, *short_out_buf;
-	signed char *signed_char_in_buf, *signed_char_out_buf;
+	return lecroy_average_segmented_data(in_buf, in_buf_len, out_buf,
+					     out_buf_len, no_of_segments,
+					     bytes_per_point, 1);
+}
+
+/* We work through the points in chunks of this many; small enough for the
+ * running totals to stay in cache, big enough to keep the threads busy. */
+#define	LECROY_CHUNK_POINTS	16384
+
+/* The easiest way of telling the PC what sort of numbers the bytes or words
+ * represent is to memcpy() them into a variable of the right sort (see the
+ * flow chart below). Doing this one point at a time means we don't need a
+ * whole extra copy of the input, and the compiler turns it into a plain load */
+static inline int lecroy_char_to_int(const char *buf, long i,
+				     int bytes_per_point)
+{
+	signed char c;
+	short s;
+	if (bytes_per_point == 1) {
+		memcpy(&c, buf + i, 1);
+		return (int)c;
+	}
+	memcpy(&s, buf + (2 * i), 2);
+	return (int)s;
+}
 
-	points_per_trace =
-	    (int)(in_buf_len / (bytes_per_point * no_of_segments));
+static inline void lecroy_int_to_char(char *buf, long i, int value,
+				      int bytes_per_point)
+{
+	signed char c;
+	short s;
+	if (bytes_per_point == 1) {
+		c = (signed char)value;
+		memcpy(buf + i, &c, 1);
+	} else {
+		s = (short)value;
+		memcpy(buf + (2 * i), &s, 2);
+	}
+}
+
+struct lecroy_average_args {
+	const char *in_buf;
+	char *out_buf;
+	long points_per_trace;
+	long out_points;
+	int no_of_segments;
+	int bytes_per_point;
+};
+
+/* Averages points [start, end) of all the segments. Each point is worked out
+ * in exactly the same way whichever thread does it, and whatever the chunk
+ * boundaries are, so the result doesn't depend on the number of threads. */
+static void lecroy_average_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_average_args *args = (struct lecroy_average_args *)ptr;
+	// need a temporary buffer to store the running total in, this needs to be >16 bits long, a long will do
+	long sum[LECROY_CHUNK_POINTS];
+	long i, j, n, p0;
+	const char *seg;
+
+	for (p0 = start; p0 < end; p0 += LECROY_CHUNK_POINTS) {
+		n = end - p0;
+		if (n > LECROY_CHUNK_POINTS)
+			n = LECROY_CHUNK_POINTS;
+		for (i = 0; i < n; i++)
+			sum[i] = 0;
+		// Go through segment by segment, as this is the order they're stored
+		// in in the array; each segment's chunk is contiguous in memory.
+		for (j = 0; j < args->no_of_segments; j++) {
+			seg =
+			    args->in_buf +
+			    (j * args->points_per_trace +
+			     p0) * args->bytes_per_point;
+			for (i = 0; i < n; i++)
+				sum[i] +=
+				    lecroy_char_to_int(seg, i,
+						       args->bytes_per_point);
+		}
+		for (i = 0; i < n && p0 + i < args->out_points; i++) {
+			lecroy_int_to_char(args->out_buf, p0 + i,
+					   (int)(sum[i] / args->no_of_segments),
+					   args->bytes_per_point);
+		}
+	}
+}
 
-	int_buf = new int[points_per_trace];
-	// Set the VALUES to be zero (memset with zeros does NOT work!)
-	for (i = 0; i < points_per_trace; i++)
-		int_buf[i] = 0;
+/* As above, but splits the points of the trace up amongst no_of_threads
+ * threads (<=0 means one per core). The result is identical, byte for byte,
+ * to the single-threaded version. Returns the number of bytes written to
+ * out_buf. */
+long lecroy_average_segmented_data(char *in_buf, size_t in_buf_len,
+				   char *out_buf, size_t out_buf_len,
+				   int no_of_segments, int bytes_per_point,
+				   int no_of_threads)
+{
+	struct lecroy_average_args args;
 
 	/* We average a stack of segmented traces by adding up the values of 
 	 * each point, then dividing the sum (of each point) by the number of
@@ -852,11 +1680,11 @@ long lecroy_average_segmented_data(char *in_buf, size_t in_buf_len,
 	 * these correspond to int8 (signed char) or int16 (short int) numbers.
 	 * How to tell the PC this? Well I tried converting from 2's compliment
 	 * back to the numbers they represent and storing them in new arrays, but
-	 * it was messy. It turns out the easiest way is to make a new array of
-	 * the right sort (signed char or short) and right size, and use memcpy()
-	 * to simply move the bytes over to the new array, and when they are 
-	 * read from the array they are interpreted correctly. We also need to
-	 * do this once we've done the averaging. The flow chart is as follows:
+	 * it was messy. It turns out the easiest way is to use memcpy() to
+	 * simply move the bytes over to a variable of the right sort (signed
+	 * char or short), and when they are read they are interpreted
+	 * correctly. We also need to do this once we've done the averaging. The
+	 * flow chart is as follows:
 	 *
 	 *                      (unsigned) char
 	 *                             |
@@ -866,7 +1694,7 @@ long lecroy_average_segmented_data(char *in_buf, size_t in_buf_len,
 	 *     8-bit---> signed char       short int <---16-bit
 	 *                      \             /
 	 *                       \           /
-	 *            int (signed 32 bit) to do maths
+	 *            long (signed 64 bit) to do maths
 	 *                       /           \
 	 *                      /             \
 	 *     8-bit---> signed char       short int <---16-bit
@@ -878,47 +1706,19 @@ long lecroy_average_segmented_data(char *in_buf, size_t in_buf_len,
 	 *                      (unsigned) char
 	 *
 	 */
-	if (bytes_per_point == 1) {
-		signed_char_in_buf = new signed char[in_buf_len];
-		signed_char_out_buf = new signed char[points_per_trace];
-		memcpy(signed_char_in_buf, in_buf, in_buf_len);
-		// Go through each point in the trace. This isn't the order they're stored in
-		// in the array, but it's the most logical way of doing the maths.
-		for (i = 0; i < points_per_trace; i++) {
-			for (j = 0; j < no_of_segments; j++) {	// running everage
-				int_buf[i] +=
-				    signed_char_in_buf[(j * points_per_trace) +
-						       i];
-			}
-			int_buf[i] /= no_of_segments;
-			if ((int_buf[i] > 127) || (int_buf[i] < -128)) {
-				printf("int_buf[%d] = %d\n", i, int_buf[i]);
-			}
-			signed_char_out_buf[i] = (signed char)int_buf[i];
-		}
-		memcpy(out_buf, signed_char_out_buf, out_buf_len);
-		delete[]signed_char_out_buf;
-		delete[]signed_char_in_buf;
-	} else {
-		short_in_buf = new short[in_buf_len / bytes_per_point];
-		short_out_buf = new short[points_per_trace];
-		memcpy(short_in_buf, in_buf, in_buf_len);
-		for (i = 0; i < points_per_trace; i++) {
-			for (j = 0; j < no_of_segments; j++) {
-				int_buf[i] +=
-				    short_in_buf[(j * points_per_trace) + i];
-			}
-			int_buf[i] /= no_of_segments;
-			if ((int_buf[i] > 32767) || (int_buf[i] < -32768)) {
-				printf("int_buf[%d] = %d\n", i, int_buf[i]);
-			}
-			short_out_buf[i] = (short)int_buf[i];
-		}
-		memcpy(out_buf, short_out_buf, out_buf_len);
-		delete[]short_out_buf;
-		delete[]short_in_buf;
-	}
-	delete[]int_buf;
+	args.in_buf = in_buf;
+	args.out_buf = out_buf;
+	args.no_of_segments = no_of_segments;
+	args.bytes_per_point = bytes_per_point;
+	args.points_per_trace =
+	    (long)(in_buf_len / (bytes_per_point * no_of_segments));
+	args.out_points = (long)(out_buf_len / bytes_per_point);
+	if (args.out_points > args.points_per_trace)
+		args.out_points = args.points_per_trace;
+
+	lecroy_parallel_for(args.out_points, LECROY_CHUNK_POINTS, no_of_threads,
+			    lecroy_average_kernel, &args);
+	return args.out_points * bytes_per_point;
 }
 
 /* Generic functions to subtract two arrays: A-B = OUT. A, B and OUT can be any
@@ -929,74 +1729,116 @@ long lecroy_subtract_char_arrays(char *in_buf_a, char *in_buf_b, char *out_buf,
 				 int bytes_per_point_a, int bytes_per_point_b,
 				 int bytes_per_point_out, int points_per_trace)
 {
-	int i, j;
-	int in_buf_len_a, in_buf_len_b, out_buf_len;
-// need a temporary buffer to store the running total in, this needs to be >16 bits long, an int will do
-	int *int_buf;
-	short *short_in_buf_a, *short_in_buf_b, *short_out_buf;
-	signed char *signed_char_tmp, *signed_char_in_buf, *signed_char_out_buf;
-
-	in_buf_len_a = points_per_trace * bytes_per_point_a;
-	in_buf_len_b = points_per_trace * bytes_per_point_b;
-	out_buf_len = points_per_trace * bytes_per_point_out;
-
-	int_buf = new int[points_per_trace];
-	short_in_buf_a = new short[points_per_trace];
-	short_in_buf_b = new short[points_per_trace];
-	short_out_buf = new short[points_per_trace];
-
-	signed_char_tmp = new signed char[2 * points_per_trace];
-	signed_char_in_buf = new signed char[points_per_trace];
-	signed_char_out_buf = new signed char[points_per_trace];
-
-	if (bytes_per_point_a == 1) {
-		memcpy(signed_char_in_buf, in_buf_a, in_buf_len_a);	// memcpy "does conversion" unsigned char to signed char
-		for (i = 0; i < points_per_trace; i++) {
-			signed_char_tmp[2 * i] = 0;	// LSB = 0
-			signed_char_tmp[(2 * i) + 1] = signed_char_in_buf[i];	// MSB = 8-bit data (ie "convert" to 16 bit)
-		}
-		memcpy(short_in_buf_a, signed_char_tmp, 2 * points_per_trace);	// memcpy "does conversion" to short int
-	} else {
-		memcpy(short_in_buf_a, in_buf_a, in_buf_len_a);
-	}
-	for (i = 0; i < points_per_trace; i++) {
-		int_buf[i] = (int)short_in_buf_a[i];	// copy A into int_buf
-	}
+	return lecroy_subtract_char_arrays(in_buf_a, in_buf_b, out_buf,
+					   bytes_per_point_a, bytes_per_point_b,
+					   bytes_per_point_out, points_per_trace,
+					   1);
+}
 
-	if (bytes_per_point_b == 1) {
-		memcpy(signed_char_in_buf, in_buf_b, in_buf_len_b);
-		for (i = 0; i < points_per_trace; i++) {
-			signed_char_tmp[2 * i] = 0;
-			signed_char_tmp[(2 * i) + 1] = signed_char_in_buf[i];
-		}
-		memcpy(short_in_buf_b, signed_char_tmp, 2 * points_per_trace);
-	} else {
-		memcpy(short_in_buf_b, in_buf_b, in_buf_len_b);
-	}
-	for (i = 0; i < points_per_trace; i++) {
-		int_buf[i] -= (int)short_in_buf_b[i];	// subtract B from int_buf (containing A)
-		if (int_buf[i] < -32768)
-			int_buf[i] = -32768;	// Limit the range of numbers to those...
-		if (int_buf[i] > 32767)
-			int_buf[i] = 32767;	// ...capable of being stored in a short int
-		short_out_buf[i] = (short)int_buf[i];
+struct lecroy_subtract_args {
+	const char *in_buf_a;
+	const char *in_buf_b;
+	char *out_buf;
+	int bytes_per_point_a;
+	int bytes_per_point_b;
+	int bytes_per_point_out;
+};
+
+/* 8-bit data is "converted" to 16 bit by making it the MSB, with an LSB of
+ * zero, ie multiplying by 256. On the way out, 8-bit data is the MSB only
+ * (the LSB is thrown away). */
+static void lecroy_subtract_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_subtract_args *args = (struct lecroy_subtract_args *)ptr;
+	long i;
+	int a, b, diff;
+
+	for (i = start; i < end; i++) {
+		a = lecroy_char_to_int(args->in_buf_a, i,
+				       args->bytes_per_point_a);
+		if (args->bytes_per_point_a == 1)
+			a *= 256;
+		b = lecroy_char_to_int(args->in_buf_b, i,
+				       args->bytes_per_point_b);
+		if (args->bytes_per_point_b == 1)
+			b *= 256;
+		diff = a - b;
+		if (diff < -32768)
+			diff = -32768;	// Limit the range of numbers to those...
+		if (diff > 32767)
+			diff = 32767;	// ...capable of being stored in a short int
+		if (args->bytes_per_point_out == 1)
+			diff >>= 8;	// MSB only (throw away LSB)
+		lecroy_int_to_char(args->out_buf, i, diff,
+				   args->bytes_per_point_out);
 	}
+}
 
-	if (bytes_per_point_out == 1) {
-		memcpy(signed_char_tmp, short_out_buf, 2 * points_per_trace);	// copy all bytes to a temporary signed char array. The LSB bytes are nonsense.
-		for (i = 0; i < points_per_trace; i++) {
-			signed_char_out_buf[i] = signed_char_tmp[(2 * i) + 1];	// MSB only (throw away LSB)
-		}
-		memcpy(out_buf, signed_char_out_buf, out_buf_len);
-	} else {
-		memcpy(out_buf, short_out_buf, out_buf_len);
+/* As above, but spread over no_of_threads threads (<=0 means one per core).
+ * Returns the number of bytes written to out_buf. */
+long lecroy_subtract_char_arrays(char *in_buf_a, char *in_buf_b, char *out_buf,
+				 int bytes_per_point_a, int bytes_per_point_b,
+				 int bytes_per_point_out, int points_per_trace,
+				 int no_of_threads)
+{
+	struct lecroy_subtract_args args;
+
+	args.in_buf_a = in_buf_a;
+	args.in_buf_b = in_buf_b;
+	args.out_buf = out_buf;
+	args.bytes_per_point_a = bytes_per_point_a;
+	args.bytes_per_point_b = bytes_per_point_b;
+	args.bytes_per_point_out = bytes_per_point_out;
+	lecroy_parallel_for(points_per_trace, LECROY_CHUNK_POINTS,
+			    no_of_threads, lecroy_subtract_kernel, &args);
+	return (long)points_per_trace *bytes_per_point_out;
+}
+
+/* Converts raw data (8 or 16 bit, as above) into volts, using the vertical
+ * gain and offset from the wfi file or waveform descriptor:
+ *     volts = vgain * data - voffset
+ * out_buf must have room for no_of_points doubles. */
+long lecroy_scale_char_array(char *in_buf, double *out_buf,
+			     int bytes_per_point, long no_of_points,
+			     double vgain, double voffset)
+{
+	return lecroy_scale_char_array(in_buf, out_buf, bytes_per_point,
+				       no_of_points, vgain, voffset, 1);
+}
+
+struct lecroy_scale_args {
+	const char *in_buf;
+	double *out_buf;
+	int bytes_per_point;
+	double vgain;
+	double voffset;
+};
+
+static void lecroy_scale_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_scale_args *args = (struct lecroy_scale_args *)ptr;
+	long i;
+
+	for (i = start; i < end; i++) {
+		args->out_buf[i] =
+		    args->vgain * lecroy_char_to_int(args->in_buf, i,
+						     args->bytes_per_point) -
+		    args->voffset;
 	}
+}
 
-	delete[]int_buf;
-	delete[]short_in_buf_a;
-	delete[]short_in_buf_b;
-	delete[]short_out_buf;
-	delete[]signed_char_tmp;
-	delete[]signed_char_in_buf;
-	delete[]signed_char_out_buf;
+long lecroy_scale_char_array(char *in_buf, double *out_buf,
+			     int bytes_per_point, long no_of_points,
+			     double vgain, double voffset, int no_of_threads)
+{
+	struct lecroy_scale_args args;
+
+	args.in_buf = in_buf;
+	args.out_buf = out_buf;
+	args.bytes_per_point = bytes_per_point;
+	args.vgain = vgain;
+	args.voffset = voffset;
+	lecroy_parallel_for(no_of_points, LECROY_CHUNK_POINTS, no_of_threads,
+			    lecroy_scale_kernel, &args);
+	return no_of_points;
 }
@@ -23,17 +23,317 @@
  * The author's email address is steve.sharples@nottingham.ac.uk
  */
 
+#ifndef	_LECROY_VXI11_H_
+#define	_LECROY_VXI11_H_
+
+#include <pthread.h>
 #include "vxi11_user.h"
 
+/* The binary waveform descriptor (WAVEDESC block) returned by "Cx:WF? DESC".
+ * One query gets us everything we used to ask for with a string of INSP?
+ * queries. Byte offsets are those of the LECROY_2_3 template (ask the scope
+ * "TMPL?" for the full description); the descriptor is 346 bytes long. */
+#define	LECROY_WAVEDESC_LEN	346
+
+/* Pass as arm_and_wait to lecroy_get_data() and friends to send ARM;WAIT and
+ * the WF? query as one message, without a *OPC? round trip in between */
+#define	LECROY_ARM_FUSED	2
+
+/* Longest header we expect in front of a data block, eg "DAT1,#9000001000".
+ * Buffers for the *_in_place() functions need this much extra room. */
+#define	LECROY_DATA_BLOCK_HEADER_LEN	25
+
+/* Smallest buffer lecroy_receive_data_block_growing() starts with */
+#define	LECROY_GROWING_MIN_LEN	65536
+
+struct lecroy_wavedesc {
+	char descriptor_name[17];
+	char template_name[17];
+	char instrument_name[17];
+	int comm_type;		/* 0 = byte, 1 = word */
+	int comm_order;		/* 0 = HIFIRST, 1 = LOFIRST */
+	long wave_descriptor;	/* lengths (in bytes) of the blocks that make up a "WF? ALL" */
+	long user_text;
+	long trigtime_array;
+	long ris_time_array;
+	long wave_array_1;
+	long wave_array_2;
+	long wave_array_count;	/* number of data points, all segments */
+	long pnts_per_screen;
+	long first_valid_pnt;
+	long last_valid_pnt;
+	long subarray_count;	/* number of segments in sequence mode */
+	long sweeps_per_acq;	/* number of sweeps averaged */
+	int nominal_bits;
+	double vertical_gain;	/* volts = vertical_gain * data - vertical_offset */
+	double vertical_offset;
+	double horiz_interval;
+	double horiz_offset;
+	double acq_duration;
+	double trigger_seconds;	/* trigger time stamp */
+	int trigger_minutes;
+	int trigger_hours;
+	int trigger_days;
+	int trigger_months;
+	int trigger_year;
+	int record_type;
+	int processing_done;
+	int wave_source;
+};
+
 int lecroy_open(VXI11_CLINK ** clink, const char *ip);
 int lecroy_close(VXI11_CLINK * clink, const char *ip);
+int lecroy_open_control(VXI11_CLINK ** control, const char *address);
+int lecroy_close_control(VXI11_CLINK * control, const char *address);
+int lecroy_abort(VXI11_CLINK * control);
 int lecroy_init(VXI11_CLINK * clink);
 long lecroy_obtain_insp_long(VXI11_CLINK * clink, const char *cmd,
 			     unsigned long timeout);
 double lecroy_obtain_insp_double(VXI11_CLINK * clink, const char *cmd,
 				 unsigned long timeout);
+/* Running statistics of every point of a stack of traces (lecroy_stats.c) */
+struct lecroy_stats {
+	long no_of_points;	/* points per trace */
+	long count;		/* number of traces added so far */
+	long long *sum;
+	long long *sum_sq;
+	short *min;
+	short *max;
+};
+
+/* A pool of pre-faulted acquisition buffers (lecroy_pool.c) */
+#define	LECROY_POOL_HUGEPAGES	1	/* transparent huge pages */
+#define	LECROY_POOL_HUGETLB	2	/* explicit huge pages */
+#define	LECROY_POOL_MLOCK	4	/* lock into RAM */
+
+struct lecroy_pool {
+	char *base;
+	size_t map_len;
+	size_t buffer_size;	/* may be rounded up from what you asked for */
+	int no_of_buffers;
+	int *free_list;		/* stack of free buffer indices */
+	int no_free;
+	int flags;
+	int locked;
+	char *in_use;		/* per buffer, to catch a buffer put back twice */
+	pthread_mutex_t mutex;
+};
+
+/* Asynchronous writing of traces to disk (lecroy_writer.c) */
+#define	LECROY_WRITER_DIRECT	1	/* O_DIRECT, bypassing the page cache */
+#define	LECROY_WRITER_THREADS	2	/* threads, even if io_uring is available */
+#define	LECROY_WRITER_ALIGN	4096	/* O_DIRECT block alignment */
+
+struct lecroy_writer;
+
+/* Spectra (lecroy_fft.c) */
+#define	LECROY_WINDOW_RECT		0
+#define	LECROY_WINDOW_HANN		1
+#define	LECROY_WINDOW_HAMMING		2
+#define	LECROY_WINDOW_BLACKMAN_HARRIS	3
+#define	LECROY_WINDOW_FLATTOP		4
+
+struct lecroy_fft_plan;
+
+/* Event gating of segmented data (lecroy_gate.c) */
+#define	LECROY_GATE_THRESHOLD	0	/* signal crosses level (volts) */
+#define	LECROY_GATE_PEAK	1	/* max |signal| >= level (volts) */
+#define	LECROY_GATE_ENERGY	2	/* mean square signal >= level (V^2) */
+#define	LECROY_GATE_TEMPLATE	3	/* correlation with templ >= level */
+#define	LECROY_GATE_ANY		0	/* keep if any criterion is met */
+#define	LECROY_GATE_ALL		1	/* keep only if all of them are */
+#define	LECROY_GATE_MAX_CRITERIA	8
+
+struct lecroy_gate_criterion {
+	int type;
+	long start;		/* the gate: points [start, end) of each segment; */
+	long end;		/* end <= 0 means to the end of the segment */
+	double level;
+	const double *templ;	/* template shape (volts), for LECROY_GATE_TEMPLATE */
+	long templ_len;
+};
+
+struct lecroy_gate_record {
+	long segment;
+	int kept;
+	float value[LECROY_GATE_MAX_CRITERIA];	/* what each criterion measured */
+};
+
+struct lecroy_gate {
+	struct lecroy_gate_criterion criteria[LECROY_GATE_MAX_CRITERIA];
+	int no_of_criteria;
+	int combine;
+	long points_per_segment;
+	int bytes_per_point;
+	double vgain;
+	double voffset;
+	double raw_level[LECROY_GATE_MAX_CRITERIA];
+	double *templ[LECROY_GATE_MAX_CRITERIA];	/* mean removed */
+	double templ_norm[LECROY_GATE_MAX_CRITERIA];
+	long segments_seen;
+	long segments_kept;
+};
+
+/* Captures in the background (lecroy_async.c) */
+#define	LECROY_CAPTURE_QUEUED		0
+#define	LECROY_CAPTURE_RUNNING		1
+#define	LECROY_CAPTURE_ACQUIRED		2	/* data on its way */
+#define	LECROY_CAPTURE_DONE		3
+#define	LECROY_CAPTURE_CANCELLED	4
+
+struct lecroy_async;
+struct lecroy_capture;
+
+/* Sharing a link between threads (lecroy_sched.c). Lower classes go first. */
+#define	LECROY_SCHED_CONTROL	0
+#define	LECROY_SCHED_STATUS	1
+#define	LECROY_SCHED_BULK	2
+#define	LECROY_SCHED_CLASSES	3
+
+struct lecroy_sched;
+
+struct lecroy_sched_stats {
+	long queued;		/* waiting for a turn right now */
+	long max_queued;
+	long turns;		/* turns had with the link */
+	double total_wait;	/* seconds, from asking to getting a turn */
+	double max_wait;
+	double total_held;	/* seconds, with the link */
+};
+
+/* Choosing the quickest way to average (lecroy_plan.c) */
+#define	LECROY_PLAN_AUTO	-1	/* let lecroy_plan_choose() decide */
+#define	LECROY_PLAN_SCOPE_AVG	0	/* AVG maths on the scope */
+#define	LECROY_PLAN_SEGMENTED	1	/* segments, averaged on the PC */
+#define	LECROY_PLAN_STREAM	2	/* one trace at a time, on the PC */
+#define	LECROY_PLAN_STRATEGIES	3
+
+struct lecroy_plan {
+	/* What lecroy_plan_measure() found; times are in seconds */
+	long no_of_points;	/* per trace */
+	int bytes_per_point;
+	double latency;		/* one query and its answer */
+	double acquire_time;	/* ARM to *OPC? answered, one trigger */
+	double trigger_period;	/* between segments in sequence mode */
+	double sweep_period;	/* per sweep, averaging on the scope */
+	double transfer_rate;	/* bytes/s */
+	double host_rate;	/* points/s, adding up on the PC */
+	long max_segments;	/* 0 means whatever the scope allows; set it
+				 * yourself if you know better */
+	int no_of_threads;
+	/* What lecroy_plan_choose() made of it */
+	int strategy;
+	long segments;		/* per capture, for LECROY_PLAN_SEGMENTED */
+	double cost[LECROY_PLAN_STRATEGIES];	/* predicted seconds */
+};
+
+/* Choosing the number of segments (lecroy_tune.c) */
+#define	LECROY_TUNE_MAX_PROBES	24
+
+struct lecroy_tune_probe {
+	long segments;
+	long bytes;		/* per capture */
+	double acquire;		/* seconds, ARM to *OPC? answered */
+	double transfer;	/* seconds, WF? to the last byte */
+	double triggers_per_second;
+};
+
+struct lecroy_tune {
+	/* Budgets, set before lecroy_tune_run(); 0 means no limit */
+	double max_latency;	/* seconds per capture, ARM to the last byte */
+	long max_bytes;		/* per capture */
+	long max_segments;
+	/* What it was tuned at (lecroy_tune_check() compares) */
+	char chan;
+	long no_of_points;	/* per segment */
+	int bytes_per_point;
+	double horiz_interval;
+	/* What the probes found */
+	int no_of_probes;
+	struct lecroy_tune_probe probe[LECROY_TUNE_MAX_PROBES];
+	long scope_max_segments;	/* 0 if we never ran into it */
+	double fixed_cost;	/* seconds per capture, whatever its size */
+	double trigger_period;	/* seconds per extra segment */
+	double transfer_rate;	/* bytes/s */
+	/* What was chosen */
+	long segments;
+	double triggers_per_second;	/* predicted */
+	double latency;		/* predicted, seconds per capture */
+};
+
+/* Lossless compression of traces (lecroy_wfz.c) */
+#define	LECROY_WFZ_BLOCK	4096	/* points per block */
+
+struct lecroy_wfz_info {
+	int bytes_per_point;
+	int shift;		/* low bits that were always zero */
+	long no_of_points;
+	long points_per_trace;
+	long no_of_traces;
+	long no_of_blocks;
+};
+
+/* What's in a .wfi file (see lecroy_read_wfi_file()) */
+struct lecroy_wfi {
+	long no_of_bytes;	/* per trace */
+	double vgain;
+	double voffset;
+	double horiz_interval;
+	double horiz_offset;
+	long no_of_traces;
+	int bytes_per_point;
+	int keep_all_points;
+};
+
+/* Persistence, a 2D histogram of traces (lecroy_persist.c) */
+struct lecroy_persist {
+	long no_of_points;	/* per trace */
+	int bytes_per_point;
+	int columns;		/* across, time */
+	int rows;		/* up, amplitude */
+	int raw_lo;		/* the rows cover raw values [raw_lo, raw_hi) */
+	int raw_hi;
+	unsigned int *counts;	/* rows + 1 per column, column after column;
+				 * the extra one is off the top or bottom */
+	int *column_of;		/* of each point */
+	long *first_point;	/* of each column, columns + 1 of them */
+	unsigned int weight;	/* what a hit adds to the counts */
+	double decay;		/* per trace, 1 means none */
+	long traces;
+};
+
+/* Min/max envelope pyramid for plotting big records (lecroy_envelope.c) */
+#define	LECROY_ENVELOPE_BASE_SHIFT	4	/* level 0 blocks are 16 points */
+#define	LECROY_ENVELOPE_MAX_LEVELS	48
+
+struct lecroy_envelope {
+	long no_of_points;
+	int bytes_per_point;
+	int base_shift;		/* level k blocks are 2^(base_shift + k) points */
+	int no_of_levels;
+	long level_len[LECROY_ENVELOPE_MAX_LEVELS];
+	short *min[LECROY_ENVELOPE_MAX_LEVELS];	/* raw units */
+	short *max[LECROY_ENVELOPE_MAX_LEVELS];
+	double vgain;
+	double voffset;
+	double horiz_interval;
+	double horiz_offset;
+};
+
+int lecroy_parse_wavedesc(const char *buf, size_t len,
+			  struct lecroy_wavedesc *desc);
+int lecroy_get_wavedesc(VXI11_CLINK * clink, char chan,
+			struct lecroy_wavedesc *desc, unsigned long timeout);
+int lecroy_set_receive_pool(VXI11_CLINK * clink, struct lecroy_pool *pool);
 long lecroy_receive_data_block(VXI11_CLINK * clink, char *buffer,
 			       size_t len, unsigned long timeout);
+long lecroy_receive_data_block_in_place(VXI11_CLINK * clink, char *buffer,
+					size_t len, long *data_offset,
+					unsigned long timeout);
+long lecroy_receive_data_block_growing(VXI11_CLINK * clink, char **buffer,
+				       size_t *len, long *data_offset,
+				       unsigned long timeout);
+void lecroy_free_receive_buffer(char *buffer);
 long lecroy_calculate_no_of_bytes(VXI11_CLINK * clink, char chan,
 				  unsigned long timeout);
 long lecroy_calculate_no_of_bytes_from_vbs(VXI11_CLINK * clink, char chan);
@@ -42,6 +342,44 @@ long lecroy_get_data(VXI11_CLINK * clink, char chan, int clear_sweeps,
 long lecroy_get_data(VXI11_CLINK * clink, char chan, int clear_sweeps,
 		     char *buf, size_t buf_len, int arm_and_wait,
 		     unsigned long timeout);
+long lecroy_get_data(VXI11_CLINK * clink, char chan, int clear_sweeps,
+		     char *buf, size_t buf_len, int arm_and_wait,
+		     unsigned long timeout, void (*acquired) (void *arg),
+		     void *arg);
+long lecroy_get_data_in_place(VXI11_CLINK * clink, char chan,
+			      int clear_sweeps, char *buf, size_t buf_len,
+			      long *data_offset, int arm_and_wait,
+			      unsigned long timeout);
+long lecroy_get_data_growing(VXI11_CLINK * clink, char chan, int clear_sweeps,
+			     char **buf, size_t *buf_len, long *data_offset,
+			     int arm_and_wait, unsigned long timeout);
+long lecroy_get_all_growing(VXI11_CLINK * clink, char chan, int clear_sweeps,
+			    char **buf, size_t *buf_len, long *data_offset,
+			    struct lecroy_wavedesc *desc, int arm_and_wait,
+			    unsigned long timeout);
+long lecroy_get_all_growing(VXI11_CLINK * clink, char chan, int clear_sweeps,
+			    char **buf, size_t *buf_len, long *data_offset,
+			    struct lecroy_wavedesc *desc, int arm_and_wait,
+			    unsigned long timeout, void (*acquired) (void *arg),
+			    void *arg);
+long lecroy_get_data_with_trigtime(VXI11_CLINK * clink, char chan,
+				   int clear_sweeps, char *buf, size_t buf_len,
+				   double *trig_time, double *trig_offset,
+				   int max_segments,
+				   struct lecroy_wavedesc *desc,
+				   unsigned long timeout);
+long lecroy_get_data_with_trigtime(VXI11_CLINK * clink, char chan,
+				   int clear_sweeps, char *buf, size_t buf_len,
+				   double *trig_time, double *trig_offset,
+				   int max_segments,
+				   struct lecroy_wavedesc *desc, int arm_and_wait,
+				   unsigned long timeout);
+int lecroy_parse_trigtime(const char *buf, size_t len, int comm_order,
+			  double *trig_time, double *trig_offset,
+			  int max_segments);
+int lecroy_write_trigtime_file(char *wftname, double *trig_time,
+			       double *trig_offset, int no_of_segments,
+			       char *captured_by);
 void lecroy_set_for_auto(VXI11_CLINK * clink);
 void lecroy_set_for_norm(VXI11_CLINK * clink);
 void lecroy_single(VXI11_CLINK * clink);
@@ -61,6 +399,13 @@ long lecroy_write_wfi_file(VXI11_CLINK * clink, char *wfiname, char chan,
 			   int bytes_per_point, long no_of_bytes,
 			   unsigned long timeout, int force_voffset,
 			   double voffset);
+long lecroy_write_wfi_file_from_wavedesc(char *wfiname,
+					 const struct lecroy_wavedesc *desc,
+					 char chan, char *captured_by,
+					 int no_of_traces, int bytes_per_point,
+					 long no_of_bytes, int force_voffset,
+					 double voffset);
+int lecroy_read_wfi_file(const char *wfiname, struct lecroy_wfi *wfi);
 char lecroy_set_averages(VXI11_CLINK * clink, char chan, int no_averages);
 int lecroy_get_averages(VXI11_CLINK * clink, char chan);
 char lecroy_set_segmented_averages(VXI11_CLINK * clink, char chan,
@@ -84,6 +429,212 @@ long lecroy_average_segmented_data(char *in_buf, size_t in_buf_len,
 long lecroy_subtract_char_arrays(char *in_buf_a, char *in_buf_b, char *out_buf,
 				 int bytes_per_point_a, int bytes_per_point_b,
 				 int bytes_per_point_out, int points_per_trace);
+long lecroy_average_segmented_data(char *in_buf, size_t in_buf_len,
+				   char *out_buf, size_t out_buf_len,
+				   int no_of_segments, int bytes_per_point,
+				   int no_of_threads);
+long lecroy_subtract_char_arrays(char *in_buf_a, char *in_buf_b, char *out_buf,
+				 int bytes_per_point_a, int bytes_per_point_b,
+				 int bytes_per_point_out, int points_per_trace,
+				 int no_of_threads);
+long lecroy_scale_char_array(char *in_buf, double *out_buf,
+			     int bytes_per_point, long no_of_points,
+			     double vgain, double voffset);
+long lecroy_scale_char_array(char *in_buf, double *out_buf,
+			     int bytes_per_point, long no_of_points,
+			     double vgain, double voffset, int no_of_threads);
+
+/* lecroy_align.c */
+long lecroy_align_segmented_data(char *in_buf, size_t in_buf_len,
+				 char *out_buf, size_t out_buf_len,
+				 int no_of_segments, int bytes_per_point,
+				 long window_start, long window_end,
+				 long max_shift, double *shifts);
+long lecroy_align_segmented_data(char *in_buf, size_t in_buf_len,
+				 char *out_buf, size_t out_buf_len,
+				 int no_of_segments, int bytes_per_point,
+				 long window_start, long window_end,
+				 long max_shift, double *shifts,
+				 int no_of_threads);
+
+/* lecroy_parallel.c */
+int lecroy_get_no_of_threads(int no_of_threads);
+void lecroy_parallel_for(long n, long chunk, int no_of_threads,
+			 void (*fn) (void *arg, long start, long end),
+			 void *arg);
+
+/* lecroy_pool.c */
+int lecroy_pool_create(struct lecroy_pool *pool, int no_of_buffers,
+		       size_t buffer_size, int flags);
+void lecroy_pool_destroy(struct lecroy_pool *pool);
+char *lecroy_pool_get(struct lecroy_pool *pool);
+int lecroy_pool_put(struct lecroy_pool *pool, char *buf);
+
+/* lecroy_writer.c */
+struct lecroy_writer *lecroy_writer_open(const char *filename,
+					 long long prealloc,
+					 size_t max_in_flight, int flags);
+int lecroy_writer_flags(struct lecroy_writer *w);
+int lecroy_writer_write(struct lecroy_writer *w, const char *buf, size_t len);
+int lecroy_writer_flush(struct lecroy_writer *w);
+int lecroy_writer_close(struct lecroy_writer *w);
+
+/* lecroy_fft.c */
+struct lecroy_fft_plan *lecroy_fft_plan_create(long n, int window);
+void lecroy_fft_plan_destroy(struct lecroy_fft_plan *plan);
+long lecroy_fft_no_of_bins(const struct lecroy_fft_plan *plan);
+double lecroy_fft_enbw(const struct lecroy_fft_plan *plan);
+int lecroy_fft_real(const struct lecroy_fft_plan *plan, const double *in,
+		    double *out_re, double *out_im);
+long lecroy_fft_power_spectrum(const struct lecroy_fft_plan *plan,
+			       const char *buf, size_t buf_len,
+			       int bytes_per_point, double vgain,
+			       double voffset, double *psd_sum);
+long lecroy_fft_power_spectrum(const struct lecroy_fft_plan *plan,
+			       const char *buf, size_t buf_len,
+			       int bytes_per_point, double vgain,
+			       double voffset, double *psd_sum,
+			       int no_of_threads);
+
+/* lecroy_gate.c */
+int lecroy_gate_init(struct lecroy_gate *gate,
+		     const struct lecroy_gate_criterion *criteria,
+		     int no_of_criteria, int combine,
+		     const struct lecroy_wavedesc *desc);
+void lecroy_gate_free(struct lecroy_gate *gate);
+long lecroy_gate_process(struct lecroy_gate *gate, char *buf, size_t buf_len,
+			 struct lecroy_gate_record *records);
+long lecroy_gate_process(struct lecroy_gate *gate, char *buf, size_t buf_len,
+			 struct lecroy_gate_record *records,
+			 int no_of_threads);
+int lecroy_gate_write_summary(const char *filename,
+			      const struct lecroy_gate *gate,
+			      const struct lecroy_gate_record *records,
+			      long no_of_records, const char *captured_by,
+			      int append);
+
+/* lecroy_async.c */
+struct lecroy_async *lecroy_async_open(VXI11_CLINK * clink);
+void lecroy_async_close(struct lecroy_async *async);
+struct lecroy_capture *lecroy_get_data_async(struct lecroy_async *async,
+					     char chan, int clear_sweeps,
+					     char *buf, size_t buf_len,
+					     int arm_and_wait,
+					     unsigned long timeout);
+struct lecroy_capture *lecroy_get_data_async(struct lecroy_async *async,
+					     char chan, int clear_sweeps,
+					     char *buf, size_t buf_len,
+					     int arm_and_wait,
+					     unsigned long timeout,
+					     void (*callback) (struct
+							       lecroy_capture *
+							       capture,
+							       long result,
+							       void *arg),
+					     void *arg);
+int lecroy_capture_status(struct lecroy_capture *capture);
+int lecroy_capture_cancel(struct lecroy_capture *capture);
+void lecroy_capture_wait_acquired(struct lecroy_capture *capture);
+long lecroy_capture_wait(struct lecroy_capture *capture);
+int lecroy_capture_wait_any(struct lecroy_capture **captures, int n,
+			    long timeout_ms);
+void lecroy_capture_free(struct lecroy_capture *capture);
+
+/* lecroy_sched.c */
+struct lecroy_sched *lecroy_sched_open(VXI11_CLINK * clink);
+void lecroy_sched_close(struct lecroy_sched *sched);
+void lecroy_sched_set_control(struct lecroy_sched *sched,
+			      VXI11_CLINK * control);
+VXI11_CLINK *lecroy_sched_acquire(struct lecroy_sched *sched, int cls);
+void lecroy_sched_release(struct lecroy_sched *sched);
+void lecroy_sched_yield(struct lecroy_sched *sched);
+long lecroy_sched_query(struct lecroy_sched *sched, int cls, const char *cmd,
+			char *buf, size_t buf_len, unsigned long timeout);
+long lecroy_sched_obtain_long(struct lecroy_sched *sched, int cls,
+			      const char *cmd, unsigned long timeout);
+int lecroy_sched_send(struct lecroy_sched *sched, int cls, const char *cmd);
+long lecroy_sched_get_data(struct lecroy_sched *sched, char chan,
+			   int clear_sweeps, char *buf, size_t buf_len,
+			   int arm_and_wait, unsigned long timeout);
+int lecroy_sched_get_stats(struct lecroy_sched *sched, int cls,
+			   struct lecroy_sched_stats *stats);
+void lecroy_sched_reset_stats(struct lecroy_sched *sched);
+int lecroy_sched_abort(struct lecroy_sched *sched);
+
+/* lecroy_plan.c */
+int lecroy_plan_measure(VXI11_CLINK * clink, char chan,
+			struct lecroy_plan *plan, int no_of_threads,
+			unsigned long timeout);
+double lecroy_plan_cost(const struct lecroy_plan *plan, int strategy,
+			long no_of_averages, long *segments);
+int lecroy_plan_choose(struct lecroy_plan *plan, long no_of_averages);
+long lecroy_plan_average(VXI11_CLINK * clink, char chan,
+			 struct lecroy_plan *plan, long no_of_averages,
+			 double *volts, long max_points, unsigned long timeout);
+
+/* lecroy_tune.c */
+long lecroy_tune_run(VXI11_CLINK * clink, char chan, struct lecroy_tune *tune,
+		     unsigned long timeout);
+int lecroy_tune_check(VXI11_CLINK * clink, struct lecroy_tune *tune,
+		      unsigned long timeout);
+double lecroy_tune_predict(const struct lecroy_tune *tune, long segments,
+			   double *latency);
+
+/* lecroy_wfz.c */
+long lecroy_wfz_compress(const char *buf, size_t buf_len, int bytes_per_point,
+			 long points_per_trace, char **out);
+long lecroy_wfz_compress(const char *buf, size_t buf_len, int bytes_per_point,
+			 long points_per_trace, char **out, int no_of_threads);
+int lecroy_wfz_info(const char *in, size_t in_len,
+		    struct lecroy_wfz_info *info);
+long lecroy_wfz_decompress(const char *in, size_t in_len, char *buf,
+			   size_t buf_len);
+long lecroy_wfz_decompress(const char *in, size_t in_len, char *buf,
+			   size_t buf_len, int no_of_threads);
+long lecroy_wfz_decompress_trace(const char *in, size_t in_len, long trace,
+				 char *buf, size_t buf_len);
+
+/* lecroy_persist.c */
+int lecroy_persist_init(struct lecroy_persist *persist, long no_of_points,
+			int bytes_per_point, int columns, int rows, int raw_lo,
+			int raw_hi);
+void lecroy_persist_reset(struct lecroy_persist *persist);
+void lecroy_persist_free(struct lecroy_persist *persist);
+void lecroy_persist_set_decay(struct lecroy_persist *persist, double traces);
+long lecroy_persist_add(struct lecroy_persist *persist, const char *buf,
+			size_t buf_len);
+long lecroy_persist_add(struct lecroy_persist *persist, const char *buf,
+			size_t buf_len, int no_of_threads);
+long lecroy_persist_snapshot(const struct lecroy_persist *persist,
+			     double *hits, double *outside);
+int lecroy_persist_write(const char *filename,
+			 const struct lecroy_persist *persist,
+			 const struct lecroy_wavedesc *desc, int log_scale);
+
+/* lecroy_envelope.c */
+int lecroy_envelope_build(struct lecroy_envelope *env, const char *buf,
+			  size_t buf_len, const struct lecroy_wavedesc *desc);
+int lecroy_envelope_build(struct lecroy_envelope *env, const char *buf,
+			  size_t buf_len, const struct lecroy_wavedesc *desc,
+			  int no_of_threads);
+void lecroy_envelope_free(struct lecroy_envelope *env);
+long lecroy_envelope_query(const struct lecroy_envelope *env,
+			   const char *buf, long start, long end,
+			   long no_of_pixels, double *min, double *max);
+int lecroy_envelope_write(const char *filename,
+			  const struct lecroy_envelope *env);
+int lecroy_envelope_read(const char *filename, struct lecroy_envelope *env);
+
+/* lecroy_stats.c */
+int lecroy_stats_init(struct lecroy_stats *stats, long no_of_points);
+void lecroy_stats_reset(struct lecroy_stats *stats);
+void lecroy_stats_free(struct lecroy_stats *stats);
+long lecroy_stats_add(struct lecroy_stats *stats, const char *buf,
+		      size_t buf_len, int bytes_per_point);
+long lecroy_stats_add(struct lecroy_stats *stats, const char *buf,
+		      size_t buf_len, int bytes_per_point, int no_of_threads);
+long lecroy_stats_snapshot(const struct lecroy_stats *stats, double *mean,
+			   double *variance, short *min, short *max);
 /*int	lecroy_report_status(VXI11_CLINK *clink, unsigned long timeout);
 int	lecroy_get_setup(VXI11_CLINK *clink, char *buf, size_t buf_len);
 int	lecroy_send_setup(VXI11_CLINK *clink, char *buf, size_t buf_len);
@@ -97,3 +648,5 @@ long	lecroy_get_averages(VXI11_CLINK *clink);
 double	lecroy_get_sample_rate(VXI11_CLINK *clink);
 long	lecroy_get_n_points(VXI11_CLINK *clink);
 int	lecroy_display_channel(VXI11_CLINK *clink, char chan, int on_or_off);*/
+
+#endif
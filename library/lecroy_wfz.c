@@ -0,0 +1,531 @@
+/* lecroy_wfz.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Lossless compression of traces, for the .wfz files lgetwf writes with -z.
+ * Raw .wf files are mostly wasted space: with 16 bit transfers from channels
+ * 1-4 the low byte is always zero, and neighbouring points are nearly the
+ * same. So:
+ *
+ *   - the number of low bits that are zero in every point is found, and
+ *     shifted out;
+ *   - the data is cut into blocks (LECROY_WFZ_BLOCK points, never crossing
+ *     from one trace into the next), and each block is turned into residuals
+ *     using whichever predictor does best for it: none, the previous point,
+ *     or a straight line through the previous two;
+ *   - the residuals are zigzag encoded (0, -1, 1, -2, ... -> 0, 1, 2, 3...)
+ *     and packed in groups of 32, each group using as few bits as its
+ *     biggest residual needs.
+ *
+ * Blocks are compressed and decompressed independently, spread across
+ * threads. An index of where each block starts follows the header, so any
+ * single trace (segment) can be got at without decompressing the others;
+ * mmap() the file and use lecroy_wfz_decompress_trace().
+ *
+ * File layout (native endian, like the .wf file):
+ *	char[8]   "WFZ00001"
+ *	int32     bytes per point
+ *	int32     shift (low bits that were zero)
+ *	int64     number of points, points per trace, points per block,
+ *	          number of blocks
+ *	int64[]   offset of each block from the start of the file, plus one
+ *	          more for the end of the last block
+ * then each block:
+ *	uint8     predictor (0, 1 or 2)
+ *	int32[2]  first two points (after shifting)
+ *	for each group of 32 residuals: uint8 bits, then 4 * bits bytes
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lecroy_vxi11.h"
+
+#define	LECROY_WFZ_MAGIC	"WFZ00001"
+#define	LECROY_WFZ_HEADER_LEN	48
+#define	LECROY_WFZ_GROUP	32
+#define	LECROY_WFZ_BLOCK_HEADER	9
+
+struct lecroy_wfz_args {
+	const char *in;
+	char *out;
+	int bytes_per_point;
+	int shift;
+	long no_of_points;
+	long points_per_trace;
+	long blocks_per_trace;
+	long long *offsets;	/* block sizes, then where they go */
+	unsigned char *predictor;
+	unsigned short *or_bits;	/* OR of each block's points */
+};
+
+/* First point and number of points of block b */
+static void lecroy_wfz_block_range(const struct lecroy_wfz_args *args,
+				   long b, long *first, long *n)
+{
+	long trace = b / args->blocks_per_trace;
+	long in_trace = (b % args->blocks_per_trace) * LECROY_WFZ_BLOCK;
+
+	*first = trace * args->points_per_trace + in_trace;
+	*n = args->points_per_trace - in_trace;
+	if (*n > LECROY_WFZ_BLOCK)
+		*n = LECROY_WFZ_BLOCK;
+	if (*first + *n > args->no_of_points)
+		*n = args->no_of_points - *first;
+}
+
+static void lecroy_wfz_load(const struct lecroy_wfz_args *args, long first,
+			    long n, int *x)
+{
+	const char *p = args->in + first * args->bytes_per_point;
+	signed char c;
+	short s;
+	long i;
+
+	if (args->bytes_per_point == 1) {
+		for (i = 0; i < n; i++) {
+			memcpy(&c, p + i, 1);
+			x[i] = c;
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			memcpy(&s, p + 2 * i, 2);
+			x[i] = s;
+		}
+	}
+}
+
+/* Residuals of x[] with predictor 0, 1 or 2, zigzag encoded. The first
+ * "order" points go in the block header instead, so their residuals are 0. */
+static void lecroy_wfz_residuals(const int *x, long n, int order,
+				 unsigned int *r)
+{
+	long i;
+	int d;
+
+	for (i = 0; i < order && i < n; i++)
+		r[i] = 0;
+	for (i = order; i < n; i++) {
+		if (order == 0)
+			d = x[i];
+		else if (order == 1)
+			d = x[i] - x[i - 1];
+		else
+			d = x[i] - 2 * x[i - 1] + x[i - 2];
+		r[i] = ((unsigned int)d << 1) ^ (unsigned int)(d >> 31);
+	}
+}
+
+static inline int lecroy_wfz_bits(unsigned int v)
+{
+	return v == 0 ? 0 : 32 - __builtin_clz(v);
+}
+
+/* Bytes needed for the packed residuals */
+static long lecroy_wfz_packed_len(const unsigned int *r, long n)
+{
+	long g, i, len = 0;
+	unsigned int m;
+
+	for (g = 0; g < n; g += LECROY_WFZ_GROUP) {
+		m = 0;
+		for (i = g; i < g + LECROY_WFZ_GROUP && i < n; i++)
+			m |= r[i];
+		len += 1 + 4 * lecroy_wfz_bits(m);
+	}
+	return len;
+}
+
+static void lecroy_wfz_or_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_wfz_args *args = (struct lecroy_wfz_args *)ptr;
+	int x[LECROY_WFZ_BLOCK];
+	long b, i, first, n;
+	unsigned int m;
+
+	for (b = start; b < end; b++) {
+		lecroy_wfz_block_range(args, b, &first, &n);
+		lecroy_wfz_load(args, first, n, x);
+		m = 0;
+		for (i = 0; i < n; i++)
+			m |= (unsigned int)x[i];
+		args->or_bits[b] = (unsigned short)m;
+	}
+}
+
+/* First pass: which predictor, and so how big each block will be */
+static void lecroy_wfz_size_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_wfz_args *args = (struct lecroy_wfz_args *)ptr;
+	int x[LECROY_WFZ_BLOCK];
+	unsigned int r[LECROY_WFZ_BLOCK];
+	long b, i, first, n, len, best_len;
+	int order;
+
+	for (b = start; b < end; b++) {
+		lecroy_wfz_block_range(args, b, &first, &n);
+		lecroy_wfz_load(args, first, n, x);
+		for (i = 0; i < n; i++)
+			x[i] >>= args->shift;
+		best_len = -1;
+		for (order = 0; order <= 2; order++) {
+			lecroy_wfz_residuals(x, n, order, r);
+			len = lecroy_wfz_packed_len(r, n);
+			if (best_len < 0 || len < best_len) {
+				best_len = len;
+				args->predictor[b] = order;
+			}
+		}
+		args->offsets[b] = LECROY_WFZ_BLOCK_HEADER + best_len;
+	}
+}
+
+/* Second pass: the packing, straight into place */
+static void lecroy_wfz_pack_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_wfz_args *args = (struct lecroy_wfz_args *)ptr;
+	int x[LECROY_WFZ_BLOCK];
+	unsigned int r[LECROY_WFZ_BLOCK];
+	long b, g, i, first, n;
+	unsigned long long acc;
+	unsigned int m;
+	int bits, w, head[2];
+	unsigned char *p;
+
+	for (b = start; b < end; b++) {
+		lecroy_wfz_block_range(args, b, &first, &n);
+		lecroy_wfz_load(args, first, n, x);
+		for (i = 0; i < n; i++)
+			x[i] >>= args->shift;
+		lecroy_wfz_residuals(x, n, args->predictor[b], r);
+		p = (unsigned char *)args->out + args->offsets[b];
+		head[0] = n > 0 ? x[0] : 0;
+		head[1] = n > 1 ? x[1] : 0;
+		*p++ = args->predictor[b];
+		memcpy(p, head, 8);
+		p += 8;
+		for (g = 0; g < n; g += LECROY_WFZ_GROUP) {
+			m = 0;
+			for (i = g; i < g + LECROY_WFZ_GROUP && i < n; i++)
+				m |= r[i];
+			w = lecroy_wfz_bits(m);
+			*p++ = w;
+			if (w == 0)
+				continue;
+			/* 32 values of w bits is exactly 4w bytes, so each
+			 * group starts on a byte; a short last group is
+			 * padded with zeros */
+			acc = 0;
+			bits = 0;
+			for (i = g; i < g + LECROY_WFZ_GROUP; i++) {
+				acc |= (unsigned long long)(i < n ? r[i] : 0) << bits;
+				bits += w;
+				while (bits >= 8) {
+					*p++ = (unsigned char)acc;
+					acc >>= 8;
+					bits -= 8;
+				}
+			}
+		}
+	}
+}
+
+long lecroy_wfz_compress(const char *buf, size_t buf_len, int bytes_per_point,
+			 long points_per_trace, char **out)
+{
+	return lecroy_wfz_compress(buf, buf_len, bytes_per_point,
+				   points_per_trace, out, 1);
+}
+
+/* Compresses buf (bytes_per_point 1 or 2, points_per_trace points to each
+ * trace or segment, or <= 0 if it's all one trace) into a complete .wfz
+ * image, which is new[]-ed into *out. no_of_threads <= 0 means one per
+ * core. Returns the length of the image, or -1. */
+long lecroy_wfz_compress(const char *buf, size_t buf_len, int bytes_per_point,
+			 long points_per_trace, char **out, int no_of_threads)
+{
+	struct lecroy_wfz_args args;
+	long long no_of_blocks, b, pos, header[4];
+	unsigned int m = 0;
+	int hdr[2];
+
+	*out = NULL;
+	if (bytes_per_point != 1 && bytes_per_point != 2)
+		return -1;
+	memset(&args, 0, sizeof(args));
+	args.in = buf;
+	args.bytes_per_point = bytes_per_point;
+	args.no_of_points = (long)(buf_len / bytes_per_point);
+	if (points_per_trace <= 0 || points_per_trace > args.no_of_points)
+		points_per_trace = args.no_of_points > 0 ? args.no_of_points : 1;
+	args.points_per_trace = points_per_trace;
+	args.blocks_per_trace =
+	    (points_per_trace + LECROY_WFZ_BLOCK - 1) / LECROY_WFZ_BLOCK;
+	no_of_blocks = args.blocks_per_trace *
+	    ((args.no_of_points + points_per_trace - 1) / points_per_trace);
+
+	args.offsets = new long long[no_of_blocks + 1];
+	args.predictor = new unsigned char[no_of_blocks + 1];
+	args.or_bits = new unsigned short[no_of_blocks + 1];
+
+	/* How many low bits are always zero */
+	lecroy_parallel_for(no_of_blocks, 16, no_of_threads,
+			    lecroy_wfz_or_kernel, &args);
+	for (b = 0; b < no_of_blocks; b++)
+		m |= args.or_bits[b];
+	m &= bytes_per_point == 1 ? 0xff : 0xffff;
+	while (m != 0 && (m & (1u << args.shift)) == 0)
+		args.shift++;
+
+	lecroy_parallel_for(no_of_blocks, 16, no_of_threads,
+			    lecroy_wfz_size_kernel, &args);
+	pos = LECROY_WFZ_HEADER_LEN + 8 * (no_of_blocks + 1);
+	for (b = 0; b < no_of_blocks; b++) {
+		long long len = args.offsets[b];
+		args.offsets[b] = pos;
+		pos += len;
+	}
+	args.offsets[no_of_blocks] = pos;
+
+	*out = new char[pos];
+	args.out = *out;
+	memcpy(*out, LECROY_WFZ_MAGIC, 8);
+	hdr[0] = bytes_per_point;
+	hdr[1] = args.shift;
+	memcpy(*out + 8, hdr, 8);
+	header[0] = args.no_of_points;
+	header[1] = points_per_trace;
+	header[2] = LECROY_WFZ_BLOCK;
+	header[3] = no_of_blocks;
+	memcpy(*out + 16, header, 32);
+	memcpy(*out + LECROY_WFZ_HEADER_LEN, args.offsets,
+	       8 * (no_of_blocks + 1));
+	lecroy_parallel_for(no_of_blocks, 16, no_of_threads,
+			    lecroy_wfz_pack_kernel, &args);
+
+	delete[]args.offsets;
+	delete[]args.predictor;
+	delete[]args.or_bits;
+	return (long)pos;
+}
+
+/* Reads the header of a .wfz image. Returns 0, or -1 if it isn't one. */
+int lecroy_wfz_info(const char *in, size_t in_len, struct lecroy_wfz_info *info)
+{
+	long long header[4];
+	int hdr[2];
+
+	memset(info, 0, sizeof(struct lecroy_wfz_info));
+	if (in_len < LECROY_WFZ_HEADER_LEN
+	    || memcmp(in, LECROY_WFZ_MAGIC, 8) != 0) {
+		printf("lecroy_wfz_info: not a .wfz file\n");
+		return -1;
+	}
+	memcpy(hdr, in + 8, 8);
+	memcpy(header, in + 16, 32);
+	/* The shift has to leave at least one bit of a point, and the number
+	 * of blocks has to be what the number of points says it is, or the
+	 * unpacking would go outside the index (or the output). Every 32
+	 * points take at least a byte, which bounds the number of points. */
+	if ((hdr[0] != 1 && hdr[0] != 2) || hdr[1] < 0
+	    || hdr[1] >= 8 * hdr[0] || header[0] < 0
+	    || header[0] > LECROY_WFZ_GROUP * (long long)in_len
+	    || header[1] <= 0 || header[1] > header[0] + 1
+	    || header[2] != LECROY_WFZ_BLOCK
+	    || header[3] != ((header[1] + LECROY_WFZ_BLOCK - 1) /
+			     LECROY_WFZ_BLOCK) *
+	    ((header[0] + header[1] - 1) / header[1])
+	    || (size_t)header[3] >= in_len / 8
+	    || in_len < LECROY_WFZ_HEADER_LEN + 8 * (size_t)(header[3] + 1)) {
+		printf("lecroy_wfz_info: .wfz header doesn't make sense\n");
+		return -1;
+	}
+	info->bytes_per_point = hdr[0];
+	info->shift = hdr[1];
+	info->no_of_points = (long)header[0];
+	info->points_per_trace = (long)header[1];
+	info->no_of_traces =
+	    (info->no_of_points + info->points_per_trace - 1) /
+	    info->points_per_trace;
+	info->no_of_blocks = (long)header[3];
+	return 0;
+}
+
+struct lecroy_wfz_unpack_args {
+	const char *in;
+	size_t in_len;
+	struct lecroy_wfz_info info;
+	struct lecroy_wfz_args block;	/* for lecroy_wfz_block_range() */
+	char *out;
+	long first_block;	/* block 0 of the kernel's range */
+	long first_point;	/* of the output buffer */
+	long errors;
+};
+
+/* Unpacks blocks [start, end), counting from first_block */
+static void lecroy_wfz_unpack_kernel(void *ptr, long start, long end)
+{
+	struct lecroy_wfz_unpack_args *args =
+	    (struct lecroy_wfz_unpack_args *)ptr;
+	unsigned int r[LECROY_WFZ_BLOCK + LECROY_WFZ_GROUP];
+	long long off, next;
+	long b, g, i, first, n;
+	const unsigned char *p, *p_end;
+	unsigned long long acc;
+	unsigned int mask;
+	int order, w, bits, head[2], x0, x1, d, v;
+	signed char c;
+	short s;
+	char *o;
+
+	for (b = start + args->first_block; b < end + args->first_block; b++) {
+		lecroy_wfz_block_range(&args->block, b, &first, &n);
+		memcpy(&off, args->in + LECROY_WFZ_HEADER_LEN + 8 * b, 8);
+		memcpy(&next, args->in + LECROY_WFZ_HEADER_LEN + 8 * (b + 1), 8);
+		if (off < 0 || next > (long long)args->in_len || next < off
+		    || next - off < LECROY_WFZ_BLOCK_HEADER) {
+			__sync_fetch_and_add(&args->errors, 1);
+			continue;
+		}
+		p = (const unsigned char *)args->in + off;
+		p_end = (const unsigned char *)args->in + next;
+		order = *p++;
+		if (order > 2) {
+			__sync_fetch_and_add(&args->errors, 1);
+			continue;
+		}
+		memcpy(head, p, 8);
+		p += 8;
+		for (g = 0; g < n; g += LECROY_WFZ_GROUP) {
+			w = p < p_end ? *p++ : 33;
+			if (w > 32 || p + 4 * w > p_end)
+				break;
+			mask = w == 32 ? 0xffffffffu : (1u << w) - 1;
+			acc = 0;
+			bits = 0;
+			for (i = g; i < g + LECROY_WFZ_GROUP; i++) {
+				while (bits < w) {
+					acc |= (unsigned long long)(*p++) << bits;
+					bits += 8;
+				}
+				r[i] = (unsigned int)acc & mask;
+				acc >>= w;
+				bits -= w;
+			}
+		}
+		if (g < n) {
+			__sync_fetch_and_add(&args->errors, 1);
+			continue;
+		}
+		/* Undo the zigzag and the prediction */
+		o = args->out + (first - args->first_point) *
+		    args->info.bytes_per_point;
+		x0 = x1 = 0;
+		for (i = 0; i < n; i++) {
+			d = (int)(r[i] >> 1) ^ -(int)(r[i] & 1);
+			if (i < order)
+				v = head[i];
+			else if (order == 0)
+				v = d;
+			else if (order == 1)
+				v = x1 + d;
+			else
+				v = 2 * x1 - x0 + d;
+			x0 = x1;
+			x1 = v;
+			if (args->info.bytes_per_point == 1) {
+				c = (signed char)(v * (1 << args->info.shift));
+				memcpy(o + i, &c, 1);
+			} else {
+				s = (short)(v * (1 << args->info.shift));
+				memcpy(o + 2 * i, &s, 2);
+			}
+		}
+	}
+}
+
+static long lecroy_wfz_unpack(const char *in, size_t in_len, long first_block,
+			      long no_of_blocks, char *buf, size_t buf_len,
+			      int no_of_threads, long trace)
+{
+	struct lecroy_wfz_unpack_args args;
+	long first, n, last_first, last_n;
+
+	memset(&args, 0, sizeof(args));
+	if (lecroy_wfz_info(in, in_len, &args.info) != 0)
+		return -1;
+	args.in = in;
+	args.in_len = in_len;
+	args.out = buf;
+	args.block.no_of_points = args.info.no_of_points;
+	args.block.points_per_trace = args.info.points_per_trace;
+	args.block.blocks_per_trace =
+	    (args.info.points_per_trace + LECROY_WFZ_BLOCK - 1) /
+	    LECROY_WFZ_BLOCK;
+	if (trace >= 0) {
+		if (trace >= args.info.no_of_traces)
+			return -1;
+		first_block = trace * args.block.blocks_per_trace;
+		no_of_blocks = args.block.blocks_per_trace;
+	}
+	if (first_block + no_of_blocks > args.info.no_of_blocks)
+		return -1;
+	lecroy_wfz_block_range(&args.block, first_block, &first, &n);
+	lecroy_wfz_block_range(&args.block, first_block + no_of_blocks - 1,
+			       &last_first, &last_n);
+	args.first_block = first_block;
+	args.first_point = first;
+	if ((size_t)(last_first + last_n - first) * args.info.bytes_per_point >
+	    buf_len) {
+		printf("lecroy_wfz: buffer too small\n");
+		return -1;
+	}
+	lecroy_parallel_for(no_of_blocks, 16, no_of_threads,
+			    lecroy_wfz_unpack_kernel, &args);
+	if (args.errors != 0) {
+		printf("lecroy_wfz: %ld corrupt blocks\n", args.errors);
+		return -1;
+	}
+	return (last_first + last_n - first) * args.info.bytes_per_point;
+}
+
+long lecroy_wfz_decompress(const char *in, size_t in_len, char *buf,
+			   size_t buf_len)
+{
+	return lecroy_wfz_decompress(in, in_len, buf, buf_len, 1);
+}
+
+/* Decompresses a whole .wfz image into buf, which needs to be no_of_points
+ * * bytes_per_point long (see lecroy_wfz_info()). Returns the number of
+ * bytes, or -1. */
+long lecroy_wfz_decompress(const char *in, size_t in_len, char *buf,
+			   size_t buf_len, int no_of_threads)
+{
+	struct lecroy_wfz_info info;
+
+	if (lecroy_wfz_info(in, in_len, &info) != 0)
+		return -1;
+	return lecroy_wfz_unpack(in, in_len, 0, info.no_of_blocks, buf,
+				 buf_len, no_of_threads, -1);
+}
+
+/* Decompresses just one trace (segment), without touching the rest.
+ * Returns the number of bytes, or -1. */
+long lecroy_wfz_decompress_trace(const char *in, size_t in_len, long trace,
+				 char *buf, size_t buf_len)
+{
+	return lecroy_wfz_unpack(in, in_len, 0, 0, buf, buf_len, 1, trace);
+}
@@ -0,0 +1,615 @@
+/* lecroy_writer.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * An asynchronous writer for getting captured traces onto the disk without
+ * holding up the next acquisition. Data handed to lecroy_writer_write() is
+ * copied into one of a fixed number of page-aligned chunks (so the caller
+ * can reuse its buffer straight away, and the memory used never grows past
+ * what was asked for), and full chunks are written out in the background.
+ *
+ * On Linux kernels that have it, the writes go through io_uring: all the
+ * chunks that fill up during one call are submitted with a single system
+ * call, and completions are picked up whenever we need a chunk back. If
+ * io_uring isn't there (old kernel, or blocked by a container's seccomp
+ * profile) a couple of threads doing pwrite() take its place.
+ *
+ * With LECROY_WRITER_DIRECT the file is opened O_DIRECT, which keeps our
+ * data out of the page cache altogether. At 400MB/s the page cache fills up
+ * in a few seconds, and then the kernel's writeback throttles whoever is
+ * writing, which is exactly when we want to be re-arming the scope. O_DIRECT
+ * needs aligned buffers, offsets and lengths; the chunks take care of that,
+ * the last (partial) block is padded, and the file is trimmed back to the
+ * right length when it's closed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef	_GNU_SOURCE
+#define	_GNU_SOURCE		/* O_DIRECT, fallocate() */
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include "lecroy_vxi11.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define	LECROY_HAVE_IO_URING
+#endif
+#endif
+
+#define	LECROY_WRITER_CHUNK	(1024 * 1024)
+#define	LECROY_WRITER_MAX_THREADS	4
+
+/* One chunk: where it goes in the file, and how much of it is data */
+struct lecroy_writer_chunk {
+	long long offset;
+	size_t len;
+	struct iovec iov;
+};
+
+struct lecroy_writer {
+	int fd;
+	int flags;		/* what we actually ended up with */
+	struct lecroy_pool pool;
+	struct lecroy_writer_chunk *chunks;
+	size_t chunk_size;
+	char *current;		/* chunk being filled, or NULL */
+	size_t current_len;
+	long long current_offset;
+	long long total;	/* bytes accepted so far = final file length */
+	int in_flight;
+	int error;		/* first errno we hit, or 0 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* io_uring */
+	int ring_fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_len, cq_ring_len, sqes_len;
+#ifdef LECROY_HAVE_IO_URING
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+#endif
+	int to_submit;
+
+	/* thread fallback: a queue of chunk indices */
+	pthread_t threads[LECROY_WRITER_MAX_THREADS];
+	int no_of_threads;
+	int *queue;
+	int queue_head, queue_len;
+	int stopping;
+};
+
+static int lecroy_writer_chunk_index(struct lecroy_writer *w, char *buf)
+{
+	return (int)((buf - w->pool.base) / w->pool.buffer_size);
+}
+
+/* Called (with the mutex held, in the thread case) when a write is done */
+static void lecroy_writer_complete(struct lecroy_writer *w, int i, long res)
+{
+	struct lecroy_writer_chunk *c = &w->chunks[i];
+	char *buf = w->pool.base + i * w->pool.buffer_size;
+	ssize_t ret;
+
+	/* A short write to a regular file is unusual, but allowed; finish the
+	 * job the old-fashioned way */
+	while (res >= 0 && (size_t)res < c->iov.iov_len) {
+		ret = pwrite(w->fd, buf + res, c->iov.iov_len - res,
+			     c->offset + res);
+		if (ret <= 0) {
+			res = ret < 0 ? -errno : -EIO;
+			break;
+		}
+		res += ret;
+	}
+	if (res < 0 && w->error == 0) {
+		w->error = (int)-res;
+		printf("lecroy_writer: error writing to disk: %s\n",
+		       strerror(w->error));
+	}
+	w->in_flight--;
+	lecroy_pool_put(&w->pool, buf);
+}
+
+/*****************************************************************************
+ * io_uring backend. We talk to the kernel directly rather than through
+ * liburing, so there's nothing extra to install.
+ *****************************************************************************/
+#ifdef LECROY_HAVE_IO_URING
+static int lecroy_uring_setup(struct lecroy_writer *w, unsigned entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	w->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (w->ring_fd < 0)
+		return -1;
+	w->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	w->cq_ring_len =
+	    p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	w->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	w->sq_ring = mmap(NULL, w->sq_ring_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, w->ring_fd,
+			  IORING_OFF_SQ_RING);
+	w->cq_ring = mmap(NULL, w->cq_ring_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, w->ring_fd,
+			  IORING_OFF_CQ_RING);
+	w->sqes = (struct io_uring_sqe *)mmap(NULL, w->sqes_len,
+					      PROT_READ | PROT_WRITE,
+					      MAP_SHARED | MAP_POPULATE,
+					      w->ring_fd, IORING_OFF_SQES);
+	if (w->sq_ring == MAP_FAILED || w->cq_ring == MAP_FAILED
+	    || w->sqes == MAP_FAILED) {
+		if (w->sq_ring != MAP_FAILED)
+			munmap(w->sq_ring, w->sq_ring_len);
+		if (w->cq_ring != MAP_FAILED)
+			munmap(w->cq_ring, w->cq_ring_len);
+		if (w->sqes != MAP_FAILED)
+			munmap(w->sqes, w->sqes_len);
+		close(w->ring_fd);
+		w->ring_fd = -1;
+		return -1;
+	}
+	sq = (char *)w->sq_ring;
+	cq = (char *)w->cq_ring;
+	w->sq_head = (unsigned *)(sq + p.sq_off.head);
+	w->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	w->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	w->sq_array = (unsigned *)(sq + p.sq_off.array);
+	w->cq_head = (unsigned *)(cq + p.cq_off.head);
+	w->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	w->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	w->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+static void lecroy_uring_teardown(struct lecroy_writer *w)
+{
+	munmap(w->sq_ring, w->sq_ring_len);
+	munmap(w->cq_ring, w->cq_ring_len);
+	munmap(w->sqes, w->sqes_len);
+	close(w->ring_fd);
+	w->ring_fd = -1;
+}
+
+/* Puts a chunk on the submission queue; it isn't submitted until
+ * lecroy_uring_submit(). There are at least as many entries as chunks, so
+ * there's always room. */
+static void lecroy_uring_queue(struct lecroy_writer *w, int i)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, index;
+
+	tail = *w->sq_tail;
+	index = tail & *w->sq_mask;
+	sqe = &w->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = w->fd;
+	sqe->addr = (unsigned long)&w->chunks[i].iov;
+	sqe->len = 1;
+	sqe->off = (unsigned long long)w->chunks[i].offset;
+	sqe->user_data = (unsigned long long)i;
+	w->sq_array[index] = index;
+	__atomic_store_n(w->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	w->to_submit++;
+}
+
+/* Picks up whatever has finished */
+static void lecroy_uring_reap(struct lecroy_writer *w)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head;
+
+	head = *w->cq_head;
+	while (head != __atomic_load_n(w->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &w->cqes[head & *w->cq_mask];
+		lecroy_writer_complete(w, (int)cqe->user_data, cqe->res);
+		head++;
+	}
+	__atomic_store_n(w->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submits everything queued in one go, and if wait_for is > 0, waits until
+ * at least that many writes have finished */
+static int lecroy_uring_submit(struct lecroy_writer *w, int wait_for)
+{
+	int ret;
+
+	while (w->to_submit > 0 || wait_for > 0) {
+		ret = (int)syscall(__NR_io_uring_enter, w->ring_fd,
+				   w->to_submit, wait_for,
+				   wait_for > 0 ? IORING_ENTER_GETEVENTS : 0,
+				   NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		w->to_submit -= ret;
+		if (w->to_submit < 0)
+			w->to_submit = 0;
+		lecroy_uring_reap(w);
+		if (w->to_submit == 0)
+			break;
+	}
+	lecroy_uring_reap(w);
+	return 0;
+}
+#endif
+
+/*****************************************************************************
+ * Thread backend
+ *****************************************************************************/
+static void *lecroy_writer_thread_fn(void *ptr)
+{
+	struct lecroy_writer *w = (struct lecroy_writer *)ptr;
+	struct lecroy_writer_chunk *c;
+	ssize_t ret;
+	int i;
+
+	pthread_mutex_lock(&w->mutex);
+	while (1) {
+		while (w->queue_len == 0 && w->stopping == 0)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (w->queue_len == 0)
+			break;
+		i = w->queue[w->queue_head];
+		w->queue_head = (w->queue_head + 1) % w->pool.no_of_buffers;
+		w->queue_len--;
+		pthread_mutex_unlock(&w->mutex);
+
+		c = &w->chunks[i];
+		ret = pwrite(w->fd, c->iov.iov_base, c->iov.iov_len, c->offset);
+		if (ret < 0)
+			ret = -errno;
+
+		pthread_mutex_lock(&w->mutex);
+		lecroy_writer_complete(w, i, (long)ret);
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+/*****************************************************************************
+ * Common
+ *****************************************************************************/
+
+/* Sends a chunk off to be written. len is rounded up to the block size with
+ * O_DIRECT (the padding is trimmed off at the end). */
+static void lecroy_writer_send(struct lecroy_writer *w, char *buf, size_t len,
+			       long long offset)
+{
+	int i = lecroy_writer_chunk_index(w, buf);
+	struct lecroy_writer_chunk *c = &w->chunks[i];
+
+	if ((w->flags & LECROY_WRITER_DIRECT) != 0 && len % LECROY_WRITER_ALIGN) {
+		memset(buf + len, 0,
+		       LECROY_WRITER_ALIGN - (len % LECROY_WRITER_ALIGN));
+		len += LECROY_WRITER_ALIGN - (len % LECROY_WRITER_ALIGN);
+	}
+	c->offset = offset;
+	c->len = len;
+	c->iov.iov_base = buf;
+	c->iov.iov_len = len;
+
+	pthread_mutex_lock(&w->mutex);
+	w->in_flight++;
+#ifdef LECROY_HAVE_IO_URING
+	if (w->ring_fd >= 0) {
+		lecroy_uring_queue(w, i);
+		pthread_mutex_unlock(&w->mutex);
+		return;
+	}
+#endif
+	w->queue[(w->queue_head + w->queue_len) % w->pool.no_of_buffers] = i;
+	w->queue_len++;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+/* Waits until all the writes sent so far have finished */
+static void lecroy_writer_wait(struct lecroy_writer *w)
+{
+#ifdef LECROY_HAVE_IO_URING
+	if (w->ring_fd >= 0) {
+		while (w->in_flight > 0) {
+			if (lecroy_uring_submit(w, 1) != 0) {
+				if (w->error == 0)
+					w->error = errno;
+				break;
+			}
+		}
+		return;
+	}
+#endif
+	pthread_mutex_lock(&w->mutex);
+	while (w->in_flight > 0)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+/* A chunk to fill; if they're all in flight, waits for one to finish.
+ * Returns NULL if the io_uring has stopped working. */
+static char *lecroy_writer_get_chunk(struct lecroy_writer *w)
+{
+	char *buf;
+
+#ifdef LECROY_HAVE_IO_URING
+	if (w->ring_fd >= 0) {
+		while ((buf = lecroy_pool_get(&w->pool)) == NULL) {
+			if (lecroy_uring_submit(w, 1) != 0) {
+				if (w->error == 0)
+					w->error = errno;
+				return NULL;
+			}
+		}
+		return buf;
+	}
+#endif
+	pthread_mutex_lock(&w->mutex);
+	while ((buf = lecroy_pool_get(&w->pool)) == NULL)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
+	return buf;
+}
+
+/* Gives back a chunk that was never sent. Under the mutex, like the
+ * completions, so that lecroy_writer_get_chunk() can't miss it. */
+static void lecroy_writer_put_chunk(struct lecroy_writer *w, char *buf)
+{
+	pthread_mutex_lock(&w->mutex);
+	lecroy_pool_put(&w->pool, buf);
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+/* Opens (creates, or truncates) filename for writing.
+ *   prealloc      : if > 0, space for this many bytes is reserved up front
+ *                   with fallocate(), so the filesystem doesn't have to find
+ *                   blocks while we're streaming (and the file is less
+ *                   fragmented). Not an error if the filesystem can't.
+ *   max_in_flight : the most memory (in bytes) the writer may use for data
+ *                   that hasn't reached the disk yet; 0 for the default
+ *                   (16MB). lecroy_writer_write() waits if it's all in use.
+ *   flags         : LECROY_WRITER_DIRECT for O_DIRECT (falls back to normal
+ *                   writes if the filesystem won't do it, eg tmpfs);
+ *                   LECROY_WRITER_THREADS to use threads even if io_uring is
+ *                   available.
+ * Returns NULL on failure. */
+struct lecroy_writer *lecroy_writer_open(const char *filename,
+					 long long prealloc,
+					 size_t max_in_flight, int flags)
+{
+	struct lecroy_writer *w;
+	int no_of_chunks, l;
+	int open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+	if (max_in_flight == 0)
+		max_in_flight = 16 * LECROY_WRITER_CHUNK;
+	w = new struct lecroy_writer;
+	memset(w, 0, sizeof(struct lecroy_writer));
+	w->ring_fd = -1;
+
+	if ((flags & LECROY_WRITER_DIRECT) != 0) {
+		w->fd = open(filename, open_flags | O_DIRECT, 0644);
+		if (w->fd < 0 && errno == EINVAL) {
+			printf
+			    ("lecroy_writer_open: %s can't do O_DIRECT, using normal writes\n",
+			     filename);
+			flags &= ~LECROY_WRITER_DIRECT;
+		}
+	}
+	if ((flags & LECROY_WRITER_DIRECT) == 0)
+		w->fd = open(filename, open_flags, 0644);
+	if (w->fd < 0) {
+		printf("lecroy_writer_open: could not open %s: %s\n", filename,
+		       strerror(errno));
+		delete w;
+		return NULL;
+	}
+	if (prealloc > 0)
+		fallocate(w->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t) prealloc);
+
+	/* Chunks of 1MB (smaller if that's all the memory we're allowed), at
+	 * least two of them so one can fill while the other is written */
+	w->chunk_size = LECROY_WRITER_CHUNK;
+	if (max_in_flight < 2 * w->chunk_size)
+		w->chunk_size = max_in_flight / 2;
+	w->chunk_size -= w->chunk_size % LECROY_WRITER_ALIGN;
+	if (w->chunk_size < LECROY_WRITER_ALIGN)
+		w->chunk_size = LECROY_WRITER_ALIGN;
+	no_of_chunks = (int)(max_in_flight / w->chunk_size);
+	if (no_of_chunks < 2)
+		no_of_chunks = 2;
+	if (lecroy_pool_create(&w->pool, no_of_chunks, w->chunk_size, 0) != 0) {
+		close(w->fd);
+		delete w;
+		return NULL;
+	}
+	w->chunks = new struct lecroy_writer_chunk[no_of_chunks];
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+#ifdef LECROY_HAVE_IO_URING
+	if ((flags & LECROY_WRITER_THREADS) == 0
+	    && lecroy_uring_setup(w, (unsigned)no_of_chunks) != 0)
+		flags |= LECROY_WRITER_THREADS;
+#else
+	flags |= LECROY_WRITER_THREADS;
+#endif
+	if ((flags & LECROY_WRITER_THREADS) != 0) {
+		w->queue = new int[no_of_chunks];
+		for (l = 0; l < LECROY_WRITER_MAX_THREADS && l < no_of_chunks;
+		     l++) {
+			if (pthread_create(&w->threads[l], NULL,
+					   lecroy_writer_thread_fn, w) != 0)
+				break;
+			w->no_of_threads++;
+		}
+		if (w->no_of_threads == 0) {
+			printf("lecroy_writer_open: could not start any threads\n");
+			lecroy_pool_destroy(&w->pool);
+			delete[]w->chunks;
+			delete[]w->queue;
+			close(w->fd);
+			delete w;
+			return NULL;
+		}
+	}
+	w->flags = flags;
+	return w;
+}
+
+/* Which of the LECROY_WRITER_* options we actually got */
+int lecroy_writer_flags(struct lecroy_writer *w)
+{
+	return w->flags;
+}
+
+/* Appends len bytes to the file. The data is copied, so buf can be reused
+ * (or freed) as soon as this returns; the writing happens later. Returns
+ * 0, or -1 if an earlier write failed (in which case nothing more is
+ * written). */
+int lecroy_writer_write(struct lecroy_writer *w, const char *buf, size_t len)
+{
+	size_t n;
+
+	if (w->error != 0)
+		return -1;
+	while (len > 0) {
+		if (w->current == NULL) {
+			w->current = lecroy_writer_get_chunk(w);
+			if (w->current == NULL)
+				return -1;
+			w->current_len = 0;
+			w->current_offset = w->total;
+		}
+		n = w->chunk_size - w->current_len;
+		if (n > len)
+			n = len;
+		memcpy(w->current + w->current_len, buf, n);
+		w->current_len += n;
+		w->total += n;
+		buf += n;
+		len -= n;
+		if (w->current_len == w->chunk_size) {
+			lecroy_writer_send(w, w->current, w->current_len,
+					   w->current_offset);
+			w->current = NULL;
+		}
+	}
+#ifdef LECROY_HAVE_IO_URING
+	/* Everything that filled up in this call goes in one system call */
+	if (w->ring_fd >= 0 && w->to_submit > 0)
+		lecroy_uring_submit(w, 0);
+#endif
+	return w->error == 0 ? 0 : -1;
+}
+
+/* Waits until everything written so far is in the kernel's hands (or on the
+ * disk, with O_DIRECT). Returns 0, or -1 if any write failed. */
+int lecroy_writer_flush(struct lecroy_writer *w)
+{
+	char tail[LECROY_WRITER_ALIGN];
+	size_t tail_len = 0;
+	long long tail_offset = 0;
+
+	if (w->current != NULL && w->current_len > 0) {
+		/* With O_DIRECT the last block goes out padded, and we keep a
+		 * copy of it so that the next chunk can start on a block
+		 * boundary by writing it again */
+		if ((w->flags & LECROY_WRITER_DIRECT) != 0) {
+			tail_len = w->current_len % LECROY_WRITER_ALIGN;
+			tail_offset = w->total - tail_len;
+			memcpy(tail, w->current + w->current_len - tail_len,
+			       tail_len);
+		}
+		lecroy_writer_send(w, w->current, w->current_len,
+				   w->current_offset);
+		w->current = NULL;
+	} else if (w->current != NULL) {
+		lecroy_writer_put_chunk(w, w->current);
+		w->current = NULL;
+	}
+#ifdef LECROY_HAVE_IO_URING
+	if (w->ring_fd >= 0)
+		lecroy_uring_submit(w, 0);
+#endif
+	lecroy_writer_wait(w);
+	if (tail_len > 0 && w->error == 0) {
+		w->current = lecroy_writer_get_chunk(w);
+		if (w->current == NULL)
+			return -1;
+		memcpy(w->current, tail, tail_len);
+		w->current_len = tail_len;
+		w->current_offset = tail_offset;
+	}
+	return w->error == 0 ? 0 : -1;
+}
+
+/* Writes out anything left, trims the file to the amount of data actually
+ * written (getting rid of any O_DIRECT padding) and closes it. Returns 0, or
+ * -1 if any write failed. */
+int lecroy_writer_close(struct lecroy_writer *w)
+{
+	int ret, l;
+
+	lecroy_writer_flush(w);
+	if (w->current != NULL) {
+		lecroy_writer_put_chunk(w, w->current);
+		w->current = NULL;
+	}
+	if (w->no_of_threads > 0) {
+		pthread_mutex_lock(&w->mutex);
+		w->stopping = 1;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->mutex);
+		for (l = 0; l < w->no_of_threads; l++)
+			pthread_join(w->threads[l], NULL);
+	}
+#ifdef LECROY_HAVE_IO_URING
+	if (w->ring_fd >= 0)
+		lecroy_uring_teardown(w);
+#endif
+	if (ftruncate(w->fd, (off_t) w->total) != 0 && w->error == 0)
+		w->error = errno;
+	if (close(w->fd) != 0 && w->error == 0)
+		w->error = errno;
+	ret = w->error == 0 ? 0 : -1;
+
+	pthread_mutex_destroy(&w->mutex);
+	pthread_cond_destroy(&w->cond);
+	lecroy_pool_destroy(&w->pool);
+	delete[]w->chunks;
+	delete[]w->queue;
+	delete w;
+	return ret;
+}
@@ -0,0 +1,889 @@
+/* lecroy_vxi11_module.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Python bindings for the lecroy_vxi11 library, so that captures can go
+ * straight into NumPy (or anything else that speaks the buffer protocol)
+ * without being written to disk and read back in:
+ *
+ *	import numpy, lecroy_vxi11
+ *	scope = lecroy_vxi11.Scope("128.243.74.78")
+ *	scope.init()
+ *	scope.set_segmented(100)
+ *	wf = scope.get_data("1")
+ *	raw = numpy.asarray(wf)		# no copy: shape (segments, points)
+ *	volts = raw * wf.vertical_gain - wf.vertical_offset
+ *
+ * A Waveform owns the buffer the data was received into, and hands it out
+ * through the buffer protocol, so numpy.asarray() (or memoryview()) just
+ * looks at it. Pass the same Waveform back in (get_data(..., out=wf)) and
+ * the next capture goes into the same buffer, over the top of the last one;
+ * any arrays looking at it see the new data. If the new capture doesn't
+ * fit, the buffer has to grow, which it can't while anything is still
+ * looking at it (you get a BufferError).
+ *
+ * The GIL is let go while we talk to the scope (waiting for *OPC?, the
+ * transfer and so on), so other Python threads carry on. Several threads
+ * can share one Scope: each call takes a turn with the link through a
+ * lecroy_sched (lecroy_sched.c), with queries and settings going ahead of
+ * waiting captures. Only one thread at a time can capture into a given
+ * Waveform (the others get a BufferError), and close() won't while other
+ * threads are still using the Scope (RuntimeError).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#define	PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lecroy_vxi11.h"
+
+/* The Waveform type: one capture, and how to scale it */
+struct waveform {
+	PyObject_HEAD
+	char *buf;		/* the whole WF? ALL block, see get_data() */
+	size_t capacity;
+	long offset;		/* where the samples start in buf */
+	char *spare;		/* for captures while buf is in use */
+	size_t spare_capacity;
+	size_t no_of_bytes;
+	int bytes_per_point;
+	long no_of_segments;
+	long points_per_trace;
+	Py_ssize_t shape[2];
+	Py_ssize_t strides[2];
+	Py_ssize_t flat_shape[1];	/* as plain bytes */
+	Py_ssize_t flat_strides[1];
+	long exports;		/* buffer views still open */
+	int busy;		/* a get_data() is receiving into it */
+	char chan;
+	double vertical_gain;
+	double vertical_offset;
+	double horiz_interval;
+	double horiz_offset;
+};
+
+/* The Scope type: a link, and the scheduler that takes turns with it */
+struct scope {
+	PyObject_HEAD
+	VXI11_CLINK *clink;
+	struct lecroy_sched *sched;
+	char ip[256];
+	long users;		/* calls using the scheduler right now */
+};
+
+/* The rest of the slots are filled in by PyInit_lecroy_vxi11() */
+static PyTypeObject waveform_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"lecroy_vxi11.Waveform",	/* tp_name */
+	sizeof(struct waveform),	/* tp_basicsize */
+};
+
+/* Channels can be given as "1", "A", 1, ... */
+static int chan_from_object(PyObject * obj, char *chan)
+{
+	const char *s;
+	long l;
+
+	if (PyLong_Check(obj)) {
+		l = PyLong_AsLong(obj);
+		if (l < 1 || l > 4) {
+			PyErr_SetString(PyExc_ValueError,
+					"channel must be 1-4 or A-D");
+			return -1;
+		}
+		*chan = (char)('0' + l);
+		return 0;
+	}
+	s = PyUnicode_AsUTF8(obj);
+	if (s == NULL)
+		return -1;
+	if (strlen(s) != 1) {
+		PyErr_SetString(PyExc_ValueError, "channel must be 1-4 or A-D");
+		return -1;
+	}
+	*chan = s[0];
+	return 0;
+}
+
+static int scope_check(struct scope *self)
+{
+	if (self->clink == NULL) {
+		PyErr_SetString(PyExc_ValueError, "the scope has been closed");
+		return -1;
+	}
+	return 0;
+}
+
+/* Every call that talks to the scope goes between these (with the GIL
+ * held), so that close() knows if anyone's still using the scheduler */
+static int scope_begin(struct scope *self)
+{
+	if (scope_check(self) != 0)
+		return -1;
+	self->users++;
+	return 0;
+}
+
+static void scope_end(struct scope *self)
+{
+	self->users--;
+}
+
+/* Waveform */
+
+static void waveform_dealloc(struct waveform *self)
+{
+	lecroy_free_receive_buffer(self->buf);
+	lecroy_free_receive_buffer(self->spare);
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int waveform_getbuffer(struct waveform *self, Py_buffer * view,
+			      int flags)
+{
+	/* get_data() might move the data, or the whole buffer */
+	if (self->busy != 0) {
+		PyErr_SetString(PyExc_BufferError,
+				"a capture into this Waveform is in progress");
+		view->obj = NULL;
+		return -1;
+	}
+	/* Writable too: it's yours to scribble on */
+	view->obj = (PyObject *) self;
+	view->buf = self->buf + self->offset;
+	view->len = (Py_ssize_t) self->no_of_bytes;
+	view->readonly = 0;
+	if ((flags & PyBUF_FORMAT) == PyBUF_FORMAT
+	    && (flags & PyBUF_ND) == PyBUF_ND) {
+		/* The scope sends LSB first (COMM_ORDER LO) */
+		view->itemsize = self->bytes_per_point;
+		view->format =
+		    (char *)(self->bytes_per_point == 1 ? "b" : "<h");
+		view->ndim = 2;
+		view->shape = self->shape;
+		view->strides = NULL;
+		if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
+			view->strides = self->strides;
+	} else {
+		/* Whoever's asking doesn't want to know the format, which
+		 * then has to be plain bytes ("B"), so that's what they get:
+		 * flat, one byte per item */
+		view->itemsize = 1;
+		view->format = NULL;
+		if ((flags & PyBUF_FORMAT) == PyBUF_FORMAT)
+			view->format = (char *)"B";
+		view->ndim = 1;
+		view->shape = NULL;
+		if ((flags & PyBUF_ND) == PyBUF_ND)
+			view->shape = self->flat_shape;
+		view->strides = NULL;
+		if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
+			view->strides = self->flat_strides;
+	}
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	self->exports++;
+	Py_INCREF(self);
+	return 0;
+}
+
+static void waveform_releasebuffer(struct waveform *self, Py_buffer *)
+{
+	self->exports--;
+}
+
+static PyBufferProcs waveform_as_buffer = {
+	(getbufferproc) waveform_getbuffer,
+	(releasebufferproc) waveform_releasebuffer,
+};
+
+/* Fills in the scaling and shape from a descriptor */
+static void waveform_describe(struct waveform *self, char chan,
+			      const struct lecroy_wavedesc *desc)
+{
+	self->chan = chan;
+	self->bytes_per_point = desc->comm_type == 1 ? 2 : 1;
+	self->no_of_segments =
+	    desc->subarray_count > 1 ? desc->subarray_count : 1;
+	self->points_per_trace = desc->wave_array_count / self->no_of_segments;
+	self->vertical_gain = desc->vertical_gain;
+	self->vertical_offset = desc->vertical_offset;
+	self->horiz_interval = desc->horiz_interval;
+	self->horiz_offset = desc->horiz_offset;
+}
+
+/* After the data's in: the shape is whatever whole segments we got */
+static void waveform_shape(struct waveform *self, long no_of_bytes)
+{
+	long bytes_per_trace = self->points_per_trace * self->bytes_per_point;
+
+	if (bytes_per_trace <= 0 || no_of_bytes / bytes_per_trace <= 1) {
+		self->shape[0] = 1;
+		self->shape[1] = no_of_bytes / self->bytes_per_point;
+	} else {
+		self->shape[0] = no_of_bytes / bytes_per_trace;
+		self->shape[1] = self->points_per_trace;
+	}
+	self->no_of_bytes =
+	    (size_t)(self->shape[0] * self->shape[1] * self->bytes_per_point);
+	self->strides[1] = self->bytes_per_point;
+	self->strides[0] = self->shape[1] * self->bytes_per_point;
+	self->flat_shape[0] = (Py_ssize_t) self->no_of_bytes;
+}
+
+static PyObject *waveform_new(PyTypeObject * type, PyObject *,
+			      PyObject *)
+{
+	struct waveform *self;
+
+	self = (struct waveform *)type->tp_alloc(type, 0);
+	if (self == NULL)
+		return NULL;
+	self->bytes_per_point = 2;
+	self->shape[0] = 1;
+	self->strides[1] = 2;
+	self->flat_strides[0] = 1;
+	return (PyObject *) self;
+}
+
+static PyObject *waveform_get_chan(struct waveform *self, void *)
+{
+	return PyUnicode_FromStringAndSize(&self->chan, self->chan ? 1 : 0);
+}
+
+static PyObject *waveform_get_shape(struct waveform *self, void *)
+{
+	return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PyGetSetDef waveform_getset[] = {
+	{(char *)"chan", (getter) waveform_get_chan, NULL,
+	 (char *)"channel the data came from", NULL},
+	{(char *)"shape", (getter) waveform_get_shape, NULL,
+	 (char *)"(segments, points per segment)", NULL},
+	{NULL}
+};
+
+static PyMemberDef waveform_members[] = {
+	{(char *)"bytes_per_point", T_INT,
+	 offsetof(struct waveform, bytes_per_point), READONLY,
+	 (char *)"1 or 2"},
+	{(char *)"nbytes", T_PYSSIZET, offsetof(struct waveform, no_of_bytes),
+	 READONLY, (char *)"bytes of data"},
+	{(char *)"vertical_gain", T_DOUBLE,
+	 offsetof(struct waveform, vertical_gain), 0,
+	 (char *)"volts = vertical_gain * data - vertical_offset"},
+	{(char *)"vertical_offset", T_DOUBLE,
+	 offsetof(struct waveform, vertical_offset), 0, NULL},
+	{(char *)"horiz_interval", T_DOUBLE,
+	 offsetof(struct waveform, horiz_interval), 0,
+	 (char *)"seconds between points"},
+	{(char *)"horiz_offset", T_DOUBLE,
+	 offsetof(struct waveform, horiz_offset), 0,
+	 (char *)"time of the first point, relative to the trigger"},
+	{NULL}
+};
+
+/* Scope */
+
+static int scope_init(struct scope *self, PyObject * args, PyObject * kwds)
+{
+	static const char *kwlist[] = { "ip", NULL };
+	const char *ip;
+	int ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", (char **)kwlist,
+					 &ip))
+		return -1;
+	if (self->clink != NULL) {
+		PyErr_SetString(PyExc_ValueError, "the scope is already open");
+		return -1;
+	}
+	snprintf(self->ip, sizeof(self->ip), "%s", ip);
+	Py_BEGIN_ALLOW_THREADS
+	ret = lecroy_open(&self->clink, self->ip);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		self->clink = NULL;
+		PyErr_Format(PyExc_IOError, "could not open the scope at %s",
+			     ip);
+		return -1;
+	}
+	self->sched = lecroy_sched_open(self->clink);
+	return 0;
+}
+
+/* Refuses (RuntimeError) while another thread has, or is waiting for, a
+ * turn with the link: the scheduler can't go from under its feet */
+static int scope_do_close(struct scope *self)
+{
+	VXI11_CLINK *clink = self->clink;
+	struct lecroy_sched *sched = self->sched;
+
+	if (clink == NULL)
+		return 0;
+	if (self->users > 0) {
+		PyErr_SetString(PyExc_RuntimeError,
+				"the scope is still in use by another thread");
+		return -1;
+	}
+	/* Closed as far as anyone else is concerned from here on */
+	self->clink = NULL;
+	self->sched = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	lecroy_close(clink, self->ip);
+	Py_END_ALLOW_THREADS
+	lecroy_sched_close(sched);
+	return 0;
+}
+
+static void scope_dealloc(struct scope *self)
+{
+	scope_do_close(self);	/* nobody can be using it by now */
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *scope_close(struct scope *self, PyObject *)
+{
+	if (scope_do_close(self) != 0)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_enter(struct scope *self, PyObject *)
+{
+	Py_INCREF(self);
+	return (PyObject *) self;
+}
+
+static PyObject *scope_exit(struct scope *self, PyObject *)
+{
+	if (scope_do_close(self) != 0)
+		return NULL;
+	Py_RETURN_FALSE;
+}
+
+static PyObject *scope_init_scope(struct scope *self, PyObject *)
+{
+	VXI11_CLINK *clink;
+	int ret;
+
+	if (scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_CONTROL);
+	ret = lecroy_init(clink);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	if (ret != 0) {
+		PyErr_SetString(PyExc_IOError, "lecroy_init failed");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_send(struct scope *self, PyObject * args)
+{
+	const char *cmd;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "s", &cmd)
+	    || scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	ret = lecroy_sched_send(self->sched, LECROY_SCHED_CONTROL, cmd);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	if (ret < 0) {
+		PyErr_SetString(PyExc_IOError, "could not send the command");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_query(struct scope *self, PyObject * args,
+			     PyObject * kwds)
+{
+	static const char *kwlist[] = { "cmd", "timeout", NULL };
+	const char *cmd;
+	unsigned long timeout = 10000;
+	char buf[4096];
+	long ret;
+	size_t len;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|k",
+					 (char **)kwlist, &cmd, &timeout)
+	    || scope_begin(self) != 0)
+		return NULL;
+	memset(buf, 0, sizeof(buf));
+	Py_BEGIN_ALLOW_THREADS
+	ret = lecroy_sched_query(self->sched, LECROY_SCHED_STATUS, cmd, buf,
+				 sizeof(buf) - 1, timeout);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	if (ret < 0) {
+		PyErr_SetString(PyExc_IOError, "no answer from the scope");
+		return NULL;
+	}
+	len = strlen(buf);
+	while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+		len--;
+	return PyUnicode_DecodeLatin1(buf, len, NULL);
+}
+
+static PyObject *scope_set_sample_rate(struct scope *self, PyObject * args,
+				       PyObject * kwds)
+{
+	static const char *kwlist[] = { "rate", "points", "timeout", NULL };
+	double rate = 0, actual;
+	long points = 0, timeout = 10000;
+	VXI11_CLINK *clink;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|dll",
+					 (char **)kwlist, &rate, &points,
+					 &timeout)
+	    || scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_CONTROL);
+	actual = lecroy_set_sample_rate(clink, rate, points, timeout);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	return PyFloat_FromDouble(actual);
+}
+
+static PyObject *scope_set_segmented(struct scope *self, PyObject * args)
+{
+	int segments;
+	VXI11_CLINK *clink;
+
+	if (!PyArg_ParseTuple(args, "i", &segments)
+	    || scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_CONTROL);
+	if (segments > 1)
+		segments = lecroy_set_segmented(clink, segments);
+	else
+		vxi11_send_printf(clink, "SEQ OFF");
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	return PyLong_FromLong(segments > 1 ? segments : 1);
+}
+
+/* set_averages(chan, n) and set_segmented_averages(chan, n) return the
+ * channel to get the data from */
+static PyObject *scope_averages(struct scope *self, PyObject * args,
+				int segmented)
+{
+	PyObject *chan_obj;
+	int averages;
+	char chan;
+	VXI11_CLINK *clink;
+
+	if (!PyArg_ParseTuple(args, "Oi", &chan_obj, &averages)
+	    || chan_from_object(chan_obj, &chan) != 0
+	    || scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_CONTROL);
+	if (segmented)
+		chan = lecroy_set_segmented_averages(clink, chan, averages);
+	else
+		chan = lecroy_set_averages(clink, chan, averages);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	return PyUnicode_FromStringAndSize(&chan, 1);
+}
+
+static PyObject *scope_set_averages(struct scope *self, PyObject * args)
+{
+	return scope_averages(self, args, 0);
+}
+
+static PyObject *scope_set_segmented_averages(struct scope *self,
+					      PyObject * args)
+{
+	return scope_averages(self, args, 1);
+}
+
+static PyObject *scope_set_bytes_per_point(struct scope *self, PyObject * args)
+{
+	int bytes_per_point;
+
+	if (!PyArg_ParseTuple(args, "i", &bytes_per_point))
+		return NULL;
+	if (bytes_per_point != 1 && bytes_per_point != 2) {
+		PyErr_SetString(PyExc_ValueError, "bytes per point is 1 or 2");
+		return NULL;
+	}
+	if (scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	lecroy_sched_send(self->sched, LECROY_SCHED_CONTROL,
+			  bytes_per_point == 1 ? "COMM_FORMAT DEF9,BYTE,BIN" :
+			  "COMM_FORMAT DEF9,WORD,BIN");
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_display_channel(struct scope *self, PyObject * args)
+{
+	PyObject *chan_obj;
+	int on = 1;
+	char chan;
+	VXI11_CLINK *clink;
+
+	if (!PyArg_ParseTuple(args, "O|p", &chan_obj, &on)
+	    || chan_from_object(chan_obj, &chan) != 0
+	    || scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_CONTROL);
+	lecroy_display_channel(clink, chan, on);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_set_trigger_channel(struct scope *self, PyObject * args)
+{
+	PyObject *chan_obj;
+	char chan;
+	VXI11_CLINK *clink;
+
+	if (!PyArg_ParseTuple(args, "O", &chan_obj)
+	    || chan_from_object(chan_obj, &chan) != 0
+	    || scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_CONTROL);
+	lecroy_set_trigger_channel(clink, chan);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	Py_RETURN_NONE;
+}
+
+/* Trigger modes: the library's void functions taking just the link */
+static PyObject *scope_trigger_mode(struct scope *self,
+				    void (*fn) (VXI11_CLINK * clink))
+{
+	VXI11_CLINK *clink;
+
+	if (scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_CONTROL);
+	fn(clink);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_set_for_norm(struct scope *self, PyObject *)
+{
+	return scope_trigger_mode(self, lecroy_set_for_norm);
+}
+
+static PyObject *scope_set_for_auto(struct scope *self, PyObject *)
+{
+	return scope_trigger_mode(self, lecroy_set_for_auto);
+}
+
+static PyObject *scope_single(struct scope *self, PyObject *)
+{
+	return scope_trigger_mode(self, lecroy_single);
+}
+
+static PyObject *scope_stop(struct scope *self, PyObject *)
+{
+	return scope_trigger_mode(self, lecroy_stop);
+}
+
+static PyObject *scope_wavedesc(struct scope *self, PyObject * args)
+{
+	struct lecroy_wavedesc desc;
+	PyObject *chan_obj;
+	char chan;
+	int ret;
+	VXI11_CLINK *clink;
+
+	if (!PyArg_ParseTuple(args, "O", &chan_obj)
+	    || chan_from_object(chan_obj, &chan) != 0
+	    || scope_begin(self) != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_STATUS);
+	ret = lecroy_get_wavedesc(clink, chan, &desc, 10000);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	scope_end(self);
+	if (ret != 0) {
+		PyErr_SetString(PyExc_IOError, "could not get the WAVEDESC");
+		return NULL;
+	}
+	return Py_BuildValue
+	    ("{s:s,s:i,s:l,s:l,s:l,s:d,s:d,s:d,s:d,s:d}",
+	     "instrument_name", desc.instrument_name,
+	     "bytes_per_point", desc.comm_type == 1 ? 2 : 1,
+	     "no_of_bytes", desc.wave_array_1,
+	     "no_of_points", desc.wave_array_count,
+	     "no_of_segments", desc.subarray_count > 1 ? desc.subarray_count : 1,
+	     "vertical_gain", desc.vertical_gain,
+	     "vertical_offset", desc.vertical_offset,
+	     "horiz_interval", desc.horiz_interval,
+	     "horiz_offset", desc.horiz_offset,
+	     "trigger_seconds", desc.trigger_seconds);
+}
+
+/* lecroy_get_all_growing() calls this between the acquisition and the
+ * transfer: queries and settings from other threads can go then */
+static void scope_acquired(void *arg)
+{
+	lecroy_sched_yield((struct lecroy_sched *)arg);
+}
+
+/* get_data(chan, clear_sweeps=False, arm=True, timeout=10000, out=None):
+ * all in one bulk turn, so that nobody changes the settings in between.
+ * One WF? ALL: the block (descriptor and all) goes straight into the
+ * Waveform's buffer, which grows to fit if it has to, and the descriptor
+ * that came with the data gives the size and the scaling, so there's no
+ * guessing beforehand and no second query afterwards. If anything is still
+ * looking at the buffer (a NumPy array, say) it can't move, so the block
+ * goes into a spare buffer instead and the samples are copied across, to
+ * where they were last time. */
+static PyObject *scope_get_data(struct scope *self, PyObject * args,
+				PyObject * kwds)
+{
+	static const char *kwlist[] =
+	    { "chan", "clear_sweeps", "arm", "timeout", "out", NULL };
+	struct lecroy_wavedesc desc;
+	struct waveform *wf;
+	PyObject *chan_obj, *out = NULL;
+	int clear_sweeps = 0, arm = 1, in_use;
+	unsigned long timeout = 10000;
+	long got, offset;
+	size_t capacity;
+	char chan, *buf, *data;
+	VXI11_CLINK *clink;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|ppkO",
+					 (char **)kwlist, &chan_obj,
+					 &clear_sweeps, &arm, &timeout, &out)
+	    || chan_from_object(chan_obj, &chan) != 0)
+		return NULL;
+	if (out != NULL && out != Py_None) {
+		if (!PyObject_TypeCheck(out, &waveform_type)) {
+			PyErr_SetString(PyExc_TypeError,
+					"out must be a Waveform");
+			return NULL;
+		}
+		wf = (struct waveform *)out;
+		if (wf->busy != 0) {
+			PyErr_SetString(PyExc_BufferError,
+					"another thread is capturing into this Waveform");
+			return NULL;
+		}
+		Py_INCREF(wf);
+	} else {
+		wf = (struct waveform *)waveform_new(&waveform_type, NULL, NULL);
+		if (wf == NULL)
+			return NULL;
+	}
+	if (scope_begin(self) != 0) {
+		Py_DECREF(wf);
+		return NULL;
+	}
+	/* No new views while busy (see waveform_getbuffer()), so this can't
+	 * change until we're done */
+	wf->busy = 1;
+	in_use = wf->exports > 0;
+	buf = in_use ? wf->spare : wf->buf;
+	capacity = in_use ? wf->spare_capacity : wf->capacity;
+
+	Py_BEGIN_ALLOW_THREADS
+	clink = lecroy_sched_acquire(self->sched, LECROY_SCHED_BULK);
+	got = lecroy_get_all_growing(clink, chan, clear_sweeps, &buf, &capacity,
+				     &offset, &desc, arm, timeout,
+				     scope_acquired, self->sched);
+	lecroy_sched_release(self->sched);
+	Py_END_ALLOW_THREADS
+	wf->busy = 0;
+	scope_end(self);
+	if (in_use) {
+		wf->spare = buf;
+		wf->spare_capacity = capacity;
+	} else {
+		wf->buf = buf;
+		wf->capacity = capacity;
+	}
+	if (got <= 0) {
+		PyErr_SetString(PyExc_IOError,
+				"no data from the scope (timed out?)");
+		Py_DECREF(wf);
+		return NULL;
+	}
+	data = buf + offset;
+	if (in_use) {
+		if (wf->buf == NULL
+		    || (size_t)(wf->offset + got) > wf->capacity) {
+			PyErr_SetString(PyExc_BufferError,
+					"capture is bigger than the last one, and the old buffer is still in use");
+			Py_DECREF(wf);
+			return NULL;
+		}
+		memcpy(wf->buf + wf->offset, data, got);
+	} else {
+		/* The descriptor etc in front of the samples are an arbitrary
+		 * number of bytes long; move 16 bit data off an odd address
+		 * (over the end of the trigger times, which we don't keep) */
+		if (desc.comm_type == 1 && ((uintptr_t) data & 1) != 0) {
+			memmove(data - 1, data, got);
+			offset--;
+		}
+		wf->offset = offset;
+	}
+	waveform_describe(wf, chan, &desc);
+	waveform_shape(wf, got);
+	return (PyObject *) wf;
+}
+
+static PyMethodDef scope_methods[] = {
+	{"close", (PyCFunction) scope_close, METH_NOARGS,
+	 "Closes the link"},
+	{"__enter__", (PyCFunction) scope_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction) scope_exit, METH_VARARGS, NULL},
+	{"init", (PyCFunction) scope_init_scope, METH_NOARGS,
+	 "Binary 16-bit little-endian transfers, no headers"},
+	{"send", (PyCFunction) scope_send, METH_VARARGS,
+	 "send(cmd): a command with no answer"},
+	{"query", (PyCFunction) scope_query, METH_VARARGS | METH_KEYWORDS,
+	 "query(cmd, timeout=10000): a command and its answer, as a string"},
+	{"set_sample_rate", (PyCFunction) scope_set_sample_rate,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "set_sample_rate(rate=0, points=0, timeout=10000): returns the actual rate"},
+	{"set_segmented", (PyCFunction) scope_set_segmented, METH_VARARGS,
+	 "set_segmented(n): returns the actual number (<= 1 turns it off)"},
+	{"set_averages", (PyCFunction) scope_set_averages, METH_VARARGS,
+	 "set_averages(chan, n): returns the channel to get the data from"},
+	{"set_segmented_averages", (PyCFunction) scope_set_segmented_averages,
+	 METH_VARARGS,
+	 "set_segmented_averages(chan, n): returns the channel to get the data from"},
+	{"set_bytes_per_point", (PyCFunction) scope_set_bytes_per_point,
+	 METH_VARARGS, "set_bytes_per_point(1 or 2)"},
+	{"display_channel", (PyCFunction) scope_display_channel, METH_VARARGS,
+	 "display_channel(chan, on=True)"},
+	{"set_trigger_channel", (PyCFunction) scope_set_trigger_channel,
+	 METH_VARARGS, "set_trigger_channel(chan)"},
+	{"set_for_norm", (PyCFunction) scope_set_for_norm, METH_NOARGS, NULL},
+	{"set_for_auto", (PyCFunction) scope_set_for_auto, METH_NOARGS, NULL},
+	{"single", (PyCFunction) scope_single, METH_NOARGS, NULL},
+	{"stop", (PyCFunction) scope_stop, METH_NOARGS, NULL},
+	{"wavedesc", (PyCFunction) scope_wavedesc, METH_VARARGS,
+	 "wavedesc(chan): the size and scaling, as a dict"},
+	{"get_data", (PyCFunction) scope_get_data, METH_VARARGS | METH_KEYWORDS,
+	 "get_data(chan, clear_sweeps=False, arm=True, timeout=10000, out=None):\n"
+	 "returns a Waveform (reusing out, if given)"},
+	{NULL}
+};
+
+static PyTypeObject scope_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"lecroy_vxi11.Scope",	/* tp_name */
+	sizeof(struct scope),	/* tp_basicsize */
+};
+
+/* read_wfi(filename): what's in a .wfi file, for .wf files from lgetwf */
+static PyObject *module_read_wfi(PyObject *, PyObject * args)
+{
+	struct lecroy_wfi wfi;
+	const char *name;
+
+	if (!PyArg_ParseTuple(args, "s", &name))
+		return NULL;
+	if (lecroy_read_wfi_file(name, &wfi) != 0) {
+		PyErr_Format(PyExc_IOError, "could not read %s", name);
+		return NULL;
+	}
+	return Py_BuildValue("{s:l,s:l,s:i,s:d,s:d,s:d,s:d,s:O}",
+			     "no_of_bytes", wfi.no_of_bytes,
+			     "no_of_traces", wfi.no_of_traces,
+			     "bytes_per_point", wfi.bytes_per_point,
+			     "vertical_gain", wfi.vgain,
+			     "vertical_offset", wfi.voffset,
+			     "horiz_interval", wfi.horiz_interval,
+			     "horiz_offset", wfi.horiz_offset,
+			     "keep_all_points",
+			     wfi.keep_all_points ? Py_True : Py_False);
+}
+
+static PyMethodDef module_methods[] = {
+	{"read_wfi", module_read_wfi, METH_VARARGS,
+	 "read_wfi(filename): the scaling etc from a .wfi file, as a dict"},
+	{NULL}
+};
+
+static struct PyModuleDef lecroy_module = {
+	PyModuleDef_HEAD_INIT,
+	"lecroy_vxi11",		/* m_name */
+	"LeCroy oscilloscopes over VXI-11, captures exposed through the buffer protocol",
+	-1,			/* m_size */
+	module_methods,
+};
+
+PyMODINIT_FUNC PyInit_lecroy_vxi11(void)
+{
+	PyObject *m;
+
+	/* The rest of the type slots; C++ won't have designated initialisers
+	 * (not until C++20) */
+	waveform_type.tp_dealloc = (destructor) waveform_dealloc;
+	waveform_type.tp_as_buffer = &waveform_as_buffer;
+	waveform_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	waveform_type.tp_doc =
+	    "One capture: use numpy.asarray(wf) or memoryview(wf) to get at it";
+	waveform_type.tp_members = waveform_members;
+	waveform_type.tp_getset = waveform_getset;
+	waveform_type.tp_new = waveform_new;
+
+	scope_type.tp_dealloc = (destructor) scope_dealloc;
+	scope_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	scope_type.tp_doc = "Scope(ip): a link to a LeCroy scope";
+	scope_type.tp_methods = scope_methods;
+	scope_type.tp_init = (initproc) scope_init;
+	scope_type.tp_new = PyType_GenericNew;
+
+	if (PyType_Ready(&waveform_type) < 0 || PyType_Ready(&scope_type) < 0)
+		return NULL;
+	m = PyModule_Create(&lecroy_module);
+	if (m == NULL)
+		return NULL;
+	Py_INCREF(&waveform_type);
+	PyModule_AddObject(m, "Waveform", (PyObject *) & waveform_type);
+	Py_INCREF(&scope_type);
+	PyModule_AddObject(m, "Scope", (PyObject *) & scope_type);
+	return m;
+}
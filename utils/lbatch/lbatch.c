@@ -0,0 +1,535 @@
+/* lbatch.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Command line utility to reprocess lots of waveform files (as written by
+ * lgetwf) in one go: average the traces of each file down to one, subtract
+ * a background, change the bytes per point, or turn the data into volts.
+ * Each filename.wf (with its filename.wfi) gives a new filename.wf and
+ * filename.wfi (or, with -volts, filename.wfv) in the output directory.
+ *
+ * It's meant for archives that are a lot bigger than the PC's memory, so
+ * the inputs are mmap()ed rather than read in, and processed (and written
+ * out) a few MB at a time; pages we've finished with are handed straight
+ * back, and the kernel is told not to bother keeping the files cached.
+ * With more files than threads, each thread gets on with a file of its own
+ * (whoever finishes first takes the next); with fewer, the threads share
+ * the work on each file instead, trace by trace and point by point. Either
+ * way it should go as fast as the disks will let it.
+ *
+ * The order of things is: average (-avg), subtract the background (-bg),
+ * then either write the raw data (at -bytes bytes per point) or volts
+ * (-volts). The background file is averaged down to one trace when it's
+ * read in, and must have the same number of points per trace as the
+ * files it's subtracted from, and the same vertical settings (the
+ * subtraction is done in raw units, so a file whose gain or offset differs
+ * from the background's is reported and skipped).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lecroy_vxi11.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+/* Roughly how much output each file has in memory at once */
+#define	BLOCK_BYTES	(8 * 1024 * 1024)
+
+/* A waveform file, mmap()ed, and what its .wfi file says about it */
+struct wf_file {
+	int fd;
+	char *data;
+	long len;
+	struct lecroy_wfi wfi;
+	long no_of_traces;
+	long points_per_trace;
+};
+
+/* What to do, and to which files; shared by all the threads */
+struct batch {
+	char **names;
+	int no_of_files;
+	const char *outdir;
+	char *progname;
+	BOOL average;
+	BOOL volts;
+	int bytes_per_point;	/* of the output, 0 means as the input */
+	char *bg;		/* one trace, NULL if there's no background */
+	int bg_bytes_per_point;
+	long bg_points;
+	double bg_vgain;	/* per 16-bit unit, see vgain16() */
+	double bg_voffset;
+	int kernel_threads;	/* for each file */
+	/* Results, added up atomically */
+	long files_done;
+	long files_failed;
+	long bytes_in;
+	long bytes_out;
+};
+
+BOOL sc(const char *, const char *);
+static void base_name(const char *name, char *base, char *wfname,
+		      char *wfiname);
+static int open_wf(const char *wfname, const char *wfiname, struct wf_file *f);
+static void close_wf(struct wf_file *f);
+static int process_file(struct batch *batch, const char *name);
+static void process_files(void *arg, long start, long end);
+
+/* The gain of a 16-bit unit, which is what the subtraction works in: 1 byte
+ * data is the top byte of it */
+static double vgain16(double vgain, int bytes_per_point)
+{
+	return bytes_per_point == 1 ? vgain / 256 : vgain;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	struct batch batch;
+	struct wf_file bg;
+	char *bgname = NULL;
+	char base[256], wfname[256], wfiname[256];
+	int no_of_threads = 0;
+	int file_threads;
+	int index = 1;
+	double t;
+
+	progname = argv[0];
+	memset(&batch, 0, sizeof(struct batch));
+	batch.progname = progname;
+	batch.names = new char *[argc];
+
+	while (index < argc) {
+		if (sc(argv[index], "-o") || sc(argv[index], "-out")
+		    || sc(argv[index], "-output")) {
+			batch.outdir = argv[++index];
+		} else if (sc(argv[index], "-avg")
+			   || sc(argv[index], "-average")) {
+			batch.average = TRUE;
+		} else if (sc(argv[index], "-bg")
+			   || sc(argv[index], "-background")) {
+			bgname = argv[++index];
+		} else if (sc(argv[index], "-b") || sc(argv[index], "-bytes")
+			   || sc(argv[index], "-bytes_per_point")) {
+			sscanf(argv[++index], "%d", &batch.bytes_per_point);
+		} else if (sc(argv[index], "-volts") || sc(argv[index], "-v")) {
+			batch.volts = TRUE;
+		} else if (sc(argv[index], "-threads")
+			   || sc(argv[index], "-j")) {
+			sscanf(argv[++index], "%d", &no_of_threads);
+		} else {
+			batch.names[batch.no_of_files++] = argv[index];
+		}
+		index++;
+	}
+
+	if (batch.outdir == NULL || batch.no_of_files == 0
+	    || (batch.average == FALSE && bgname == NULL
+		&& batch.volts == FALSE && batch.bytes_per_point == 0)
+	    || batch.bytes_per_point < 0 || batch.bytes_per_point > 2) {
+		printf
+		    ("%s: reprocesses lots of waveform files from lgetwf, in parallel\n",
+		     progname);
+		printf("Run using %s [arguments] filename[.wf] ...\n\n",
+		       progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf
+		    ("-o     -output         -out     : directory to write the results to\n");
+		printf("and at least one of:\n");
+		printf
+		    ("-avg   -average                 : average each file's traces down to one\n");
+		printf
+		    ("-bg    -background     file     : subtract (the average of) this file\n");
+		printf
+		    ("-b     -bytes_per_point -bytes  : 1 or 2 (default: as the input)\n");
+		printf
+		    ("-v     -volts                   : write volts rather than raw data\n\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf
+		    ("-j     -threads                 : no of threads (default one per core)\n\n");
+		printf("INPUTS:\n");
+		printf("filename.wf  : binary data of waveform\n");
+		printf("filename.wfi : waveform information (text)\n\n");
+		printf("OUTPUTS (in the output directory):\n");
+		printf("filename.wf  : binary data of waveform\n");
+		printf("filename.wfi : waveform information (text)\n");
+		printf
+		    ("filename.wfv : volts, as doubles (if -volts, instead of the above)\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -avg -bg dark -o averaged run1/*.wf\n", progname);
+		exit(1);
+	}
+
+	/* The background, averaged down to one trace */
+	if (bgname != NULL) {
+		base_name(bgname, base, wfname, wfiname);
+		if (open_wf(wfname, wfiname, &bg) != 0)
+			exit(2);
+		batch.bg_bytes_per_point = bg.wfi.bytes_per_point;
+		batch.bg_points = bg.points_per_trace;
+		batch.bg_vgain = vgain16(bg.wfi.vgain, bg.wfi.bytes_per_point);
+		batch.bg_voffset = bg.wfi.voffset;
+		batch.bg = new char[bg.points_per_trace *
+				    bg.wfi.bytes_per_point];
+		lecroy_average_segmented_data(bg.data,
+					      bg.points_per_trace *
+					      bg.wfi.bytes_per_point *
+					      bg.no_of_traces, batch.bg,
+					      bg.points_per_trace *
+					      bg.wfi.bytes_per_point,
+					      (int)bg.no_of_traces,
+					      bg.wfi.bytes_per_point,
+					      no_of_threads);
+		close_wf(&bg);
+	}
+
+	/* A file per thread if there are enough of them to go round,
+	 * otherwise the threads are shared out amongst the files */
+	no_of_threads = lecroy_get_no_of_threads(no_of_threads);
+	if (batch.no_of_files >= no_of_threads) {
+		file_threads = no_of_threads;
+		batch.kernel_threads = 1;
+	} else {
+		file_threads = batch.no_of_files;
+		batch.kernel_threads = no_of_threads / batch.no_of_files;
+	}
+
+	t = now();
+	lecroy_parallel_for(batch.no_of_files, 1, file_threads, process_files,
+			    &batch);
+	t = now() - t;
+	printf("%ld files done, %ld failed: %ld bytes in, %ld out, %.1f MB/s\n",
+	       batch.files_done, batch.files_failed, batch.bytes_in,
+	       batch.bytes_out, t > 0 ? batch.bytes_in / t / 1e6 : 0);
+	delete[]batch.bg;
+	delete[]batch.names;
+	return batch.files_failed > 0 ? 2 : 0;
+}
+
+static void process_files(void *arg, long start, long end)
+{
+	struct batch *batch = (struct batch *)arg;
+	long l;
+
+	for (l = start; l < end; l++) {
+		if (process_file(batch, batch->names[l]) == 0)
+			__sync_fetch_and_add(&batch->files_done, 1);
+		else
+			__sync_fetch_and_add(&batch->files_failed, 1);
+	}
+}
+
+/* "dir/name", "dir/name.wf" -> "dir/name" and its .wf and .wfi names */
+static void base_name(const char *name, char *base, char *wfname,
+		      char *wfiname)
+{
+	size_t l = strlen(name);
+
+	if (l > 3 && strcmp(name + l - 3, ".wf") == 0)
+		l -= 3;
+	snprintf(base, 256, "%.*s", (int)l, name);
+	snprintf(wfname, 256, "%s.wf", base);
+	snprintf(wfiname, 256, "%s.wfi", base);
+}
+
+static int open_wf(const char *wfname, const char *wfiname, struct wf_file *f)
+{
+	struct stat st;
+
+	memset(f, 0, sizeof(struct wf_file));
+	f->fd = -1;
+	if (lecroy_read_wfi_file(wfiname, &f->wfi) != 0)
+		return -1;
+	if (f->wfi.bytes_per_point != 1 && f->wfi.bytes_per_point != 2) {
+		printf("error: %s: %d bytes per point?\n", wfiname,
+		       f->wfi.bytes_per_point);
+		return -1;
+	}
+	f->fd = open(wfname, O_RDONLY);
+	if (f->fd < 0 || fstat(f->fd, &st) != 0) {
+		printf("error: could not open %s\n", wfname);
+		close_wf(f);
+		return -1;
+	}
+	f->len = (long)st.st_size;
+	f->no_of_traces = f->wfi.no_of_traces > 0 ? f->wfi.no_of_traces : 1;
+	/* Legacy files lost a point off each trace, so go by what's
+	 * actually there */
+	f->points_per_trace = f->len / (f->wfi.bytes_per_point *
+					f->no_of_traces);
+	if (f->points_per_trace < 1) {
+		printf("error: %s is empty\n", wfname);
+		close_wf(f);
+		return -1;
+	}
+	f->data = (char *)mmap(NULL, f->len, PROT_READ, MAP_PRIVATE, f->fd, 0);
+	if (f->data == MAP_FAILED) {
+		printf("error: could not mmap %s\n", wfname);
+		f->data = NULL;
+		close_wf(f);
+		return -1;
+	}
+	return 0;
+}
+
+static void close_wf(struct wf_file *f)
+{
+	if (f->data != NULL)
+		munmap(f->data, f->len);
+	if (f->fd >= 0) {
+		/* We won't be back, so don't push anything else out of the
+		 * page cache on our account */
+		posix_fadvise(f->fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(f->fd);
+	}
+	f->data = NULL;
+	f->fd = -1;
+}
+
+/* Hands back the pages of [from, to) that we've finished with */
+static void done_with(struct wf_file *f, long from, long to)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	from = (from + page - 1) / page * page;
+	to = to / page * page;
+	if (to > from)
+		madvise(f->data + from, to - from, MADV_DONTNEED);
+}
+
+/* Does whatever's been asked for to one file. Returns 0, or -1 (having said
+ * why) if it couldn't. */
+static int process_file(struct batch *batch, const char *name)
+{
+	struct wf_file in;
+	struct lecroy_wavedesc desc;
+	struct stat st_in, st_out;
+	char base[256], wfname[256], wfiname[256];
+	char outname[512], outwfiname[512];
+	const char *leaf;
+	char *src, *avg = NULL, *zero = NULL, *raw = NULL, *block;
+	char *bg, *trace, *out;
+	int bpp, out_bpp, sub_bpp, bg_bpp;
+	long ppt, traces, trace_bytes, out_trace_bytes, block_traces;
+	long i, t, n, written = 0;
+	double vgain, voffset;
+	BOOL subtract;
+	FILE *f;
+	int ret = 0;
+
+	base_name(name, base, wfname, wfiname);
+	if (open_wf(wfname, wfiname, &in) != 0)
+		return -1;
+	leaf = strrchr(base, '/');
+	leaf = leaf == NULL ? base : leaf + 1;
+	snprintf(outname, 512, "%s/%s.%s", batch->outdir, leaf,
+		 batch->volts == TRUE ? "wfv" : "wf");
+	snprintf(outwfiname, 512, "%s/%s.wfi", batch->outdir, leaf);
+	/* Writing over the input would end badly */
+	if (stat(outname, &st_out) == 0 && fstat(in.fd, &st_in) == 0
+	    && st_in.st_dev == st_out.st_dev && st_in.st_ino == st_out.st_ino) {
+		printf("error: %s would be written over itself\n", wfname);
+		close_wf(&in);
+		return -1;
+	}
+
+	bpp = in.wfi.bytes_per_point;
+	ppt = in.points_per_trace;
+	traces = in.no_of_traces;
+	trace_bytes = ppt * bpp;
+	src = in.data;
+	vgain = in.wfi.vgain;
+	voffset = in.wfi.voffset;
+	out_bpp = batch->bytes_per_point > 0 ? batch->bytes_per_point : bpp;
+	if (batch->bg != NULL && batch->bg_points != ppt) {
+		printf("error: %s has %ld points per trace, the background %ld\n",
+		       wfname, ppt, batch->bg_points);
+		close_wf(&in);
+		return -1;
+	}
+	/* Raw units only subtract if they mean the same number of volts; the
+	 * offsets have to agree to within half a unit */
+	if (batch->bg != NULL
+	    && (fabs(vgain16(vgain, bpp) - batch->bg_vgain) >
+		1e-6 * fabs(batch->bg_vgain)
+		|| fabs(voffset - batch->bg_voffset) >
+		0.5 * fabs(batch->bg_vgain))) {
+		printf
+		    ("error: %s has different vertical settings (gain %g, offset %g) to the background (gain %g, offset %g)\n",
+		     wfname, vgain16(vgain, bpp), voffset, batch->bg_vgain,
+		     batch->bg_voffset);
+		close_wf(&in);
+		return -1;
+	}
+
+	if (batch->average == TRUE && traces > 1) {
+		avg = new char[trace_bytes];
+		lecroy_average_segmented_data(in.data, trace_bytes * traces,
+					      avg, trace_bytes, (int)traces,
+					      bpp, batch->kernel_threads);
+		src = avg;
+		traces = 1;
+		done_with(&in, 0, in.len);
+	}
+
+	/* The subtraction kernel also does the changing of bytes per point;
+	 * with no background, there's just nothing to subtract. It works in
+	 * 16-bit units, so the gain changes if the bytes per point do. */
+	subtract = batch->bg != NULL || out_bpp != bpp;
+	bg = batch->bg;
+	bg_bpp = batch->bg_bytes_per_point;
+	if (subtract == TRUE) {
+		if (bg == NULL) {
+			zero = new char[ppt];
+			memset(zero, 0, ppt);
+			bg = zero;
+			bg_bpp = 1;
+		}
+		sub_bpp = batch->volts == TRUE ? 2 : out_bpp;
+		if (bpp == 1 && sub_bpp == 2)
+			vgain /= 256;
+		if (bpp == 2 && sub_bpp == 1)
+			vgain *= 256;
+		/* The offsets (the same, see above) have cancelled */
+		if (batch->bg != NULL)
+			voffset = 0;
+		if (batch->volts == TRUE)
+			raw = new char[ppt * 2];
+	} else {
+		sub_bpp = bpp;
+	}
+
+	f = fopen(outname, "wb");
+	if (f == NULL) {
+		printf("error: could not open %s for writing\n", outname);
+		delete[]avg;
+		delete[]zero;
+		close_wf(&in);
+		return -1;
+	}
+	out_trace_bytes = batch->volts == TRUE ? ppt * sizeof(double) :
+	    ppt * out_bpp;
+	block_traces = BLOCK_BYTES / out_trace_bytes;
+	if (block_traces < 1)
+		block_traces = 1;
+	if (block_traces > traces)
+		block_traces = traces;
+	/* Nothing to do to the traces themselves: straight out of the
+	 * average */
+	if (subtract == FALSE && batch->volts == FALSE)
+		block = NULL;
+	else
+		block = new char[block_traces * out_trace_bytes];
+
+	for (t = 0; t < traces && ret == 0; t += block_traces) {
+		n = traces - t < block_traces ? traces - t : block_traces;
+		if (block == NULL) {
+			if (fwrite(src + t * trace_bytes, 1, n * trace_bytes,
+				   f) != (size_t)(n * trace_bytes))
+				ret = -1;
+			written += n * trace_bytes;
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			trace = src + (t + i) * trace_bytes;
+			out = block + i * out_trace_bytes;
+			if (subtract == TRUE) {
+				lecroy_subtract_char_arrays(trace, bg,
+							    raw != NULL ? raw :
+							    out, bpp, bg_bpp,
+							    sub_bpp, (int)ppt,
+							    batch->kernel_threads);
+				if (raw != NULL)
+					lecroy_scale_char_array(raw,
+								(double *)out,
+								2, ppt, vgain,
+								voffset,
+								batch->kernel_threads);
+			} else {
+				lecroy_scale_char_array(trace, (double *)out,
+							bpp, ppt, vgain,
+							voffset,
+							batch->kernel_threads);
+			}
+		}
+		if (fwrite(block, 1, n * out_trace_bytes, f) !=
+		    (size_t)(n * out_trace_bytes))
+			ret = -1;
+		written += n * out_trace_bytes;
+		if (avg == NULL)
+			done_with(&in, t * trace_bytes, (t + n) * trace_bytes);
+	}
+	if (fclose(f) != 0)
+		ret = -1;
+	if (ret != 0)
+		printf("error: could not write %s\n", outname);
+
+	/* A .wfi for the raw data; volts don't need one */
+	if (ret == 0 && batch->volts == FALSE) {
+		memset(&desc, 0, sizeof(struct lecroy_wavedesc));
+		desc.vertical_gain = vgain;
+		desc.vertical_offset = voffset;
+		desc.horiz_interval = in.wfi.horiz_interval;
+		desc.horiz_offset = in.wfi.horiz_offset;
+		desc.subarray_count = traces;
+		if (lecroy_write_wfi_file_from_wavedesc(outwfiname, &desc, '1',
+							batch->progname, 1,
+							out_bpp, written,
+							0, 0) < 0)
+			ret = -1;
+	}
+
+	__sync_fetch_and_add(&batch->bytes_in, in.len);
+	__sync_fetch_and_add(&batch->bytes_out, written);
+	delete[]block;
+	delete[]raw;
+	delete[]zero;
+	delete[]avg;
+	close_wf(&in);
+	return ret;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
@@ -38,6 +38,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include "lecroy_vxi11.h"
 
@@ -52,6 +53,10 @@
 #endif
 
 BOOL sc(const char *, const char *);
+int read_template(const char *filename, struct lecroy_gate_criterion *c);
+void print_size(char chnl, long buf_size, int bytes_per_point, int no_segments,
+		double actual_s_rate);
+struct lecroy_writer *open_writer(const char *wfname, long buf_size, int flags);
 
 int main(int argc, char *argv[])
 {
@@ -59,11 +64,44 @@ int main(int argc, char *argv[])
 	static char *progname;
 	static char *serverIP;
 	char chnl;		/* we use '1' to '4' for channels, and 'A' to 'D' for FUNC[1...4] */
-	FILE *f_wf;
+	FILE *f_wf = NULL;
+	struct lecroy_writer *writer = NULL;
+	int writer_flags = 0;
+	BOOL async = FALSE;
+	BOOL envelope = FALSE;
+	long align_shift = -1;
+	long segs;
+	double *shifts, jitter;
+	struct lecroy_envelope env;
+	struct lecroy_persist persist;
+	int persist_columns = 0, persist_rows = 0;
+	struct lecroy_gate_criterion criteria[LECROY_GATE_MAX_CRITERIA];
+	struct lecroy_gate gate;
+	struct lecroy_gate_record *records;
+	int no_criteria = 0;
+	int gate_combine = LECROY_GATE_ANY;
+	long gate_start = 0, gate_end = 0;
+	long bytes_to_write;
 	char wfname[256];
 	char wfiname[256];
-	long buf_size;
+	char wftname[256];
+	char wfgname[256];
+	char wfename[256];
+	char wfzname[256];
+	char wfpname[256];
+	BOOL compress = FALSE;
+	char *zbuf = NULL;
+	long zlen;
+	long buf_size = 0;
 	char *buf;
+	char *data;
+	long data_offset;
+	struct lecroy_pool pool;
+	int pool_flags = 0;
+	int arm_and_wait;
+	BOOL fused = FALSE;
+	BOOL self_size = FALSE;
+	size_t grown_len = 0;
 	unsigned long timeout = 10000;	/* in ms (= 10 seconds) */
 
 	long bytes_returned;
@@ -73,6 +111,11 @@ int main(int argc, char *argv[])
 	BOOL got_file = FALSE;
 	BOOL got_no_averages = FALSE;
 	BOOL got_segmented_averages = FALSE;
+	BOOL got_trigtime = FALSE;
+	double *trig_time;
+	double *trig_offset;
+	int no_trigtimes;
+	struct lecroy_wavedesc desc;
 	int no_averages;
 	BOOL got_no_segments = FALSE;
 	int no_segments = 1;
@@ -81,7 +124,6 @@ int main(int argc, char *argv[])
 	double s_rate = 0;
 	long npoints = 0;
 	double actual_s_rate;
-	long actual_npoints;
 	VXI11_CLINK *clink;	/* client link (actually a structure contining CLIENT and VXI11_LINK pointers) */
 	int l;
 	char cmd[256];
@@ -95,6 +137,11 @@ int main(int argc, char *argv[])
 		    || sc(argv[index], "-file")) {
 			snprintf(wfname, 256, "%s.wf", argv[++index]);
 			snprintf(wfiname, 256, "%s.wfi", argv[index]);
+			snprintf(wftname, 256, "%s.wft", argv[index]);
+			snprintf(wfgname, 256, "%s.wfg", argv[index]);
+			snprintf(wfename, 256, "%s.wfe", argv[index]);
+			snprintf(wfzname, 256, "%s.wfz", argv[index]);
+			snprintf(wfpname, 256, "%s.pgm", argv[index]);
 			got_file = TRUE;
 		}
 
@@ -150,6 +197,92 @@ int main(int argc, char *argv[])
 			clear_sweeps = TRUE;
 		}
 
+		if (sc(argv[index], "-trigtime") || sc(argv[index], "-tt")
+		    || sc(argv[index], "-trig_times")) {
+			got_trigtime = TRUE;
+		}
+
+		if (sc(argv[index], "-z") || sc(argv[index], "-compress")) {
+			compress = TRUE;
+		}
+
+		if (sc(argv[index], "-auto") || sc(argv[index], "-self_size")) {
+			self_size = TRUE;
+		}
+
+		if (sc(argv[index], "-fused") || sc(argv[index], "-fast")) {
+			fused = TRUE;
+		}
+
+		if (sc(argv[index], "-gate")) {
+			sscanf(argv[++index], "%ld", &gate_start);
+			sscanf(argv[++index], "%ld", &gate_end);
+		}
+
+		if ((sc(argv[index], "-keep_threshold")
+		     || sc(argv[index], "-keep_peak")
+		     || sc(argv[index], "-keep_energy")
+		     || sc(argv[index], "-keep_template"))
+		    && no_criteria < LECROY_GATE_MAX_CRITERIA) {
+			memset(&criteria[no_criteria], 0,
+			       sizeof(struct lecroy_gate_criterion));
+			if (sc(argv[index], "-keep_threshold"))
+				criteria[no_criteria].type =
+				    LECROY_GATE_THRESHOLD;
+			if (sc(argv[index], "-keep_peak"))
+				criteria[no_criteria].type = LECROY_GATE_PEAK;
+			if (sc(argv[index], "-keep_energy"))
+				criteria[no_criteria].type = LECROY_GATE_ENERGY;
+			if (sc(argv[index], "-keep_template")) {
+				criteria[no_criteria].type =
+				    LECROY_GATE_TEMPLATE;
+				if (read_template(argv[++index],
+						  &criteria[no_criteria]) != 0)
+					exit(3);
+			}
+			sscanf(argv[++index], "%lg",
+			       &criteria[no_criteria].level);
+			no_criteria++;
+		}
+
+		if (sc(argv[index], "-keep_all")) {
+			gate_combine = LECROY_GATE_ALL;
+		}
+
+		if (sc(argv[index], "-align")) {
+			sscanf(argv[++index], "%ld", &align_shift);
+		}
+
+		if (sc(argv[index], "-envelope") || sc(argv[index], "-env")) {
+			envelope = TRUE;
+		}
+
+		if (sc(argv[index], "-persist")) {
+			sscanf(argv[++index], "%d", &persist_columns);
+			sscanf(argv[++index], "%d", &persist_rows);
+		}
+
+		if (sc(argv[index], "-async")) {
+			async = TRUE;
+		}
+
+		if (sc(argv[index], "-direct")) {
+			async = TRUE;
+			writer_flags |= LECROY_WRITER_DIRECT;
+		}
+
+		if (sc(argv[index], "-hugepages") || sc(argv[index], "-hp")) {
+			pool_flags |= LECROY_POOL_HUGEPAGES;
+		}
+
+		if (sc(argv[index], "-hugetlb")) {
+			pool_flags |= LECROY_POOL_HUGETLB;
+		}
+
+		if (sc(argv[index], "-mlock")) {
+			pool_flags |= LECROY_POOL_MLOCK;
+		}
+
 		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
 			sscanf(argv[++index], "%lu", &timeout);
 		}
@@ -185,10 +318,57 @@ int main(int argc, char *argv[])
 		printf
 		    ("-sa    -seg_averages   -seg_aver: set no of averages (segmented mode)\n");
 		printf
-		    ("-seg   -segmented      -seq     : set no of segments\n\n");
+		    ("-seg   -segmented      -seq     : set no of segments\n");
+		printf
+		    ("-tt    -trigtime  -trig_times   : save segment trigger times\n");
+		printf
+		    ("-fused -fast                    : arm, wait and fetch in one message\n");
+		printf
+		    ("-auto  -self_size               : don't ask how big the data is first\n");
+		printf
+		    ("-z     -compress                : write filename.wfz (lossless) not .wf\n");
+		printf
+		    ("       -keep_threshold V        : only keep segments that cross V volts\n");
+		printf
+		    ("       -keep_peak V             : only keep segments with |signal| >= V volts\n");
+		printf
+		    ("       -keep_energy V2          : only keep segments with mean square >= V2\n");
+		printf
+		    ("       -keep_template file r    : only keep segments that correlate with the\n");
+		printf
+		    ("                                  shape in file (volts, one per line) >= r\n");
+		printf
+		    ("       -keep_all                : keep only if every -keep_* test passes\n");
+		printf
+		    ("       -gate start end          : only test points start to end of a segment\n");
+		printf
+		    ("       -align N                 : average the segments on the PC, lining\n");
+		printf
+		    ("                                  them up first (searching +/- N points)\n");
+		printf
+		    ("-env   -envelope                : also save a min/max envelope for plotting\n");
+		printf
+		    ("       -persist cols rows       : also save a persistence image of the\n");
+		printf
+		    ("                                  segments (cols 0 = one per point)\n");
+		printf
+		    ("       -async                   : write the file in the background\n");
+		printf
+		    ("       -direct                  : as -async, bypassing the page cache\n");
+		printf
+		    ("-hp    -hugepages               : use transparent huge pages for the buffer\n");
+		printf
+		    ("       -hugetlb                 : use explicit huge pages for the buffer\n");
+		printf
+		    ("       -mlock                   : lock the buffer into RAM\n\n");
 		printf("OUTPUTS:\n");
 		printf("filename.wf  : binary data of waveform\n");
-		printf("filename.wfi : waveform information (text)\n\n");
+		printf("filename.wfz : the same, compressed (if -z; lwfz turns it back)\n");
+		printf("filename.wfi : waveform information (text)\n");
+		printf("filename.wft : segment trigger times (text, if -tt)\n");
+		printf("filename.wfg : what each segment measured (text, if -keep_*)\n");
+		printf("filename.wfe : min/max envelope (binary, if -envelope)\n");
+		printf("filename.pgm : persistence image (16-bit PGM, if -persist)\n\n");
 		printf
 		    ("In Matlab, use loadwf or similar to load and process the waveform\n\n");
 		printf("EXAMPLE:\n");
@@ -196,8 +376,13 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	f_wf = fopen(wfname, "w");
-	if (f_wf > 0) {
+	if (compress == TRUE)
+		strcpy(wfname, wfzname);
+
+	/* With -async the file is opened once we know how big it will be */
+	if (async == FALSE)
+		f_wf = fopen(wfname, "w");
+	if (f_wf != NULL || async == TRUE) {
 		/* This utility illustrates the general idea behind how data is acquired.
 		 * First we open the device, referenced by an IP address, and obtain
 		 * a client id, and a link id, all contained in a "VXI11_CLINK" structure.  Each
@@ -235,7 +420,7 @@ int main(int argc, char *argv[])
 		}
 
 		if (got_no_segments == TRUE)
-			lecroy_set_segmented(clink, no_segments);
+			no_segments = lecroy_set_segmented(clink, no_segments);
 
 		/* Make sure the channel is turned on */
 		lecroy_display_channel(clink, chnl, 1);
@@ -248,28 +433,234 @@ int main(int argc, char *argv[])
 //              double_ret = lecroy_obtain_insp_double(clink, cmd, timeout);
 //              printf("Returned value: %g\n",double_ret);
 
-		buf_size =
-		    lecroy_write_wfi_file(clink, wfiname, chnl, progname, 1,
-					  bytes_per_point, timeout);
-		actual_npoints = buf_size / (bytes_per_point * no_segments);
-		printf
-		    ("Bytes per trace (channel %c): %ld; pts/trace: %ld; sample rate: %gSa/S\n",
-		     chnl, buf_size, actual_npoints, actual_s_rate);
-		buf = new char[buf_size];
-		bytes_returned =
-		    lecroy_get_data(clink, chnl, clear_sweeps, buf, buf_size,
-				    got_no_segments, timeout);
+		/* The trigger times need the size up front */
+		if (self_size == TRUE && got_trigtime == TRUE) {
+			printf("-auto can't be used with -tt, ignoring it\n");
+			self_size = FALSE;
+		}
+		/* Only an estimate, from the live settings, for the size of
+		 * the pool (and the preallocated file); the exact size, and
+		 * everything the .wfi file needs, come in the descriptor at
+		 * the front of the block that comes back */
+		if (self_size == FALSE)
+			buf_size = lecroy_calculate_no_of_bytes_from_vbs(clink,
+									 chnl);
+		/* All the memory for the transfer comes from a pool, which is mapped
+		 * and pre-faulted before the scope is armed, so we don't take a page
+		 * fault every 4kB during the transfer. The WF? ALL block is received
+		 * straight into it; if the estimate was short, the library finds a
+		 * bigger buffer once it's seen the block header, as it does for
+		 * -auto. With -tt the data is copied out into a second buffer. */
+		if (self_size == FALSE
+		    && lecroy_pool_create(&pool, got_trigtime == TRUE ? 2 : 1,
+					  buf_size + LECROY_WAVEDESC_LEN + 160 +
+					  (16 * no_segments) +
+					  LECROY_DATA_BLOCK_HEADER_LEN,
+					  pool_flags) != 0) {
+			printf("Quitting...\n");
+			exit(2);
+		}
+		if (self_size == FALSE)
+			lecroy_set_receive_pool(clink, &pool);
+		if (async == TRUE && self_size == FALSE)
+			writer = open_writer(wfname, buf_size, writer_flags);
+		buf = self_size == TRUE ? NULL : lecroy_pool_get(&pool);
+		grown_len = self_size == TRUE ? 0 : pool.buffer_size;
+		data = buf;
+		/* Segmented acquisitions need arming; with -fused we always arm, but
+		 * without the separate *OPC? query */
+		if (fused == TRUE)
+			arm_and_wait = LECROY_ARM_FUSED;
+		else
+			arm_and_wait = got_no_segments;
+		if (got_trigtime == TRUE) {
+			/* The trigger times come back in the same transfer as the data */
+			trig_time = new double[no_segments];
+			trig_offset = new double[no_segments];
+			bytes_returned =
+			    lecroy_get_data_with_trigtime(clink, chnl,
+							  clear_sweeps, buf,
+							  buf_size, trig_time,
+							  trig_offset,
+							  no_segments, &desc,
+							  arm_and_wait,
+							  timeout);
+			no_trigtimes = (int)(desc.trigtime_array / 16);
+			if (no_trigtimes > no_segments)
+				no_trigtimes = no_segments;
+			lecroy_write_trigtime_file(wftname, trig_time,
+						   trig_offset, no_trigtimes,
+						   progname);
+			delete[]trig_time;
+			delete[]trig_offset;
+		} else {
+			/* Nothing asked beforehand (with -auto, not even for an
+			 * estimate) */
+			bytes_returned =
+			    lecroy_get_all_growing(clink, chnl, clear_sweeps,
+						   &buf, &grown_len,
+						   &data_offset, &desc,
+						   arm_and_wait, timeout);
+			data = buf + data_offset;
+		}
+		if (bytes_returned <= 0) {
+			printf("error: no data, quitting...\n");
+			exit(2);
+		}
+		buf_size = bytes_returned;
+		lecroy_write_wfi_file_from_wavedesc(wfiname, &desc, chnl,
+						    progname, 1, bytes_per_point,
+						    buf_size, 0, 0);
+		print_size(chnl, buf_size, bytes_per_point, no_segments,
+			   actual_s_rate);
+		if (async == TRUE && self_size == TRUE)
+			writer = open_writer(wfname, buf_size, writer_flags);
 		//lecroy_set_for_norm(clink);
+		bytes_to_write = buf_size;
+		if (no_criteria > 0) {
+			/* Event gating: only the segments that pass are written,
+			 * and the .wfg file says what every segment measured */
+			for (l = 0; l < no_criteria; l++) {
+				criteria[l].start = gate_start;
+				criteria[l].end = gate_end;
+			}
+			if (lecroy_gate_init(&gate, criteria, no_criteria,
+					     gate_combine, &desc) != 0) {
+				printf("Quitting...\n");
+				exit(2);
+			}
+			/* One record for every segment actually in buf (what
+			 * came back, not what we asked for with -seg) */
+			segs = buf_size / (gate.points_per_segment *
+					   gate.bytes_per_point);
+			records =
+			    new struct lecroy_gate_record[segs > 1 ? segs : 1];
+			bytes_to_write =
+			    lecroy_gate_process(&gate, data, buf_size, records,
+						0);
+			lecroy_gate_write_summary(wfgname, &gate, records,
+						  gate.segments_seen, progname,
+						  0);
+			printf("Kept %ld of %ld segments\n", gate.segments_kept,
+			       gate.segments_seen);
+			desc.subarray_count = gate.segments_kept;
+			lecroy_write_wfi_file_from_wavedesc(wfiname, &desc,
+							    chnl, progname,
+							    gate.segments_kept >
+							    0 ? 1 : 0,
+							    bytes_per_point,
+							    bytes_to_write, 0,
+							    0);
+			delete[]records;
+			lecroy_gate_free(&gate);
+			for (l = 0; l < no_criteria; l++)
+				delete[]criteria[l].templ;
+		}
+		if (align_shift >= 0) {
+			/* Jitter-corrected average of the segments on the PC;
+			 * only the average is written */
+			segs = desc.subarray_count > 1 ? desc.subarray_count : 1;
+			shifts = new double[segs];
+			long_ret =
+			    lecroy_align_segmented_data(data, bytes_to_write,
+							data,
+							bytes_to_write / segs,
+							(int)segs,
+							desc.comm_type ==
+							1 ? 2 : 1, 0, 0,
+							align_shift, shifts,
+							0);
+			if (long_ret > 0) {
+				jitter = 0;
+				for (l = 0; l < segs; l++)
+					jitter += shifts[l] * shifts[l];
+				printf
+				    ("Averaged %ld segments, rms jitter %g s\n",
+				     segs,
+				     sqrt(jitter / segs) * desc.horiz_interval);
+				bytes_to_write = long_ret;
+				desc.subarray_count = 1;
+				desc.wave_array_count =
+				    bytes_to_write / (desc.comm_type == 1 ? 2 : 1);
+				lecroy_write_wfi_file_from_wavedesc(wfiname,
+								    &desc, chnl,
+								    progname, 1,
+								    bytes_per_point,
+								    bytes_to_write,
+								    0, 0);
+			}
+			delete[]shifts;
+		}
+		if (envelope == TRUE) {
+			/* The envelope is of what's actually written, so it
+			 * lines up with the .wf file point for point */
+			if (lecroy_envelope_build(&env, data, bytes_to_write,
+						  &desc, 0) == 0) {
+				lecroy_envelope_write(wfename, &env);
+				lecroy_envelope_free(&env);
+			}
+		}
+		if (persist_rows > 0) {
+			/* Every segment is a trace; log scale, so that the odd
+			 * one out still shows up */
+			segs = desc.subarray_count > 1 ? desc.subarray_count : 1;
+			if (lecroy_persist_init(&persist,
+						bytes_to_write /
+						(bytes_per_point * segs),
+						bytes_per_point,
+						persist_columns, persist_rows,
+						0, 0) == 0) {
+				lecroy_persist_add(&persist, data,
+						   bytes_to_write, 0);
+				lecroy_persist_write(wfpname, &persist, &desc,
+						     1);
+				lecroy_persist_free(&persist);
+			}
+		}
 		/* Check if we've specifically requested 8-bit transfers, if so, set back to 16 */
 		if (bytes_per_point == 1)
 			vxi11_send_printf(clink, "COMM_FORMAT DEF9,WORD,BIN");
-		fwrite(buf, sizeof(char), buf_size, f_wf);
-//              fwrite(buf, sizeof(char), bytes_returned, f_wf);
-		fclose(f_wf);
-		delete[]buf;
+		/* Compressed, each segment can be got at on its own */
+		if (compress == TRUE) {
+			l = desc.subarray_count > 1 ? desc.subarray_count : 1;
+			zlen = lecroy_wfz_compress(data, bytes_to_write,
+						   bytes_per_point,
+						   bytes_to_write /
+						   (bytes_per_point * l), &zbuf,
+						   0);
+			if (zlen < 0) {
+				printf("error: could not compress, quitting...\n");
+				exit(3);
+			}
+			printf("Compressed %ld bytes to %ld\n", bytes_to_write,
+			       zlen);
+			data = zbuf;
+			bytes_to_write = zlen;
+		}
+		/* The async writer takes a copy, so the disk can get on with it
+		 * while we tidy up and close the link */
+		if (writer != NULL) {
+			lecroy_writer_write(writer, data, bytes_to_write);
+		} else {
+			fwrite(data, sizeof(char), bytes_to_write, f_wf);
+//              fwrite(data, sizeof(char), bytes_returned, f_wf);
+			fclose(f_wf);
+		}
+		delete[]zbuf;
+		/* Back to the pool (or delete[]-ed, if it grew or there's no
+		 * pool) before the pool goes */
+		lecroy_free_receive_buffer(buf);
+		if (self_size == FALSE) {
+			lecroy_set_receive_pool(clink, NULL);
+			lecroy_pool_destroy(&pool);
+		}
 
 		/* Finally we sever the link to the client. */
 		lecroy_close(clink, serverIP);	// could also use "vxi11_close_device()"
+		if (writer != NULL && lecroy_writer_close(writer) != 0) {
+			printf("error: could not write %s\n", wfname);
+			exit(3);
+		}
 	} else {
 		printf("error: could not open file for writing, quitting...\n");
 		exit(3);
@@ -300,6 +691,59 @@ int main(int argc, char *argv[])
 	lecroy_close(serverIP,clink);
  */
 
+/* How big each trace is, and so on */
+void print_size(char chnl, long buf_size, int bytes_per_point, int no_segments,
+		double actual_s_rate)
+{
+	printf
+	    ("Bytes per trace (channel %c): %ld; pts/trace: %ld; sample rate: %gSa/S\n",
+	     chnl, buf_size, buf_size / (bytes_per_point * no_segments),
+	     actual_s_rate);
+}
+
+/* Opens the file for -async, which preallocates it */
+struct lecroy_writer *open_writer(const char *wfname, long buf_size, int flags)
+{
+	struct lecroy_writer *writer;
+
+	writer = lecroy_writer_open(wfname, buf_size, 0, flags);
+	if (writer == NULL) {
+		printf("error: could not open file for writing, quitting...\n");
+		exit(3);
+	}
+	return writer;
+}
+
+/* Reads a template shape for -keep_template: one value (volts) per line */
+int read_template(const char *filename, struct lecroy_gate_criterion *c)
+{
+	FILE *f;
+	double v;
+	double *templ;
+	long n = 0, max_n = 1024;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		printf("error: could not open template %s\n", filename);
+		return -1;
+	}
+	templ = new double[max_n];
+	while (fscanf(f, "%lg", &v) == 1) {
+		if (n == max_n) {
+			double *bigger = new double[2 * max_n];
+			memcpy(bigger, templ, n * sizeof(double));
+			delete[]templ;
+			templ = bigger;
+			max_n *= 2;
+		}
+		templ[n++] = v;
+	}
+	fclose(f);
+	c->templ = templ;
+	c->templ_len = n;
+	return 0;
+}
+
 /* string compare (sc) function for parsing... ignore */
 BOOL sc(const char *con, const char *var)
 {
@@ -0,0 +1,812 @@
+/* lprofile.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Command line utility to find out where the time goes when acquiring traces
+ * from LeCroy oscilloscopes. It runs one or more capture "scenarios"
+ * (channel, no of points, segments, averages, bytes per point) a number of
+ * times each, timing every phase of the acquisition separately:
+ *
+ *   open        : lecroy_open()
+ *   init        : lecroy_init()
+ *   sample_rate : lecroy_set_sample_rate()
+ *   configure   : bytes per point, averages, segments, channel on
+ *   metadata    : how big the record will be (the VBS settings)
+ *   arm_wait    : ARM;WAIT and *OPC? (or waiting for all the averages)
+ *   transfer    : WF? ALL and receiving the data block
+ *   parse       : the descriptor in front of the data (gain etc), and
+ *                 converting the raw data to volts
+ *   write       : writing the data to disk (only with -f)
+ *   close       : lecroy_close()
+ *
+ * and reports the spread of each (min, median, 90th and 99th percentiles,
+ * max), plus the transfer rate in MB/s and the number of triggers per
+ * second. Results can also be appended to a CSV file, or written as JSON,
+ * so that you can keep track of how things change over time (new firmware,
+ * new network card, new version of this library...).
+ *
+ * With -tune it doesn't run the scenarios, but asks lecroy_tune_run() how
+ * many segments get the most triggers per second with the first scenario's
+ * settings (within -max_latency and -max_mb, if given), and shows how it
+ * got there.
+ *
+ * Nothing here cares what is on the other end of the link, so you can point
+ * it at a real scope, or at a VXI-11 mock server on the local machine
+ * (-ip 127.0.0.1) to see the overhead of the PC side on its own.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lecroy_vxi11.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+#define	MAX_SCENARIOS	64
+
+enum {
+	PH_OPEN, PH_INIT, PH_SAMPLE_RATE, PH_CONFIGURE, PH_METADATA,
+	PH_ARM_WAIT, PH_TRANSFER, PH_PARSE, PH_WRITE, PH_CLOSE, NO_PHASES
+};
+
+static const char *phase_names[NO_PHASES] = {
+	"open", "init", "sample_rate", "configure", "metadata",
+	"arm_wait", "transfer", "parse", "write", "close"
+};
+
+struct scenario {
+	char chan;
+	long npoints;
+	double s_rate;
+	int segments;
+	int averages;
+	int bytes_per_point;
+};
+
+/* What we measured for one scenario. Times are in seconds; count[p] is how
+ * many times phase p was timed (open, init etc only happen once per
+ * scenario with -persistent, and write only with -f). */
+struct result {
+	double *times[NO_PHASES];
+	int count[NO_PHASES];
+	int runs;
+	int failed;
+	long bytes;		/* per capture */
+	long triggers;		/* per capture */
+	double transfer_total;
+	double capture_total;	/* arm_wait + transfer */
+};
+
+BOOL sc(const char *, const char *);
+static int read_scenarios(const char *filename, struct scenario *scen,
+			  int max_scen);
+static int run_scenario(const char *ip, struct scenario *scen,
+			struct result *res, int runs, BOOL persistent,
+			const char *wfname, unsigned long timeout);
+static void print_result(FILE * f, struct scenario *scen, struct result *res);
+static int tune_scenario(const char *ip, struct scenario *scen,
+			 struct lecroy_tune *tune, unsigned long timeout);
+static void write_csv(const char *csvname, const char *ip, time_t stamp,
+		      struct scenario *scen, struct result *res, int no_scen);
+static void write_json(const char *jsonname, const char *ip, time_t stamp,
+		       struct scenario *scen, struct result *res, int no_scen);
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	static char *serverIP;
+	struct scenario scen[MAX_SCENARIOS];
+	struct result res[MAX_SCENARIOS];
+	int no_scen = 1;
+	int runs = 10;
+	unsigned long timeout = 10000;	/* in ms (= 10 seconds) */
+	char *scenario_file = NULL;
+	char *wfname = NULL;
+	char *csvname = NULL;
+	char *jsonname = NULL;
+	BOOL got_ip = FALSE;
+	BOOL persistent = FALSE;
+	BOOL tune = FALSE;
+	struct lecroy_tune tuned;
+	double max_mb = 0;
+	time_t stamp;
+	int index = 1;
+	int l, ret = 0;
+
+	progname = argv[0];
+
+	/* The scenario given on the command line; ignored if there's a file */
+	scen[0].chan = '1';
+	scen[0].npoints = 0;
+	scen[0].s_rate = 0;
+	scen[0].segments = 1;
+	scen[0].averages = 0;
+	scen[0].bytes_per_point = 2;
+	memset(&tuned, 0, sizeof(struct lecroy_tune));
+
+	while (index < argc) {
+		if (sc(argv[index], "-ip") || sc(argv[index], "-ip_address")
+		    || sc(argv[index], "-IP")) {
+			serverIP = argv[++index];
+			got_ip = TRUE;
+		}
+
+		if (sc(argv[index], "-channel") || sc(argv[index], "-c")
+		    || sc(argv[index], "-scope_channel")) {
+			sscanf(argv[++index], "%c", &scen[0].chan);
+		}
+
+		if (sc(argv[index], "-sample_rate") || sc(argv[index], "-s")
+		    || sc(argv[index], "-rate")) {
+			sscanf(argv[++index], "%lg", &scen[0].s_rate);
+		}
+
+		if (sc(argv[index], "-no_points") || sc(argv[index], "-n")
+		    || sc(argv[index], "-points")) {
+			sscanf(argv[++index], "%ld", &scen[0].npoints);
+		}
+
+		if (sc(argv[index], "-bytes_per_point") || sc(argv[index], "-b")
+		    || sc(argv[index], "-bytes")) {
+			sscanf(argv[++index], "%d", &scen[0].bytes_per_point);
+		}
+
+		if (sc(argv[index], "-averages") || sc(argv[index], "-a")
+		    || sc(argv[index], "-aver")) {
+			sscanf(argv[++index], "%d", &scen[0].averages);
+		}
+
+		if (sc(argv[index], "-segmented") || sc(argv[index], "-seg")
+		    || sc(argv[index], "-seq")) {
+			sscanf(argv[++index], "%d", &scen[0].segments);
+		}
+
+		if (sc(argv[index], "-runs") || sc(argv[index], "-r")) {
+			sscanf(argv[++index], "%d", &runs);
+		}
+
+		if (sc(argv[index], "-scenarios") || sc(argv[index], "-sf")) {
+			scenario_file = argv[++index];
+		}
+
+		if (sc(argv[index], "-persistent") || sc(argv[index], "-p")) {
+			persistent = TRUE;
+		}
+
+		if (sc(argv[index], "-filename") || sc(argv[index], "-f")
+		    || sc(argv[index], "-file")) {
+			wfname = argv[++index];
+		}
+
+		if (sc(argv[index], "-tune")) {
+			tune = TRUE;
+		}
+
+		if (sc(argv[index], "-max_latency") || sc(argv[index], "-ml")) {
+			sscanf(argv[++index], "%lg", &tuned.max_latency);
+		}
+
+		if (sc(argv[index], "-max_mb")) {
+			sscanf(argv[++index], "%lg", &max_mb);
+		}
+
+		if (sc(argv[index], "-csv")) {
+			csvname = argv[++index];
+		}
+
+		if (sc(argv[index], "-json")) {
+			jsonname = argv[++index];
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &timeout);
+		}
+
+		index++;
+	}
+
+	if (got_ip == FALSE || runs < 1) {
+		printf
+		    ("%s: times each phase of acquiring traces from a LeCroy scope\n",
+		     progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf
+		    ("-ip    -ip_address     -IP      : IP address of scope (or of a mock server)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf
+		    ("-r     -runs                    : no of captures per scenario (default 10)\n");
+		printf
+		    ("-p     -persistent              : keep the link open between captures\n");
+		printf
+		    ("-c     -scope_channel  -channel : scope channel (default 1)\n");
+		printf
+		    ("-s     -sample_rate    -rate    : set sample rate (eg 1e9 = 1GS/s)\n");
+		printf
+		    ("-n     -no_points      -points  : set minimum no of points\n");
+		printf
+		    ("-a     -averages       -aver    : set no of averages (<=1 means none)\n");
+		printf
+		    ("-seg   -segmented      -seq     : set no of segments\n");
+		printf
+		    ("-b     -bytes_per_point -bytes  : 1 or 2 (default 2)\n");
+		printf
+		    ("-sf    -scenarios               : file of scenarios, one per line:\n");
+		printf
+		    ("                                  chan points segments averages bytes [rate]\n");
+		printf
+		    ("-f     -filename       -file    : time writing the data to this file too\n");
+		printf
+		    ("       -tune                    : find the no of segments that gets the\n");
+		printf
+		    ("                                  most triggers/s (ignores -seg)\n");
+		printf
+		    ("-ml    -max_latency             : ...in no more than this many s per capture\n");
+		printf
+		    ("       -max_mb                  : ...and no more than this many MB per capture\n");
+		printf
+		    ("       -csv                     : append results to a CSV file\n");
+		printf
+		    ("       -json                    : write results to a JSON file\n");
+		printf
+		    ("-t     -timeout                 : timout (in milliseconds)\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -ip 128.243.74.78 -c 2 -n 100000 -seg 100 -r 50 -csv trend.csv\n",
+		       progname);
+		exit(1);
+	}
+
+	if (scenario_file != NULL) {
+		no_scen = read_scenarios(scenario_file, scen, MAX_SCENARIOS);
+		if (no_scen < 1) {
+			printf("error: no scenarios in %s, quitting...\n",
+			       scenario_file);
+			exit(3);
+		}
+	}
+
+	if (tune == TRUE) {
+		tuned.max_bytes = (long)(max_mb * 1e6);
+		return tune_scenario(serverIP, &scen[0], &tuned, timeout);
+	}
+
+	stamp = time(NULL);
+	for (l = 0; l < no_scen; l++) {
+		if (run_scenario(serverIP, &scen[l], &res[l], runs, persistent,
+				 wfname, timeout) != 0)
+			ret = 2;
+		print_result(stdout, &scen[l], &res[l]);
+	}
+	if (csvname != NULL)
+		write_csv(csvname, serverIP, stamp, scen, res, no_scen);
+	if (jsonname != NULL)
+		write_json(jsonname, serverIP, stamp, scen, res, no_scen);
+
+	for (l = 0; l < no_scen; l++) {
+		for (index = 0; index < NO_PHASES; index++)
+			delete[]res[l].times[index];
+	}
+	return ret;
+}
+
+/* Reads scenarios from a text file, one per line:
+ *	chan points segments averages bytes_per_point [sample_rate]
+ * Blank lines and lines starting with '#' are ignored. Returns the number of
+ * scenarios read. */
+static int read_scenarios(const char *filename, struct scenario *scen,
+			  int max_scen)
+{
+	FILE *f;
+	char line[256];
+	char *p;
+	int n = 0;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		printf("error: could not open %s\n", filename);
+		return 0;
+	}
+	while (n < max_scen && fgets(line, 256, f) != NULL) {
+		p = line;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+			continue;
+		scen[n].s_rate = 0;
+		if (sscanf(p, "%c %ld %d %d %d %lg", &scen[n].chan,
+			   &scen[n].npoints, &scen[n].segments,
+			   &scen[n].averages, &scen[n].bytes_per_point,
+			   &scen[n].s_rate) < 5) {
+			printf("warning: ignoring scenario line: %s", line);
+			continue;
+		}
+		n++;
+	}
+	fclose(f);
+	return n;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/* Start and stop of each phase; "t" is updated so the phases follow on */
+static void lap(struct result *res, int phase, double *t)
+{
+	double t_now = now();
+	res->times[phase][res->count[phase]++] = t_now - *t;
+	*t = t_now;
+}
+
+/* Opens the link and sets the scope up as the scenario describes. Returns
+ * the channel to fetch (a maths channel if we're averaging), or 0. */
+static char open_and_configure(const char *ip, struct scenario *scen,
+			       struct result *res, VXI11_CLINK ** clink,
+			       unsigned long timeout)
+{
+	char chan = scen->chan;
+	double t = now();
+
+	if (lecroy_open(clink, ip) != 0)
+		return 0;
+	lap(res, PH_OPEN, &t);
+	if (lecroy_init(*clink) != 0) {
+		lecroy_close(*clink, ip);
+		return 0;
+	}
+	lap(res, PH_INIT, &t);
+	lecroy_set_sample_rate(*clink, scen->s_rate, scen->npoints, timeout);
+	lap(res, PH_SAMPLE_RATE, &t);
+	if (scen->bytes_per_point == 1)
+		vxi11_send_printf(*clink, "COMM_FORMAT DEF9,BYTE,BIN");
+	else
+		vxi11_send_printf(*clink, "COMM_FORMAT DEF9,WORD,BIN");
+	if (scen->averages > 1)
+		chan = lecroy_set_averages(*clink, chan, scen->averages);
+	if (scen->segments > 1)
+		lecroy_set_segmented(*clink, scen->segments, 0);
+	lecroy_display_channel(*clink, chan, 1);
+	lap(res, PH_CONFIGURE, &t);
+	return chan;
+}
+
+/* Puts the scope back as we found it (more or less) and closes the link */
+static void unconfigure_and_close(const char *ip, struct scenario *scen,
+				  struct result *res, VXI11_CLINK * clink)
+{
+	double t;
+
+	if (scen->segments > 1)
+		vxi11_send_printf(clink, "SEQ OFF");
+	if (scen->bytes_per_point == 1)
+		vxi11_send_printf(clink, "COMM_FORMAT DEF9,WORD,BIN");
+	t = now();
+	lecroy_close(clink, ip);
+	lap(res, PH_CLOSE, &t);
+}
+
+/* Sets the scope up as the scenario says (bar the segments), lets
+ * lecroy_tune_run() loose on it, and shows what it found. Returns 0, or 2
+ * if it didn't work out. */
+static int tune_scenario(const char *ip, struct scenario *scen,
+			 struct lecroy_tune *tune, unsigned long timeout)
+{
+	VXI11_CLINK *clink;
+	struct lecroy_tune_probe *probe;
+	long segments;
+	int l;
+
+	if (lecroy_open(&clink, ip) != 0 || lecroy_init(clink) != 0) {
+		printf("error: could not open %s\n", ip);
+		return 2;
+	}
+	lecroy_set_sample_rate(clink, scen->s_rate, scen->npoints, timeout);
+	if (scen->bytes_per_point == 1)
+		vxi11_send_printf(clink, "COMM_FORMAT DEF9,BYTE,BIN");
+	else
+		vxi11_send_printf(clink, "COMM_FORMAT DEF9,WORD,BIN");
+	lecroy_display_channel(clink, scen->chan, 1);
+
+	segments = lecroy_tune_run(clink, scen->chan, tune, timeout);
+	if (tune->no_of_probes > 0) {
+		printf("%10s %12s %12s %12s %12s\n", "segments", "bytes",
+		       "acquire (s)", "transfer (s)", "triggers/s");
+		for (l = 0; l < tune->no_of_probes; l++) {
+			probe = &tune->probe[l];
+			printf("%10ld %12ld %12.6f %12.6f %12.1f\n",
+			       probe->segments, probe->bytes, probe->acquire,
+			       probe->transfer, probe->triggers_per_second);
+		}
+		printf
+		    ("fixed cost %g s/capture, %g s between triggers, %.2f MB/s\n",
+		     tune->fixed_cost, tune->trigger_period,
+		     tune->transfer_rate / 1e6);
+		if (tune->scope_max_segments > 0)
+			printf("the scope will do no more than %ld segments\n",
+			       tune->scope_max_segments);
+	}
+	if (segments > 0)
+		printf
+		    ("best: %ld segments, about %.1f triggers/s, %g s per capture\n",
+		     segments, tune->triggers_per_second, tune->latency);
+
+	vxi11_send_printf(clink, "SEQ OFF");
+	if (scen->bytes_per_point == 1)
+		vxi11_send_printf(clink, "COMM_FORMAT DEF9,WORD,BIN");
+	lecroy_close(clink, ip);
+	return segments > 0 ? 0 : 2;
+}
+
+/* A buffer goes back to the pool if it came from there, otherwise it's one
+ * lecroy_receive_data_block_growing() new[]-ed when the pool's was short */
+static void free_buffer(struct lecroy_pool *pool, char *buf)
+{
+	if (buf != NULL && lecroy_pool_put(pool, buf) == -1)
+		delete[]buf;
+}
+
+/* Runs one scenario "runs" times. This does by hand what
+ * lecroy_get_all_growing() does, so that we can put a stopwatch on each
+ * step. Returns 0, or -1 if any capture failed. */
+static int run_scenario(const char *ip, struct scenario *scen,
+			struct result *res, int runs, BOOL persistent,
+			const char *wfname, unsigned long timeout)
+{
+	VXI11_CLINK *clink = NULL;
+	struct lecroy_wavedesc desc;
+	struct lecroy_pool pool;
+	char source[20];
+	char *buf = NULL;
+	size_t buf_len = 0, needed;
+	double *volts = NULL;
+	long no_of_points = 0;
+	long block_offset, data_offset, block_bytes, bytes_returned, opc;
+	long estimate;
+	FILE *f_wf = NULL;
+	char chan = 0;
+	int l, p, bytes_per_point;
+	double t, t_capture;
+
+	memset(res, 0, sizeof(struct result));
+	memset(&pool, 0, sizeof(struct lecroy_pool));
+	for (p = 0; p < NO_PHASES; p++)
+		res->times[p] = new double[runs];
+	res->runs = runs;
+	if (wfname != NULL) {
+		f_wf = fopen(wfname, "w");
+		if (f_wf == NULL)
+			printf("warning: could not open %s, not timing writes\n",
+			       wfname);
+	}
+
+	for (l = 0; l < runs; l++) {
+		if (persistent == FALSE || l == 0) {
+			chan = open_and_configure(ip, scen, res, &clink, timeout);
+			if (chan == 0) {
+				printf("error: could not open %s\n", ip);
+				res->failed += runs - l;
+				break;
+			}
+			lecroy_scope_channel_str(chan, source);
+		}
+
+		/* How big the record will be, from the live settings: WF? DESC
+		 * would still describe the last acquisition, which (on the
+		 * first run, at least) was with the previous scenario's
+		 * settings */
+		t = now();
+		estimate = lecroy_calculate_no_of_bytes_from_vbs(clink, chan);
+		if (estimate <= 0) {
+			res->failed++;
+			goto next;
+		}
+		lap(res, PH_METADATA, &t);
+		/* Buffers come from a pool so that we're not timing page faults;
+		 * it only gets remade if the scope's record got bigger. If the
+		 * estimate was short, the block still all comes over, into a
+		 * bigger buffer, which is then kept for the next run. */
+		needed = estimate + LECROY_WAVEDESC_LEN + 160 +
+		    16 * (scen->segments > 1 ? scen->segments : 1) +
+		    LECROY_DATA_BLOCK_HEADER_LEN;
+		if (pool.base == NULL || needed > pool.buffer_size) {
+			free_buffer(&pool, buf);
+			buf = NULL;
+			lecroy_pool_destroy(&pool);
+			if (lecroy_pool_create(&pool, 1, needed, 0) != 0) {
+				res->failed++;
+				goto next;
+			}
+		}
+		if (buf == NULL) {
+			buf = lecroy_pool_get(&pool);
+			buf_len = pool.buffer_size;
+		}
+		lecroy_set_receive_pool(clink, &pool);
+
+		t = now();
+		t_capture = t;
+		if (lecroy_is_maths_chan(chan) == 1 && scen->averages > 1) {
+			lecroy_clear_sweeps(clink);
+			lecroy_wait_all_averages(clink, timeout);
+		} else {
+			vxi11_send_printf(clink, "ARM;WAIT");
+			opc =
+			    vxi11_obtain_long_value_timeout(clink, "*OPC?",
+							    timeout);
+			if (opc != 1) {
+				res->failed++;
+				goto next;
+			}
+		}
+		lap(res, PH_ARM_WAIT, &t);
+		vxi11_send_printf(clink, "%s:WF? ALL", source);
+		block_bytes =
+		    lecroy_receive_data_block_growing(clink, &buf, &buf_len,
+						      &block_offset, timeout);
+		if (block_bytes <= 0) {
+			res->failed++;
+			goto next;
+		}
+		lap(res, PH_TRANSFER, &t);
+		res->transfer_total += res->times[PH_TRANSFER]
+		    [res->count[PH_TRANSFER] - 1];
+		res->capture_total += t - t_capture;
+
+		/* The descriptor at the front of the block describes exactly
+		 * the data behind it */
+		if (lecroy_parse_wavedesc(buf + block_offset, block_bytes,
+					  &desc) != 0) {
+			res->failed++;
+			goto next;
+		}
+		data_offset = desc.wave_descriptor + desc.user_text +
+		    desc.trigtime_array + desc.ris_time_array;
+		bytes_returned = desc.wave_array_1;
+		if (data_offset < 0 || data_offset + bytes_returned > block_bytes
+		    || bytes_returned <= 0) {
+			res->failed++;
+			goto next;
+		}
+		data_offset += block_offset;
+		bytes_per_point = desc.comm_type == 1 ? 2 : 1;
+		if (bytes_returned / bytes_per_point > no_of_points) {
+			delete[]volts;
+			no_of_points = bytes_returned / bytes_per_point;
+			volts = new double[no_of_points];
+		}
+		res->bytes = bytes_returned;
+		res->triggers =
+		    (desc.subarray_count > 1 ? desc.subarray_count : 1) *
+		    (scen->averages > 1 ? scen->averages : 1);
+
+		lecroy_scale_char_array(buf + data_offset, volts,
+					bytes_per_point,
+					bytes_returned / bytes_per_point,
+					desc.vertical_gain,
+					desc.vertical_offset);
+		lap(res, PH_PARSE, &t);
+
+		if (f_wf != NULL) {
+			rewind(f_wf);
+			fwrite(buf + data_offset, sizeof(char), bytes_returned,
+			       f_wf);
+			fflush(f_wf);
+			lap(res, PH_WRITE, &t);
+		}
+
+ next:
+		lecroy_set_receive_pool(clink, NULL);
+		if (persistent == FALSE || l == runs - 1)
+			unconfigure_and_close(ip, scen, res, clink);
+	}
+
+	if (f_wf != NULL)
+		fclose(f_wf);
+	free_buffer(&pool, buf);
+	lecroy_pool_destroy(&pool);
+	delete[]volts;
+	return res->failed > 0 ? -1 : 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* Summary of one phase: mean, min, median, 90th and 99th percentile (nearest
+ * rank) and max, all in ms */
+struct phase_summary {
+	double mean, min, p50, p90, p99, max;
+};
+
+static double percentile(const double *sorted, int n, double pc)
+{
+	int i = (int)((pc / 100.0) * n + 0.999999) - 1;
+	if (i < 0)
+		i = 0;
+	if (i > n - 1)
+		i = n - 1;
+	return sorted[i];
+}
+
+static void summarise(struct result *res, int phase, struct phase_summary *s)
+{
+	int n = res->count[phase];
+	double *sorted;
+	double sum = 0;
+	int i;
+
+	memset(s, 0, sizeof(struct phase_summary));
+	if (n == 0)
+		return;
+	sorted = new double[n];
+	for (i = 0; i < n; i++) {
+		sorted[i] = res->times[phase][i] * 1e3;
+		sum += sorted[i];
+	}
+	qsort(sorted, n, sizeof(double), compare_doubles);
+	s->mean = sum / n;
+	s->min = sorted[0];
+	s->p50 = percentile(sorted, n, 50);
+	s->p90 = percentile(sorted, n, 90);
+	s->p99 = percentile(sorted, n, 99);
+	s->max = sorted[n - 1];
+	delete[]sorted;
+}
+
+static double mb_per_s(struct result *res)
+{
+	int n = res->count[PH_TRANSFER];
+	if (n == 0 || res->transfer_total <= 0)
+		return 0;
+	return (double)res->bytes * n / res->transfer_total / 1e6;
+}
+
+static double triggers_per_s(struct result *res)
+{
+	int n = res->count[PH_TRANSFER];
+	if (n == 0 || res->capture_total <= 0)
+		return 0;
+	return (double)res->triggers * n / res->capture_total;
+}
+
+static void print_result(FILE * f, struct scenario *scen, struct result *res)
+{
+	struct phase_summary s;
+	int p;
+
+	fprintf(f,
+		"\nChannel %c, %ld points, %d segments, %d averages, %d bytes/pt: %d runs, %d failed\n",
+		scen->chan, scen->npoints, scen->segments, scen->averages,
+		scen->bytes_per_point, res->runs, res->failed);
+	fprintf(f, "%-12s %6s %10s %10s %10s %10s %10s %10s\n", "phase (ms)",
+		"count", "mean", "min", "p50", "p90", "p99", "max");
+	for (p = 0; p < NO_PHASES; p++) {
+		if (res->count[p] == 0)
+			continue;
+		summarise(res, p, &s);
+		fprintf(f,
+			"%-12s %6d %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+			phase_names[p], res->count[p], s.mean, s.min, s.p50,
+			s.p90, s.p99, s.max);
+	}
+	fprintf(f,
+		"%ld bytes/capture, %.2f MB/s (transfer), %.1f triggers/s (arm to end of transfer)\n",
+		res->bytes, mb_per_s(res), triggers_per_s(res));
+}
+
+/* One line per scenario per phase. We append, and only write the header if
+ * the file is new, so one file can collect results from run after run. */
+static void write_csv(const char *csvname, const char *ip, time_t stamp,
+		      struct scenario *scen, struct result *res, int no_scen)
+{
+	FILE *f;
+	struct phase_summary s;
+	int l, p;
+
+	f = fopen(csvname, "a");
+	if (f == NULL) {
+		printf("error: could not open %s for writing\n", csvname);
+		return;
+	}
+	if (ftell(f) == 0)
+		fprintf(f,
+			"timestamp,ip,channel,points,segments,averages,bytes_per_point,runs,failed,phase,count,mean_ms,min_ms,p50_ms,p90_ms,p99_ms,max_ms,bytes,mb_per_s,triggers_per_s\n");
+	for (l = 0; l < no_scen; l++) {
+		for (p = 0; p < NO_PHASES; p++) {
+			if (res[l].count[p] == 0)
+				continue;
+			summarise(&res[l], p, &s);
+			fprintf(f,
+				"%ld,%s,%c,%ld,%d,%d,%d,%d,%d,%s,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%ld,%.6f,%.6f\n",
+				(long)stamp, ip, scen[l].chan, scen[l].npoints,
+				scen[l].segments, scen[l].averages,
+				scen[l].bytes_per_point, res[l].runs,
+				res[l].failed, phase_names[p], res[l].count[p],
+				s.mean, s.min, s.p50, s.p90, s.p99, s.max,
+				res[l].bytes, mb_per_s(&res[l]),
+				triggers_per_s(&res[l]));
+		}
+	}
+	fclose(f);
+}
+
+static void write_json(const char *jsonname, const char *ip, time_t stamp,
+		       struct scenario *scen, struct result *res, int no_scen)
+{
+	FILE *f;
+	struct phase_summary s;
+	int l, p, first;
+
+	f = fopen(jsonname, "w");
+	if (f == NULL) {
+		printf("error: could not open %s for writing\n", jsonname);
+		return;
+	}
+	fprintf(f, "{\n  \"timestamp\": %ld,\n  \"ip\": \"%s\",\n",
+		(long)stamp, ip);
+	fprintf(f, "  \"scenarios\": [\n");
+	for (l = 0; l < no_scen; l++) {
+		fprintf(f,
+			"    {\n      \"channel\": \"%c\", \"points\": %ld, \"segments\": %d, \"averages\": %d, \"bytes_per_point\": %d,\n",
+			scen[l].chan, scen[l].npoints, scen[l].segments,
+			scen[l].averages, scen[l].bytes_per_point);
+		fprintf(f,
+			"      \"runs\": %d, \"failed\": %d, \"bytes\": %ld, \"mb_per_s\": %.6f, \"triggers_per_s\": %.6f,\n",
+			res[l].runs, res[l].failed, res[l].bytes,
+			mb_per_s(&res[l]), triggers_per_s(&res[l]));
+		fprintf(f, "      \"phases_ms\": {");
+		first = 1;
+		for (p = 0; p < NO_PHASES; p++) {
+			if (res[l].count[p] == 0)
+				continue;
+			summarise(&res[l], p, &s);
+			fprintf(f,
+				"%s\n        \"%s\": {\"count\": %d, \"mean\": %.6f, \"min\": %.6f, \"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f}",
+				first ? "" : ",", phase_names[p],
+				res[l].count[p], s.mean, s.min, s.p50, s.p90,
+				s.p99, s.max);
+			first = 0;
+		}
+		fprintf(f, "\n      }\n    }%s\n", l < no_scen - 1 ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
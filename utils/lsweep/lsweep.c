@@ -0,0 +1,775 @@
+/* lsweep.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Command line utility to acquire traces from a LeCroy oscilloscope over a
+ * grid of settings (sample rate, no of points, averages, segments...), as a
+ * replacement for driving lgetwf from a shell loop. The link is opened once,
+ * and for each point of the grid only the settings that are different from
+ * the last point are sent. Writing to disk happens in a separate thread, so
+ * the next acquisition can get going while the last one is being written.
+ *
+ * The grid file has one parameter per line, followed by its values, eg:
+ *
+ *	# lsweep grid
+ *	channel     1
+ *	sample_rate 1e9 2e9 5e9
+ *	averages    1 16 256
+ *	segments    1
+ *
+ * Parameters are channel, sample_rate, points, averages, segments and bytes
+ * (bytes per point). Every combination is acquired. The first line is the
+ * outermost loop and the last line the innermost, so put the settings that
+ * are slowest for the scope to change (sample rate, usually) first.
+ *
+ * All the data goes into a single name.wf file, one capture after another.
+ * A text index, name.wfx, has one line per capture with where it is in the
+ * .wf file and the settings and scaling that go with it. A line is only added
+ * once its data has been written, so if the sweep gets interrupted, running
+ * the same command again carries on from the capture after the last one in
+ * the index.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "lecroy_vxi11.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+#define	MAX_VALUES	64
+
+enum {
+	P_CHANNEL, P_SAMPLE_RATE, P_POINTS, P_AVERAGES, P_SEGMENTS, P_BYTES,
+	NO_PARAMS
+};
+
+static const char *param_names[NO_PARAMS] = {
+	"channel", "sample_rate", "points", "averages", "segments", "bytes"
+};
+
+struct axis {
+	int param;
+	int no_values;
+	double values[MAX_VALUES];	/* channels are stored as their character */
+};
+
+/* The settings for one point of the grid */
+struct settings {
+	char chan;
+	double s_rate;
+	long npoints;
+	int averages;
+	int segments;
+	int bytes_per_point;
+};
+
+/* A capture on its way to the disk. The writer thread owns buf once it's
+ * been queued, and frees it (lecroy_free_receive_buffer()) when it's done. */
+struct write_job {
+	char *buf;
+	size_t buf_len;		/* how big buf is, not how much is in it */
+	long data_offset;
+	long no_of_bytes;
+	long capture;
+	struct settings set;
+	struct lecroy_wavedesc desc;
+	struct write_job *next;
+};
+
+struct writer {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct write_job *head;
+	struct write_job *tail;
+	struct write_job *spare;	/* written, ready to be used again */
+	int queued;
+	int max_queued;
+	BOOL finished;
+	int error;
+	FILE *f_wf;
+	FILE *f_idx;
+	long long file_offset;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+BOOL sc(const char *, const char *);
+static int read_grid(const char *filename, struct axis *axes);
+static void grid_point(struct axis *axes, int no_axes, long point,
+		       struct settings *set);
+static long resume(const char *wfname, const char *wfxname, long no_captures,
+		   long long *file_offset);
+static int writer_start(struct writer *w, FILE * f_wf, FILE * f_idx,
+			long long file_offset, int max_queued);
+static struct write_job *writer_spare(struct writer *w);
+static int writer_queue(struct writer *w, struct write_job *job);
+static int writer_finish(struct writer *w);
+
+static void sigint_handler(int)
+{
+	interrupted = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	static char *serverIP;
+	char wfname[256];
+	char wfxname[256];
+	char *grid_file = NULL;
+	struct axis axes[NO_PARAMS];
+	int no_axes;
+	struct settings set, last;
+	struct write_job *job;
+	struct writer w;
+	VXI11_CLINK *clink;
+	FILE *f_wf, *f_idx;
+	struct lecroy_wavedesc desc;
+	long no_points, no_captures, capture, point, start;
+	long long file_offset = 0;
+	size_t buf_len = 0;
+	long bytes_returned;
+	char fetch_chan = 0;
+	int repeats = 1;
+	int max_queued = 4;
+	int arm_and_wait;
+	int l;
+	unsigned long timeout = 10000;	/* in ms (= 10 seconds) */
+	BOOL got_ip = FALSE;
+	BOOL got_file = FALSE;
+	BOOL overwrite = FALSE;
+	BOOL fused = FALSE;
+	BOOL first = TRUE;
+	int index = 1;
+	int ret = 0;
+
+	progname = argv[0];
+	memset(&last, 0, sizeof(struct settings));
+
+	while (index < argc) {
+		if (sc(argv[index], "-filename") || sc(argv[index], "-f")
+		    || sc(argv[index], "-file")) {
+			snprintf(wfname, 256, "%s.wf", argv[++index]);
+			snprintf(wfxname, 256, "%s.wfx", argv[index]);
+			got_file = TRUE;
+		}
+
+		if (sc(argv[index], "-ip") || sc(argv[index], "-ip_address")
+		    || sc(argv[index], "-IP")) {
+			serverIP = argv[++index];
+			got_ip = TRUE;
+		}
+
+		if (sc(argv[index], "-grid") || sc(argv[index], "-g")) {
+			grid_file = argv[++index];
+		}
+
+		if (sc(argv[index], "-repeats") || sc(argv[index], "-r")) {
+			sscanf(argv[++index], "%d", &repeats);
+		}
+
+		if (sc(argv[index], "-queue") || sc(argv[index], "-q")) {
+			sscanf(argv[++index], "%d", &max_queued);
+		}
+
+		if (sc(argv[index], "-overwrite") || sc(argv[index], "-o")) {
+			overwrite = TRUE;
+		}
+
+		if (sc(argv[index], "-fused") || sc(argv[index], "-fast")) {
+			fused = TRUE;
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &timeout);
+		}
+
+		index++;
+	}
+
+	if (got_file == FALSE || got_ip == FALSE || grid_file == NULL
+	    || repeats < 1) {
+		printf
+		    ("%s: acquires traces from a LeCroy scope over a grid of settings\n",
+		     progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf
+		    ("-ip    -ip_address     -IP      : IP address of scope (eg 128.243.74.78)\n");
+		printf
+		    ("-f     -filename       -file    : filename (without extension)\n");
+		printf
+		    ("-g     -grid                    : grid file, one parameter per line, eg:\n");
+		printf
+		    ("                                    sample_rate 1e9 2e9\n");
+		printf
+		    ("                                    averages 1 16 256\n");
+		printf
+		    ("                                  (channel, sample_rate, points, averages,\n");
+		printf
+		    ("                                   segments, bytes; first line = outer loop)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf
+		    ("-r     -repeats                 : captures per grid point (default 1)\n");
+		printf
+		    ("-q     -queue                   : max captures waiting to be written (default 4)\n");
+		printf
+		    ("-o     -overwrite               : start again, rather than resuming\n");
+		printf
+		    ("-fused -fast                    : arm, wait and fetch in one message\n");
+		printf
+		    ("-t     -timeout                 : timout (in milliseconds)\n\n");
+		printf("OUTPUTS:\n");
+		printf("filename.wf  : binary data of all the captures, one after another\n");
+		printf("filename.wfx : index (text), one line per capture\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -ip 128.243.74.78 -f sweep -g grid.txt -r 10\n",
+		       progname);
+		exit(1);
+	}
+
+	no_axes = read_grid(grid_file, axes);
+	if (no_axes < 0) {
+		printf("Quitting...\n");
+		exit(3);
+	}
+	no_points = 1;
+	for (l = 0; l < no_axes; l++)
+		no_points *= axes[l].no_values;
+	no_captures = no_points * repeats;
+
+	if (overwrite == TRUE)
+		start = 0;
+	else
+		start = resume(wfname, wfxname, no_captures, &file_offset);
+	if (start < 0) {
+		printf("Quitting...\n");
+		exit(3);
+	}
+	if (start >= no_captures) {
+		printf("All %ld captures already done\n", no_captures);
+		exit(0);
+	}
+
+	if (start == 0) {
+		f_wf = fopen(wfname, "w");
+		f_idx = fopen(wfxname, "w");
+	} else {
+		f_wf = fopen(wfname, "a");
+		f_idx = fopen(wfxname, "a");
+		printf("Resuming at capture %ld of %ld\n", start, no_captures);
+	}
+	if (f_wf == NULL || f_idx == NULL) {
+		printf("error: could not open %s or %s for writing, quitting...\n",
+		       wfname, wfxname);
+		exit(3);
+	}
+	if (start == 0) {
+		fprintf(f_idx, "# %s index, %ld captures (%ld points x %d repeats)\n",
+			wfname, no_captures, no_points, repeats);
+		fprintf(f_idx,
+			"# capture offset bytes channel sample_rate points averages segments bytes_per_point actual_sample_rate vertical_gain vertical_offset horiz_interval horiz_offset\n");
+		fflush(f_idx);
+	}
+
+	if (lecroy_open(&clink, serverIP) != 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	if (lecroy_init(clink) != 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	if (writer_start(&w, f_wf, f_idx, file_offset, max_queued) != 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	/* Ctrl-C finishes the capture in progress and writes everything that's
+	 * queued, so the index is left consistent for resuming */
+	signal(SIGINT, sigint_handler);
+
+	for (capture = start; capture < no_captures && interrupted == 0;
+	     capture++) {
+		point = capture / repeats;
+		grid_point(axes, no_axes, point, &set);
+
+		/* Only send what has changed since the last point. After a
+		 * resume we don't know what state the scope was left in, so
+		 * the first point sends everything. */
+		if (first == TRUE || set.s_rate != last.s_rate
+		    || set.npoints != last.npoints)
+			lecroy_set_sample_rate(clink, set.s_rate, set.npoints,
+					       timeout);
+		if (first == TRUE || set.bytes_per_point != last.bytes_per_point) {
+			if (set.bytes_per_point == 1)
+				vxi11_send_printf(clink,
+						  "COMM_FORMAT DEF9,BYTE,BIN");
+			else
+				vxi11_send_printf(clink,
+						  "COMM_FORMAT DEF9,WORD,BIN");
+		}
+		if (first == TRUE || set.chan != last.chan
+		    || set.averages != last.averages) {
+			fetch_chan =
+			    lecroy_set_averages(clink, set.chan, set.averages);
+			lecroy_display_channel(clink, fetch_chan, 1);
+		}
+		if (first == TRUE || set.segments != last.segments) {
+			if (set.segments > 1)
+				lecroy_set_segmented(clink, set.segments, 0);
+			else
+				vxi11_send_printf(clink, "SEQ OFF");
+		}
+		first = FALSE;
+		last = set;
+
+		/* Segments need arming; averages need the sweeps cleared, which
+		 * lecroy_get_data_in_place() does for a maths channel. Averaged
+		 * segments need both: clearing the sweeps, then arming, so that
+		 * the average is of a complete set of segments. */
+		if (set.averages > 1 && set.segments <= 1)
+			arm_and_wait = 0;
+		else
+			arm_and_wait = fused == TRUE ? LECROY_ARM_FUSED : 1;
+
+		/* WF? ALL, so the descriptor comes in the same block as the
+		 * data and is always the one that goes with it. Jobs (and
+		 * their buffers) come back from the writer once they've been
+		 * written, so after the first few captures nothing is
+		 * allocated unless a capture is bigger than the buffer it gets
+		 * (the settings have changed, say), when it grows. A brand new
+		 * buffer starts off the size of the last one. */
+		job = writer_spare(&w);
+		if (job->buf == NULL && buf_len > 0) {
+			job->buf = new char[buf_len];
+			job->buf_len = buf_len;
+		}
+		bytes_returned =
+		    lecroy_get_all_growing(clink, fetch_chan, 1, &job->buf,
+					   &job->buf_len, &job->data_offset,
+					   &job->desc, arm_and_wait, timeout);
+		if (job->buf_len > buf_len)
+			buf_len = job->buf_len;
+		if (bytes_returned <= 0) {
+			printf("error: no data for capture %ld\n", capture);
+			lecroy_free_receive_buffer(job->buf);
+			delete job;
+			ret = 2;
+			break;
+		}
+		job->no_of_bytes = bytes_returned;
+		job->capture = capture;
+		job->set = set;
+		desc = job->desc;	/* the writer might be done with job first */
+		if (writer_queue(&w, job) != 0) {
+			ret = 3;
+			break;
+		}
+		printf("Capture %ld/%ld: channel %c, %g Sa/s, %d averages, %d segments, %ld bytes\n",
+		       capture + 1, no_captures, fetch_chan,
+		       desc.horiz_interval > 0 ? 1.0 / desc.horiz_interval : 0,
+		       set.averages, set.segments, bytes_returned);
+	}
+
+	if (writer_finish(&w) != 0)
+		ret = 3;
+	if (interrupted != 0)
+		printf("Interrupted; run the same command again to carry on\n");
+	if (first == FALSE) {
+		if (last.segments > 1)
+			vxi11_send_printf(clink, "SEQ OFF");
+		if (last.bytes_per_point == 1)
+			vxi11_send_printf(clink, "COMM_FORMAT DEF9,WORD,BIN");
+	}
+	lecroy_close(clink, serverIP);
+	fclose(f_wf);
+	fclose(f_idx);
+	return ret;
+}
+
+static int param_from_name(const char *name)
+{
+	int p;
+	for (p = 0; p < NO_PARAMS; p++) {
+		if (strcmp(name, param_names[p]) == 0)
+			return p;
+	}
+	/* A few of lgetwf's names, for good measure */
+	if (strcmp(name, "rate") == 0 || strcmp(name, "s") == 0)
+		return P_SAMPLE_RATE;
+	if (strcmp(name, "no_points") == 0 || strcmp(name, "n") == 0)
+		return P_POINTS;
+	if (strcmp(name, "aver") == 0 || strcmp(name, "a") == 0)
+		return P_AVERAGES;
+	if (strcmp(name, "segmented") == 0 || strcmp(name, "seg") == 0)
+		return P_SEGMENTS;
+	if (strcmp(name, "bytes_per_point") == 0 || strcmp(name, "b") == 0)
+		return P_BYTES;
+	if (strcmp(name, "c") == 0 || strcmp(name, "scope_channel") == 0)
+		return P_CHANNEL;
+	return -1;
+}
+
+/* Reads the grid file into axes (at most one per parameter). Returns the
+ * number of axes, or -1 if there's something wrong with the file. */
+static int read_grid(const char *filename, struct axis *axes)
+{
+	FILE *f;
+	char line[1024];
+	char *tok;
+	int no_axes = 0;
+	int p, l;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		printf("error: could not open grid file %s\n", filename);
+		return -1;
+	}
+	while (fgets(line, 1024, f) != NULL) {
+		tok = strtok(line, " \t\r\n,");
+		if (tok == NULL || tok[0] == '#')
+			continue;
+		p = param_from_name(tok);
+		if (p < 0) {
+			printf("error: unknown parameter '%s' in %s\n", tok,
+			       filename);
+			fclose(f);
+			return -1;
+		}
+		for (l = 0; l < no_axes; l++) {
+			if (axes[l].param == p) {
+				printf("error: '%s' is in %s twice\n", tok,
+				       filename);
+				fclose(f);
+				return -1;
+			}
+		}
+		axes[no_axes].param = p;
+		axes[no_axes].no_values = 0;
+		while ((tok = strtok(NULL, " \t\r\n,")) != NULL
+		       && axes[no_axes].no_values < MAX_VALUES) {
+			if (p == P_CHANNEL)
+				axes[no_axes].values[axes[no_axes].no_values++] =
+				    (double)tok[0];
+			else
+				axes[no_axes].values[axes[no_axes].no_values++] =
+				    strtod(tok, NULL);
+		}
+		if (axes[no_axes].no_values == 0) {
+			printf("error: no values for '%s' in %s\n",
+			       param_names[p], filename);
+			fclose(f);
+			return -1;
+		}
+		no_axes++;
+	}
+	fclose(f);
+	return no_axes;
+}
+
+/* Works out the settings for point number "point" of the grid, the last axis
+ * changing fastest. Anything not in the grid gets lgetwf's default. */
+static void grid_point(struct axis *axes, int no_axes, long point,
+		       struct settings *set)
+{
+	double v;
+	int l;
+
+	set->chan = '1';
+	set->s_rate = 0;
+	set->npoints = 0;
+	set->averages = 1;
+	set->segments = 1;
+	set->bytes_per_point = 2;
+	for (l = no_axes - 1; l >= 0; l--) {
+		v = axes[l].values[point % axes[l].no_values];
+		point /= axes[l].no_values;
+		switch (axes[l].param) {
+		case P_CHANNEL:
+			set->chan = (char)v;
+			break;
+		case P_SAMPLE_RATE:
+			set->s_rate = v;
+			break;
+		case P_POINTS:
+			set->npoints = (long)v;
+			break;
+		case P_AVERAGES:
+			set->averages = (int)v;
+			break;
+		case P_SEGMENTS:
+			set->segments = (int)v;
+			break;
+		case P_BYTES:
+			set->bytes_per_point = (int)v;
+			break;
+		}
+	}
+}
+
+/* Looks at what a previous run left behind. Captures are only believed if
+ * they're in order from 0, and their data is all there in the .wf file;
+ * anything after the first one that isn't is thrown away (the .wf file is
+ * cut short, and the index rewritten). Returns the capture to start at, with
+ * the .wf file offset it goes at in *file_offset, or -1 if the old index is
+ * for a different grid. */
+static long resume(const char *wfname, const char *wfxname, long no_captures,
+		   long long *file_offset)
+{
+	FILE *f;
+	struct stat st;
+	char line[1024];
+	char *keep;
+	size_t keep_len = 0, len;
+	long long wf_size, offset, bytes;
+	long capture, next = 0, old_no_captures;
+
+	*file_offset = 0;
+	f = fopen(wfxname, "r");
+	if (f == NULL)
+		return 0;
+	if (stat(wfname, &st) != 0) {
+		fclose(f);
+		return 0;
+	}
+	wf_size = (long long)st.st_size;
+
+	/* The index is small, so just hold on to the good bit of it */
+	keep = new char[1024 * 64];
+	len = 1024 * 64;
+	while (fgets(line, 1024, f) != NULL) {
+		if (line[0] == '#') {
+			if (sscanf(line, "# %*s index, %ld captures",
+				   &old_no_captures) == 1
+			    && old_no_captures != no_captures) {
+				printf
+				    ("error: %s is from a grid of %ld captures, not %ld (use -overwrite to start again)\n",
+				     wfxname, old_no_captures, no_captures);
+				fclose(f);
+				delete[]keep;
+				return -1;
+			}
+		} else {
+			if (sscanf(line, "%ld %lld %lld", &capture, &offset,
+				   &bytes) != 3 || capture != next
+			    || offset != *file_offset
+			    || offset + bytes > wf_size)
+				break;
+			next++;
+			*file_offset = offset + bytes;
+		}
+		if (keep_len + strlen(line) + 1 > len) {
+			char *bigger = new char[2 * len];
+			memcpy(bigger, keep, keep_len);
+			delete[]keep;
+			keep = bigger;
+			len *= 2;
+		}
+		memcpy(keep + keep_len, line, strlen(line));
+		keep_len += strlen(line);
+	}
+	fclose(f);
+
+	if (truncate(wfname, (off_t) * file_offset) != 0) {
+		printf("error: could not truncate %s\n", wfname);
+		delete[]keep;
+		return -1;
+	}
+	f = fopen(wfxname, "w");
+	if (f == NULL) {
+		printf("error: could not rewrite %s\n", wfxname);
+		delete[]keep;
+		return -1;
+	}
+	fwrite(keep, sizeof(char), keep_len, f);
+	fclose(f);
+	delete[]keep;
+	return next;
+}
+
+/* The writer thread: takes captures off the queue, appends the data to the
+ * .wf file, and then (and only then) adds the capture to the index */
+static void *writer_fn(void *ptr)
+{
+	struct writer *w = (struct writer *)ptr;
+	struct write_job *job;
+	struct settings *set;
+	struct lecroy_wavedesc *desc;
+
+	while (1) {
+		pthread_mutex_lock(&w->mutex);
+		while (w->head == NULL && w->finished == FALSE)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		job = w->head;
+		if (job == NULL) {
+			pthread_mutex_unlock(&w->mutex);
+			break;
+		}
+		w->head = job->next;
+		if (w->head == NULL)
+			w->tail = NULL;
+		pthread_mutex_unlock(&w->mutex);
+
+		if (w->error == 0) {
+			if (fwrite(job->buf + job->data_offset, sizeof(char),
+				   job->no_of_bytes, w->f_wf)
+			    != (size_t)job->no_of_bytes
+			    || fflush(w->f_wf) != 0) {
+				printf("error: could not write capture %ld\n",
+				       job->capture);
+				w->error = 1;
+			} else {
+				set = &job->set;
+				desc = &job->desc;
+				fprintf(w->f_idx,
+					"%ld %lld %ld %c %g %ld %d %d %d %g %g %g %g %g\n",
+					job->capture, w->file_offset,
+					job->no_of_bytes, set->chan,
+					set->s_rate, set->npoints,
+					set->averages, set->segments,
+					desc->comm_type == 1 ? 2 : 1,
+					desc->horiz_interval >
+					0 ? 1.0 / desc->horiz_interval : 0,
+					desc->vertical_gain,
+					desc->vertical_offset,
+					desc->horiz_interval,
+					desc->horiz_offset);
+				fflush(w->f_idx);
+				w->file_offset += job->no_of_bytes;
+			}
+		}
+
+		/* Keep the job, and its buffer, for another capture */
+		pthread_mutex_lock(&w->mutex);
+		job->next = w->spare;
+		w->spare = job;
+		w->queued--;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->mutex);
+	}
+	return NULL;
+}
+
+static int writer_start(struct writer *w, FILE * f_wf, FILE * f_idx,
+			long long file_offset, int max_queued)
+{
+	memset(w, 0, sizeof(struct writer));
+	w->f_wf = f_wf;
+	w->f_idx = f_idx;
+	w->file_offset = file_offset;
+	w->max_queued = max_queued < 1 ? 1 : max_queued;
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	if (pthread_create(&w->thread, NULL, writer_fn, w) != 0) {
+		printf("error: could not start the writer thread\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* A job that's been written and can be used again, or a new one (with no
+ * buffer yet) if they're all still queued */
+static struct write_job *writer_spare(struct writer *w)
+{
+	struct write_job *job;
+
+	pthread_mutex_lock(&w->mutex);
+	job = w->spare;
+	if (job != NULL)
+		w->spare = job->next;
+	pthread_mutex_unlock(&w->mutex);
+	if (job == NULL) {
+		job = new struct write_job;
+		job->buf = NULL;
+		job->buf_len = 0;
+	}
+	return job;
+}
+
+/* Hands a capture over to the writer. If max_queued captures are already
+ * waiting, we wait too; that's what stops memory running away if the disk
+ * can't keep up with the scope. Returns 0, or -1 if writing has failed. */
+static int writer_queue(struct writer *w, struct write_job *job)
+{
+	int error;
+
+	job->next = NULL;
+	pthread_mutex_lock(&w->mutex);
+	while (w->queued >= w->max_queued && w->error == 0)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	error = w->error;
+	if (error == 0) {
+		if (w->tail == NULL)
+			w->head = job;
+		else
+			w->tail->next = job;
+		w->tail = job;
+		w->queued++;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	if (error != 0) {
+		lecroy_free_receive_buffer(job->buf);
+		delete job;
+		return -1;
+	}
+	return 0;
+}
+
+/* Writes out whatever's still queued, stops the thread, and frees the jobs
+ * that were being kept for reuse */
+static int writer_finish(struct writer *w)
+{
+	struct write_job *job;
+
+	pthread_mutex_lock(&w->mutex);
+	w->finished = TRUE;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->thread, NULL);
+	while ((job = w->spare) != NULL) {
+		w->spare = job->next;
+		lecroy_free_receive_buffer(job->buf);
+		delete job;
+	}
+	pthread_mutex_destroy(&w->mutex);
+	pthread_cond_destroy(&w->cond);
+	return w->error == 0 ? 0 : -1;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
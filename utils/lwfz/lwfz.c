@@ -0,0 +1,209 @@
+/* lwfz.c
+ * Copyright (C) 2026 The lecroy_vxi11 contributors
+ *
+ * Command line utility to compress waveform files (as written by lgetwf)
+ * without losing anything, and to turn them back again. Given filename.wf,
+ * it reads filename.wfi to find out how many bytes per point and how many
+ * traces there are, and writes filename.wfz; given filename.wfz, it writes
+ * filename.wf (or, with -trace, just the one trace you asked for, which
+ * doesn't need the rest of the file unpacking). The .wfi file is left alone
+ * either way, so a .wfz and its .wfi together are everything a .wf is.
+ *
+ * lgetwf -z writes .wfz files straight away.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lecroy_vxi11.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+static char *read_file(const char *filename, long *len);
+static int write_file(const char *filename, const char *buf, long len);
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	char *inname = NULL;
+	char *outname = NULL;
+	char name[256];
+	char wfiname[256];
+	char *in, *out;
+	long in_len, out_len = 0;
+	long trace = -1;
+	int no_of_threads = 0;
+	struct lecroy_wfi wfi;
+	struct lecroy_wfz_info info;
+	size_t l;
+	int index = 1;
+
+	progname = argv[0];
+
+	while (index < argc) {
+		if (sc(argv[index], "-trace") || sc(argv[index], "-tr")
+		    || sc(argv[index], "-segment")) {
+			sscanf(argv[++index], "%ld", &trace);
+		} else if (sc(argv[index], "-o") || sc(argv[index], "-out")
+			   || sc(argv[index], "-output")) {
+			outname = argv[++index];
+		} else if (sc(argv[index], "-threads")
+			   || sc(argv[index], "-j")) {
+			sscanf(argv[++index], "%d", &no_of_threads);
+		} else {
+			inname = argv[index];
+		}
+		index++;
+	}
+
+	if (inname == NULL) {
+		printf
+		    ("%s: lossless compression of waveform files from lgetwf\n",
+		     progname);
+		printf("Run using %s [arguments] filename.wf|filename.wfz\n\n",
+		       progname);
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf
+		    ("-o     -output         -out     : output file (default: swap the extension)\n");
+		printf
+		    ("-tr    -trace          -segment : only unpack this trace (from 0)\n");
+		printf
+		    ("-j     -threads                 : no of threads (default one per core)\n\n");
+		printf("INPUTS:\n");
+		printf("filename.wf  : compressed into filename.wfz, using\n");
+		printf("filename.wfi : for the bytes per point and no of traces\n");
+		printf("filename.wfz : turned back into filename.wf\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -tr 3 -o fourth.wf test.wfz\n", progname);
+		exit(1);
+	}
+
+	l = strlen(inname);
+	if (l > 4 && strcmp(inname + l - 4, ".wfz") == 0) {
+		in = read_file(inname, &in_len);
+		if (in == NULL)
+			exit(2);
+		if (lecroy_wfz_info(in, in_len, &info) != 0) {
+			printf("error: %s isn't a .wfz file, quitting...\n",
+			       inname);
+			exit(2);
+		}
+		out = new char[info.no_of_points * info.bytes_per_point];
+		if (trace >= 0)
+			out_len = lecroy_wfz_decompress_trace(in, in_len, trace,
+							      out,
+							      info.no_of_points *
+							      info.bytes_per_point);
+		else
+			out_len = lecroy_wfz_decompress(in, in_len, out,
+							info.no_of_points *
+							info.bytes_per_point,
+							no_of_threads);
+		snprintf(name, 256, "%.*s.wf", (int)(l - 4), inname);
+	} else {
+		if (l > 3 && strcmp(inname + l - 3, ".wf") == 0)
+			l -= 3;
+		snprintf(wfiname, 256, "%.*s.wfi", (int)l, inname);
+		if (lecroy_read_wfi_file(wfiname, &wfi) != 0)
+			exit(2);
+		in = read_file(inname, &in_len);
+		if (in == NULL)
+			exit(2);
+		if (trace >= 0)
+			printf("(-trace only means anything when unpacking)\n");
+		out = NULL;
+		/* Legacy files lost a point off each trace, so go by what's
+		 * actually there */
+		out_len = lecroy_wfz_compress(in, in_len, wfi.bytes_per_point,
+					      in_len / (wfi.bytes_per_point *
+							(wfi.no_of_traces >
+							 0 ? wfi.no_of_traces :
+							 1)), &out,
+					      no_of_threads);
+		snprintf(name, 256, "%.*s.wfz", (int)l, inname);
+	}
+	if (out_len < 0) {
+		printf("error: could not convert %s, quitting...\n", inname);
+		exit(3);
+	}
+	if (outname == NULL)
+		outname = name;
+	if (write_file(outname, out, out_len) != 0)
+		exit(2);
+	printf("%s (%ld bytes) -> %s (%ld bytes)\n", inname, in_len, outname,
+	       out_len);
+	delete[]in;
+	delete[]out;
+	return 0;
+}
+
+static char *read_file(const char *filename, long *len)
+{
+	FILE *f;
+	char *buf;
+
+	f = fopen(filename, "rb");
+	if (f == NULL) {
+		printf("error: could not open %s\n", filename);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = new char[*len > 0 ? *len : 1];
+	if (fread(buf, 1, *len, f) != (size_t) * len) {
+		printf("error: could not read %s\n", filename);
+		fclose(f);
+		delete[]buf;
+		return NULL;
+	}
+	fclose(f);
+	return buf;
+}
+
+static int write_file(const char *filename, const char *buf, long len)
+{
+	FILE *f;
+
+	f = fopen(filename, "wb");
+	if (f == NULL) {
+		printf("error: could not open %s for writing\n", filename);
+		return -1;
+	}
+	fwrite(buf, sizeof(char), len, f);
+	fclose(f);
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}